@@ -0,0 +1,122 @@
+// --crossfade: what the mix kernel costs per frame, checked against a plain
+// loop, and what a whole fade adds to the decoder
+// build: make bench && ./build/bench_crossfade
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "crossfade.h"
+#include "latency.h"
+
+#define BLOCK_FRAMES 1152   // what an mp3 frame decodes to
+#define CHANNELS 2
+#define RATE 48000
+#define ROUNDS 20000
+#define FADE_SECONDS 5
+
+static void fill(void *pcm, ma_format fmt, int samples)
+{
+  for (int i = 0; i < samples; i++){
+    float v = (rand() / (float)RAND_MAX * 2.0f - 1.0f) * 0.7f;
+
+    switch (fmt){
+      case ma_format_f32: ((float*)pcm)[i] = v; break;
+      case ma_format_s16: ((int16_t*)pcm)[i] = v * 32767; break;
+      case ma_format_s32: ((int32_t*)pcm)[i] = v * 2147483647.0; break;
+      default: break;
+    }
+  }
+}
+
+static double sample_at(const void *pcm, ma_format fmt, int i)
+{
+  switch (fmt){
+    case ma_format_f32: return ((const float*)pcm)[i];
+    case ma_format_s16: return ((const int16_t*)pcm)[i] / 32768.0;
+    case ma_format_s32: return ((const int32_t*)pcm)[i] / 2147483648.0;
+    default: return 0;
+  }
+}
+
+// the largest difference from the mix done in doubles, in full scale
+static double check(ma_format fmt)
+{
+  static uint8_t a[BLOCK_FRAMES * CHANNELS * 4], b[BLOCK_FRAMES * CHANNELS * 4], mixed[BLOCK_FRAMES * CHANNELS * 4];
+  float in_from = 0.1f, in_step = 0.8f / BLOCK_FRAMES, out_from = 0.9f, out_step = -0.8f / BLOCK_FRAMES;
+  double worst = 0;
+
+  fill(a, fmt, BLOCK_FRAMES * CHANNELS);
+  fill(b, fmt, BLOCK_FRAMES * CHANNELS);
+  memcpy(mixed, a, sizeof(mixed));
+  crossfade_mix(mixed, b, BLOCK_FRAMES, fmt, CHANNELS, in_from, in_step, out_from, out_step);
+
+  for (int i = 0; i < BLOCK_FRAMES * CHANNELS; i++){
+    int f = i / CHANNELS + 1;
+    double want = sample_at(a, fmt, i) * (in_from + in_step * f) + sample_at(b, fmt, i) * (out_from + out_step * f);
+    double diff = fabs(sample_at(mixed, fmt, i) - want);
+    if (diff > worst) worst = diff;
+  }
+  return worst;
+}
+
+// ns per frame, the block copied in fresh every round and that counted too
+static double run_mix(ma_format fmt)
+{
+  static uint8_t src[BLOCK_FRAMES * CHANNELS * 4], tail[BLOCK_FRAMES * CHANNELS * 4], pcm[BLOCK_FRAMES * CHANNELS * 4];
+  int bytes = BLOCK_FRAMES * CHANNELS * ma_get_bytes_per_sample(fmt);
+
+  fill(src, fmt, BLOCK_FRAMES * CHANNELS);
+  fill(tail, fmt, BLOCK_FRAMES * CHANNELS);
+
+  uint64_t start = now_ns();
+  for (int r = 0; r < ROUNDS; r++){
+    memcpy(pcm, src, bytes);
+    crossfade_mix(pcm, tail, BLOCK_FRAMES, fmt, CHANNELS, 0.25f, 0.5f / BLOCK_FRAMES, 0.75f, -0.5f / BLOCK_FRAMES);
+  }
+  return (double)(now_ns() - start) / ROUNDS / BLOCK_FRAMES;
+}
+
+// a whole fade: hold the end of one track, mix it into the next
+static double run_fade(ma_format fmt, Crossfade_Curve curve)
+{
+  Crossfade *cf = crossfade_create(fmt, CHANNELS, RATE, FADE_SECONDS, curve);
+  int frame_bytes = CHANNELS * ma_get_bytes_per_sample(fmt);
+  uint8_t *pcm = malloc(BLOCK_FRAMES * frame_bytes);
+
+  if (!cf || !pcm) return -1;
+  fill(pcm, fmt, BLOCK_FRAMES * CHANNELS);
+
+  crossfade_arm(cf, 0, 1.0f);
+  crossfade_position(cf, 0);
+
+  uint64_t start = now_ns();
+  for (int f = 0; f < cf->cap; f += BLOCK_FRAMES){
+    int n = cf->cap - f < BLOCK_FRAMES ? cf->cap - f : BLOCK_FRAMES;
+    crossfade_hold(cf, pcm, n);
+  }
+  crossfade_handoff(cf);
+  while (crossfade_apply(cf, pcm, BLOCK_FRAMES, 1.0f) > 0);
+  double ms = (now_ns() - start) / 1e6;
+
+  crossfade_destroy(cf);
+  free(pcm);
+  return ms;
+}
+
+int main(void)
+{
+  static const struct { ma_format fmt; const char *name; } formats[] = {
+    { ma_format_f32, "f32" }, { ma_format_s16, "s16" }, { ma_format_s32, "s32" },
+  };
+
+  printf("crossfade, mix kernel: %s. %dch, %d frame blocks\n", crossfade_kernel_name(), CHANNELS, BLOCK_FRAMES);
+  printf("  fmt   ns/frame   max error   %ds fade, equal / linear (ms)\n", FADE_SECONDS);
+
+  for (int f = 0; f < 3; f++)
+    printf("  %-4s %9.3f %11.2e %12.2f / %.2f\n", formats[f].name, run_mix(formats[f].fmt), check(formats[f].fmt),
+      run_fade(formats[f].fmt, CROSSFADE_EQUAL_POWER), run_fade(formats[f].fmt, CROSSFADE_LINEAR));
+
+  return 0;
+}
@@ -0,0 +1,137 @@
+// --eq kernels: cost per band per channel, and the vector kernels checked
+// against the scalar one (same output, eq_latency() samples later)
+// build: make bench && ./build/bench_eq
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "eq.h"
+#include "latency.h"
+
+#define BLOCK_FRAMES 480   // 10ms at 48kHz
+#define CHANNELS 2
+#define RATE 48000
+#define ROUNDS 20000
+#define CHECK_FRAMES 48000
+
+static const char *kernel_names[] = { "scalar", "sse2", "avx2" };
+
+// something like a real curve: shelves at the ends, peaks in between
+static void make_bands(Eq_Band *bands, int n)
+{
+  for (int i = 0; i < n; i++){
+    bands[i].type = i == 0 ? EQ_LOW_SHELF : i == n - 1 && n > 1 ? EQ_HIGH_SHELF : EQ_PEAK;
+    bands[i].freq = 40.0f * powf(400.0f, (i + 0.5f) / n);
+    bands[i].gain = i & 1 ? -3.0f : 4.0f;
+    bands[i].q = bands[i].type == EQ_PEAK ? 1.4f : 1.0f;
+  }
+}
+
+static void fill(void *pcm, ma_format fmt, int samples)
+{
+  for (int i = 0; i < samples; i++){
+    float v = (rand() / (float)RAND_MAX * 2.0f - 1.0f) * 0.25f;
+
+    switch (fmt){
+      case ma_format_f32: ((float*)pcm)[i] = v; break;
+      case ma_format_s16: ((int16_t*)pcm)[i] = v * 32767; break;
+      case ma_format_s32: ((int32_t*)pcm)[i] = v * 2147483647.0; break;
+      default: break;
+    }
+  }
+}
+
+// ns per frame of one channel through one band. the block is copied in
+// fresh each round so the signal doesn't drift, that copy is counted too
+static double run_eq(ma_format fmt, int bands)
+{
+  static uint8_t src[BLOCK_FRAMES * CHANNELS * 4], pcm[BLOCK_FRAMES * CHANNELS * 4];
+  Eq_Band band[EQ_MAX_BANDS];
+
+  make_bands(band, bands);
+  fill(src, fmt, BLOCK_FRAMES * CHANNELS);
+
+  Equalizer *eq = eq_create(band, bands, fmt, CHANNELS, RATE);
+  if (!eq) return -1;
+
+  uint64_t start = now_ns();
+  for (int r = 0; r < ROUNDS; r++){
+    memcpy(pcm, src, sizeof(pcm));
+    eq_process(eq, pcm, BLOCK_FRAMES);
+  }
+  double ns = (now_ns() - start) / (double)ROUNDS / BLOCK_FRAMES / CHANNELS / bands;
+
+  eq_destroy(eq);
+  return ns;
+}
+
+// the biggest difference to the scalar output, in dB below full scale
+static double check(const char *name, int bands)
+{
+  static float ref[CHECK_FRAMES * CHANNELS], out[CHECK_FRAMES * CHANNELS];
+  Eq_Band band[EQ_MAX_BANDS];
+  double worst = 0;
+
+  make_bands(band, bands);
+  srand(1);
+  fill(ref, ma_format_f32, CHECK_FRAMES * CHANNELS);
+  memcpy(out, ref, sizeof(out));
+
+  eq_kernel_select("scalar");
+  Equalizer *a = eq_create(band, bands, ma_format_f32, CHANNELS, RATE);
+  eq_kernel_select(name);
+  Equalizer *b = eq_create(band, bands, ma_format_f32, CHANNELS, RATE);
+
+  eq_process(a, ref, CHECK_FRAMES);
+  eq_process(b, out, CHECK_FRAMES);
+
+  int late = eq_latency(b) - eq_latency(a);
+  for (int i = 0; i + late < CHECK_FRAMES; i++)
+    for (int c = 0; c < CHANNELS; c++)
+      worst = fmax(worst, fabs(ref[i * CHANNELS + c] - out[(i + late) * CHANNELS + c]));
+
+  eq_destroy(a);
+  eq_destroy(b);
+  return worst > 0 ? 20 * log10(worst) : -INFINITY;
+}
+
+int main(void)
+{
+  static const struct { ma_format fmt; const char *name; } formats[] = {
+    { ma_format_f32, "f32" }, { ma_format_s16, "s16" }, { ma_format_s32, "s32" },
+  };
+  static const int band_counts[] = { 1, 4, 8, 16 };
+
+  printf("eq, best kernel here: %s. %d frames x %dch blocks at %dHz\n", eq_kernel_name(), BLOCK_FRAMES, CHANNELS, RATE);
+  printf("ns per frame per channel per band (lower is better)\n");
+  printf("  kernel fmt  %8s %8s %8s %8s\n", "1 band", "4", "8", "16");
+
+  for (int k = 0; k < 3; k++){
+    if (eq_kernel_select(kernel_names[k]) < 0) continue;
+
+    for (int f = 0; f < 3; f++){
+      printf("  %-6s %-4s", kernel_names[k], formats[f].name);
+      for (int b = 0; b < 4; b++) printf(" %8.3f", run_eq(formats[f].fmt, band_counts[b]));
+      printf("\n");
+    }
+  }
+
+  printf("\nagainst scalar, worst difference (dBFS) and delay (samples):\n");
+  for (int k = 1; k < 3; k++){
+    if (eq_kernel_select(kernel_names[k]) < 0) continue;
+
+    for (int b = 0; b < 4; b++){
+      double db = check(kernel_names[k], band_counts[b]);
+      Eq_Band band[EQ_MAX_BANDS];
+      make_bands(band, band_counts[b]);
+      Equalizer *eq = eq_create(band, band_counts[b], ma_format_f32, CHANNELS, RATE);
+
+      printf("  %-6s %2d bands: %7.1f dB, %2d late\n", kernel_names[k], band_counts[b], db, eq_latency(eq));
+      eq_destroy(eq);
+    }
+  }
+
+  return 0;
+}
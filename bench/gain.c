@@ -0,0 +1,71 @@
+// gain stage vs. what the callback used before (ma_apply_volume_factor_pcm_frames)
+// build: make bench && ./build/bench_gain
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "gain.h"
+#include "latency.h"
+
+#define BLOCK_FRAMES 480   // 10ms at 48kHz
+#define CHANNELS 2
+#define ROUNDS 200000
+
+static void fill(void *pcm, ma_format fmt, int samples)
+{
+  for (int i = 0; i < samples; i++){
+    float v = (rand() / (float)RAND_MAX * 2.0f - 1.0f) * 0.8f;
+
+    switch (fmt){
+      case ma_format_f32: ((float*)pcm)[i] = v; break;
+      case ma_format_s16: ((int16_t*)pcm)[i] = v * 32767; break;
+      case ma_format_s32: ((int32_t*)pcm)[i] = v * 2147483647.0; break;
+      default: break;
+    }
+  }
+}
+
+// odd rounds undo the even ones, so floats never decay into denormals
+static double run_miniaudio(void *pcm, ma_format fmt, float volume)
+{
+  uint64_t start = now_ns();
+  for (int r = 0; r < ROUNDS; r++)
+    ma_apply_volume_factor_pcm_frames(pcm, BLOCK_FRAMES, fmt, CHANNELS, r & 1 ? 1.0f / volume : volume);
+  return (now_ns() - start) / (double)ROUNDS / BLOCK_FRAMES;
+}
+
+static double run_gain(void *pcm, ma_format fmt, float from, float to, int limit)
+{
+  uint64_t start = now_ns();
+  for (int r = 0; r < ROUNDS; r++){
+    if (r & 1 && !limit) gain_apply(pcm, BLOCK_FRAMES, fmt, CHANNELS, 1.0f / from, 1.0f / to, limit);
+    else gain_apply(pcm, BLOCK_FRAMES, fmt, CHANNELS, from, to, limit);
+  }
+  return (now_ns() - start) / (double)ROUNDS / BLOCK_FRAMES;
+}
+
+int main(void)
+{
+  static const struct { ma_format fmt; const char *name; } formats[] = {
+    { ma_format_f32, "f32" }, { ma_format_s16, "s16" }, { ma_format_s32, "s32" },
+  };
+  static uint8_t pcm[BLOCK_FRAMES * CHANNELS * 4];
+
+  gain_init();
+  printf("gain kernel: %s, %d frames x %dch blocks, ns per frame\n", gain_kernel_name(), BLOCK_FRAMES, CHANNELS);
+  printf("  fmt   miniaudio(0.8)  flat(0.8)  ramp(0.8->0.82)  ramp+limit(1.2->1.26)\n");
+
+  for (int i = 0; i < 3; i++){
+    fill(pcm, formats[i].fmt, BLOCK_FRAMES * CHANNELS);
+    double ma = run_miniaudio(pcm, formats[i].fmt, 0.8f);
+    double flat = run_gain(pcm, formats[i].fmt, 0.8f, 0.8f, 0);
+    double ramp = run_gain(pcm, formats[i].fmt, 0.8f, 0.82f, 0);
+
+    fill(pcm, formats[i].fmt, BLOCK_FRAMES * CHANNELS);
+    double limit = run_gain(pcm, formats[i].fmt, 1.2f, 1.26f, 1);
+
+    printf("  %-5s %14.3f %10.3f %16.3f %22.3f\n", formats[i].name, ma, flat, ramp, limit);
+  }
+
+  return 0;
+}
@@ -0,0 +1,92 @@
+// planar -> interleaved: swr vs. our kernels, in CPU time per hour of audio
+// build: make bench && ./build/bench_interleave
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <libswresample/swresample.h>
+#include <libavutil/channel_layout.h>
+
+#include "interleave.h"
+#include "latency.h"
+
+#if LIBSWRESAMPLE_VERSION_MAJOR <= 3
+  #define LEGACY_LIBSWRSAMPLE
+#endif
+
+#define FRAME_SAMPLES 1152  // one mp3 frame, flac/opus are in the same range
+#define RATE 48000
+#define ROUNDS 20000
+
+static SwrContext *make_swr(enum AVSampleFormat in, int ch)
+{
+  SwrContext *swrCTX = NULL;
+
+  #ifdef LEGACY_LIBSWRSAMPLE
+    int64_t layout = av_get_default_channel_layout(ch);
+    swrCTX = swr_alloc_set_opts(NULL, layout, av_get_packed_sample_fmt(in), RATE, layout, in, RATE, 0, NULL);
+  #else
+    AVChannelLayout layout;
+    av_channel_layout_default(&layout, ch);
+    swr_alloc_set_opts2(&swrCTX, &layout, av_get_packed_sample_fmt(in), RATE, &layout, in, RATE, 0, NULL);
+    av_channel_layout_uninit(&layout);
+  #endif
+
+  if (!swrCTX || swr_init(swrCTX) < 0 ){
+    fprintf(stderr, "swr init failed\n");
+    exit(1);
+  }
+  return swrCTX;
+}
+
+// seconds of CPU to get through one hour of audio
+static double per_hour(uint64_t ns)
+{
+  double ns_per_frame = ns / (double)ROUNDS / FRAME_SAMPLES;
+  return ns_per_frame * RATE * 3600 / 1e9;
+}
+
+int main(void)
+{
+  static const struct { enum AVSampleFormat fmt; int ch; const char *name; } cases[] = {
+    { AV_SAMPLE_FMT_FLTP, 1, "fltp 1ch" }, { AV_SAMPLE_FMT_FLTP, 2, "fltp 2ch" }, { AV_SAMPLE_FMT_FLTP, 4, "fltp 4ch" },
+    { AV_SAMPLE_FMT_FLTP, 6, "fltp 6ch" }, { AV_SAMPLE_FMT_FLTP, 8, "fltp 8ch" },
+    { AV_SAMPLE_FMT_S16P, 2, "s16p 2ch" }, { AV_SAMPLE_FMT_S16P, 6, "s16p 6ch" }, { AV_SAMPLE_FMT_S16P, 8, "s16p 8ch" },
+    { AV_SAMPLE_FMT_S32P, 2, "s32p 2ch" }, { AV_SAMPLE_FMT_U8P, 2, "u8p 2ch" }, { AV_SAMPLE_FMT_U8P, 6, "u8p 6ch" },
+  };
+
+  printf("interleave kernel: %s, %d frame blocks at %dHz, CPU seconds per audio hour\n",
+    interleave_kernel_name(), FRAME_SAMPLES, RATE);
+  printf("  input           swr   kernel  speedup\n");
+
+  for (int i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++){
+    int ch = cases[i].ch;
+    int bytes = av_get_bytes_per_sample(cases[i].fmt);
+
+    uint8_t *planes[8];
+    for (int c = 0; c < ch; c++){
+      planes[c] = malloc(FRAME_SAMPLES * bytes);
+      for (int s = 0; s < FRAME_SAMPLES * bytes; s++) planes[c][s] = rand();
+    }
+    uint8_t *out = malloc(FRAME_SAMPLES * ch * bytes);
+
+    SwrContext *swrCTX = make_swr(cases[i].fmt, ch);
+    uint64_t start = now_ns();
+    for (int r = 0; r < ROUNDS; r++)
+      swr_convert(swrCTX, &out, FRAME_SAMPLES, (const uint8_t**)planes, FRAME_SAMPLES);
+    double swr = per_hour(now_ns() - start);
+    swr_free(&swrCTX);
+
+    interleave_fn interleave = interleave_get(bytes, ch);
+    start = now_ns();
+    for (int r = 0; r < ROUNDS; r++)
+      interleave(out, (const uint8_t *const *)planes, 0, FRAME_SAMPLES, ch);
+    double kernel = per_hour(now_ns() - start);
+
+    printf("  %-10s %8.3f %8.3f %7.1fx\n", cases[i].name, swr, kernel, swr / kernel);
+
+    for (int c = 0; c < ch; c++) free(planes[c]);
+    free(out);
+  }
+
+  return 0;
+}
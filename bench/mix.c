@@ -0,0 +1,128 @@
+// --mix: what the bus costs per layer, and how much of one core summing N
+// layers takes at 48kHz stereo (the decoders aside). given files, also the
+// whole player: one --mix process with all of them against a process per
+// file, CPU time and peak RSS from the children's rusage. both run on the
+// null device (--latency), in real time, so keep the files short
+// build: make && make bench && ./build/bench_mix [FILE...]   (TOMU=path to the binary, ./tomu by default)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mix.h"
+#include "gain.h"
+#include "latency.h"
+
+#define PERIOD 480          // 10ms at 48kHz
+#define CHANNELS 2
+#define RATE 48000
+#define ROUNDS 20000
+
+typedef struct {
+  double cpu;               // user + system seconds, every process
+  long rss_kib;             // peak RSS, summed over the processes (they run at once)
+  double wall;
+
+} Usage;
+
+static pid_t spawn(const char *tomu, char **files, int count)
+{
+  char *argv[MIX_MAX_LAYERS + 4] = { (char*)tomu, "--latency", "--mix" };
+  pid_t pid = fork();
+
+  if (pid) return pid;
+
+  // quiet, and no terminal for the key thread
+  int null = open("/dev/null", O_RDWR);
+  dup2(null, 0);
+  dup2(null, 1);
+  dup2(null, 2);
+
+  memcpy(argv + 3, files, count * sizeof(char*));
+  execv(tomu, argv);
+  _exit(127);
+}
+
+// `groups` processes at once, each mixing `per` of the files
+static int run_players(const char *tomu, char **files, int groups, int per, Usage *u)
+{
+  pid_t pids[MIX_MAX_LAYERS];
+  uint64_t start = now_ns();
+  int failed = 0;
+
+  *u = (Usage){0};
+  for (int g = 0; g < groups; g++) pids[g] = spawn(tomu, files + g * per, per);
+
+  for (int g = 0; g < groups; g++){
+    struct rusage ru;
+    int status;
+
+    if (pids[g] < 0 || wait4(pids[g], &status, 0, &ru) < 0) {
+      failed = 1;
+      continue;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) failed = 1;
+
+    u->cpu += ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    u->rss_kib += ru.ru_maxrss;
+  }
+
+  u->wall = (now_ns() - start) / 1e9;
+  return failed ? -1 : 0;
+}
+
+static void compare(char **files, int count)
+{
+  const char *tomu = getenv("TOMU") ? getenv("TOMU") : "./tomu";
+  Usage one, many;
+
+  if (count > MIX_MAX_LAYERS) count = MIX_MAX_LAYERS;
+
+  if (run_players(tomu, files, 1, count, &one) < 0 || run_players(tomu, files, count, 1, &many) < 0) {
+    printf("\n%s didn't run, build it first (make) or point TOMU at it\n", tomu);
+    return;
+  }
+
+  printf("\n%d files, the whole player on the null device\n", count);
+  printf("                      cpu (s)   peak rss (MiB)   wall (s)\n");
+  printf("  one --mix process %9.2f %16.1f %10.1f\n", one.cpu, one.rss_kib / 1024.0, one.wall);
+  printf("  %2d processes      %9.2f %16.1f %10.1f\n", count, many.cpu, many.rss_kib / 1024.0, many.wall);
+  printf("  --mix uses %.0f%% of the cpu and %.0f%% of the memory\n",
+    many.cpu > 0 ? one.cpu / many.cpu * 100 : 0.0, many.rss_kib ? one.rss_kib * 100.0 / many.rss_kib : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+  static float layers[MIX_MAX_LAYERS][PERIOD * CHANNELS], bus[PERIOD * CHANNELS];
+
+  for (int l = 0; l < MIX_MAX_LAYERS; l++)
+    for (int i = 0; i < PERIOD * CHANNELS; i++) layers[l][i] = (rand() / (float)RAND_MAX * 2.0f - 1.0f) * 0.3f;
+
+  gain_init();
+  printf("mix bus: %s, limiter: %s. %dch, %d frame periods\n", mix_kernel_name(), gain_kernel_name(), CHANNELS, PERIOD);
+  printf("  layers   ns/period   ns/frame/layer   %% of a core\n");
+
+  for (int n = 1; n <= MIX_MAX_LAYERS; n++){
+    uint64_t start = now_ns();
+
+    for (int r = 0; r < ROUNDS; r++){
+      memset(bus, 0, sizeof(bus));
+      // the first few frames ramp like a volume change would
+      for (int l = 0; l < n; l++){
+        mix_add(bus, layers[l], 240, CHANNELS, 0.5f, 0.5f / 240);
+        mix_add(bus + 240 * CHANNELS, layers[l] + 240 * CHANNELS, PERIOD - 240, CHANNELS, 1.0f, 0.0f);
+      }
+      gain_limit(bus, PERIOD * CHANNELS);
+    }
+
+    double ns = (double)(now_ns() - start) / ROUNDS;
+    printf("  %6d %11.0f %16.3f %12.4f\n", n, ns, ns / PERIOD / n, ns / (1e9 * PERIOD / RATE) * 100);
+  }
+
+  if (argc > 1) compare(argv + 1, argc - 1);
+  return 0;
+}
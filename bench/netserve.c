@@ -0,0 +1,153 @@
+// a local http server to play network streams against: throttled bandwidth,
+// connections dropped on purpose, range requests, or an endless live stream
+// build: make bench && ./build/bench_netserve FILE [--port=N] [--rate=KIB] [--drop=KIB] [--live]
+//        ./build/tomu http://127.0.0.1:8000/stream
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "latency.h"
+
+#define CHUNK 4096
+
+static const char *file;
+static long file_size;
+static int rate_kib;   // KiB/s per connection, 0 = as fast as it goes
+static int drop_kib;   // hang up after this much on every connection, 0 = never
+static int live;       // no length, no ranges, the file loops forever
+
+static const char *content_type(const char *path)
+{
+  const char *ext = strrchr(path, '.');
+
+  if (ext && !strcasecmp(ext, ".ogg")) return "audio/ogg";
+  if (ext && !strcasecmp(ext, ".opus")) return "audio/ogg";
+  if (ext && !strcasecmp(ext, ".flac")) return "audio/flac";
+  if (ext && (!strcasecmp(ext, ".aac") || !strcasecmp(ext, ".m4a"))) return "audio/aac";
+  return "audio/mpeg";
+}
+
+static void *serve(void *arg)
+{
+  int fd = (int)(intptr_t)arg;
+  char req[4096];
+  int got = 0, n;
+
+  // the headers are all we care about, the request has no body
+  while (got < (int)sizeof(req) - 1 && (n = recv(fd, req + got, sizeof(req) - 1 - got, 0)) > 0) {
+    got += n;
+    req[got] = '\0';
+    if (strstr(req, "\r\n\r\n")) break;
+  }
+  if (got <= 0) goto out;
+
+  long from = 0;
+  const char *range = strstr(req, "\r\nRange: bytes="); // how ffmpeg and curl spell it
+  if (range && !live) from = atol(range + 15);
+  if (from >= file_size) from = 0;
+
+  FILE *f = fopen(file, "rb");
+  if (!f) goto out;
+  fseek(f, from, SEEK_SET);
+
+  char head[512];
+  if (live)
+    n = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nicy-name: tomu netserve\r\n\r\n",
+      content_type(file));
+  else if (from)
+    n = snprintf(head, sizeof(head), "HTTP/1.1 206 Partial Content\r\nContent-Type: %s\r\nAccept-Ranges: bytes\r\n"
+      "Content-Range: bytes %ld-%ld/%ld\r\nContent-Length: %ld\r\nConnection: close\r\n\r\n",
+      content_type(file), from, file_size - 1, file_size, file_size - from);
+  else
+    n = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nAccept-Ranges: bytes\r\n"
+      "Content-Length: %ld\r\nConnection: close\r\n\r\n", content_type(file), file_size);
+
+  send(fd, head, n, MSG_NOSIGNAL);
+
+  // paced per chunk against the clock, so a slow reader doesn't earn a burst
+  char chunk[CHUNK];
+  long sent = 0;
+  int dropped = 0;
+  uint64_t start = now_ns();
+
+  while (1) {
+    if ((n = fread(chunk, 1, CHUNK, f)) <= 0) {
+      if (!live) break;
+      rewind(f);
+      continue;
+    }
+
+    if (drop_kib && sent + n > (long)drop_kib << 10) {
+      dropped = 1;
+      break;
+    }
+
+    if (send(fd, chunk, n, MSG_NOSIGNAL) < 0) break;
+    sent += n;
+
+    if (rate_kib) {
+      uint64_t due = start + sent * 1000000000ull / ((uint64_t)rate_kib << 10);
+      uint64_t now = now_ns();
+      if (due > now) usleep((due - now) / 1000);
+    }
+  }
+
+  fclose(f);
+  fprintf(stderr, "GET from %ld: sent %ld KiB in %.1fs%s\n", from, sent >> 10,
+    (now_ns() - start) / 1e9, dropped ? ", dropped" : "");
+
+out:
+  close(fd);
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  int port = 8000;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "--port=", 7)) port = atoi(argv[i] + 7);
+    else if (!strncmp(argv[i], "--rate=", 7)) rate_kib = atoi(argv[i] + 7);
+    else if (!strncmp(argv[i], "--drop=", 7)) drop_kib = atoi(argv[i] + 7);
+    else if (!strcmp(argv[i], "--live")) live = 1;
+    else file = argv[i];
+  }
+
+  struct stat st;
+  if (!file || stat(file, &st) < 0) {
+    fprintf(stderr, "usage: %s FILE [--port=N] [--rate=KIB] [--drop=KIB] [--live]\n", argv[0]);
+    return 1;
+  }
+  file_size = st.st_size;
+
+  int srv = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(srv, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+  if (bind(srv, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(srv, 8) < 0) {
+    perror("netserve");
+    return 1;
+  }
+
+  printf("http://127.0.0.1:%d/ -> %s (%ld KiB)%s, rate %s, drop %s\n", port, file, file_size >> 10,
+    live ? " live" : "", rate_kib ? "limited" : "unlimited", drop_kib ? "on" : "off");
+  fflush(stdout);
+
+  // one thread a connection: the player reconnects while the old one drains
+  while (1) {
+    int fd = accept(srv, NULL, NULL);
+    if (fd < 0) continue;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, serve, (void*)(intptr_t)fd);
+    pthread_detach(thread);
+  }
+}
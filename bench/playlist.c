@@ -0,0 +1,73 @@
+// playlist parsing: time and memory for big .m3u8 files, and queue moves
+// build: make bench && ./build/bench_playlist [entries]
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "queue.h"
+#include "latency.h"
+
+static long max_rss_kb(void)
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+int main(int argc, char *argv[])
+{
+  int entries = argc > 1 ? atoi(argv[1]) : 1000000;
+  char playlist[] = "/tmp/tomu_bench_XXXXXX.m3u8";
+
+  int fd = mkstemps(playlist, 5);
+  if (fd < 0) { perror("mkstemps"); return 1; }
+
+  // the usual shape: an EXTINF line per entry, relative and absolute paths
+  FILE *f = fdopen(fd, "w");
+  fprintf(f, "#EXTM3U\n");
+  for (int i = 0; i < entries; i++){
+    fprintf(f, "#EXTINF:%d,Artist %d - Title %d\n", 180 + i % 120, i % 977, i);
+    if (i & 1) fprintf(f, "Music/Artist %d/Album %d/%02d - Title %d.flac\n", i % 977, i % 61, i % 20, i);
+    else fprintf(f, "/srv/music/Artist %d/Album %d/%02d - Title %d.opus\n", i % 977, i % 61, i % 20, i);
+  }
+  long file_bytes = ftell(f);
+  fclose(f);
+
+  long rss_before = max_rss_kb();
+
+  Play_Queue q;
+  queue_init(&q);
+
+  uint64_t start = now_ns();
+  queue_add_playlist(&q, playlist);
+  double parse_ms = (now_ns() - start) / 1e6;
+
+  long rss_after = max_rss_kb();
+  size_t index_bytes = q.cap * sizeof(char*);
+
+  printf("%d entries, %.1f MiB playlist\n", q.count, file_bytes / 1048576.0);
+  printf("  parse          %8.1f ms  (%.0f ns/entry)\n", parse_ms, parse_ms * 1e6 / q.count);
+  printf("  arena          %8.1f MiB (%.1f bytes/entry)\n", q.bytes / 1048576.0, q.bytes / (double)q.count);
+  printf("  index          %8.1f MiB\n", index_bytes / 1048576.0);
+  printf("  max rss grew   %8.1f MiB\n", (rss_after - rss_before) / 1024.0);
+
+  // next/prev/jump are index moves, should be flat whatever the size
+  int moves = 10000000;
+  start = now_ns();
+  queue_jump(&q, 0);
+  for (int i = 0; i < moves; i++){
+    if (!queue_next(&q)) queue_jump(&q, 0);
+    if (i % 3 == 0) queue_prev(&q);
+    if (i % 1000 == 0) queue_jump(&q, (i * 7919u) % q.count);
+  }
+  printf("  queue moves    %8.1f ns/op\n", (now_ns() - start) / (double)moves);
+
+  start = now_ns();
+  for (int i = 0; i < 100000; i++) queue_push(&q, "/srv/music/enqueued from the socket.flac");
+  printf("  enqueue        %8.1f ns/op\n", (now_ns() - start) / 100000.0);
+
+  queue_free(&q);
+  unlink(playlist);
+  return 0;
+}
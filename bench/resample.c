@@ -0,0 +1,82 @@
+// resampling presets: CPU time per hour of audio for the usual rate pairs
+// build: make bench && ./build/bench_resample
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <libswresample/swresample.h>
+#include <libavutil/channel_layout.h>
+
+#include "backend.h"
+#include "backend_utils.h"
+#include "latency.h"
+
+#define FRAME_SAMPLES 1152
+#define CHANNELS 2
+#define SECONDS 60           // of audio pushed through per run
+
+static SwrContext *make_swr(int in_rate, int out_rate, Resample_Quality quality)
+{
+  SwrContext *swrCTX = NULL;
+
+  #ifdef LEGACY_LIBSWRSAMPLE
+    int64_t layout = av_get_default_channel_layout(CHANNELS);
+    swrCTX = swr_alloc_set_opts(NULL, layout, AV_SAMPLE_FMT_FLT, out_rate, layout, AV_SAMPLE_FMT_FLTP, in_rate, 0, NULL);
+  #else
+    AVChannelLayout layout;
+    av_channel_layout_default(&layout, CHANNELS);
+    swr_alloc_set_opts2(&swrCTX, &layout, AV_SAMPLE_FMT_FLT, out_rate, &layout, AV_SAMPLE_FMT_FLTP, in_rate, 0, NULL);
+    av_channel_layout_uninit(&layout);
+  #endif
+
+  if (!swrCTX || resample_init(swrCTX, quality) < 0 ){
+    fprintf(stderr, "swr init failed\n");
+    exit(1);
+  }
+  return swrCTX;
+}
+
+// seconds of CPU to convert one hour of audio
+static double run(int in_rate, int out_rate, Resample_Quality quality, float *const *planes, uint8_t *out, int out_cap)
+{
+  SwrContext *swrCTX = make_swr(in_rate, out_rate, quality);
+  int blocks = (int64_t)in_rate * SECONDS / FRAME_SAMPLES;
+
+  uint64_t start = now_ns();
+  for (int b = 0; b < blocks; b++)
+    swr_convert(swrCTX, &out, out_cap, (const uint8_t**)planes, FRAME_SAMPLES);
+  uint64_t ns = now_ns() - start;
+
+  swr_free(&swrCTX);
+  return ns / 1e9 * (3600.0 / SECONDS);
+}
+
+int main(void)
+{
+  static const int pairs[][2] = { { 44100, 48000 }, { 48000, 44100 }, { 96000, 48000 } };
+  static const Resample_Quality presets[] = { RESAMPLE_FAST, RESAMPLE_DEFAULT, RESAMPLE_HIGH };
+
+  float *planes[CHANNELS];
+  for (int c = 0; c < CHANNELS; c++){
+    planes[c] = malloc(FRAME_SAMPLES * sizeof(float));
+    for (int i = 0; i < FRAME_SAMPLES; i++) planes[c][i] = sinf(i * 0.05f + c) * 0.5f;
+  }
+
+  // room for the worst upsampling ratio plus what swr keeps buffered
+  int out_cap = FRAME_SAMPLES * 4;
+  uint8_t *out = malloc(out_cap * CHANNELS * sizeof(float));
+
+  printf("fltp %dch -> flt, %d frame blocks, CPU seconds per audio hour\n", CHANNELS, FRAME_SAMPLES);
+  printf("  rates              fast  default     high\n");
+
+  for (int p = 0; p < 3; p++){
+    printf("  %5d -> %5d", pairs[p][0], pairs[p][1]);
+    for (int q = 0; q < 3; q++)
+      printf(" %8.3f", run(pairs[p][0], pairs[p][1], presets[q], planes, out, out_cap));
+    printf("\n");
+  }
+
+  for (int c = 0; c < CHANNELS; c++) free(planes[c]);
+  free(out);
+  return 0;
+}
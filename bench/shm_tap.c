@@ -0,0 +1,103 @@
+// --shm-tap: what the callback pays per period for the mirror, and a reader
+// on another thread checking that what it gets is whole and in order (a
+// counter in every sample), with one that keeps up and one that doesn't
+// build: make bench && ./build/bench_shm_tap
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "shm_tap.h"
+#include "latency.h"
+
+#define RATE 48000
+#define CHANNELS 2
+#define PERIOD 480          // 10ms
+#define PERIODS 3000        // 30s of audio, written as fast as it goes
+
+typedef struct {
+  int sleep_us;             // between reads, the slow reader sleeps longer than the ring lasts
+  atomic_int done;
+  uint64_t got, lost, bad;
+
+} Reader;
+
+static void *run_reader(void *arg)
+{
+  Reader *r = arg;
+  Shm_Tap *tap = shm_tap_open();
+  int32_t *buf = malloc(RATE * CHANNELS * sizeof(int32_t));
+  uint64_t pos = 0, lost;
+
+  if (!tap || !buf) return NULL;
+
+  for (;;) {
+    int done = atomic_load(&r->done);
+    int n = shm_tap_read(tap, &pos, buf, RATE * CHANNELS * sizeof(int32_t), &lost);
+
+    r->lost += lost;
+    r->got += n;
+
+    // every frame holds its own index in both channels
+    int frames = n / (CHANNELS * 4);
+    int64_t first = (int64_t)((pos - n) / (CHANNELS * 4));
+    for (int f = 0; f < frames; f++)
+      if (buf[f * CHANNELS] != (int32_t)(first + f) || buf[f * CHANNELS + 1] != (int32_t)(first + f)) r->bad++;
+
+    if (done && !n) break;
+    if (r->sleep_us) usleep(r->sleep_us);
+  }
+
+  shm_tap_close(tap);
+  free(buf);
+  return NULL;
+}
+
+int main(void)
+{
+  static int32_t period[PERIOD * CHANNELS];
+  Shm_Tap *tap = shm_tap_create(ma_format_s32, CHANNELS, RATE);
+
+  if (!tap) {
+    perror("shm tap");
+    return 1;
+  }
+
+  Reader fast = { .sleep_us = 0 }, slow = { .sleep_us = 2500000 };
+  pthread_t threads[2];
+  pthread_create(&threads[0], NULL, run_reader, &fast);
+  pthread_create(&threads[1], NULL, run_reader, &slow);
+
+  uint64_t spent = 0, worst = 0;
+  for (int p = 0; p < PERIODS; p++){
+    for (int f = 0; f < PERIOD; f++)
+      period[f * CHANNELS] = period[f * CHANNELS + 1] = p * PERIOD + f;
+
+    uint64_t start = now_ns();
+    shm_tap_write(tap, period, PERIOD);
+    uint64_t took = now_ns() - start;
+
+    spent += took;
+    if (took > worst) worst = took;
+    // a bit of breathing room so the fast reader is a reader and not a spinner
+    if (p % 50 == 0) usleep(1000);
+  }
+
+  atomic_store(&fast.done, 1);
+  atomic_store(&slow.done, 1);
+  pthread_join(threads[0], NULL);
+  pthread_join(threads[1], NULL);
+
+  uint64_t total = (uint64_t)PERIODS * PERIOD * CHANNELS * 4;
+  printf("shm tap %s: %d periods of %d frames, s32 %dch\n", SHM_TAP_NAME, PERIODS, PERIOD, CHANNELS);
+  printf("  write: %.0f ns/period on average, %.1f us worst (%.4f%% of a period)\n",
+    (double)spent / PERIODS, worst / 1000.0, (double)spent / PERIODS / (1e9 * PERIOD / RATE) * 100);
+  printf("  fast reader: %llu of %llu bytes, %llu lost, %llu bad samples\n",
+    (unsigned long long)fast.got, (unsigned long long)total, (unsigned long long)fast.lost, (unsigned long long)fast.bad);
+  printf("  slow reader: %llu of %llu bytes, %llu lost, %llu bad samples\n",
+    (unsigned long long)slow.got, (unsigned long long)total, (unsigned long long)slow.lost, (unsigned long long)slow.bad);
+
+  shm_tap_destroy(tap);
+  return 0;
+}
@@ -0,0 +1,61 @@
+// --spectrum: what the tap adds to every callback period, and what the
+// analyzer thread costs at SPECTRUM_FPS, as a share of one core
+// build: make bench && ./build/bench_spectrum
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "spectrum.h"
+#include "latency.h"
+
+#define RATE 48000
+#define CHANNELS 2
+#define PERIOD 480          // 10ms
+#define ROUNDS 20000
+
+int main(void)
+{
+  static int16_t s16[PERIOD * CHANNELS];
+  static float f32[PERIOD * CHANNELS];
+  static const Spectrum_Mode modes[] = { SPECTRUM_BARS_VIEW, SPECTRUM_VU };
+  static const char *mode_names[] = { "bars", "vu" };
+
+  // a 1kHz tone with some noise under it
+  for (int i = 0; i < PERIOD; i++){
+    float v = 0.5f * sinf(2 * M_PI * 1000 * i / RATE) + (rand() / (float)RAND_MAX - 0.5f) * 0.01f;
+    for (int c = 0; c < CHANNELS; c++){
+      f32[i * CHANNELS + c] = v;
+      s16[i * CHANNELS + c] = v * 32767;
+    }
+  }
+
+  printf("spectrum: %d point fft at %d fps, %d bars. %dch %dHz, %d frame periods\n",
+    SPECTRUM_FFT, SPECTRUM_FPS, SPECTRUM_BARS, CHANNELS, RATE, PERIOD);
+
+  for (int m = 0; m < 2; m++){
+    Spectrum *sp = spectrum_create(RATE, modes[m]);
+    char view[160];
+
+    uint64_t start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) spectrum_tap(sp, s16, PERIOD, ma_format_s16, CHANNELS);
+    double tap_s16 = (double)(now_ns() - start) / ROUNDS;
+
+    start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) spectrum_tap(sp, f32, PERIOD, ma_format_f32, CHANNELS);
+    double tap_f32 = (double)(now_ns() - start) / ROUNDS;
+
+    start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) spectrum_analyze(sp);
+    double frame = (double)(now_ns() - start) / ROUNDS;
+
+    spectrum_draw(sp, view, sizeof(view));
+    printf("  %-4s  tap: %.0f ns/period s16, %.0f f32 (%.3f%% of the period)\n", mode_names[m], tap_s16, tap_f32,
+      tap_s16 / (1e9 * PERIOD / RATE) * 100);
+    printf("        analysis: %.1f us/frame, %.4f%% of a core at %d fps   %s\n", frame / 1000,
+      frame * SPECTRUM_FPS / 1e9 * 100, SPECTRUM_FPS, view);
+    spectrum_destroy(sp);
+  }
+
+  return 0;
+}
@@ -0,0 +1,95 @@
+// --speed: how much faster than realtime the stretch runs on one core, and
+// whether the output is as long as it should be
+// build: make bench && ./build/bench_stretch
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "stretch.h"
+#include "latency.h"
+
+#define RATE 48000
+#define CHANNELS 2
+#define SECONDS 60
+#define CHUNK 1152          // what an mp3 frame decodes to
+
+// a voice-ish signal: a few harmonics on a wandering pitch, in syllables
+static void fill(float *pcm, int frames)
+{
+  double phase = 0;
+
+  for (int i = 0; i < frames; i++){
+    double t = (double)i / RATE;
+    double f0 = 140 + 30 * sin(2 * M_PI * 0.7 * t);
+    double env = 0.5 + 0.5 * sin(2 * M_PI * 4 * t);
+    double v = 0;
+
+    phase += 2 * M_PI * f0 / RATE;
+    for (int h = 1; h <= 6; h++) v += sin(phase * h) / h;
+    v = v * env * 0.3 + (rand() / (double)RAND_MAX - 0.5) * 0.01;
+
+    for (int c = 0; c < CHANNELS; c++) pcm[i * CHANNELS + c] = v;
+  }
+}
+
+static void convert(const float *in, void *out, ma_format fmt, int samples)
+{
+  for (int i = 0; i < samples; i++){
+    if (fmt == ma_format_f32) ((float*)out)[i] = in[i];
+    else ((int16_t*)out)[i] = lrintf(in[i] * 32767);
+  }
+}
+
+int main(void)
+{
+  static const float speeds[] = { 0.5f, 0.75f, 1.0f, 1.25f, 1.5f, 2.0f };
+  static const struct { ma_format fmt; const char *name; } formats[] = {
+    { ma_format_f32, "f32" }, { ma_format_s16, "s16" },
+  };
+  int frames = RATE * SECONDS;
+  float *src = malloc(frames * CHANNELS * sizeof(float));
+  void *pcm = malloc(frames * CHANNELS * sizeof(float));
+
+  if (!src || !pcm) return 1;
+  fill(src, frames);
+
+  printf("stretch, correlation kernel: %s. %ds of %dch %dHz, fed %d frames at a time\n",
+    stretch_kernel_name(), SECONDS, CHANNELS, RATE, CHUNK);
+  printf("  fmt  speed   x realtime   out/expected\n");
+
+  for (int f = 0; f < 2; f++){
+    convert(src, pcm, formats[f].fmt, frames * CHANNELS);
+    int frame_bytes = CHANNELS * ma_get_bytes_per_sample(formats[f].fmt);
+
+    for (int s = 0; s < 6; s++){
+      Stretch *st = stretch_create(formats[f].fmt, CHANNELS, RATE, speeds[s]);
+      int64_t out_frames = 0;
+      uint8_t *out;
+      int n;
+
+      uint64_t start = now_ns();
+      for (int i = 0; i < frames; i += CHUNK){
+        const uint8_t *in = (const uint8_t*)pcm + (int64_t)i * frame_bytes;
+        int left = frames - i < CHUNK ? frames - i : CHUNK;
+
+        while (left > 0){
+          int used = stretch_feed(st, in, left);
+          in += used * frame_bytes;
+          left -= used;
+          while ((n = stretch_take(st, &out)) > 0) out_frames += n;
+        }
+      }
+      while ((n = stretch_drain(st, &out)) > 0) out_frames += n;
+      double secs = (now_ns() - start) / 1e9;
+
+      printf("  %-4s %5.2f %12.0f %14.4f\n", formats[f].name, speeds[s], SECONDS / secs,
+        out_frames / (frames / speeds[s]));
+      stretch_destroy(st);
+    }
+  }
+
+  free(src);
+  free(pcm);
+  return 0;
+}
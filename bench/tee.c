@@ -0,0 +1,107 @@
+// --tee: what the callback pays per period to feed two sinks, a wav file
+// that keeps up and a fifo whose reader stalls for longer than the ring lasts.
+// the wav is checked afterwards (a counter in every sample), the fifo shows
+// up as dropped blocks and never as a slower callback
+// build: make bench && ./build/bench_tee
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tee.h"
+#include "latency.h"
+
+#define RATE 48000
+#define CHANNELS 2
+#define PERIOD 480          // 10ms
+#define PERIODS 1500        // 15s of audio, written 2x faster than it plays
+#define STALL 4             // seconds the fifo's reader sleeps first
+
+static const char *wav_path = "/tmp/bench_tee.wav";
+static const char *fifo_path = "/tmp/bench_tee.fifo";
+
+static void *run_slow_reader(void *arg)
+{
+  uint64_t *got = arg;
+  char buf[65536];
+  int fd = open(fifo_path, O_RDONLY);
+  ssize_t n;
+
+  if (fd < 0) return NULL;
+  sleep(STALL);
+  while ((n = read(fd, buf, sizeof(buf))) > 0) *got += n;
+  close(fd);
+  return NULL;
+}
+
+int main(void)
+{
+  static int32_t period[PERIOD * CHANNELS];
+  const char *targets[] = { wav_path, fifo_path };
+  uint64_t fifo_got = 0;
+  pthread_t reader;
+
+  unlink(fifo_path);
+  if (mkfifo(fifo_path, 0600) < 0) {
+    perror("mkfifo");
+    return 1;
+  }
+  pthread_create(&reader, NULL, run_slow_reader, &fifo_got);
+
+  Tee *tee = tee_create(targets, 2, ma_format_s32, CHANNELS, RATE);
+  if (!tee) {
+    perror("tee");
+    return 1;
+  }
+
+  uint64_t spent = 0, worst = 0;
+  for (int p = 0; p < PERIODS; p++){
+    for (int f = 0; f < PERIOD; f++)
+      period[f * CHANNELS] = period[f * CHANNELS + 1] = p * PERIOD + f;
+
+    uint64_t start = now_ns();
+    tee_write(tee, period, PERIOD);
+    uint64_t took = now_ns() - start;
+
+    spent += took;
+    if (took > worst) worst = took;
+    usleep(1000000 * PERIOD / RATE / 2);
+  }
+
+  printf("tee: %d periods of %d frames, s32 %dch, a wav and a fifo stalled for %ds\n", PERIODS, PERIOD, CHANNELS, STALL);
+  printf("  write: %.0f ns/period on average, %.1f us worst (%.4f%% of a period)\n",
+    (double)spent / PERIODS, worst / 1000.0, (double)spent / PERIODS / (1e9 * PERIOD / RATE) * 100);
+
+  tee_destroy(tee);
+  pthread_join(reader, NULL);
+
+  // the wav: a header and then every frame, in order
+  FILE *f = fopen(wav_path, "rb");
+  uint8_t head[44];
+  int32_t frame[CHANNELS];
+  uint64_t frames = 0, bad = 0;
+
+  if (!f || fread(head, 1, sizeof(head), f) != sizeof(head)) {
+    perror(wav_path);
+    return 1;
+  }
+  while (fread(frame, sizeof(frame), 1, f) == 1){
+    if (frame[0] != (int32_t)frames || frame[1] != (int32_t)frames) bad++;
+    frames++;
+  }
+  fclose(f);
+
+  uint32_t data_size = head[40] | head[41] << 8 | head[42] << 16 | (uint32_t)head[43] << 24;
+  printf("  wav: %llu of %d frames, %llu bad, header says %u bytes (%s)\n", (unsigned long long)frames,
+    PERIODS * PERIOD, (unsigned long long)bad, data_size, data_size == frames * sizeof(frame) ? "right" : "wrong");
+  printf("  fifo: %llu of %llu bytes got through\n", (unsigned long long)fifo_got,
+    (unsigned long long)PERIODS * PERIOD * sizeof(frame));
+
+  unlink(wav_path);
+  unlink(fifo_path);
+  return 0;
+}
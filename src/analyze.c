@@ -0,0 +1,299 @@
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswresample/swresample.h>
+#include <libavutil/opt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "analyze.h"
+#include "backend_utils.h"
+#include "loudness.h"
+#include "pipe_input.h"
+#include "silence.h"
+#include "utils.h"
+#include "work_pool.h"
+
+typedef struct {
+  const char *path;            // as queued
+  char *real;                  // realpath, NULL if it isn't a file we can measure
+  int64_t mtime, size;
+  int album;
+  float lufs, peak;
+  int64_t audio_from, audio_to; // for --trim, while we're decoding it anyway
+  Loudness_Meter meter;        // its blocks, until they're merged into the album
+  int failed;
+
+} Analyze_File;
+
+typedef struct {
+  Loudness_Meter meter;        // its tracks' blocks, only while some are still out
+  Analyze_File **files;        // into Analyze_Job.order
+  int count;
+  int pending;                 // tracks not measured yet
+
+} Analyze_Album;
+
+typedef struct {
+  const PlayBackOptions *opt;
+  Loudness_Cache *cache;
+  Analyze_File **work;         // the files to measure, one per pool item
+  int work_count;
+
+  // under the pool's lock
+  Analyze_Album *albums;
+  int failed;
+
+} Analyze_Job;
+
+// directory first, so an album's files end up next to each other
+static int by_directory(const void *a, const void *b)
+{
+  const char *x = (*(Analyze_File**)a)->real;
+  const char *y = (*(Analyze_File**)b)->real;
+  size_t dx = strrchr(x, '/') - x;
+  size_t dy = strrchr(y, '/') - y;
+  int c = memcmp(x, y, dx < dy ? dx : dy);
+
+  if (c) return c;
+  if (dx != dy) return dx < dy ? -1 : 1;
+  return strcmp(x + dx, y + dy);
+}
+
+static int same_directory(const char *x, const char *y)
+{
+  size_t dx = strrchr(x, '/') - x;
+  return dx == (size_t)(strrchr(y, '/') - y) && !memcmp(x, y, dx);
+}
+
+// the playback decode loop with the meter where the ring would be
+static int measure(Analyze_File *f, const PlayBackOptions *opt, Loudness_Meter *m)
+{
+  Track track = { .filename = f->path };
+  Audio_Info *inf = &track.inf;
+  SwrContext *swrCTX = NULL;
+  AVPacket *packet = NULL;
+  AVFrame *frame = NULL;
+  float *pcm = NULL;
+  int pcm_cap = 0;
+  int64_t pos = 0;
+  float level = pow(10.0, SILENCE_DB / 20.0);
+  int ret = -1;
+
+  *m = (Loudness_Meter){0};
+
+  if (open_track(&track, opt) < 0) {
+    warn("%s: %s", f->path, track.error);
+    return -1;
+  }
+
+  if (loudness_init(m, inf->in_rate, inf->in_ch) < 0) {
+    warn("%s: can't measure %d channels at %dHz", f->path, inf->in_ch, inf->in_rate);
+    goto out;
+  }
+
+  if (inf->in_fmt != AV_SAMPLE_FMT_FLT && !(swrCTX = init_float(inf))) {
+    warn("%s: swr: can't convert %s to float", f->path, av_get_sample_fmt_name(inf->in_fmt));
+    goto out;
+  }
+
+  if (!(packet = av_packet_alloc()) || !(frame = av_frame_alloc())) goto out;
+
+  for (;;) {
+    int eof = av_read_frame(track.fmtCTX, packet) < 0;
+
+    // at the end an empty packet gets out what the decoder still holds
+    if (eof) avcodec_send_packet(track.codecCTX, NULL);
+    else if (packet->stream_index == inf->audioStream) avcodec_send_packet(track.codecCTX, packet);
+    av_packet_unref(packet);
+
+    while (avcodec_receive_frame(track.codecCTX, frame) >= 0) {
+      const float *samples = (const float*)frame->data[0];
+      int frames = frame->nb_samples;
+
+      if (swrCTX) {
+        if (frames * inf->in_ch > pcm_cap) {
+          float *grown = realloc(pcm, frames * inf->in_ch * sizeof(float));
+          if (!grown) goto out;
+          pcm = grown;
+          pcm_cap = frames * inf->in_ch;
+        }
+
+        uint8_t *data[1] = {(uint8_t*)pcm};
+        frames = swr_convert(swrCTX, data, frames, (const uint8_t**)frame->extended_data, frame->nb_samples);
+        samples = pcm;
+      }
+
+      if (frames > 0) {
+        const uint8_t *data[1] = {(const uint8_t*)samples};
+        int first = f->audio_to ? 0 : silence_first(data, AV_SAMPLE_FMT_FLT, inf->in_ch, frames, level);
+        int last = silence_last(data, AV_SAMPLE_FMT_FLT, inf->in_ch, frames, level);
+
+        if (!f->audio_to && first >= 0) f->audio_from = pos + first;
+        if (last >= 0) f->audio_to = pos + last + 1;
+        pos += frames;
+
+        loudness_add(m, samples, frames);
+      }
+      av_frame_unref(frame);
+    }
+
+    if (eof) break;
+  }
+  ret = 0;
+
+out:
+  if (swrCTX) swr_free(&swrCTX);
+  av_packet_free(&packet);
+  av_frame_free(&frame);
+  free(pcm);
+  close_track(&track);
+  return ret;
+}
+
+// every track of the album is in: its loudness, then the whole album into
+// the cache. called under the pool's lock
+static void album_done(Analyze_Job *job, Analyze_Album *a)
+{
+  // none of its tracks could be measured, the meter was never set up.
+  // they're counted as failed already, there's nothing to cache
+  if (!a->meter.count) return;
+
+  float lufs = loudness_integrated(&a->meter);
+  float peak = a->meter.peak;
+
+  for (int i = 0; i < a->count; i++) {
+    Analyze_File *f = a->files[i];
+    if (f->failed) continue;
+
+    Loudness_Entry e = {
+      .path = f->real, .mtime = f->mtime, .size = f->size,
+      .track_lufs = f->lufs, .track_peak = f->peak,
+      .album_lufs = lufs, .album_peak = peak,
+      .audio_from = f->audio_from, .audio_to = f->audio_to,
+    };
+    loudness_cache_put(job->cache, &e);
+  }
+
+  if (a->count > 1)
+    printf("%*s album %6.1f LUFS %+5.1f dBTP  %.*s/\n", 12, "", lufs, 20 * log10f(peak),
+      (int)(strrchr(a->files[0]->real, '/') - a->files[0]->real), a->files[0]->real);
+
+  loudness_free(&a->meter);
+}
+
+static void analyze_work(void *arg, int i)
+{
+  Analyze_Job *job = (Analyze_Job*)arg;
+  Analyze_File *f = job->work[i];
+
+  if (measure(f, job->opt, &f->meter) == 0) {
+    f->lufs = loudness_integrated(&f->meter);
+    f->peak = f->meter.peak;
+  }
+  else f->failed = 1;
+}
+
+static void analyze_done(void *arg, int i, int done)
+{
+  Analyze_Job *job = (Analyze_Job*)arg;
+  Analyze_File *f = job->work[i];
+  Analyze_Album *a = &job->albums[f->album];
+
+  // an album only needs the histogram and the peak, the rate doesn't matter
+  if (!f->failed && (a->meter.count || loudness_init(&a->meter, 48000, 1) == 0))
+    loudness_merge(&a->meter, &f->meter);
+
+  if (f->failed) job->failed++;
+  else printf("[%4d/%d] %6.1f LUFS %+5.1f dBTP  %s\n", done, job->work_count, f->lufs,
+    20 * log10f(f->peak), f->path);
+
+  if (--a->pending == 0) album_done(job, a);
+  loudness_free(&f->meter);
+}
+
+int analyze_run(Play_Queue *queue, const PlayBackOptions *opt)
+{
+  Loudness_Cache cache;
+  Analyze_Job job = { .opt = opt, .cache = &cache };
+  int n = queue->count;
+  int unchanged = 0;
+
+  av_log_set_level(AV_LOG_QUIET);
+
+  if (loudness_cache_load(&cache) < 0)
+    warn("loudness cache: can't read it, starting over:");
+
+  Analyze_File *files = calloc(n, sizeof(Analyze_File));
+  Analyze_File **order = calloc(n, sizeof(Analyze_File*));
+  job.work = calloc(n, sizeof(Analyze_File*));
+  job.albums = calloc(n, sizeof(Analyze_Album));
+  if (n && (!files || !order || !job.work || !job.albums)) die("analyze: out of memory");
+
+  // files only: a pipe or a stream has no length to measure or key to cache under
+  int count = 0;
+  for (int i = 0; i < n; i++) {
+    Analyze_File *f = &files[i];
+    char real[PATH_MAX];
+    struct stat st;
+
+    f->path = queue_get(queue, i);
+    if (pipe_is_input(f->path) || net_is_url(f->path) || !realpath(f->path, real) || stat(real, &st) < 0) {
+      warn("%s: not a file, skipped", f->path);
+      continue;
+    }
+
+    f->real = strdup(real);
+    f->mtime = st.st_mtime;
+    f->size = st.st_size;
+    order[count++] = f;
+  }
+
+  // a directory is an album. one that's all in the cache already stays as
+  // it is, a changed or new file has the whole album measured again
+  qsort(order, count, sizeof(Analyze_File*), by_directory);
+
+  int albums = 0;
+  for (int i = 0; i < count;) {
+    Analyze_Album *a = &job.albums[albums];
+    int cached = 1;
+
+    a->files = order + i;
+    while (i + a->count < count && same_directory(order[i]->real, order[i + a->count]->real)) {
+      const Loudness_Entry *e = loudness_cache_get(&cache, order[i + a->count]->real);
+      if (!e || e->album_lufs < -70) cached = 0;
+      order[i + a->count]->album = albums;
+      a->count++;
+    }
+
+    if (cached) unchanged += a->count;
+    else {
+      for (int j = 0; j < a->count; j++) job.work[job.work_count++] = a->files[j];
+      a->pending = a->count;
+    }
+
+    i += a->count;
+    albums++;
+  }
+
+  double seconds;
+  int jobs = work_pool_run(job.work_count, opt->jobs, analyze_work, analyze_done, &job, &seconds);
+
+  printf("%d files measured in %.1fs (%.1f files/s on %d threads), %d failed, %d unchanged\n",
+    job.work_count, seconds, seconds > 0 ? job.work_count / seconds : 0.0, jobs, job.failed, unchanged);
+
+  if (job.work_count && loudness_cache_save(&cache) < 0)
+    warn("loudness cache: can't write it:");
+
+  for (int i = 0; i < n; i++) free(files[i].real);
+  free(files);
+  free(order);
+  free(job.work);
+  free(job.albums);
+  loudness_cache_free(&cache);
+
+  return job.failed;
+}
@@ -0,0 +1,13 @@
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include "backend.h"
+#include "queue.h"
+
+// --analyze: loudness and true peak of every file in the queue, one file per
+// thread at a time on --jobs threads (all cores by default). files in one
+// directory make an album. results go in the loudness cache, whole albums
+// whose files haven't changed since are skipped. returns the files that failed
+int analyze_run(Play_Queue *queue, const PlayBackOptions *opt);
+
+#endif
@@ -2,6 +2,9 @@
 #include <libavcodec/avcodec.h>
 #include <libswresample/swresample.h>
 #include <libavutil/avutil.h>
+#include <libavutil/opt.h>
+#include <errno.h>
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <pthread.h>
@@ -12,8 +15,14 @@
 #include "backend.h"
 #include "backend_utils.h"
 #include "control.h"
+#include "gain.h"
+#include "interleave.h"
+#include "pipe_input.h"
+#include "pipeline.h"
+#include "prefetch.h"
 #include "socket.h"
 #include "utils.h"
+#include "waveform.h"
 
 #include "../libs/miniaudio.h"
 
@@ -21,14 +30,43 @@
   #define LEGACY_LIBSWRSAMPLE
 #endif
 
-// WRITE AUDIO DATA TO BUFFER
-void audio_buffer_write(Audio_Buffer *buf, uint8_t *audio_data, int data_must_write)
+#define SWR_DRAIN 1024           // frames at a time when swr is flushed at the end of a track
+
+// wait until `bytes` fit in the buffer, -1 once the buffer got closed or the
+// wait cancelled
+static int audio_buffer_wait_space(Audio_Buffer *buf, int bytes)
 {
-  pthread_mutex_lock(&buf->lock);
-  
-  while (buf->filled + data_must_write > buf->capacity) {
-    pthread_cond_wait(&buf->space_free, &buf->lock);
+  int limit = buf->capacity - (buf->burst ? 0 : buf->headroom);
+
+  while (atomic_load(&buf->filled) + bytes > limit) {
+    if (atomic_load(&buf->closed) || atomic_load(&buf->cancel)) return -1;
+
+    // announce we're going to sleep, then check again so a read that happened
+    // in between can't be missed
+    atomic_store(&buf->writer_waiting, 1);
+    if (atomic_load(&buf->filled) + bytes > limit && !atomic_load(&buf->closed) && !atomic_load(&buf->cancel))
+      sem_wait(&buf->space_free);
+    atomic_store(&buf->writer_waiting, 0);
   }
+  return 0;
+}
+
+// hand bytes already stored at write_pos over to the callback
+static void audio_buffer_commit(Audio_Buffer *buf, int bytes)
+{
+  buf->write_pos = (buf->write_pos + bytes) % buf->capacity;
+  buf->written += bytes;
+  buf->burst = 0;
+
+  // publish the bytes only after they're copied
+  atomic_fetch_add(&buf->filled, bytes);
+}
+
+// WRITE AUDIO DATA TO BUFFER
+// blocks until there's room, returns -1 once the buffer got closed
+int audio_buffer_write(Audio_Buffer *buf, uint8_t *audio_data, int data_must_write)
+{
+  if (audio_buffer_wait_space(buf, data_must_write) < 0) return -1;
   
   int space_until_end = buf->capacity - buf->write_pos;
   
@@ -41,26 +79,76 @@ void audio_buffer_write(Audio_Buffer *buf, uint8_t *audio_data, int data_must_wr
     memcpy(buf->pcm_data, audio_data + space_until_end, remaining);
   }
   
-  buf->write_pos = (buf->write_pos + data_must_write) % buf->capacity;
-  
-  buf->filled += data_must_write;
-  
-  pthread_cond_signal(&buf->data_ready);
-  pthread_mutex_unlock(&buf->lock);
+  audio_buffer_commit(buf, data_must_write);
+  return 0;
+}
+
+// WRITE PLANAR AUDIO DATA TO BUFFER
+// interleaves straight into the ring, no staging copy. the capacity is a whole
+// number of frames so a frame never straddles the wrap
+int audio_buffer_write_planar(Audio_Buffer *buf, interleave_fn interleave, const uint8_t *const *planes, int frames, int ch, int frame_bytes)
+{
+  if (audio_buffer_wait_space(buf, frames * frame_bytes) < 0) return -1;
+
+  int done = 0;
+  while (done < frames) {
+    int span = (buf->capacity - buf->write_pos) / frame_bytes;
+    if (span > frames - done) span = frames - done;
+
+    interleave(buf->pcm_data + buf->write_pos, planes, done, span, ch);
+    audio_buffer_commit(buf, span * frame_bytes);
+    done += span;
+  }
+  return 0;
+}
+
+// everything written so far is stale (seek, skip), the callback will skip it.
+// the ring is normally kept a headroom short of full, so right after a mark
+// the first write can go in without waiting for the callback to drop the old
+// data first: if it lands before the next period, that period already plays it
+void audio_buffer_discard_mark(Audio_Buffer *buf)
+{
+  atomic_store(&buf->discard_until, buf->written);
+  buf->burst = 1;
+}
+
+// drop bytes without copying them anywhere (callback only)
+static void audio_buffer_advance(Audio_Buffer *buf, int bytes)
+{
+  buf->read_pos = (buf->read_pos + bytes) % buf->capacity;
+  buf->consumed += bytes;
+
+  atomic_fetch_sub(&buf->filled, bytes);
+
+  // sem_post doesn't lock, fine to call from here
+  if (bytes > 0 && atomic_load(&buf->writer_waiting))
+    sem_post(&buf->space_free);
+}
+
+// drop everything currently stored (callback only)
+void audio_buffer_skip(Audio_Buffer *buf)
+{
+  audio_buffer_advance(buf, atomic_load(&buf->filled));
 }
 
 // READ AUDIO DATA FROM BUFFER TO SPEAKER
-void audio_buffer_read(Audio_Buffer *buf, uint8_t *output, int bytes_needed)
+// never blocks (realtime path), returns how many bytes were actually read
+int audio_buffer_read(Audio_Buffer *buf, uint8_t *output, int bytes_needed)
 {
-  pthread_mutex_lock(&buf->lock);
-  
-  while (buf->filled == 0) {
-    pthread_cond_wait(&buf->data_ready, &buf->lock);
+  int filled = atomic_load(&buf->filled);
+
+  // skip stale data left from before a seek
+  uint64_t until = atomic_load(&buf->discard_until);
+  if (buf->consumed < until) {
+    int stale = until - buf->consumed < (uint64_t)filled ? (int)(until - buf->consumed) : filled;
+    audio_buffer_advance(buf, stale);
+    filled -= stale;
   }
-  
+
   int bytes_to_read = bytes_needed;
-  if (bytes_to_read > buf->filled) {
-    bytes_to_read = buf->filled;
+
+  if (bytes_to_read > filled) {
+    bytes_to_read = filled;
   }
   
   int data_until_end = buf->capacity - buf->read_pos;
@@ -74,143 +162,875 @@ void audio_buffer_read(Audio_Buffer *buf, uint8_t *output, int bytes_needed)
     memcpy(output + data_until_end, buf->pcm_data, remaining);
   }
   
-  buf->read_pos = (buf->read_pos + bytes_to_read) % buf->capacity;
-  
-  buf->filled -= bytes_to_read;
-  
-  pthread_cond_signal(&buf->space_free);
-  pthread_mutex_unlock(&buf->lock);
+  audio_buffer_advance(buf, bytes_to_read);
+
+  // what's been played, for seeking: the skip while a seek is pending drops
+  // the rest unheard, so the seek can't take it from `filled`
+  atomic_store_explicit(&buf->heard, buf->consumed, memory_order_release);
+  return bytes_to_read;
 }
 
-void *run_decoder(void *arg)
+// wake the decoder if it's waiting for space and make it give up
+void audio_buffer_close(Audio_Buffer *buf)
+{
+  if (atomic_exchange(&buf->closed, 1)) return;
+  sem_post(&buf->space_free);
+}
+
+// the same for one track: writes fail until the next track clears it. any
+// thread, it doesn't touch the data
+void audio_buffer_cancel(Audio_Buffer *buf)
+{
+  if (atomic_exchange(&buf->cancel, 1)) return;
+  sem_post(&buf->space_free);
+}
+
+static inline int seek_pending(PlayBackState *state)
+{
+  return atomic_load(&state->flush_req) != atomic_load(&state->flush_ack);
+}
+
+// quit, or next/previous: whoever decodes this track leaves it. a skip also
+// bumps flush_req, so check this after seek_pending() saw a flush, not before,
+// or a skip looks like a seek
+static inline int track_stopping(PlayBackState *state)
+{
+  return !atomic_load(&state->running) || atomic_load(&state->skip);
+}
+
+// jump relative to what's being heard right now (not to what we've decoded,
+// that's up to a buffer ahead), returns the new position in input samples.
+// `written` is the ring's byte count that goes with `played`
+static int64_t seek_input(StreamContext *streamCTX, int64_t played, uint64_t written, int duration_time)
 {
-  StreamContext *streamCTX = (StreamContext*)arg;
-  AVFormatContext *fmtCTX = streamCTX->fmtCTX;
-  AVCodecContext * codecCTX = streamCTX->codecCTX;
-  SwrContext *swrCTX = NULL;
   Audio_Info *inf = streamCTX->inf;
-  PlayBackState *state = streamCTX->state;
+  int offset = atomic_exchange(&streamCTX->state->seek_offset, 0);
+
+  // decoded samples count at the file's rate, buffered ones at the device's.
+  // buffered is what was written but not heard, the callback may have
+  // dropped it already
+  uint64_t heard = atomic_load_explicit(&streamCTX->buf->heard, memory_order_acquire);
+  double buffered = written > heard ? (double)(written - heard) / (inf->ch * inf->sample_fmt_bytes) / inf->sample_rate : 0;
+
+  // --crossfade may be holding the end back. --speed: a second in the ring is
+  // `speed` seconds of the file, and the stretch holds some input that isn't
+  // in the ring yet
+  Stretch *st = streamCTX->state->stretch;
+  Crossfade *cf = streamCTX->state->fade;
+  if (cf)
+    buffered += (double)atomic_load(&cf->held) / inf->sample_rate;
+  if (st)
+    buffered = buffered * atomic_load(&st->speed) + (double)atomic_load(&st->pending) / inf->sample_rate;
+
+  double target = (double)played / inf->in_rate - buffered + offset;
+
+  if (target < 0) target = 0;
+  if (duration_time > 0 && target > duration_time) target = duration_time;
+
+  av_seek_frame(streamCTX->fmtCTX, -1, (int64_t)(target * AV_TIME_BASE), AVSEEK_FLAG_BACKWARD);
+  return target * inf->in_rate;
+}
+
+// new position reached the converter: drop whatever the resampler still holds
+// from the old one, then tell the callback where the old data ends
+static void seek_done(StreamContext *streamCTX, unsigned req)
+{
+  if (streamCTX->swrCTX) swr_init(streamCTX->swrCTX);
+  if (streamCTX->state->stretch) stretch_reset(streamCTX->state->stretch);
+  if (streamCTX->state->fade) crossfade_reset(streamCTX->state->fade);
+
+  audio_buffer_discard_mark(streamCTX->buf);
+  atomic_store(&streamCTX->state->flush_ack, req);
+}
+
+static void decoder_seek(StreamContext *streamCTX, int64_t *total_samples_played, int duration_time)
+{
+  unsigned req = atomic_load(&streamCTX->state->flush_req);
+
+  *total_samples_played = seek_input(streamCTX, *total_samples_played, streamCTX->buf->written, duration_time);
+  avcodec_flush_buffers(streamCTX->codecCTX);
+  if (streamCTX->state->trim) silence_trim_seek(streamCTX->state->trim, *total_samples_played);
+  seek_done(streamCTX, req);
+}
+
+// one converter from whatever the decoder gives to what the device runs at
+static SwrContext *init_swr(Audio_Info *inf)
+{
+  SwrContext *swrCTX = NULL;
 
   #ifdef LEGACY_LIBSWRSAMPLE
     swrCTX = swr_alloc_set_opts(swrCTX,
       inf->ch_layout, inf->sample_fmt, inf->sample_rate, // output
-      inf->ch_layout, codecCTX->sample_fmt, inf->sample_rate, // input
+      inf->in_layout, inf->in_fmt, inf->in_rate, // input
       0, NULL
     );
   #else
     swr_alloc_set_opts2(&swrCTX,
       &inf->ch_layout, inf->sample_fmt, inf->sample_rate, // output
-      &inf->ch_layout, codecCTX->sample_fmt, inf->sample_rate, // input
+      &inf->in_layout, inf->in_fmt, inf->in_rate, // input
       0, NULL
     );
   #endif
 
-  if (!swrCTX || swr_init(swrCTX) < 0 )
-    swr_free(&swrCTX);
+  // swr only normalizes the mixing matrix for integer output, do it for float
+  // too so a downmix can't sum past full scale and clip
+  if (swrCTX && !same_layout(inf))
+    av_opt_set_double(swrCTX, "rematrix_maxval", 1.0, 0);
+
+  if (!swrCTX || resample_init(swrCTX, inf->resample) < 0 )
+    die("swr: can't convert %s %dHz %dch to what the device takes",
+      av_get_sample_fmt_name(inf->in_fmt), inf->in_rate, inf->in_ch);
+
+  return swrCTX;
+}
+
+// turns decoded frames into ring data, shared by run_decoder and the
+// pipeline's convert stage
+typedef struct {
+  interleave_fn interleave;    // planar input that only needs interleaving
+  uint8_t *conv_buf;           // swr output (--eq/--speed/--crossfade input), grown when a frame needs more
+  int conv_cap;
+  int frame_bytes;
+  uint64_t skip_stamp;         // the skip that got us here, until the first frame
+
+} Frame_Sink;
+
+static void frame_sink_init(StreamContext *streamCTX, Frame_Sink *sink)
+{
+  Audio_Info *inf = streamCTX->inf;
+
+  *sink = (Frame_Sink){0};
+  sink->frame_bytes = inf->ch * inf->sample_fmt_bytes;
+  sink->skip_stamp = atomic_exchange(&streamCTX->state->skip_stamp, 0);
+
+  // swr only when there's real work (rate, layout or sample type). planar
+  // input that just needs interleaving goes through our own kernels and
+  // already packed input in the device format is copied as is
+  sink->interleave = interleave_only(inf) ? interleave_get(inf->sample_fmt_bytes, inf->ch) : NULL;
+  int direct = !sink->interleave && inf->in_fmt == inf->sample_fmt && inf->in_rate == inf->sample_rate && same_layout(inf);
+  streamCTX->swrCTX = sink->interleave || direct ? NULL : init_swr(inf);
+}
+
+static void frame_sink_free(StreamContext *streamCTX, Frame_Sink *sink)
+{
+  if (streamCTX->swrCTX) swr_free(&streamCTX->swrCTX);
+  // a skip leaves the old track's end in there, a track that ended drained it
+  if (streamCTX->state->stretch) stretch_reset(streamCTX->state->stretch);
+  free(sink->conv_buf);
+  sink->conv_buf = NULL;
+}
+
+// conv_buf big enough for `bytes`, 0 if there's no memory for it
+static int sink_reserve(Frame_Sink *sink, int bytes)
+{
+  if (bytes <= sink->conv_cap) return 1;
+
+  uint8_t *grown = realloc(sink->conv_buf, bytes);
+  if (!grown) return 0;
+
+  sink->conv_buf = grown;
+  sink->conv_cap = bytes;
+  return 1;
+}
+
+// frames of what --crossfade holds into the ring. that can be more than the
+// ring holds, so 100ms at a time, and less where the tail wraps
+static int tail_write(StreamContext *streamCTX, Crossfade *cf, int from, int frames)
+{
+  int step = streamCTX->inf->sample_rate / 10;
+
+  for (int done = 0; done < frames; ){
+    uint8_t *data;
+    int n = crossfade_span(cf, from + done, frames - done < step ? frames - done : step, &data);
+
+    if (audio_buffer_write(streamCTX->buf, data, n * cf->frame_bytes) < 0) return -1;
+    done += n;
+  }
+  return 0;
+}
+
+// the last stop before the ring: --crossfade mixes the end of the track
+// before into the start of this one, or holds this one's end back for the
+// next. `pcm` may be changed in place, -1 once the buffer got closed
+static int ring_write(StreamContext *streamCTX, Frame_Sink *sink, uint8_t *pcm, int frames)
+{
+  Crossfade *cf = streamCTX->state->fade;
+
+  if (!cf) return audio_buffer_write(streamCTX->buf, pcm, frames * sink->frame_bytes);
+
+  crossfade_apply(cf, pcm, frames, atomic_load(&streamCTX->state->replaygain));
+  if (!cf->holding) return audio_buffer_write(streamCTX->buf, pcm, frames * sink->frame_bytes);
+
+  // the window keeps the newest `cap` frames, older ones are let go
+  int over = crossfade_over(cf, frames);
+  int out = over < cf->len ? over : cf->len;
+
+  if (out > 0 ){
+    if (tail_write(streamCTX, cf, 0, out) < 0) return -1;
+    crossfade_drop(cf, out);
+  }
+
+  if (over > out ){
+    if (audio_buffer_write(streamCTX->buf, pcm, (over - out) * sink->frame_bytes) < 0) return -1;
+    pcm += (over - out) * sink->frame_bytes;
+    frames -= over - out;
+  }
+
+  crossfade_hold(cf, pcm, frames);
+  return 0;
+}
+
+// what --crossfade held back goes to the ring after all: the track loops
+static void ring_unhold(StreamContext *streamCTX)
+{
+  Crossfade *cf = streamCTX->state->fade;
+
+  if (!cf || !cf->holding) return;
+
+  tail_write(streamCTX, cf, 0, cf->len);
+  crossfade_reset(cf);
+}
+
+// the track ended before the fade into it did (it's shorter than that): the
+// rest of the old tail goes out over silence
+static void ring_finish_fade(StreamContext *streamCTX, Frame_Sink *sink)
+{
+  Crossfade *cf = streamCTX->state->fade;
+
+  while (cf && cf->mixed < cf->len && !track_stopping(streamCTX->state) ){
+    int frames = cf->len - cf->mixed < CROSSFADE_STEP * 16 ? cf->len - cf->mixed : CROSSFADE_STEP * 16;
+
+    if (!sink_reserve(sink, frames * sink->frame_bytes)) break;
+    // u8 silence is 128, the rest is all zeros
+    memset(sink->conv_buf, cf->fmt == ma_format_u8 ? 128 : 0, frames * sink->frame_bytes);
+    if (ring_write(streamCTX, sink, sink->conv_buf, frames) < 0) break;
+  }
+}
+
+// converted frames through --speed and --eq into the ring. `pcm` may be
+// changed in place, -1 once the buffer got closed
+static int sink_write(StreamContext *streamCTX, Frame_Sink *sink, uint8_t *pcm, int frames)
+{
+  Stretch *st = streamCTX->state->stretch;
+  Equalizer *eq = streamCTX->state->eq;
+  uint8_t *out;
+  int n;
+
+  if (!st ){
+    if (eq) eq_process(eq, pcm, frames);
+    return ring_write(streamCTX, sink, pcm, frames);
+  }
+
+  // the stretch takes what it has room for and hands out a hop at a time
+  while (frames > 0 ){
+    int used = stretch_feed(st, pcm, frames);
+    pcm += used * sink->frame_bytes;
+    frames -= used;
+
+    while ((n = stretch_take(st, &out)) > 0 ){
+      if (eq) eq_process(eq, out, n);
+      if (ring_write(streamCTX, sink, out, n) < 0) return -1;
+    }
+  }
+  return 0;
+}
+
+// the track is over: what swr and the stretch still hold goes out before
+// the ring is drained
+static void sink_drain(StreamContext *streamCTX, Frame_Sink *sink)
+{
+  SwrContext *swrCTX = streamCTX->swrCTX;
+  Stretch *st = streamCTX->state->stretch;
+  Equalizer *eq = streamCTX->state->eq;
+  uint8_t *out;
+  int n;
+
+  // swr keeps back its filter delay and the end of a rate conversion until
+  // it's flushed with no input
+  if (swrCTX && sink_reserve(sink, SWR_DRAIN * sink->frame_bytes) ){
+    uint8_t *data[1] = {sink->conv_buf};
+
+    while ((n = swr_convert(swrCTX, data, SWR_DRAIN, NULL, 0)) > 0)
+      if (sink_write(streamCTX, sink, data[0], n) < 0) break;
+  }
+
+  if (!st) return;
+
+  while ((n = stretch_drain(st, &out)) > 0 ){
+    if (eq) eq_process(eq, out, n);
+    if (ring_write(streamCTX, sink, out, n) < 0) break;
+  }
+  stretch_reset(st);
+}
+
+// convert one frame into the buffer, -1 once the buffer got closed
+static int write_frame(StreamContext *streamCTX, Frame_Sink *sink, AVFrame *frame)
+{
+  SwrContext *swrCTX = streamCTX->swrCTX;
+  Audio_Info *inf = streamCTX->inf;
+  int frame_bytes = sink->frame_bytes;
+  Latency_Stats *latency = streamCTX->state->latency;
+
+  if (sink->skip_stamp ){
+    if (latency) latency_record_skip(latency, sink->skip_stamp);
+    sink->skip_stamp = 0;
+  }
+
+  // run this if the device wants anything else: format, rate and
+  // channels all change in this one pass, miniaudio does nothing after
+  if (swrCTX ){
+    int out_samples = swr_get_out_samples(swrCTX, frame->nb_samples);
+
+    if (!sink_reserve(sink, out_samples * frame_bytes) ){
+      fprintf(stderr, "Error: Out of memory for audio convertion\n");
+      return 0;
+    }
+
+    uint8_t *data[1] = {sink->conv_buf};
+
+    // start converting the samples
+    int samples = swr_convert(swrCTX,
+      data, out_samples, // output
+      (const uint8_t**)frame->extended_data, frame->nb_samples // input
+    );
+
+    // write in buffer
+    if (samples > 0 )
+      return sink_write(streamCTX, sink, data[0], samples);
+    return 0;
+  }
+
+  // --eq and --crossfade work in place and --speed wants packed frames, so
+  // with any of them on the two paths below land in conv_buf first instead
+  // of the ring
+  if (streamCTX->state->eq || streamCTX->state->stretch || streamCTX->state->fade ){
+    if (!sink_reserve(sink, frame->nb_samples * frame_bytes) ){
+      fprintf(stderr, "Error: Out of memory for audio convertion\n");
+      return 0;
+    }
+
+    if (sink->interleave)
+      sink->interleave(sink->conv_buf, (const uint8_t *const *)frame->extended_data, 0, frame->nb_samples, inf->ch);
+    else
+      memcpy(sink->conv_buf, frame->data[0], frame->nb_samples * frame_bytes);
+
+    return sink_write(streamCTX, sink, sink->conv_buf, frame->nb_samples);
+  }
+
+  // run this if: planar but otherwise what the device takes
+  if (sink->interleave )
+    return audio_buffer_write_planar(streamCTX->buf, sink->interleave, (const uint8_t *const *)frame->extended_data,
+      frame->nb_samples, inf->ch, frame_bytes);
+
+  // run this if: already interleaved and in the device format
+  return audio_buffer_write(streamCTX->buf, frame->data[0], frame->nb_samples * frame_bytes);
+}
+
+// write_frame behind --trim: the frame may be cut or held back, held silence
+// goes out first once the trim lets it go
+static int sink_frame(StreamContext *streamCTX, Frame_Sink *sink, AVFrame *frame)
+{
+  Silence_Trim *trim = streamCTX->state->trim;
+  Audio_Info *inf = streamCTX->inf;
+  AVFrame *held;
+  int ret = 0;
+
+  if (!trim) return write_frame(streamCTX, sink, frame);
+
+  Silence_Action action = silence_trim_frame(trim, frame, inf->in_fmt, inf->in_ch);
+
+  while ((held = silence_trim_release(trim))) {
+    if (ret >= 0) ret = write_frame(streamCTX, sink, held);
+    av_frame_free(&held);
+  }
+
+  if (action == SILENCE_PASS && ret >= 0) ret = write_frame(streamCTX, sink, frame);
+  return ret;
+}
+
+// let the callback play what's left in the buffer before we say we're done.
+// returns 1 if someone seeked while it was draining (or right at the end)
+static int drain_or_seek(StreamContext *streamCTX)
+{
+  PlayBackState *state = streamCTX->state;
+
+  while (!track_stopping(state) && atomic_load(&streamCTX->buf->filled) > 0 && !seek_pending(state))
+    usleep(10000);
+
+  return seek_pending(state) && !track_stopping(state);
+}
+
+void *run_decoder(void *arg)
+{
+  StreamContext *streamCTX = (StreamContext*)arg;
+  AVFormatContext *fmtCTX = streamCTX->fmtCTX;
+  AVCodecContext * codecCTX = streamCTX->codecCTX;
+  Audio_Info *inf = streamCTX->inf;
+  PlayBackState *state = streamCTX->state;
+
+  Frame_Sink sink;
+  frame_sink_init(streamCTX, &sink);
 
   AVPacket *packet = av_packet_alloc();
   AVFrame *frame = av_frame_alloc();
 
   if (!packet || !frame ){
     printf("something happend during packet or frame init!\n");
-    if (swrCTX ) swr_free(&swrCTX);
+    frame_sink_free(streamCTX, &sink);
     return NULL;
   }
 
   int64_t total_samples_played = 0;
-  int duration_time = fmtCTX->duration / 1000000.0;
+  int duration_time = duration_seconds(fmtCTX);
+  int decode_errors = 0;
 
-decode:
-  // first we read the data from container format (.mp3, .opus, .flac, ...etc)
-  while (av_read_frame(fmtCTX, packet) >= 0){
+  for (;;) {
+    // first we read the data from container format (.mp3, .opus, .flac, ...etc)
+    while (av_read_frame(fmtCTX, packet) >= 0){
 
-    // we need only audio stream
-    if (packet->stream_index == inf->audioStream ){
+      // we need only audio stream
+      if (packet->stream_index == inf->audioStream ){
 
-      // send packet to frame decoder
-      if (avcodec_send_packet(codecCTX, packet) < 0 )
-        continue;
+        // send packet to frame decoder. a bad one is dropped and counted,
+        // playback goes on with the next (--verify has the details)
+        if (avcodec_send_packet(codecCTX, packet) < 0 ){
+          av_packet_unref(packet);
+          decode_errors++;
+          continue;
+        }
 
-      // frame recieves it as PCM samples (used by miniaudio for playback)
-      while (avcodec_receive_frame(codecCTX, frame) >= 0){
-        // init duration progress
-        double current_time = (double)total_samples_played / inf->sample_rate;
-        progress(state, current_time, duration_time);
-        total_samples_played += frame->nb_samples;
-
-        // run this if plnar: convert from planar to interleaved
-        if (swrCTX ){
-          uint8_t *data_conv = malloc(frame->nb_samples * inf->ch * inf->sample_fmt_bytes);
-
-          if (!data_conv){
-            fprintf(stderr, "Error: Out of memory for audio convertion\n");
-            av_frame_unref(frame);
-            continue;
-          }
-
-          uint8_t *data[1] = {data_conv};
-
-          // start converting the samples
-          int samples = swr_convert(swrCTX,
-            data, frame->nb_samples, // output
-            (const uint8_t**)frame->data, frame->nb_samples // input
-          );
-
-          if (samples > 0 ){
-            // get how much bytes to write from this (PCM samples)
-            int bytes = samples * inf->ch * inf->sample_fmt_bytes;
-            // write in buffer
-            audio_buffer_write(streamCTX->buf, data[0], bytes);
-          }
-          free(data_conv);
-
-          // run this if: already interleaved
-        } else {
-          // get how much bytes to write from this (PCM samples)
-          int bytes = frame->nb_samples * inf->ch * inf->sample_fmt_bytes;
-          // write in buffer
-          audio_buffer_write(streamCTX->buf, frame->data[0], bytes);
+        // frame recieves it as PCM samples (used by miniaudio for playback)
+        while (avcodec_receive_frame(codecCTX, frame) >= 0){
+          // init duration progress
+          double current_time = (double)total_samples_played / inf->in_rate;
+          progress(state, current_time, duration_time);
+          total_samples_played += frame->nb_samples;
+          if (state->fade) crossfade_position(state->fade, total_samples_played);
+
+          // fails once the buffer is closed (quit) or a skip cancelled the
+          // wait, the track_stopping() check below takes us out either way
+          sink_frame(streamCTX, &sink, frame);
+          av_frame_unref(frame);
         }
-        av_frame_unref(frame);
       }
+      av_packet_unref(packet);
+
+      // no need to check for pause here, once the callback stops reading
+      // the buffer fills up and audio_buffer_write() puts us to sleep
+      if (track_stopping(state)) break;
+
+      if (seek_pending(state) && !track_stopping(state))
+        decoder_seek(streamCTX, &total_samples_played, duration_time);
     }
-    av_packet_unref(packet);
 
-    // check if paused
-    pthread_mutex_lock(&state->lock);
+    if (track_stopping(state)) break;
 
-      while (state->paused)
-        pthread_cond_wait(&state->wait_cond, &state->lock);
+    // what --trim held back is the silence the track ends in
+    if (state->trim) silence_trim_eof(state->trim);
 
-    pthread_mutex_unlock(&state->lock);
+    if (state->looping && atomic_load(&state->seekable)) { // if we're looping, restart again..
+      ring_unhold(streamCTX);
+      av_seek_frame(fmtCTX, -1, 0, AVSEEK_FLAG_BACKWARD);
+      avcodec_flush_buffers(codecCTX);
+      total_samples_played = 0;
+      if (state->trim) silence_trim_rewind(state->trim);
+      continue;
+    }
 
-    if (!state->running) break;
-  }
+    // --crossfade: the next track's decoder plays what's held, no waiting
+    // for the ring to run dry
+    sink_drain(streamCTX, &sink);
+    ring_finish_fade(streamCTX, &sink);
+    if (state->fade && crossfade_handoff(state->fade)) break;
 
-    if (state->looping && state->running) { // if we're looping, restart again..
-        av_seek_frame(fmtCTX, -1, 0, AVSEEK_FLAG_BACKWARD);
-        avcodec_flush_buffers(codecCTX);
-        total_samples_played = 0;
-        goto decode; // find another way, labels aren't good for readability
+    if (drain_or_seek(streamCTX)) {
+      decoder_seek(streamCTX, &total_samples_played, duration_time);
+      continue;
     }
 
-  printf("\n");
+    break;
+  }
+
+  // a --mix layer leaves the mixer's one line alone, it reports them itself
+  atomic_store(&state->decode_errors, decode_errors);
+  if (!state->quiet ){
+    printf("\n");
+    if (decode_errors) warn("%d packets failed to decode", decode_errors);
+  }
 
-  // IMPORTANT: Signal all waiting threads before exiting
-  // Note that other threads are implemented to exit once state.running is false so...
-  pthread_mutex_lock(&state->lock);
-  state->running = 0;  // Ensure running is 0
-  pthread_cond_broadcast(&state->wait_cond);
-  pthread_mutex_unlock(&state->lock);
-  
   // clean
-  if (swrCTX) swr_free(&swrCTX);
+  frame_sink_free(streamCTX, &sink);
   av_frame_free(&frame);
   av_packet_free(&packet);
 
   // exit
   return NULL;
 }
+
+// =================================================================
+// --pipeline: the same work as run_decoder split over three threads,
+// demux -> packets -> decode -> frames -> convert -> ring. a slow read only
+// drains the packet queue instead of stalling the decoder.
+//
+// seeks travel down the queues as ITEM_FLUSH markers: stages drop data while
+// flush_req is ahead of the last marker they saw (it's stale), and the
+// convert stage answers flush_ack once the marker reaches it
+
+typedef struct {
+  StreamContext *streamCTX;
+  Stage_Queue packets;         // demux -> decode
+  Stage_Queue frames;          // decode -> convert
+  atomic_llong played;         // input samples converted so far, for seeking
+  atomic_ullong written;       // the ring's written once they were in it
+  atomic_int stop;             // the convert stage is done with this track
+  Net_Buffer *net;             // urls: packets counted in seconds, NULL for files
+  int decode_errors;           // the decode stage's own, read once it's joined
+
+} Pipeline;
+
+static inline int pipeline_stopping(Pipeline *pl)
+{
+  return atomic_load(&pl->stop) || track_stopping(pl->streamCTX->state);
+}
+
+// ffmpeg polls this during network reads and connects (Track.interrupt)
+static int net_interrupted(void *opaque)
+{
+  return track_stopping((PlayBackState*)opaque);
+}
+
+// how much audio a packet holds, for the network buffer's fill level
+static int64_t packet_us(AVFormatContext *fmtCTX, AVCodecContext *codecCTX, AVPacket *pkt)
+{
+  if (pkt->duration > 0)
+    return av_rescale_q(pkt->duration, fmtCTX->streams[pkt->stream_index]->time_base, AV_TIME_BASE_Q);
+
+  if (codecCTX->frame_size > 0 && codecCTX->sample_rate > 0)
+    return codecCTX->frame_size * 1000000LL / codecCTX->sample_rate;
+
+  return 20000; // a typical mp3/aac frame, close enough for a fill level
+}
+
+// the connection's gone and ffmpeg's own reconnect didn't bring it back: open
+// the url again, backing off between tries, and carry on from `resume_us` if
+// the server can seek (a live stream just carries on from now). runs on the
+// demux thread, the only one touching fmtCTX while the pipeline is up
+static int net_reconnect(Pipeline *pl, int64_t resume_us)
+{
+  StreamContext *streamCTX = pl->streamCTX;
+  AVFormatContext *old = streamCTX->fmtCTX;
+  int audioStream = streamCTX->inf->audioStream;
+
+  for (int attempt = 0; attempt < NET_RETRIES; attempt++) {
+    // 0.25s, 0.5s, 1s... in short naps, a skip or quit doesn't wait for it
+    for (int ms = 250 << attempt; ms > 0 && !pipeline_stopping(pl); ms -= 10)
+      usleep(10000);
+
+    if (pipeline_stopping(pl)) return -1;
+
+    AVFormatContext *fmtCTX = avformat_alloc_context();
+    AVDictionary *opts = NULL;
+    if (!fmtCTX) return -1;
+
+    fmtCTX->interrupt_callback = old->interrupt_callback;
+    fmtCTX->probesize = old->probesize;
+    fmtCTX->max_analyze_duration = old->max_analyze_duration;
+    net_options(&opts);
+
+    int ret = avformat_open_input(&fmtCTX, old->url, NULL, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) continue; // fmtCTX is freed on failure
+
+    // the decoder stays as it is, so it has to be the same stream
+    if (avformat_find_stream_info(fmtCTX, NULL) < 0 || audioStream >= fmtCTX->nb_streams
+      || fmtCTX->streams[audioStream]->codecpar->codec_id != old->streams[audioStream]->codecpar->codec_id) {
+      avformat_close_input(&fmtCTX);
+      continue;
+    }
+
+    for (int i = 0; i < fmtCTX->nb_streams; i++)
+      if (i != audioStream) fmtCTX->streams[i]->discard = AVDISCARD_ALL;
+
+    if (resume_us > 0 && fmtCTX->pb && (fmtCTX->pb->seekable & AVIO_SEEKABLE_NORMAL))
+      av_seek_frame(fmtCTX, -1, resume_us, AVSEEK_FLAG_BACKWARD);
+
+    avformat_close_input(&old);
+    streamCTX->fmtCTX = fmtCTX;
+    atomic_fetch_add(&pl->net->reconnects, 1);
+    return 0;
+  }
+
+  return -1;
+}
+
+// hold the decoder while the jitter buffer fills, at the start and after it
+// ran dry, until jitter_us came in, the stream ended or the queue is full
+// (tiny packets, more of them than NET_PACKETS_PER_SEC planned for)
+static void net_gate(Pipeline *pl)
+{
+  Net_Buffer *net = pl->net;
+  Stage_Queue *q = &pl->packets;
+
+  while (atomic_load(&net->buffering) && atomic_load(&net->buffered_us) < net->jitter_us
+    && !atomic_load(&net->eof) && atomic_load(&q->tail) - atomic_load(&q->head) < q->size
+    && !pipeline_stopping(pl))
+    usleep(5000);
+
+  atomic_store(&net->buffering, 0);
+}
+
+static void *run_demux(void *arg)
+{
+  Pipeline *pl = (Pipeline*)arg;
+  StreamContext *streamCTX = pl->streamCTX;
+  PlayBackState *state = streamCTX->state;
+  int duration_time = duration_seconds(streamCTX->fmtCTX);
+  Net_Buffer *net = pl->net;
+  int64_t resume_us = 0; // where a reconnect picks up
+  unsigned handled = 0;
+  int ret;
+
+  while (!pipeline_stopping(pl)) {
+    // a network stream reads up to ahead_us and lets the server wait for the rest
+    if (net && atomic_load(&net->buffered_us) >= net->ahead_us && atomic_load(&state->flush_req) == handled) {
+      usleep(10000);
+      continue;
+    }
+
+    Stage_Item *item = stage_queue_back(&pl->packets);
+    if (!item) break;
+
+    unsigned req = atomic_load(&state->flush_req);
+
+    if (req != handled) {
+      if (pipeline_stopping(pl)) break; // a skip, not a seek
+
+      item->kind = ITEM_FLUSH;
+      item->req = handled = req;
+      // the converter stops at the flush, these two settle within a frame
+      uint64_t written = atomic_load(&pl->written);
+      item->pos = seek_input(streamCTX, atomic_load(&pl->played), written, duration_time);
+
+      if (net) {
+        resume_us = item->pos * 1000000 / streamCTX->inf->in_rate;
+        atomic_store(&net->eof, 0);
+      }
+    }
+    else if ((ret = av_read_frame(streamCTX->fmtCTX, item->obj)) >= 0) {
+      AVPacket *pkt = item->obj;
+
+      // discarded streams don't show up, but a demuxer may still hand one out
+      if (pkt->stream_index != streamCTX->inf->audioStream) {
+        av_packet_unref(pkt);
+        continue;
+      }
+      item->kind = ITEM_DATA;
+
+      if (net) {
+        item->pos = packet_us(streamCTX->fmtCTX, streamCTX->codecCTX, pkt);
+        net_buffer_add(net, item->pos);
+
+        if (pkt->pts != AV_NOPTS_VALUE)
+          resume_us = av_rescale_q(pkt->pts, streamCTX->fmtCTX->streams[pkt->stream_index]->time_base, AV_TIME_BASE_Q) + item->pos;
+      }
+    }
+    // a dropped connection, or a live stream that "ended": reopen and go on.
+    // a file that really ended is eof close to its duration
+    else if (net && (ret != AVERROR_EOF || duration_time <= 0 || resume_us < (duration_time - 1) * 1000000LL)
+      && net_reconnect(pl, resume_us) == 0) {
+      continue;
+    }
+    else if (state->looping && atomic_load(&state->seekable)) {
+      av_seek_frame(streamCTX->fmtCTX, -1, 0, AVSEEK_FLAG_BACKWARD);
+      item->kind = ITEM_RESTART;
+    }
+    else {
+      if (net) atomic_store(&net->eof, 1);
+      item->kind = ITEM_EOF;
+      stage_queue_push(&pl->packets);
+
+      // nothing left to read, but a seek can still bring us back
+      while (!pipeline_stopping(pl) && atomic_load(&state->flush_req) == handled)
+        usleep(10000);
+      continue;
+    }
+
+    stage_queue_push(&pl->packets);
+  }
+
+  return NULL;
+}
+
+static void *run_decode(void *arg)
+{
+  Pipeline *pl = (Pipeline*)arg;
+  AVCodecContext *codecCTX = pl->streamCTX->codecCTX;
+  PlayBackState *state = pl->streamCTX->state;
+  Net_Buffer *net = pl->net;
+  unsigned seen = 0;
+  int decoding = 0; // got data since the start or the last seek
+  Stage_Item *in;
+
+  while (1) {
+    // ran dry: a rebuffer, unless a seek emptied the queue on purpose
+    if (net && !atomic_load(&net->buffering) && atomic_load(&net->buffered_us) <= 0 && !atomic_load(&net->eof)) {
+      atomic_store(&net->buffering, 1);
+      if (decoding && atomic_load(&state->flush_req) == seen) atomic_fetch_add(&net->rebuffers, 1);
+    }
+
+    if (!(in = stage_queue_front(&pl->packets))) break;
+
+    if (net && in->kind == ITEM_DATA) {
+      net_gate(pl);
+      decoding = 1;
+    }
+
+    if (in->kind != ITEM_DATA) {
+      // seek or loop: the decoder starts over, the marker goes on
+      if (in->kind != ITEM_EOF) avcodec_flush_buffers(codecCTX);
+      // a seek starts from an empty buffer, it fills up like at the start
+      if (in->kind == ITEM_FLUSH) {
+        seen = in->req;
+        decoding = 0;
+        if (net) atomic_store(&net->buffering, 1);
+      }
+
+      Stage_Item *out = stage_queue_back(&pl->frames);
+      if (!out) break;
+
+      out->kind = in->kind;
+      out->req = in->req;
+      out->pos = in->pos;
+      stage_queue_push(&pl->frames);
+    }
+    // skip decoding packets from before a seek the demuxer hasn't answered yet.
+    // a bad one is dropped and counted, as without --pipeline
+    else if (atomic_load(&state->flush_req) == seen) {
+      Stage_Item *out;
+
+      if (avcodec_send_packet(codecCTX, in->obj) < 0) pl->decode_errors++;
+      else
+        while ((out = stage_queue_back(&pl->frames)) && avcodec_receive_frame(codecCTX, out->obj) >= 0) {
+          out->kind = ITEM_DATA;
+          stage_queue_push(&pl->frames);
+        }
+    }
+
+    if (net && in->kind == ITEM_DATA) net_buffer_take(net, in->pos);
+    av_packet_unref(in->obj);
+    stage_queue_pop(&pl->packets);
+  }
+
+  return NULL;
+}
+
+// the convert stage runs on the thread play_track started
+void *run_pipeline(void *arg)
+{
+  StreamContext *streamCTX = (StreamContext*)arg;
+  Audio_Info *inf = streamCTX->inf;
+  PlayBackState *state = streamCTX->state;
+
+  Pipeline pl = { .streamCTX = streamCTX, .net = state->net, .written = streamCTX->buf->written };
+
+  // a network stream's packet queue holds everything up to ahead_us, the
+  // demuxer stops there rather than on a full queue
+  unsigned packets = PIPELINE_PACKETS;
+  if (pl.net)
+    while (packets < (pl.net->ahead_us / 1000000 + 1) * NET_PACKETS_PER_SEC) packets <<= 1;
+
+  if (stage_queue_init(&pl.packets, packets) < 0 || stage_queue_init(&pl.frames, PIPELINE_FRAMES) < 0)
+    die("pipeline: can't allocate the stage queues");
+
+  for (unsigned i = 0; i < pl.packets.size; i++)
+    if (!(pl.packets.items[i].obj = av_packet_alloc())) die("pipeline: can't allocate packets");
+
+  for (unsigned i = 0; i < pl.frames.size; i++)
+    if (!(pl.frames.items[i].obj = av_frame_alloc())) die("pipeline: can't allocate frames");
+
+  Frame_Sink sink;
+  frame_sink_init(streamCTX, &sink);
+
+  pthread_t demux_thread, decode_thread;
+  pthread_create(&demux_thread, NULL, run_demux, &pl);
+  pthread_create(&decode_thread, NULL, run_decode, &pl);
+
+  int64_t total_samples_played = 0;
+  int duration_time = duration_seconds(streamCTX->fmtCTX);
+  unsigned seen = 0;
+  Stage_Item *in;
+
+  while ((in = stage_queue_front(&pl.frames))) {
+    switch (in->kind) {
+      case ITEM_DATA:
+        if (atomic_load(&state->flush_req) == seen) {
+          progress(state, (double)total_samples_played / inf->in_rate, duration_time);
+          total_samples_played += ((AVFrame*)in->obj)->nb_samples;
+          if (state->fade) crossfade_position(state->fade, total_samples_played);
+
+          if (sink_frame(streamCTX, &sink, in->obj) < 0)
+            atomic_store(&pl.stop, 1);
+          atomic_store(&pl.written, streamCTX->buf->written);
+          atomic_store(&pl.played, total_samples_played);
+        }
+        av_frame_unref(in->obj);
+        break;
+
+      case ITEM_FLUSH:
+        seen = in->req;
+        total_samples_played = in->pos;
+        atomic_store(&pl.written, streamCTX->buf->written);
+        atomic_store(&pl.played, total_samples_played);
+        if (state->trim) silence_trim_seek(state->trim, total_samples_played);
+        seek_done(streamCTX, in->req);
+        break;
+
+      case ITEM_RESTART:
+        ring_unhold(streamCTX);
+        total_samples_played = 0;
+        atomic_store(&pl.written, streamCTX->buf->written);
+        atomic_store(&pl.played, 0);
+        if (state->trim) silence_trim_rewind(state->trim);
+        break;
+
+      case ITEM_EOF:
+        if (state->trim) silence_trim_eof(state->trim);
+        sink_drain(streamCTX, &sink);
+        ring_finish_fade(streamCTX, &sink);
+        // a seek while draining: its marker is on the way
+        if ((state->fade && crossfade_handoff(state->fade)) || !drain_or_seek(streamCTX)) atomic_store(&pl.stop, 1);
+        break;
+    }
+
+    stage_queue_pop(&pl.frames);
+    if (pipeline_stopping(&pl)) break;
+  }
+
+  printf("\n");
+
+  // wake and stop the other two stages
+  atomic_store(&pl.stop, 1);
+  stage_queue_close(&pl.packets);
+  stage_queue_close(&pl.frames);
+  pthread_join(demux_thread, NULL);
+  pthread_join(decode_thread, NULL);
+
+  atomic_store(&state->decode_errors, pl.decode_errors);
+  if (pl.decode_errors) warn("%d packets failed to decode", pl.decode_errors);
+
+  printf("pipeline queues (occupancy per push):\n");
+  stage_queue_report(&pl.packets, "packets");
+  stage_queue_report(&pl.frames, "frames");
+
+  // clean
+  for (unsigned i = 0; i < pl.packets.size; i++) av_packet_free((AVPacket**)&pl.packets.items[i].obj);
+  for (unsigned i = 0; i < pl.frames.size; i++) av_frame_free((AVFrame**)&pl.frames.items[i].obj);
+  stage_queue_destroy(&pl.packets);
+  stage_queue_destroy(&pl.frames);
+  frame_sink_free(streamCTX, &sink);
+
+  return NULL;
+}
   
 // miniaudio will use this callback to read PCM samples
 void ma_dataCallback(ma_device *ma_config, void *output, const void *input, ma_uint32 frameCount)
@@ -218,74 +1038,221 @@ void ma_dataCallback(ma_device *ma_config, void *output, const void *input, ma_u
   StreamContext *streamCTX = (StreamContext*)ma_config->pUserData;
   Audio_Info *inf = streamCTX->inf;
   PlayBackState *state = streamCTX->state;
-  
-  // Read audio data
-  int bytes = frameCount * inf->ch * inf->sample_fmt_bytes;
-  audio_buffer_read(streamCTX->buf, output, bytes);
+  Output_State *out = &streamCTX->out;
 
-  // check if paused
-  pthread_mutex_lock(&state->lock);
+  int frame_bytes = inf->ch * inf->sample_fmt_bytes;
+  int got = 0; // frames taken from the buffer this period
+  uint64_t applied[CMD_COUNT] = {0};
 
-  while (state->paused)
-    pthread_cond_wait(&state->wait_cond, &state->lock);
+  // apply queued controls here, at the start of the period, so they always
+  // land on a block boundary. nothing below takes a lock or waits.
+  playback_apply(state, applied);
 
-  pthread_mutex_unlock(&state->lock);
-  
-  // Apply volume (already have safe copy)
-  if (state->volume != 1.00f) {
-    ma_apply_volume_factor_pcm_frames(output, frameCount, inf->ma_fmt, inf->ch, state->volume);
+  if (!atomic_load(&state->running)) {
+    audio_buffer_close(streamCTX->buf);
+    ma_silence_pcm_frames(output, frameCount, inf->ma_fmt, inf->ch);
+    return;
+  }
+
+  // a skip may already be answered when we get here: the new track starts
+  // this block, glide it in like after a seek
+  if (applied[CMD_NEXT] || applied[CMD_PREV])
+    out->gain = 0.0f;
+
+  // seek or skip in flight: whatever is buffered belongs to the old position,
+  // drop it so the decoder can get going, and play silence until it has jumped
+  if (seek_pending(state)) {
+    audio_buffer_skip(streamCTX->buf);
+    ma_silence_pcm_frames(output, frameCount, inf->ma_fmt, inf->ch);
+    out->gain = 0.0f; // the new position glides in
+  }
+
+  else if (atomic_load(&state->paused)) {
+    // just paused: fade out over the first few ms and stop reading right
+    // there, the next sample stays in the buffer for resume
+    if (!out->paused) {
+      int fade = out->fade_frames < frameCount ? out->fade_frames : (int)frameCount;
+      got = audio_buffer_read(streamCTX->buf, output, fade * frame_bytes) / frame_bytes;
+      gain_apply(output, got, inf->ma_fmt, inf->ch, out->gain, 0.0f, out->soft_limit);
+      out->gain = 0.0f;
+      out->paused = 1;
+    }
+
+    ma_silence_pcm_frames((uint8_t*)output + got * frame_bytes, frameCount - got, inf->ma_fmt, inf->ch);
+  }
+
+  else {
+    // Read audio data, pad with silence if the decoder is late
+    got = audio_buffer_read(streamCTX->buf, output, frameCount * frame_bytes) / frame_bytes;
+    ma_silence_pcm_frames((uint8_t*)output + got * frame_bytes, frameCount - got, inf->ma_fmt, inf->ch);
+
+    // replaygain rides on the volume multiply. it changes where the next
+    // track's data starts, the block it lands in glides over like a volume change
+    if (streamCTX->buf->consumed >= atomic_load(&state->replaygain_at))
+      out->replaygain = atomic_load(&state->replaygain);
+
+    // volume changes glide across the whole period instead of stepping,
+    // a resume ramps in from the sample we stopped on within the fade length
+    float volume = atomic_load(&state->volume) * out->replaygain;
+    int ramp = got;
+
+    if (out->paused) {
+      ramp = out->fade_frames < got ? out->fade_frames : got;
+      out->paused = 0;
+    }
+
+    gain_apply(output, ramp, inf->ma_fmt, inf->ch, out->gain, volume, out->soft_limit);
+    gain_apply((uint8_t*)output + ramp * frame_bytes, got - ramp, inf->ma_fmt, inf->ch, volume, volume, out->soft_limit);
+
+    if (got > 0) out->gain = volume;
+  }
+
+  // --spectrum, --shm-tap and --tee see exactly what goes out, silence included
+  if (state->spectrum) spectrum_tap(state->spectrum, output, frameCount, inf->ma_fmt, inf->ch);
+  if (state->tap) shm_tap_write(state->tap, output, frameCount);
+  if (state->tee) tee_write(state->tee, output, frameCount);
+
+  // the block goes to the device once we return, that's when it's audible.
+  // a seek or skip only counts once the first sample from the new position
+  // (or track) is out
+  if (state->latency) {
+    state->latency->period_frames = frameCount;
+
+    for (int i = 0; i < CMD_COUNT; i++){
+      if (!applied[i]) continue;
+
+      if (i == CMD_SEEK || i == CMD_NEXT || i == CMD_PREV) {
+        out->flush_stamp = applied[i];
+        out->flush_cmd = i;
+      }
+      else latency_record(state->latency, i, applied[i]);
+    }
+
+    if (out->flush_stamp && got > 0 && !seek_pending(state)) {
+      latency_record(state->latency, out->flush_cmd, out->flush_stamp);
+      out->flush_stamp = 0;
+    }
   }
 }
 
 // init miniaudio config before using
-ma_device_config init_miniaudioConfig(Audio_Info *inf, StreamContext *streamCTX)
+// format/channels/rate are left unknown so the device opens in its native
+// setup, the decoder side then converts into exactly that
+ma_device_config init_miniaudioConfig(StreamContext *streamCTX)
 {
   ma_device_config ma_config = ma_device_config_init(ma_device_type_playback);
 
-  ma_config.playback.channels = inf->ch;
-  ma_config.playback.format = inf->ma_fmt;
-  ma_config.sampleRate = inf->sample_rate;
+  ma_config.playback.channels = 0;
+  ma_config.playback.format = ma_format_unknown;
+  ma_config.sampleRate = 0;
   ma_config.dataCallback = ma_dataCallback;
   ma_config.pUserData = streamCTX;
 
+  // the callback writes every frame. the gain stage limits unless
+  // --no-limiter, then it's miniaudio's clip that keeps f32 within unity
+  ma_config.noPreSilencedOutputBuffer = MA_TRUE;
+  ma_config.noClip = streamCTX->out.soft_limit ? MA_TRUE : MA_FALSE;
+
   return ma_config;
 }
 
-// reads the file and creates a Stream Context
-void get_audio_info(const char *filename, StreamContext *streamCTX)
+// opens and probes the file and its decoder, fills the input side of
+// track->inf. safe to run on any thread (the prefetcher does). returns -1 with
+// track->error set and nothing left open on failure
+int open_track(Track *track, const PlayBackOptions *opt)
 {
-  Audio_Info *inf = streamCTX->inf;
+  Audio_Info *inf = &track->inf;
+  const char *err = NULL;
+  AVDictionary *opts = NULL;
+  int stream = opt->stream;
+
+  // stdin and fifos go through our own reader. a small probe: the defaults
+  // (5MB, 5s) would sit there until that much came down the pipe
+  if (pipe_is_input(track->filename) ){
+    if (!(track->pb = pipe_input_open(track->filename, opt->pipe_buffer << 10, opt->spill))) {
+      snprintf(track->error, sizeof(track->error), "pipe: %s", strerror(errno));
+      goto fail;
+    }
+
+    if (!(track->fmtCTX = avformat_alloc_context())) {
+      err = "ffmpeg: failed allocate format context!";
+      goto fail;
+    }
+
+    track->fmtCTX->pb = track->pb;
+    track->fmtCTX->flags |= AVFMT_FLAG_CUSTOM_IO;
+    track->fmtCTX->probesize = opt->pipe_probe << 10;
+    track->fmtCTX->max_analyze_duration = PIPE_ANALYZE;
+  }
+
+  // urls go through ffmpeg's own protocols, with reconnects on. same small
+  // probe as a pipe: the first sound shouldn't wait on a big download too
+  else if (net_is_url(track->filename) ){
+    if (!(track->fmtCTX = avformat_alloc_context())) {
+      err = "ffmpeg: failed allocate format context!";
+      goto fail;
+    }
+
+    track->fmtCTX->interrupt_callback = track->interrupt;
+    track->fmtCTX->probesize = opt->pipe_probe << 10;
+    track->fmtCTX->max_analyze_duration = PIPE_ANALYZE;
+    net_options(&opts);
+  }
 
   // Read File
-  if (avformat_open_input(&streamCTX->fmtCTX, filename, NULL, NULL) < 0 )
-    die("ffmpeg: file type is not supported");
+  int opened = avformat_open_input(&track->fmtCTX, track->filename, NULL, &opts);
+  av_dict_free(&opts);
 
-  if (avformat_find_stream_info(streamCTX->fmtCTX, NULL) < 0 )
-    die("ffmpeg: cannot find any streams");
+  if (opened < 0 ){
+    err = net_is_url(track->filename) ? "network: can't open the stream" : "ffmpeg: file type is not supported";
+    goto fail;
+  }
+
+  if (avformat_find_stream_info(track->fmtCTX, NULL) < 0 ){
+    err = "ffmpeg: cannot find any streams";
+    goto fail;
+  }
 
   // here we try get audio stream index from container
-  int audioStream = -1;
-  audioStream = get_stream(streamCTX->fmtCTX, AVMEDIA_TYPE_AUDIO, audioStream);
+  track->audio_tracks = count_streams(track->fmtCTX, AVMEDIA_TYPE_AUDIO);
+  int audioStream = get_stream(track->fmtCTX, AVMEDIA_TYPE_AUDIO, stream);
 
-  if (audioStream == -1 )
-    die("file: can't find AudioStream");
+  if (!track->audio_tracks ){
+    err = "file: can't find AudioStream";
+    goto fail;
+  }
+
+  if (audioStream == -1 ){
+    snprintf(track->error, sizeof(track->error), "file: no audio track %d, this one has %d (counting from 0)",
+      stream, track->audio_tracks);
+    goto fail;
+  }
+
+  // video, cover art, subtitles and the other audio tracks: tell the demuxer
+  // to skip them instead of reading their packets for us to throw away
+  for (int i = 0; i < track->fmtCTX->nb_streams; i++)
+    if (i != audioStream) track->fmtCTX->streams[i]->discard = AVDISCARD_ALL;
 
   // here we get the information about audio stream is codecParameters
-  const AVCodecParameters *codecPAR = streamCTX->fmtCTX->streams[audioStream]->codecpar;
+  const AVCodecParameters *codecPAR = track->fmtCTX->streams[audioStream]->codecpar;
   const AVCodec *codecID = avcodec_find_decoder(codecPAR->codec_id);
 
   // allocate empty decoder
-  streamCTX->codecCTX = avcodec_alloc_context3(codecID);
+  track->codecCTX = avcodec_alloc_context3(codecID);
 
-  if (!streamCTX->codecCTX )
-    die("ffmpeg: failed allocate codec!");
+  if (!track->codecCTX ){
+    err = "ffmpeg: failed allocate codec!";
+    goto fail;
+  }
 
   // Copy audio specification to decoder
-  avcodec_parameters_to_context(streamCTX->codecCTX, codecPAR);
+  avcodec_parameters_to_context(track->codecCTX, codecPAR);
 
   // initialize decoder with actual codec
-  if (avcodec_open2(streamCTX->codecCTX, codecID, NULL) < 0)
-    die("ffmpeg: failed init decoder!");
+  if (avcodec_open2(track->codecCTX, codecID, NULL) < 0){
+    err = "ffmpeg: failed init decoder!";
+    goto fail;
+  }
 
   // Audio samples can be stored in two formats: PLANAR or INTERLEAVED
   // 
@@ -293,99 +1260,436 @@ void get_audio_info(const char *filename, StreamContext *streamCTX)
   //   Channel 0: [L L L L L L]              [L R L R L R L R L R]
   //   Channel 1: [R R R R R R]
   // 
-  // Speakers need INTERLEAVED format! We must convert PLANAR to INTERLEAVED.
-  // The decoder will take care of converting sample formats
-  enum AVSampleFormat input_sample_fmt = streamCTX->codecCTX->sample_fmt;
-  enum AVSampleFormat output_sample_fmt = input_sample_fmt;
-  
-  if (av_sample_fmt_is_planar(input_sample_fmt)){
-    output_sample_fmt = get_interleaved(input_sample_fmt);
-  }
-
-  // save to inf base information
+  // Speakers need INTERLEAVED format! run_decoder converts to whatever the
+  // device was opened with (set_output_format), here we only note the input
   #ifdef LEGACY_LIBSWRSAMPLE
-    inf->ch = streamCTX->codecCTX->channels,
-    inf->ch_layout = streamCTX->codecCTX->channel_layout,
+    inf->in_ch = track->codecCTX->channels;
+    inf->in_layout = track->codecCTX->channel_layout;
+    if (!inf->in_layout) inf->in_layout = av_get_default_channel_layout(inf->in_ch);
   #else
-    inf->ch = streamCTX->codecCTX->ch_layout.nb_channels,
-    inf->ch_layout = streamCTX->codecCTX->ch_layout,
+    inf->in_ch = track->codecCTX->ch_layout.nb_channels;
+    av_channel_layout_copy(&inf->in_layout, &track->codecCTX->ch_layout);
+    if (inf->in_layout.order == AV_CHANNEL_ORDER_UNSPEC)
+      av_channel_layout_default(&inf->in_layout, inf->in_ch);
+  #endif
+
+  inf->audioStream = audioStream;
+  inf->in_rate = track->codecCTX->sample_rate;
+  inf->in_fmt = track->codecCTX->sample_fmt;
+  return 0;
+
+fail:
+  if (err) snprintf(track->error, sizeof(track->error), "%s", err);
+  cleanUP(track->fmtCTX, track->codecCTX);
+  pipe_input_close(&track->pb);
+  track->fmtCTX = NULL;
+  track->codecCTX = NULL;
+  return -1;
+}
+
+// everything open_track and playback_run left behind, the filename stays
+void close_track(Track *track)
+{
+  #ifndef LEGACY_LIBSWRSAMPLE
+    av_channel_layout_uninit(&track->inf.in_layout);
+    av_channel_layout_uninit(&track->inf.ch_layout);
   #endif
 
-  inf->audioStream = audioStream,
-  inf->sample_rate = streamCTX->codecCTX->sample_rate,
-  inf->sample_fmt = output_sample_fmt,
-  inf->sample_fmt_bytes = av_get_bytes_per_sample(inf->sample_fmt),
-  inf->ma_fmt = get_ma_format(output_sample_fmt);
+  cleanUP(track->fmtCTX, track->codecCTX);
+  pipe_input_close(&track->pb);
+  track->fmtCTX = NULL;
+  track->codecCTX = NULL;
+  track->inf = (Audio_Info){0};
+  track->played = 0;
+}
+
+// a track kept open after it played starts over from the top
+static void rewind_track(Track *track)
+{
+  av_seek_frame(track->fmtCTX, -1, 0, AVSEEK_FLAG_BACKWARD);
+  avcodec_flush_buffers(track->codecCTX);
 }
 
-// this handles playing audio files.
-int playback_run(const char *filename, uint loop)
+// the track --crossfade handed its tail to didn't open: that tail plays out
+// as it is, the end of the track it came from, instead of being mixed into
+// whatever comes next
+static void fade_release(StreamContext *streamCTX)
 {
-  Audio_Info inf = {0};
-  Audio_Buffer *buf = NULL;
+  Crossfade *cf = streamCTX->state->fade;
+
+  if (!cf || cf->holding || cf->mixed >= cf->len) return;
+
+  tail_write(streamCTX, cf, cf->mixed, cf->len - cf->mixed);
+  crossfade_reset(cf);
+}
+
+// plays one track on its own decoder thread, the device keeps running across
+// tracks. `next` (may be NULL) gets opened in the background meanwhile.
+// returns -1 if the track couldn't be opened
+static int play_track(StreamContext *streamCTX, Track *track, Track *next, const PlayBackOptions *opt)
+{
+  PlayBackState *state = streamCTX->state;
+  Prefetch prefetch = {0};
+  Net_Buffer net;
+  Wave_Scan scan;
+  pthread_t decoder_thread;
+
+  // cold open unless the prefetcher (or an earlier round) got to it first
+  track->interrupt = (AVIOInterruptCB){ net_interrupted, state };
+
+  if (!track->fmtCTX && open_track(track, opt) < 0 ){
+    warn("%s: %s", track->filename, track->error);
+    fade_release(streamCTX);
+    return -1;
+  }
+
+  if (track->played) rewind_track(track);
+  track->played = 1;
+
+  // the decoder isn't running, nobody else reads the input side right now
+  set_input_format(streamCTX->inf, &track->inf);
+  atomic_store(&streamCTX->buf->cancel, 0);
+  streamCTX->fmtCTX = track->fmtCTX;
+  streamCTX->codecCTX = track->codecCTX;
+  atomic_store(&state->position, 0);
+
+  // the decoder isn't running, nobody's writing the ring now
+  const char *gain_from;
+  float gain = replaygain_gain(state->loudness, track->filename, track->fmtCTX->metadata,
+    track->fmtCTX->streams[track->inf.audioStream]->metadata, opt->replaygain, &gain_from);
+  atomic_store(&state->replaygain_at, streamCTX->buf->written);
+  atomic_store(&state->replaygain, gain);
+
+  // --trim: the cache may know where the sound is already. only files hold
+  // silence back, a pipe or a stream would run dry while we wait on it
+  Silence_Trim trim;
+  int is_file = !pipe_is_input(track->filename) && !net_is_url(track->filename);
+  if (opt->trim ){
+    silence_trim_init(&trim, track->inf.in_rate, is_file, is_file ? loudness_cache_get(state->loudness, track->filename) : NULL);
+    state->trim = &trim;
+  }
+
+  // a pipe without --spill or a live stream plays once, straight through
+  AVIOContext *pb = track->fmtCTX->pb;
+  atomic_store(&state->seekable, !pb || (pb->seekable & AVIO_SEEKABLE_NORMAL));
+
+  // Outputs
+  if (streamCTX->fmtCTX->metadata)
+    print_metadata(streamCTX->fmtCTX->metadata);
+
+  if (track->audio_tracks > 1 )
+    printf("audio track %d of %d (--stream=N picks another)\n", opt->stream, track->audio_tracks);
+
+  printf("Playing: %s\n",  track->filename);
+  print_pipeline(streamCTX->inf);
+
+  if (gain_from)
+    printf("replaygain: %+.1f dB (%s)\n", 20 * log10f(gain), gain_from);
+
+  if (state->trim && trim.end)
+    printf("trim: sound from %.1fs to %.1fs (cached)\n", (double)trim.lead / track->inf.in_rate,
+      (double)trim.end / track->inf.in_rate);
+
+  if (!atomic_load(&state->seekable))
+    printf("not seekable: seeking and --loop are off for this one%s\n",
+      pipe_is_input(track->filename) ? " (--spill makes it seekable)" : "");
+
+  // urls always take the pipeline: its demux thread does the network reads,
+  // the packet queue behind it is the jitter buffer
+  if (net_is_url(track->filename) ){
+    net_buffer_init(&net, opt->jitter);
+    state->net = &net;
+  }
+
+  // the progress bar's waveform, from the cache or scanned in the background
+  wave_scan_start(&scan, track->filename, opt);
+  state->wave = scan.running || atomic_load(&scan.wave.filled) ? &scan.wave : NULL;
+
+  // --crossfade: only a file we know the length of, with another after it.
+  // it needs to be long enough to fade in and out without the two meeting
+  if (state->fade ){
+    double hold = state->fade->seconds * (state->stretch ? atomic_load(&state->stretch->speed) : 1.0);
+    int duration = duration_seconds(track->fmtCTX);
+
+    if (next && is_file && !state->looping && atomic_load(&state->seekable) && duration >= 2 * hold)
+      crossfade_arm(state->fade, (int64_t)((duration - hold) * track->inf.in_rate), gain);
+    else
+      crossfade_arm(state->fade, -1, gain);
+  }
+
+  pthread_create(&decoder_thread, NULL, opt->pipeline || state->net ? run_pipeline : run_decoder, streamCTX); // decoder ._.
+
+  // open the next file in the background before this one ends (it may still
+  // be open from before if we came back to this one)
+  if (next && next->fmtCTX )
+    next = NULL;
+
+  if (next ){
+    prefetch.track = next;
+    prefetch.state = state;
+    prefetch.duration = duration_seconds(streamCTX->fmtCTX);
+    prefetch.lead = opt->prefetch_lead;
+    prefetch.opt = opt;
+    prefetch_start(&prefetch);
+  }
+
+  pthread_join(decoder_thread, NULL);
+
+  wave_scan_stop(&scan);
+  state->wave = NULL;
+
+  // a reconnect swapped the format context for a new one
+  if (state->net ){
+    track->fmtCTX = streamCTX->fmtCTX;
+    net_buffer_report(&net);
+    state->net = NULL;
+  }
+
+  // a pass from start to end found where the sound is, the next one won't scan
+  if (state->trim ){
+    if (trim.found && is_file && state->loudness) silence_trim_save(state->loudness, track->filename, &trim);
+    silence_trim_free(&trim);
+    state->trim = NULL;
+  }
+
+  // played out or skipped, either way the next one is wanted now
+  if (next ){
+    prefetch_now(&prefetch);
+    prefetch_finish(&prefetch);
+  }
+
+  if (state->latency)
+    print_io_cost(track->fmtCTX);
+
+  return 0;
+}
+
+// this handles playing the queue. the device, the ring and the control
+// threads live for the whole session, only the decoder changes per track, so
+// next/previous is a flush and a switch to a track that's already open.
+// returns 1 if the user quit, -1 if there's no device
+int playback_run(Play_Queue *queue, const PlayBackOptions *opt)
+{
+  Audio_Info inf = {0}; // output side for the session, input side per track
   PlayBackState state = {0};
   StreamContext streamCTX = {0};
+  Latency_Stats latency = {0};
+
+  av_log_set_level(AV_LOG_QUIET); // ignore warning
+  avformat_network_init();
 
   streamCTX.inf = &inf;
   streamCTX.buf = NULL;
   streamCTX.state = &state;
-  streamCTX.fmtCTX = NULL;
-  streamCTX.codecCTX = NULL;
 
-  av_log_set_level(AV_LOG_QUIET); // ignore warning
+  init_playbackstatus(&state, opt->loop);
+  state.queue = queue;
 
-  // create StreamContext from file.
-  get_audio_info(filename, &streamCTX);
-  init_playbackstatus(&state, loop);
+  Loudness_Cache loudness = {0};
+  if (opt->replaygain != REPLAYGAIN_OFF || opt->trim ){
+    if (loudness_cache_load(&loudness) < 0) warn("loudness cache: can't read it:");
+    state.loudness = &loudness;
+  }
 
   // init threads
   pthread_t control_thread;
   pthread_t sock_thread;
-  pthread_t decoder_thread;
-
-  // init a buffer size = 500ms
-  int capacity = (inf.sample_rate) * (inf.ch) * (inf.sample_fmt_bytes) * 0.5;
-  streamCTX.buf = audio_buffer_init(capacity);
 
   // init miniaudio device (for sending PCM samples to speaker)
   ma_device device;
-  ma_device_config ma_config = init_miniaudioConfig(&inf, &streamCTX);
+  streamCTX.out.soft_limit = !opt->no_limiter;
+  ma_device_config ma_config = init_miniaudioConfig(&streamCTX);
+
+  // a forced layout opens the device with that many channels, otherwise it
+  // keeps its own and swr mixes the file down (or up) to it
+  if (opt->layout ){
+    int ch = layout_channels(opt->layout);
+    if (ch <= 0 || ch > MA_MAX_CHANNELS) die("layout: unknown channel layout '%s'", opt->layout);
+    ma_config.playback.channels = ch;
+  }
+
+  // --latency runs on the null backend: no sound card, the callback is driven
+  // by a timer at the same period so the timings still mean something
+  ma_context context;
+  ma_context *pContext = NULL;
+
+  if (opt->latency_probe ){
+    ma_backend backends[] = { ma_backend_null };
+    if (ma_context_init(backends, 1, NULL, &context) != MA_SUCCESS )
+      return -1;
+
+    pContext = &context;
+  }
 
   // initialize the device output
-  if (ma_device_init(NULL, &ma_config, &device) != MA_SUCCESS ){
-    audio_buffer_destroy(buf);
-    pthread_mutex_destroy(&state.lock);
-    pthread_cond_destroy(&state.wait_cond);
-    return 1;
+  if (ma_device_init(pContext, &ma_config, &device) != MA_SUCCESS ){
+    if (pContext) ma_context_uninit(pContext);
+    return -1;
   }
 
-  // Outputs
-  if (streamCTX.fmtCTX->metadata)
-    print_metadata(streamCTX.fmtCTX->metadata);
+  // ffmpeg can't produce packed 24 bit, give those devices s32 and let
+  // miniaudio drop the low byte (the only conversion left on its side)
+  if (get_av_format(device.playback.format) == AV_SAMPLE_FMT_NONE ){
+    ma_device_uninit(&device);
+    ma_config.playback.format = ma_format_s32;
+
+    if (ma_device_init(pContext, &ma_config, &device) != MA_SUCCESS ){
+      if (pContext) ma_context_uninit(pContext);
+      return -1;
+    }
+  }
+
+  set_output_format(&inf, &device, opt->layout);
+  inf.resample = opt->resample;
+
+  // init a buffer size = 500ms (of what the device plays, not of the file),
+  // rounded to whole frames
+  int capacity = (inf.sample_rate / 2) * (inf.ch) * (inf.sample_fmt_bytes);
+  streamCTX.buf = audio_buffer_init(capacity);
+  state.buf = streamCTX.buf;
+
+  // pause/resume fades, 5ms is short enough to feel instant and long enough not to click
+  streamCTX.out.fade_frames = inf.sample_rate / 200;
+  streamCTX.out.gain = 0.0f; // fade in on the first block too
+  streamCTX.out.replaygain = 1.0f;
+  gain_init();
+
+  // --eq runs at what the device plays, the same for every track
+  if (opt->eq_bands ){
+    state.eq = eq_create(opt->eq, opt->eq_bands, inf.ma_fmt, inf.ch, inf.sample_rate);
+    if (!state.eq) warn("eq: can't run on %d channels, playing without it", inf.ch);
+  }
+
+  if (opt->speed > 0 && !(state.stretch = stretch_create(inf.ma_fmt, inf.ch, inf.sample_rate, opt->speed)) ){
+    if (errno == EINVAL) die("speed: unsupported format, the device plays %s", ma_get_format_name(inf.ma_fmt));
+    die("speed: out of memory");
+  }
+
+  // --crossfade is last before the ring, in its format
+  if (opt->crossfade > 0 ){
+    state.fade = crossfade_create(inf.ma_fmt, inf.ch, inf.sample_rate, opt->crossfade, opt->crossfade_curve);
+    if (!state.fade) die("crossfade: out of memory");
+  }
+
+  // --spectrum: its thread runs for the whole session, on what the device plays
+  if (opt->spectrum ){
+    if (!(state.spectrum = spectrum_create(inf.sample_rate, opt->spectrum))) die("spectrum: out of memory");
+    spectrum_start(state.spectrum);
+  }
 
-  printf("Playing: %s\n",  filename);
-  printf("%.2dHz, %dch, %s\n", inf.sample_rate, inf.ch, av_get_sample_fmt_name(inf.sample_fmt));
+  // --shm-tap: playing goes on without it if there's no shared memory
+  if (opt->shm_tap ){
+    if ((state.tap = shm_tap_create(inf.ma_fmt, inf.ch, inf.sample_rate)))
+      printf("shm tap: %s, %s %dch %dHz\n", SHM_TAP_NAME, state.tap->head->format_name, inf.ch, inf.sample_rate);
+    else if (errno == EBUSY)
+      warn("shm tap: %s belongs to another tomu that's playing, going on without it", SHM_TAP_NAME);
+    else
+      warn("shm tap: %s:", SHM_TAP_NAME);
+  }
+
+  // --tee: every sink gets its own ring and thread, a slow one drops blocks
+  // and leaves the device alone
+  if (opt->tee_count && !(state.tee = tee_create(opt->tee, opt->tee_count, inf.ma_fmt, inf.ch, inf.sample_rate)))
+    die("tee: out of memory");
+
+  if (opt->latency_probe ){
+    latency.sample_rate = inf.sample_rate;
+    state.latency = &latency;
+  }
 
   // start threads
-  pthread_create(&control_thread, NULL, handle_input, &state); // terminal controls
-  pthread_create(&sock_thread, NULL, run_socket, &state); // socket controls
-  pthread_create(&decoder_thread, NULL, run_decoder, &streamCTX); // decoder ._.
-  
-  // start mini audio and wait decoder write to end
+  if (opt->latency_probe ){
+    pthread_create(&control_thread, NULL, run_latency_probe, &state); // scripted controls
+  } else {
+    pthread_create(&control_thread, NULL, handle_input, &state); // terminal controls
+    pthread_create(&sock_thread, NULL, run_socket, &state); // socket controls
+  }
+
+  // start mini audio, it plays silence until the first track is buffered
   ma_device_start(&device);
 
-  // wait for all threads to finish.. (if only we could allow the main thread to have coffee during this..)
-  pthread_join(decoder_thread, NULL);
+  // three slots: what plays, what comes next (prefetched) and what played
+  // last, kept open so "previous" doesn't go back to the disk. they rotate as
+  // we move through the queue, a slot only counts while its filename is
+  // still the entry it's standing in for
+  Track tracks[3] = {0};
+  Track *prev = &tracks[0];
+  Track *current = &tracks[1];
+  Track *next = &tracks[2];
+  Track *tmp;
+
+  const char *path = queue_jump(queue, 0);
+
+  while (path ){
+    if (current->filename != path) close_track(current);
+    current->filename = path;
+
+    const char *upcoming = queue_get(queue, queue_position(queue) + 1);
+    if (next->filename != upcoming) close_track(next);
+    next->filename = upcoming;
+
+    play_track(&streamCTX, current, upcoming ? next : NULL, opt);
+
+    int skip = atomic_exchange(&state.skip, 0);
+    if (!atomic_load(&state.running)) break;
+
+    // the rest of the track we left is still buffered: mark it for the
+    // callback to drop and answer the flush the skip asked for
+    if (skip ){
+      unsigned req = atomic_load(&state.flush_req);
+      audio_buffer_discard_mark(streamCTX.buf);
+      atomic_store(&state.flush_ack, req);
+      if (state.fade) crossfade_reset(state.fade);
+    }
+
+    if (skip < 0 ){
+      // at the top of the queue "previous" starts this one over
+      if (!(path = queue_prev(queue))) {
+        path = current->filename;
+        continue;
+      }
+
+      // the one we left becomes next, nothing older than it is kept
+      tmp = next; next = current; current = prev; prev = tmp;
+      close_track(prev);
+      prev->filename = NULL;
+    }
+    else {
+      if (!(path = queue_next(queue))) break;
+
+      tmp = prev; prev = current; current = next; next = tmp;
+    }
+  }
+
+  // the control threads leave once nothing is running
+  atomic_store(&state.running, 0);
   pthread_join(control_thread, NULL);
-  pthread_join(sock_thread, NULL);
+  if (!opt->latency_probe) pthread_join(sock_thread, NULL);
 
   // clean up
   ma_device_stop(&device);
   ma_device_uninit(&device);
+  if (pContext) ma_context_uninit(pContext);
   audio_buffer_destroy(streamCTX.buf);
-  pthread_mutex_destroy(&state.lock);
-  pthread_cond_destroy(&state.wait_cond);
+  eq_destroy(state.eq);
+  stretch_destroy(state.stretch);
+  crossfade_destroy(state.fade);
+  spectrum_destroy(state.spectrum);
+  shm_tap_destroy(state.tap);
+  tee_destroy(state.tee);
 
-  cleanUP(streamCTX.fmtCTX, streamCTX.codecCTX);
-  return 0;
+  for (int i = 0; i < 3; i++) close_track(&tracks[i]);
+
+  #ifndef LEGACY_LIBSWRSAMPLE
+    av_channel_layout_uninit(&inf.in_layout);
+    av_channel_layout_uninit(&inf.ch_layout);
+  #endif
+
+  if (state.latency)
+    latency_report(state.latency);
+
+  if (loudness.dirty && loudness_cache_save(&loudness) < 0) warn("loudness cache: can't write it:");
+  loudness_cache_free(&loudness);
+  avformat_network_deinit();
+  return atomic_load(&state.quit);
 }
@@ -5,41 +5,167 @@
 #include <libavcodec/avcodec.h>
 #include <libavutil/avutil.h>
 #include <libswresample/swresample.h>
+#include <stdatomic.h>
+#include <semaphore.h>
 #include "../libs/miniaudio.h"
 
+#include "command.h"
+#include "eq.h"
+#include "latency.h"
+#include "loudness.h"
+#include "network.h"
+#include "queue.h"
+#include "silence.h"
+#include "shm_tap.h"
+#include "spectrum.h"
+#include "stretch.h"
+#include "tee.h"
+#include "crossfade.h"
+
 #if LIBSWRESAMPLE_VERSION_MAJOR <= 3
   #define LEGACY_LIBSWRSAMPLE
 #endif
 
-// struct handle Playback
+// swr filter presets, only matter when the file's rate isn't the device's
+typedef enum {
+  RESAMPLE_DEFAULT,            // swr's own defaults
+  RESAMPLE_FAST,               // short filter, linear interpolation between phases
+  RESAMPLE_HIGH,               // soxr if swr was built with it, else a long swr filter
+
+} Resample_Quality;
+
+// what the command line asked for
 typedef struct {
-  int running;
-  int paused;
-  float volume;
-  uint looping;
-  pthread_mutex_t lock;
-  pthread_cond_t wait_cond;
+  uint loop;
+  int latency_probe;           // --latency: null backend + scripted commands
+  int no_limiter;              // --no-limiter: hard clip above unity gain
+  Resample_Quality resample;   // --resample=fast|default|high
+  const char *layout;          // --layout=NAME, NULL = whatever the device has
+  int stream;                  // --stream=N, which audio track (0 = first)
+  int pipeline;                // --pipeline: demux/decode/convert on their own threads
+  int prefetch_lead;           // --prefetch=N: open the next file N seconds before the end
+  int pipe_buffer;             // --pipe-buffer=KiB: read size for stdin/fifos
+  int pipe_probe;              // --pipe-probe=KiB: how much the format probe may read from them
+  int spill;                   // --spill: keep piped input in a temp file so it can seek
+  double jitter;               // --jitter=S: seconds of a network stream buffered before playing
+  int analyze;                 // --analyze: measure loudness instead of playing
+  int verify;                  // --verify: decode everything and report errors instead of playing
+  int jobs;                    // --jobs=N: threads for --analyze and --verify, 0 = every core
+  ReplayGain_Mode replaygain;  // --replaygain=track|album|off
+  int trim;                    // --trim: skip the silence at the start and end of tracks
+  Eq_Band eq[EQ_MAX_BANDS];    // --eq=type:freq:gain[:q],...
+  int eq_bands;                // 0 = no eq
+  float speed;                 // --speed=X: 0.5 to 2, pitch kept. 0 = no stretch stage
+  int mix;                     // --mix: play every file at once, layered
+  Spectrum_Mode spectrum;      // --spectrum[=bars|vu]: drawn after the progress line
+  int shm_tap;                 // --shm-tap: mirror the output into shared memory (SHM_TAP_NAME)
+  const char *tee[TEE_MAX_SINKS];  // --tee=PATH: write the output there as well, PATH.wav, |command or raw
+  int tee_count;
+  int crossfade;               // --crossfade=S: seconds consecutive tracks overlap, 0 = none
+  Crossfade_Curve crossfade_curve;
 
-} PlayBackState;
+} PlayBackOptions;
 
+// single producer (decoder) / single consumer (audio callback) ring,
+// the callback side never locks or waits
 typedef struct {
   uint8_t *pcm_data;           // Audio data storage
   int capacity;                // Total size in bytes
-  int write_pos;               // Where to write next
-  int read_pos;                // Where to read next  
-  int filled;                  // How many bytes are stored now
-  pthread_mutex_t lock;        // Protect from multiple threads
-  pthread_cond_t data_ready;   // Signal when data available
-  pthread_cond_t space_free;   // Signal when space available
+  int write_pos;               // Where to write next (decoder only)
+  int read_pos;                // Where to read next (callback only)
+  atomic_int filled;           // How many bytes are stored now
+  atomic_int writer_waiting;   // decoder is sleeping on space_free
+  atomic_int closed;           // no more reads will happen, stop writing
+  atomic_int cancel;           // a skip: stop waiting for room, this track is over
+  sem_t space_free;            // Signal when space available
+  uint64_t written;            // bytes ever written (decoder only)
+  uint64_t consumed;           // bytes ever read (callback only)
+  atomic_ullong heard;         // consumed as of the last read, a seek skip doesn't move it
+  atomic_ullong discard_until; // callback skips everything written before this
+  int headroom;                // bytes normally left free, see audio_buffer_discard_mark
+  int burst;                   // next write may use the headroom (decoder only)
 
 } Audio_Buffer;
 
+#define WAVE_BUCKETS 512         // waveform slices per track, whatever its length
+
+// peak envelope of a track for the progress bar: the lowest and highest
+// sample (of any channel) in each of WAVE_BUCKETS equal slices, full scale
+// 127. the waveform scan fills it in from the start (waveform.h)
+typedef struct {
+  int8_t min[WAVE_BUCKETS];
+  int8_t max[WAVE_BUCKETS];
+  atomic_int filled;           // buckets done from the start, the bar draws those
+
+} Waveform;
+
+// struct handle Playback
+// every thread reads these, but only the audio callback changes paused/volume
+// (by draining cmds), so nothing here needs a lock
+typedef struct PlayBackState {
+  atomic_int running;          // the whole session, not one track
+  atomic_int quit;             // user asked to stop
+  atomic_int skip;             // +1 next, -1 previous: the decoder leaves this track
+  atomic_int paused;
+  _Atomic float volume;
+  atomic_uint looping;         // 'l' flips it, the decoder reads it at the end of the track
+  Command_Queue cmds;          // keyboard/socket -> audio callback
+
+  // seeking: the callback bumps flush_req and drops whatever is buffered until
+  // the decoder has jumped and answers with flush_ack
+  atomic_int seek_offset;      // seconds, accumulated until the decoder takes it
+  atomic_uint flush_req;
+  atomic_uint flush_ack;
+
+  Latency_Stats *latency;      // only set with --latency
+  atomic_int position;         // seconds decoded so far in this track (prefetcher watches it)
+  atomic_int seekable;         // this track can seek/loop (a pipe can't without --spill)
+  Net_Buffer *net;             // the network stream playing now, NULL for files
+  Loudness_Cache *loudness;    // what --analyze measured, NULL with --replaygain=off and no --trim
+  Silence_Trim *trim;          // --trim: the track being decoded, NULL without
+  Waveform *wave;              // the playing track's envelope, NULL for pipes and urls
+  Equalizer *eq;               // --eq, runs in the decoder on what goes into the ring. NULL without
+  Stretch *stretch;            // --speed, before the eq. NULL without
+  Crossfade *fade;             // --crossfade, after the eq, the last stop before the ring. NULL without
+  Spectrum *spectrum;          // --spectrum, the callback taps what it plays into it. NULL without
+  Shm_Tap *tap;                // --shm-tap, the same for other processes. NULL without
+  Tee *tee;                    // --tee, the same into files and pipes. NULL without
+
+  // replaygain of the track being decoded, from where its data starts in the
+  // ring (Audio_Buffer.written). the callback switches once it reads past that
+  _Atomic float replaygain;
+  atomic_ullong replaygain_at;
+  Play_Queue *queue;           // the socket can add to it
+  Audio_Buffer *buf;           // a skip wakes the decoder waiting on it
+  atomic_ullong skip_stamp;    // when the last skip was asked for (now_ns)
+
+  // --mix: the session's state lists the layers' own, the keys act on the
+  // picked one. a layer keeps quiet, the mixer draws one line for all of them
+  struct PlayBackState **layers;
+  int layer_count;
+  atomic_int layer;
+  int quiet;
+  atomic_int decode_errors;    // packets of the last track that failed, a quiet one's owner reports them
+
+} PlayBackState;
+
 // struct for base information of audio file (codec)
+// in_* is what the decoder hands us, the rest is what the device runs at
+// natively (and what the ring carries). one swr pass goes from one to the other.
 typedef struct {
   int audioStream;
+  enum AVSampleFormat in_fmt;
+  int in_rate;
+  int in_ch;
+  #ifdef LEGACY_LIBSWRSAMPLE
+    int64_t in_layout;
+  #else
+    AVChannelLayout in_layout;
+  #endif
+
   int ch;
   #ifdef LEGACY_LIBSWRSAMPLE
-    int ch_layout;
+    int64_t ch_layout;
   #else
     AVChannelLayout ch_layout;
   #endif
@@ -47,9 +173,38 @@ typedef struct {
   enum AVSampleFormat sample_fmt;
   int sample_fmt_bytes;
   ma_format ma_fmt;
+  ma_format device_fmt;        // differs from ma_fmt only for s24 devices
+  Resample_Quality resample;
 
 } Audio_Info;
 
+// a file opened and probed, ready to play. the prefetcher fills one for the
+// next track while the current one plays, the one played last stays open for
+// "previous"
+typedef struct {
+  const char *filename;
+  AVFormatContext *fmtCTX;     // NULL until opened
+  AVCodecContext *codecCTX;
+  AVIOContext *pb;             // our reader for stdin/fifos, NULL for files
+  AVIOInterruptCB interrupt;   // urls: lets a skip or quit cut a stalled read short
+  Audio_Info inf;              // input side only, the output side is the session's
+  int audio_tracks;            // audio streams in the file
+  int played;                  // decoded from already, rewind before playing it again
+  char error[128];             // why open_track failed
+
+} Track;
+
+// owned by the audio callback, nobody else touches it
+typedef struct {
+  int paused;                  // what the last period actually played
+  int fade_frames;             // length of the pause/resume ramps
+  float gain;                  // gain the last block ended on, ramps start here
+  int soft_limit;              // bend peaks instead of clipping when gain > 1
+  float replaygain;            // of the track the ring is playing out now
+  uint64_t flush_stamp;        // seek/skip waiting for its first new sample
+  Command_Type flush_cmd;      // which one it was
+
+} Output_State;
 
 // struct for point context used in another functions (needed)
 typedef struct {
@@ -57,10 +212,21 @@ typedef struct {
   Audio_Info *inf;
   AVFormatContext *fmtCTX;
   AVCodecContext *codecCTX;
+  SwrContext *swrCTX;          // decoder only, NULL if nothing to convert
   PlayBackState *state;
+  Output_State out;
 
 } StreamContext;
 
-int playback_run(const char *filename, uint loop);
+int audio_buffer_read(Audio_Buffer *buf, uint8_t *output, int bytes_needed);
+void audio_buffer_skip(Audio_Buffer *buf);
+void audio_buffer_close(Audio_Buffer *buf);
+void audio_buffer_cancel(Audio_Buffer *buf);
+
+void *run_decoder(void *arg);
+
+int open_track(Track *track, const PlayBackOptions *opt);
+void close_track(Track *track);
+int playback_run(Play_Queue *queue, const PlayBackOptions *opt);
 
 #endif
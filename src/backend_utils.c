@@ -1,49 +1,244 @@
+#include <sys/resource.h>
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+#include <libswresample/swresample.h>
 #include "../libs/miniaudio.h"
 
 #include "backend.h"
 #include "backend_utils.h"
+#include "command.h"
+#include "interleave.h"
+#include "utils.h"
+#include "waveform.h"
 
-// function take from planar_value to get interleaved_value
-enum AVSampleFormat get_interleaved(enum AVSampleFormat value)
+// function take from the device's ma_format the sample format swr should produce
+enum AVSampleFormat get_av_format(ma_format value)
 {
   switch (value){
-    case AV_SAMPLE_FMT_DBLP: return AV_SAMPLE_FMT_DBL;
-    case AV_SAMPLE_FMT_FLTP: return AV_SAMPLE_FMT_FLT;
-    case AV_SAMPLE_FMT_S64P: return AV_SAMPLE_FMT_S64;
-    case AV_SAMPLE_FMT_S32P: return AV_SAMPLE_FMT_S32;
-    case AV_SAMPLE_FMT_S16P: return AV_SAMPLE_FMT_S16;
-    case AV_SAMPLE_FMT_U8P: return AV_SAMPLE_FMT_U8;
-    default: return AV_SAMPLE_FMT_S16; // fallback
+    case ma_format_f32: return AV_SAMPLE_FMT_FLT;
+    case ma_format_s32: return AV_SAMPLE_FMT_S32;
+    case ma_format_s16: return AV_SAMPLE_FMT_S16;
+    case ma_format_u8: return AV_SAMPLE_FMT_U8;
+    default: return AV_SAMPLE_FMT_NONE; // packed s24 has no ffmpeg equivalent
   }
 }
 
-// function take from interleaved_value get mini audio format
-ma_format get_ma_format(enum AVSampleFormat value)
+// channel count of a layout name ("stereo", "5.1", "7.1(wide)"...), -1 if
+// ffmpeg doesn't know it
+int layout_channels(const char *name)
 {
-  switch (value){
-    case AV_SAMPLE_FMT_DBL: return ma_format_f32;
-    case AV_SAMPLE_FMT_FLT: return ma_format_f32;
-    case AV_SAMPLE_FMT_S64: return ma_format_s32;
-    case AV_SAMPLE_FMT_S32: return ma_format_s32;
-    case AV_SAMPLE_FMT_S16: return ma_format_s16;
-    case AV_SAMPLE_FMT_U8: return ma_format_u8;
-    default: return ma_format_s16; // fallback
+  #ifdef LEGACY_LIBSWRSAMPLE
+    uint64_t layout = av_get_channel_layout(name);
+    return layout ? av_get_channel_layout_nb_channels(layout) : -1;
+  #else
+    AVChannelLayout layout;
+    if (av_channel_layout_from_string(&layout, name) < 0) return -1;
+
+    int ch = layout.nb_channels;
+    av_channel_layout_uninit(&layout);
+    return ch;
+  #endif
+}
+
+// take the output side of inf from what the device ended up running at,
+// `layout` (may be NULL) names the channel order when the default isn't it
+void set_output_format(Audio_Info *inf, ma_device *device, const char *layout)
+{
+  inf->ma_fmt = device->playback.format;
+  inf->device_fmt = device->playback.internalFormat;
+  inf->ch = device->playback.channels;
+  inf->sample_rate = device->sampleRate;
+  inf->sample_fmt = get_av_format(inf->ma_fmt);
+  inf->sample_fmt_bytes = av_get_bytes_per_sample(inf->sample_fmt);
+
+  #ifdef LEGACY_LIBSWRSAMPLE
+    inf->ch_layout = layout ? av_get_channel_layout(layout) : 0;
+    if (av_get_channel_layout_nb_channels(inf->ch_layout) != inf->ch)
+      inf->ch_layout = av_get_default_channel_layout(inf->ch);
+  #else
+    if (!layout || av_channel_layout_from_string(&inf->ch_layout, layout) < 0 || inf->ch_layout.nb_channels != inf->ch ){
+      av_channel_layout_uninit(&inf->ch_layout);
+      av_channel_layout_default(&inf->ch_layout, inf->ch);
+    }
+  #endif
+}
+
+// take the input side of inf from a track, the output side stays what the
+// device runs at
+void set_input_format(Audio_Info *inf, const Audio_Info *track)
+{
+  inf->audioStream = track->audioStream;
+  inf->in_fmt = track->in_fmt;
+  inf->in_rate = track->in_rate;
+  inf->in_ch = track->in_ch;
+
+  #ifdef LEGACY_LIBSWRSAMPLE
+    inf->in_layout = track->in_layout;
+  #else
+    av_channel_layout_copy(&inf->in_layout, &track->in_layout);
+  #endif
+}
+
+static void describe_layout(Audio_Info *inf, int input, char *buf, int size)
+{
+  #ifdef LEGACY_LIBSWRSAMPLE
+    if (input) av_get_channel_layout_string(buf, size, inf->in_ch, inf->in_layout);
+    else av_get_channel_layout_string(buf, size, inf->ch, inf->ch_layout);
+  #else
+    av_channel_layout_describe(input ? &inf->in_layout : &inf->ch_layout, buf, size);
+  #endif
+}
+
+const char *resample_quality_name(Resample_Quality quality)
+{
+  switch (quality){
+    case RESAMPLE_FAST: return "fast";
+    case RESAMPLE_HIGH: return "high";
+    default: return "default";
+  }
+}
+
+// said once a run, not for every track that opens a context
+static atomic_flag soxr_warned = ATOMIC_FLAG_INIT;
+
+// apply the preset and init the context, returns what swr_init() returned
+int resample_init(SwrContext *swrCTX, Resample_Quality quality)
+{
+  switch (quality){
+    case RESAMPLE_FAST:
+      av_opt_set_int(swrCTX, "filter_size", 8, 0);
+      av_opt_set_int(swrCTX, "phase_shift", 6, 0);
+      av_opt_set_int(swrCTX, "linear_interp", 1, 0);
+      break;
+
+    case RESAMPLE_HIGH:
+      av_opt_set_int(swrCTX, "resampler", SWR_ENGINE_SOXR, 0);
+      if (swr_init(swrCTX) >= 0) return 0;
+
+      // no soxr in this build, get close with a longer filter instead
+      if (!atomic_flag_test_and_set(&soxr_warned))
+        warn("swr: built without soxr, using a long swr filter for --resample=high");
+      av_opt_set_int(swrCTX, "resampler", SWR_ENGINE_SWR, 0);
+      av_opt_set_int(swrCTX, "filter_size", 64, 0);
+      av_opt_set_int(swrCTX, "phase_shift", 12, 0);
+      av_opt_set_double(swrCTX, "cutoff", 0.97, 0);
+      break;
+
+    default:
+      break;
+  }
+
+  return swr_init(swrCTX);
+}
+
+int same_layout(Audio_Info *inf)
+{
+  #ifdef LEGACY_LIBSWRSAMPLE
+    return inf->in_ch == inf->ch;
+  #else
+    return inf->in_ch == inf->ch && !av_channel_layout_compare(&inf->in_layout, &inf->ch_layout);
+  #endif
+}
+
+// planar input where interleaving is the only thing left to do
+int interleave_only(Audio_Info *inf)
+{
+  return av_sample_fmt_is_planar(inf->in_fmt) &&
+    av_get_packed_sample_fmt(inf->in_fmt) == inf->sample_fmt &&
+    inf->in_rate == inf->sample_rate && same_layout(inf);
+}
+
+// one line saying what happens between the decoder and the speaker
+void print_pipeline(Audio_Info *inf)
+{
+  printf("%dHz, %dch, %s -> %dHz, %dch, %s",
+    inf->in_rate, inf->in_ch, av_get_sample_fmt_name(inf->in_fmt),
+    inf->sample_rate, inf->ch, av_get_sample_fmt_name(inf->sample_fmt)
+  );
+
+  if (inf->in_rate != inf->sample_rate) printf(" [resample: %s]", resample_quality_name(inf->resample));
+  if (!same_layout(inf)){
+    char in[64], out[64];
+    describe_layout(inf, 1, in, sizeof(in));
+    describe_layout(inf, 0, out, sizeof(out));
+    printf(" [%s %s -> %s]", inf->in_ch > inf->ch ? "downmix" : "remix", in, out);
   }
+
+  if (av_get_packed_sample_fmt(inf->in_fmt) != inf->sample_fmt) printf(" [convert]");
+  else if (interleave_only(inf)) printf(" [interleave: %s, no swr]", interleave_kernel_name());
+  else if (av_sample_fmt_is_planar(inf->in_fmt)) printf(" [interleave]");
+
+  if (inf->in_rate == inf->sample_rate && same_layout(inf) && inf->in_fmt == inf->sample_fmt)
+    printf(" [direct]");
+
+  if (inf->device_fmt != inf->ma_fmt)
+    printf(" (device is %s, miniaudio packs it)", ma_get_format_name(inf->device_fmt));
+
+  printf("\n");
 }
 
-// fn to search correct stream you want
-int get_stream(AVFormatContext *fmtCTX, int type, int value)
+// packed float in the file's own rate and layout, what --analyze and the
+// waveform scan read
+SwrContext *init_float(Audio_Info *inf)
+{
+  SwrContext *swrCTX = NULL;
+
+  #ifdef LEGACY_LIBSWRSAMPLE
+    swrCTX = swr_alloc_set_opts(swrCTX,
+      inf->in_layout, AV_SAMPLE_FMT_FLT, inf->in_rate,
+      inf->in_layout, inf->in_fmt, inf->in_rate,
+      0, NULL
+    );
+  #else
+    swr_alloc_set_opts2(&swrCTX,
+      &inf->in_layout, AV_SAMPLE_FMT_FLT, inf->in_rate,
+      &inf->in_layout, inf->in_fmt, inf->in_rate,
+      0, NULL
+    );
+  #endif
+
+  if (swrCTX && swr_init(swrCTX) < 0) swr_free(&swrCTX);
+  return swrCTX;
+}
+
+// fn to search correct stream you want: index of the nth stream of that
+// type, -1 if there aren't that many
+int get_stream(AVFormatContext *fmtCTX, int type, int nth)
 {
   for (int i = 0; i < fmtCTX->nb_streams; i++){
     AVStream *stream = fmtCTX->streams[i];
-    if (stream->codecpar->codec_type == type ){
-      value = i;
-      break;
-    }
+    if (stream->codecpar->codec_type == type && nth-- == 0 )
+      return i;
   }
-  return value;
+  return -1;
+}
+
+int count_streams(AVFormatContext *fmtCTX, int type)
+{
+  int count = 0;
+  for (int i = 0; i < fmtCTX->nb_streams; i++)
+    if (fmtCTX->streams[i]->codecpar->codec_type == type) count++;
+  return count;
+}
+
+// length in whole seconds, 0 when the container doesn't know (pipes)
+int duration_seconds(AVFormatContext *fmtCTX)
+{
+  return fmtCTX->duration > 0 ? fmtCTX->duration / AV_TIME_BASE : 0;
+}
+
+// bytes the demuxer pulled in and CPU the whole process used, to see what
+// the other streams in a container cost us
+void print_io_cost(AVFormatContext *fmtCTX)
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+
+  double cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+
+  printf("io: %.2f MiB read, %.2fs CPU\n",
+    fmtCTX->pb ? fmtCTX->pb->bytes_read / (1024.0 * 1024.0) : 0.0, cpu);
 }
 
 
@@ -55,11 +250,18 @@ Audio_Buffer *audio_buffer_init(int capacity)
   buf->capacity = capacity;
   buf->write_pos = 0;     // Start writing at beginning
   buf->read_pos = 0;      // Start reading from beginning
-  buf->filled = 0;        // Buffer starts empty
+  atomic_init(&buf->filled, 0); // Buffer starts empty
+  atomic_init(&buf->writer_waiting, 0);
+  atomic_init(&buf->closed, 0);
+  atomic_init(&buf->cancel, 0);
+  buf->written = 0;
+  buf->consumed = 0;
+  atomic_init(&buf->heard, 0);
+  atomic_init(&buf->discard_until, 0);
+  buf->headroom = capacity / 4;
+  buf->burst = 0;
 
-  pthread_mutex_init(&buf->lock, NULL);
-  pthread_cond_init(&buf->data_ready, NULL);
-  pthread_cond_init(&buf->space_free, NULL);
+  sem_init(&buf->space_free, 0, 0);
   return buf;
 }
 
@@ -67,22 +269,34 @@ void audio_buffer_destroy(Audio_Buffer *buf)
 {
   if (buf ){
     free(buf->pcm_data);
-    pthread_mutex_destroy(&buf->lock);
-    pthread_cond_destroy(&buf->data_ready);
-    pthread_cond_destroy(&buf->space_free);
+    sem_destroy(&buf->space_free);
     free (buf);
   }
 }
 
 void init_playbackstatus(PlayBackState *state, uint loop)
 {
-  state->running = 1;
-  state->paused = 0;
-  state->volume = 1.00f;
+  atomic_init(&state->running, 1);
+  atomic_init(&state->quit, 0);
+  atomic_init(&state->skip, 0);
+  atomic_init(&state->paused, 0);
+  atomic_init(&state->volume, 1.00f);
   state->looping = loop;
+  atomic_init(&state->seek_offset, 0);
+  atomic_init(&state->flush_req, 0);
+  atomic_init(&state->flush_ack, 0);
+  state->latency = NULL;
+  state->buf = NULL;
+  atomic_init(&state->skip_stamp, 0);
+  atomic_init(&state->position, 0);
+  atomic_init(&state->seekable, 1);
+  state->net = NULL;
+  state->loudness = NULL;
+  atomic_init(&state->replaygain, 1.0f);
+  atomic_init(&state->replaygain_at, 0);
+  atomic_init(&state->decode_errors, 0);
 
-  pthread_mutex_init(&state->lock, NULL);
-  pthread_cond_init(&state->wait_cond, NULL);
+  command_queue_init(&state->cmds);
 }
 
 void print_metadata(AVDictionary *metadata) {
@@ -94,16 +308,61 @@ void print_metadata(AVDictionary *metadata) {
   }
 }
 
+// after the volume: the speed, the spectrum, and for network streams how
+// much is buffered or that we're waiting for it
+static void progress_tail(PlayBackState *state)
+{
+  Net_Buffer *net = state->net;
+
+  // --speed: the times are the file's, this is how fast they go by
+  if (state->stretch) printf(" | %.1fx", atomic_load(&state->stretch->speed));
+
+  // --spectrum: whatever its thread had last, this line is what redraws it
+  if (state->spectrum ){
+    char view[160];
+    spectrum_draw(state->spectrum, view, sizeof(view));
+    printf(" | %s", view);
+  }
+  if (!net) return;
+
+  if (atomic_load(&net->buffering))
+    printf(" | buffering");
+  else
+    printf(" | buf %.1fs", atomic_load(&net->buffered_us) / 1e6);
+
+  int rebuffers = atomic_load(&net->rebuffers);
+  if (rebuffers) printf(" (%d rebuffers)", rebuffers);
+}
+
 void progress(PlayBackState *state, double current_time, int duration_time)
 {
   int bar_width = 30;
+  atomic_store(&state->position, (int)current_time);
+  if (state->quiet) return;
+
+  // a pipe or a live stream: no length to draw the bar against
+  if (duration_time <= 0 ){
+    printf("\033[2K\r%d:%02d:%02d | v: %.0f%%",
+      get_hour(current_time), get_min(current_time), get_sec(current_time),
+      atomic_load(&state->volume) * 100.0f
+    );
+    progress_tail(state);
+    fflush(stdout);
+    return;
+  }
 
   int pos = (current_time / duration_time) * bar_width;
   printf("\033[2K"); // clear the line before writing, if this causes flickering, do it manually (using spaces)
   printf("\r[");
   for (int i = 0; i < bar_width; i++){
+    // the waveform where it's scanned already: played part as is, where we
+    // are inverted, what's left dimmed
+    const char *block = state->wave ? wave_block(state->wave, i, bar_width) : NULL;
+
+    if (block)
+      printf("%s%s\033[0m", i < pos ? "" : i == pos ? "\033[7m" : "\033[2m", block);
 
-    if (i < pos)
+    else if (i < pos)
       printf("=");
 
     else if (i == pos)
@@ -116,8 +375,9 @@ void progress(PlayBackState *state, double current_time, int duration_time)
     printf("] %d:%02d:%02d / %d:%02d:%02d (%.00f%%) | v: %.0f%%",
     get_hour(current_time), get_min(current_time), get_sec(current_time), 
     get_hour(duration_time), get_min(duration_time), get_sec(duration_time),
-    (current_time / duration_time) * 100.0, state->volume * 100.0f
+    (current_time / duration_time) * 100.0, atomic_load(&state->volume) * 100.0f
   );
 
+  progress_tail(state);
   fflush(stdout);
 }
@@ -8,10 +8,21 @@
 
 #include "backend.h"
 
-enum AVSampleFormat get_interleaved(enum AVSampleFormat value);
-ma_format get_ma_format(enum AVSampleFormat value);
-
-int get_stream(AVFormatContext *fmtCTX, int type, int value);
+enum AVSampleFormat get_av_format(ma_format value);
+int layout_channels(const char *name);
+void set_output_format(Audio_Info *inf, ma_device *device, const char *layout);
+void set_input_format(Audio_Info *inf, const Audio_Info *track);
+const char *resample_quality_name(Resample_Quality quality);
+int resample_init(SwrContext *swrCTX, Resample_Quality quality);
+int same_layout(Audio_Info *inf);
+int interleave_only(Audio_Info *inf);
+void print_pipeline(Audio_Info *inf);
+SwrContext *init_float(Audio_Info *inf);
+
+int get_stream(AVFormatContext *fmtCTX, int type, int nth);
+int count_streams(AVFormatContext *fmtCTX, int type);
+int duration_seconds(AVFormatContext *fmtCTX);
+void print_io_cost(AVFormatContext *fmtCTX);
 
 Audio_Buffer *audio_buffer_init(int capacity);
 void audio_buffer_destroy(Audio_Buffer *buf);
@@ -0,0 +1,54 @@
+#include <stdatomic.h>
+
+#include "command.h"
+
+void command_queue_init(Command_Queue *q)
+{
+  for (unsigned i = 0; i < CMD_QUEUE_SIZE; i++)
+    atomic_init(&q->slots[i].seq, i);
+
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+}
+
+// returns 0 when the queue is full (command dropped), never blocks
+int command_push(Command_Queue *q, Command cmd)
+{
+  unsigned pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+  for (;;) {
+    unsigned seq = atomic_load_explicit(&q->slots[pos & (CMD_QUEUE_SIZE - 1)].seq, memory_order_acquire);
+    int diff = (int)(seq - pos);
+
+    if (diff == 0) {
+      // slot is free, try to claim it before another producer does
+      if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+            memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+    else if (diff < 0)
+      return 0;
+
+    else
+      pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  }
+
+  q->slots[pos & (CMD_QUEUE_SIZE - 1)].cmd = cmd;
+  atomic_store_explicit(&q->slots[pos & (CMD_QUEUE_SIZE - 1)].seq, pos + 1, memory_order_release);
+  return 1;
+}
+
+// returns 0 when there's nothing to pop, safe to call from the audio callback
+int command_pop(Command_Queue *q, Command *cmd)
+{
+  unsigned pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+  unsigned seq = atomic_load_explicit(&q->slots[pos & (CMD_QUEUE_SIZE - 1)].seq, memory_order_acquire);
+
+  // the producer that claimed this slot hasn't finished writing yet (or it's empty)
+  if ((int)(seq - (pos + 1)) < 0) return 0;
+
+  *cmd = q->slots[pos & (CMD_QUEUE_SIZE - 1)].cmd;
+  atomic_store_explicit(&q->slots[pos & (CMD_QUEUE_SIZE - 1)].seq, pos + CMD_QUEUE_SIZE, memory_order_release);
+  atomic_store_explicit(&q->head, pos + 1, memory_order_relaxed);
+  return 1;
+}
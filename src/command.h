@@ -0,0 +1,48 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// must be a power of two
+#define CMD_QUEUE_SIZE 64
+
+typedef enum {
+  CMD_NONE = 0,
+  CMD_TOGGLE,
+  CMD_PAUSE,
+  CMD_RESUME,
+  CMD_VOLUME_UP,
+  CMD_VOLUME_DOWN,
+  CMD_SEEK,
+  CMD_NEXT,
+  CMD_PREV,
+  CMD_COUNT,
+
+} Command_Type;
+
+typedef struct {
+  Command_Type type;
+  int arg;                     // CMD_SEEK: seconds, relative
+  uint64_t stamp;              // when it was sent (now_ns), for latency stats
+
+} Command;
+
+// bounded lock-free queue, many producers (keyboard, socket) and a single
+// consumer (the audio callback). every slot carries a sequence number so a
+// producer knows when the slot is free and the consumer knows when it's written.
+typedef struct {
+  struct {
+    atomic_uint seq;
+    Command cmd;
+  } slots[CMD_QUEUE_SIZE];
+  atomic_uint head;            // next slot to pop (consumer only)
+  atomic_uint tail;            // next slot to push (shared by producers)
+
+} Command_Queue;
+
+void command_queue_init(Command_Queue *q);
+int command_push(Command_Queue *q, Command cmd);
+int command_pop(Command_Queue *q, Command *cmd);
+
+#endif
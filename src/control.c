@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <sys/poll.h>
 #include <termios.h>
@@ -11,15 +12,41 @@
 #include <poll.h>
 
 #include "backend.h"
+#include "command.h"
 #include "control.h"
+#include "latency.h"
 #include "utils.h"
 
 void help(){
   printf(
-    "Usage: tomu [COMMAND] [PATH]\n"
+    "Usage: tomu [COMMAND] [PATH]...\n"
     " Commands:\n\n"
 
     "   --loop            : loop same sound\n"
+    "   --latency         : measure control latency on the null backend\n"
+    "   --no-limiter      : clip instead of soft limiting when volume is above 100%%\n"
+    "   --pipeline        : demux, decode and convert on separate threads (slow storage/network)\n"
+    "   --prefetch=N      : open the next file N seconds before the current one ends (default 15)\n"
+    "   --resample=Q      : resampling quality when the device rate differs: fast, default, high\n"
+    "   --layout=NAME     : output channel layout (stereo, mono, 5.1...), default is the device's\n"
+    "   --stream=N        : play the Nth audio track of the file (0 = first)\n"
+    "   --pipe-buffer=KIB : read size for stdin and named pipes (default 64)\n"
+    "   --pipe-probe=KIB  : how much of a pipe the format probe may read (default 64)\n"
+    "   --spill           : keep piped input in a temp file so it can seek and loop\n"
+    "   --jitter=S        : seconds of a network stream to buffer before playing (default 2)\n"
+    "   --analyze         : measure loudness (EBU R128) and true peak of the files, no playback\n"
+    "   --verify          : decode the files end to end and report broken ones as json, no playback\n"
+    "   --jobs=N          : threads for --analyze and --verify (default: every core)\n"
+    "   --replaygain=MODE : track, album (a directory) or off. measured values, else tags\n"
+    "   --trim            : skip the silence at the start and end of tracks (below -70 dBFS)\n"
+    "   --eq=BANDS        : parametric eq, type:freq:gain[:q] bands separated by ','\n"
+    "                       type is low or high (shelves) or peak, e.g. low:100:3,peak:3000:-2:1.4\n"
+    "   --speed=X         : play at X times the speed (0.5 to 2) without changing the pitch\n"
+    "   --crossfade=S     : overlap consecutive tracks by S seconds (up to 15), :linear or :equal (power, default)\n"
+    "   --mix             : play every file at once, layered (up to 9), each with its own volume/pause/loop\n"
+    "   --spectrum[=vu]   : a spectrum (or a level meter) after the progress bar\n"
+    "   --shm-tap         : mirror what plays into shared memory (/dev/shm/tomu-pcm) for other programs\n"
+    "   --tee=PATH        : write what plays to PATH too: a .wav, a fifo/raw file or |command (wav on stdin), up to 4\n"
     "   --version         : show version of program\n"
     "   --help            : show help message\n"
 
@@ -28,7 +55,17 @@ void help(){
     " q = quit\n"
     " ↑ = increase volume\n"
     " ↓ = decrease volume\n"
-
+    " → = seek forward 5s\n"
+    " ← = seek backward 5s\n"
+    " n = next track\n"
+    " p = previous track\n"
+    " e = eq on/off\n"
+    " [ ] = slower / faster (with --speed)\n"
+    " l = loop on/off\n"
+    " 1-9 = the layer the keys act on (with --mix)\n"
+
+    "\nPATH can be a file, a directory (played shuffled), a .m3u/.m3u8/.pls playlist,\n"
+    "a named pipe or - for stdin (compressed audio or wav, e.g. ffmpeg -i X -f wav - | tomu -)\n"
     "\nExample: tomu loop [FILE.mp3]\n"
   );
 }
@@ -42,6 +79,14 @@ static const struct keybinding keybindings[] = {
     {"q"     ,       playback_stop},
     {"\x1b[A",       volume_increase}, // Up
     {"\x1b[B",     	 volume_decrease}, // Down
+    {"\x1b[C",       seek_forward},    // Right
+    {"\x1b[D",       seek_backward},   // Left
+    {"n"     ,       track_next},
+    {"p"     ,       track_prev},
+    {"e"     ,       eq_toggle},
+    {"]"     ,       speed_up},
+    {"["     ,       speed_down},
+    {"l"     ,       loop_toggle},
 };
 
 static const int kbds_len = sizeof(keybindings) / sizeof(struct keybinding);
@@ -51,6 +96,10 @@ static const int kbds_len = sizeof(keybindings) / sizeof(struct keybinding);
 void *handle_input(void *arg){
   PlayBackState *state = (PlayBackState*)arg;
 
+  // no terminal to read keys from: stdin is a file, /dev/null or the audio
+  // itself (tomu -). the socket still works
+  if (!isatty(STDIN_FILENO)) return NULL;
+
   struct termios old, raw;
 
   tcgetattr(STDIN_FILENO, &old);
@@ -68,11 +117,11 @@ void *handle_input(void *arg){
     .events = POLLIN
   };
 
-  while (state->running){
+  while (atomic_load(&state->running)){
     // wait 80ms for input
     int ret = poll(&pfd, 1, 80);
 
-    if (!state->running) break;
+    if (!atomic_load(&state->running)) break;
 
     if (ret > 0 && (pfd.revents & POLLIN)) {
         char key_buf[4] = {0}; // for escape sequences
@@ -94,14 +143,22 @@ void *handle_input(void *arg){
             if (ret == 1 && (pfd.revents & POLLIN)) read(STDIN_FILENO, key_buf + 1, sizeof(key_buf) - 1); // read into key_buf[1] and forward
         }
 
+        // --mix: a digit picks the layer, the rest goes to that one (but
+        // quitting quits them all)
+        if (state->layers && key_buf[0] >= '1' && key_buf[0] < '1' + state->layer_count && !key_buf[1])
+            atomic_store(&state->layer, key_buf[0] - '1');
+
+        PlayBackState *target = state->layers ? state->layers[atomic_load(&state->layer)] : state;
+
         // now we just find the proper keybinding..
         // a hashmap should be used here but allocating mem here is overkill
         for (uint i = 0; i < kbds_len; i++) {
-            if (strcmp(key_buf, keybindings[i].key) == 0) keybindings[i].handler(state); 
+            if (strcmp(key_buf, keybindings[i].key) == 0)
+                keybindings[i].handler(keybindings[i].handler == playback_stop ? state : target);
 
         }
 
-        if (!state->running) break; // leave if there's nothing playing
+        if (!atomic_load(&state->running)) break; // leave if there's nothing playing
     }
 
     else if (ret == 0) {
@@ -120,35 +177,32 @@ void *handle_input(void *arg){
 }
 
 // functions for playback
+// these only queue the action, the audio callback applies it at the start of
+// its next period (see playback_apply), so none of them touch the state directly
+static void playback_send(PlayBackState *state, Command_Type type, int arg){
+  Command cmd = { .type = type, .arg = arg, .stamp = now_ns() };
+  command_push(&state->cmds, cmd);
+}
+
 // fn toggle pause/resume
 inline void playback_toggle(PlayBackState *state) {
-    if (state->paused)
-        playback_resume(state);
-    else 
-        playback_pause(state);
+  playback_send(state, CMD_TOGGLE, 0);
 }
 
 // use playback_toggle unless you have a good reason to use this
 inline void playback_pause(PlayBackState *state){
-  pthread_mutex_lock(&state->lock);
-    state->paused = 1;
-  pthread_mutex_unlock(&state->lock);
+  playback_send(state, CMD_PAUSE, 0);
 }
 
 // use playback_toggle unless you have a good reason to use this
 inline void playback_resume(PlayBackState *state){
-  pthread_mutex_lock(&state->lock);
-    state->paused = 0;
-    pthread_cond_broadcast(&state->wait_cond);
-  pthread_mutex_unlock(&state->lock);
+  playback_send(state, CMD_RESUME, 0);
 }
 
+// stopping isn't tied to a sample position, every thread polls running
 inline void playback_stop(PlayBackState *state){
-  pthread_mutex_lock(&state->lock);
-    state->paused = 0;
-    state->running = 0;
-    pthread_cond_broadcast(&state->wait_cond);
-  pthread_mutex_unlock(&state->lock);
+  atomic_store(&state->quit, 1);
+  atomic_store(&state->running, 0);
 }
 // =================================================================
 
@@ -156,58 +210,124 @@ inline void playback_stop(PlayBackState *state){
 // functions for handle a volume of playback audio
 // fn change value of a control volume
 inline void volume_increase(PlayBackState *state){
-  pthread_mutex_lock(&state->lock);
-    state->volume += 0.02f;
-    if (state->volume > 1.26f) state->volume = 1.26f;
-  pthread_mutex_unlock(&state->lock);
+  playback_send(state, CMD_VOLUME_UP, 0);
 }
 
 inline void volume_decrease(PlayBackState *state){
-  pthread_mutex_lock(&state->lock);
-    state->volume -= 0.02f;
-    if (state->volume < 0.00f) state->volume = 0.00f;
-  pthread_mutex_unlock(&state->lock);
+  playback_send(state, CMD_VOLUME_DOWN, 0);
+}
+
+// --speed, read by the decoder every segment. nothing to change without it
+static void speed_change(PlayBackState *state, float by){
+  if (!state->stretch) return;
+
+  float speed = atomic_load(&state->stretch->speed) + by;
+  if (speed < STRETCH_MIN) speed = STRETCH_MIN;
+  if (speed > STRETCH_MAX) speed = STRETCH_MAX;
+  atomic_store(&state->stretch->speed, roundf(speed * 10) / 10);
+}
+
+inline void speed_up(PlayBackState *state){
+  speed_change(state, STRETCH_STEP);
+}
+
+inline void speed_down(PlayBackState *state){
+  speed_change(state, -STRETCH_STEP);
+}
+
+// not a command: the eq lives in the decoder, which fades to whatever this
+// says by the next block it writes
+inline void eq_toggle(PlayBackState *state){
+  if (state->eq) atomic_fetch_xor(&state->eq->enabled, 1);
+}
+
+// the decoder looks at it when the track ends, nothing to time either
+inline void loop_toggle(PlayBackState *state){
+  atomic_fetch_xor(&state->looping, 1);
 }
 // ===================================================================
 
-void shuffle(const char *path, uint loop){
-  DIR *dir = opendir(path);
-  struct dirent *entry;
-  int count = 0;
-  srand(time(NULL));
 
-  if (!dir ) goto free;
-  
-  while ((entry = readdir(dir)) != NULL ){
-    if (strcmp(".", entry->d_name) == 0 || strcmp("..", entry->d_name) == 0) 
-      continue;
+// functions for seeking, the decoder does the actual jump
+// nothing to jump in on a pipe, don't even flush what's buffered
+inline void playback_seek(PlayBackState *state, int seconds){
+  if (!atomic_load(&state->seekable)) return;
+  playback_send(state, CMD_SEEK, seconds);
+}
 
-    count++;
-  }
+inline void seek_forward(PlayBackState *state){
+  playback_seek(state, 5);
+}
 
-  if (count == 0) goto free;
+inline void seek_backward(PlayBackState *state){
+  playback_seek(state, -5);
+}
+// ===================================================================
 
-  int index_rand = rand() % count;
-  rewinddir(dir);
 
-  for (int i = 0; i <= index_rand;){
-    entry = readdir(dir);
-    if (strcmp(".", entry->d_name) == 0 || strcmp("..", entry->d_name) == 0) continue;
-    if (i == index_rand){
-      char filename[512];
-      snprintf(filename, sizeof(filename), "%s/%s", path, entry->d_name);
-      playback_run(filename, loop);
-      break;
-    }
-    i++;
-  }
+// functions for moving through the queue
+// unlike the rest these don't wait for the callback: a skip is a flush the
+// decoder answers from another track, and the sooner it hears about it the
+// more likely the new track is buffered before the next period. skip goes
+// before the flush so whoever sees the flush also sees why
+static void playback_skip(PlayBackState *state, Command_Type type){
+  atomic_store(&state->skip_stamp, now_ns());
+  atomic_store(&state->skip, type == CMD_NEXT ? 1 : -1);
+  atomic_fetch_add(&state->flush_req, 1);
+  if (state->buf) audio_buffer_cancel(state->buf);
 
-  // find a better control flow.. you're running the die function on end.
-  // also who the fuck uses two space indentation? it should be four!!!!
-  closedir(dir); 
-  return;
+  playback_send(state, type, 0);
+}
+
+inline void track_next(PlayBackState *state){
+  playback_skip(state, CMD_NEXT);
+}
+
+inline void track_prev(PlayBackState *state){
+  playback_skip(state, CMD_PREV);
+}
+// ===================================================================
 
-free:
-  closedir(dir);
-  die("FILE: %s",strerror(errno));
+// called from the audio callback: drain the queue and apply every command.
+// the callback is the only writer of paused/volume so plain stores are enough.
+// applied[type] gets the send time of the last command of each type.
+void playback_apply(PlayBackState *state, uint64_t *applied){
+  Command cmd;
+
+  while (command_pop(&state->cmds, &cmd)) {
+    float volume = atomic_load_explicit(&state->volume, memory_order_relaxed);
+    applied[cmd.type] = cmd.stamp;
+
+    switch (cmd.type) {
+      case CMD_TOGGLE:
+        atomic_store(&state->paused, !atomic_load(&state->paused));
+        break;
+      case CMD_PAUSE:
+        atomic_store(&state->paused, 1);
+        break;
+      case CMD_RESUME:
+        atomic_store(&state->paused, 0);
+        break;
+      case CMD_VOLUME_UP:
+        volume += 0.02f;
+        if (volume > 1.26f) volume = 1.26f;
+        atomic_store(&state->volume, volume);
+        break;
+      case CMD_VOLUME_DOWN:
+        volume -= 0.02f;
+        if (volume < 0.00f) volume = 0.00f;
+        atomic_store(&state->volume, volume);
+        break;
+      case CMD_SEEK:
+        atomic_fetch_add(&state->seek_offset, cmd.arg);
+        atomic_fetch_add(&state->flush_req, 1);
+        break;
+      // track_next/track_prev already did the work, these only time it
+      case CMD_NEXT:
+      case CMD_PREV:
+        break;
+      default:
+        break;
+    }
+  }
 }
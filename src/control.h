@@ -12,6 +12,15 @@ void playback_toggle(PlayBackState *state);
 void playback_stop(PlayBackState *state);
 void volume_increase(PlayBackState *state);
 void volume_decrease(PlayBackState *state);
-void shuffle(const char *path, uint loop);
+void eq_toggle(PlayBackState *state);
+void loop_toggle(PlayBackState *state);
+void speed_up(PlayBackState *state);
+void speed_down(PlayBackState *state);
+void playback_seek(PlayBackState *state, int seconds);
+void seek_forward(PlayBackState *state);
+void seek_backward(PlayBackState *state);
+void track_next(PlayBackState *state);
+void track_prev(PlayBackState *state);
+void playback_apply(PlayBackState *state, uint64_t *applied);
 
 #endif
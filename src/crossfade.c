@@ -0,0 +1,484 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+  #define CROSSFADE_X86
+  #define TARGET_SSE2 __attribute__((target("sse2")))
+  #define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#include "crossfade.h"
+
+// frame i gets the gains from + step * (i + 1), same as the gain stage
+typedef void (*mix_kernel)(void *dst, const void *tail, int frames, int ch,
+  float in_from, float in_step, float out_from, float out_step);
+
+static struct {
+  const char *name;
+  mix_kernel f32, s16, s32;
+
+} kernels;
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static inline int32_t clamp_round(float v, float lo, float hi)
+{
+  if (v < lo) v = lo;
+  if (v > hi) v = hi;
+  return (int32_t)lrintf(v);
+}
+
+
+// =================================================================
+// scalar kernels, also used for the tails and odd channel counts
+
+static void mix_f32_scalar(void *dst, const void *tail, int frames, int ch,
+  float in_from, float in_step, float out_from, float out_step)
+{
+  float *d = dst;
+  const float *t = tail;
+
+  for (int i = 0; i < frames; i++){
+    float gi = in_from + in_step * (i + 1), go = out_from + out_step * (i + 1);
+    for (int c = 0; c < ch; c++, d++, t++) *d = *d * gi + *t * go;
+  }
+}
+
+static void mix_s16_scalar(void *dst, const void *tail, int frames, int ch,
+  float in_from, float in_step, float out_from, float out_step)
+{
+  int16_t *d = dst;
+  const int16_t *t = tail;
+
+  for (int i = 0; i < frames; i++){
+    float gi = in_from + in_step * (i + 1), go = out_from + out_step * (i + 1);
+    for (int c = 0; c < ch; c++, d++, t++) *d = clamp_round(*d * gi + *t * go, -32768.0f, 32767.0f);
+  }
+}
+
+static void mix_s32_scalar(void *dst, const void *tail, int frames, int ch,
+  float in_from, float in_step, float out_from, float out_step)
+{
+  int32_t *d = dst;
+  const int32_t *t = tail;
+
+  for (int i = 0; i < frames; i++){
+    float gi = in_from + in_step * (i + 1), go = out_from + out_step * (i + 1);
+    // 2147483520 is the biggest float below 2^31
+    for (int c = 0; c < ch; c++, d++, t++)
+      *d = clamp_round((float)*d * gi + (float)*t * go, -2147483648.0f, 2147483520.0f);
+  }
+}
+
+static void mix_u8_scalar(void *dst, const void *tail, int frames, int ch,
+  float in_from, float in_step, float out_from, float out_step)
+{
+  uint8_t *d = dst;
+  const uint8_t *t = tail;
+
+  for (int i = 0; i < frames; i++){
+    float gi = in_from + in_step * (i + 1), go = out_from + out_step * (i + 1);
+    for (int c = 0; c < ch; c++, d++, t++) *d = clamp_round((*d - 128) * gi + (*t - 128) * go, -128.0f, 127.0f) + 128;
+  }
+}
+
+
+#ifdef CROSSFADE_X86
+// =================================================================
+// SSE2, 4 lanes. lane j of a vector belongs to frame j / ch, so this only
+// works when ch divides the lane count (1, 2, 4), everything else is scalar
+
+TARGET_SSE2 static inline __m128 lane_index_sse2(int ch)
+{
+  return _mm_setr_ps(0 / ch + 1, 1 / ch + 1, 2 / ch + 1, 3 / ch + 1);
+}
+
+TARGET_SSE2 static void mix_f32_sse2(void *dst, const void *tail, int frames, int ch,
+  float in_from, float in_step, float out_from, float out_step)
+{
+  float *d = dst;
+  const float *t = tail;
+  int samples = frames * ch, i = 0;
+
+  if (4 % ch == 0){
+    __m128 ifrom = _mm_set1_ps(in_from), istep = _mm_set1_ps(in_step);
+    __m128 ofrom = _mm_set1_ps(out_from), ostep = _mm_set1_ps(out_step);
+    __m128 idx = lane_index_sse2(ch), inc = _mm_set1_ps(4 / ch);
+
+    for (; i + 4 <= samples; i += 4){
+      __m128 gi = _mm_add_ps(ifrom, _mm_mul_ps(istep, idx));
+      __m128 go = _mm_add_ps(ofrom, _mm_mul_ps(ostep, idx));
+      __m128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(d + i), gi), _mm_mul_ps(_mm_loadu_ps(t + i), go));
+      _mm_storeu_ps(d + i, v);
+      idx = _mm_add_ps(idx, inc);
+    }
+  }
+
+  int f = i / ch;
+  mix_f32_scalar(d + i, t + i, frames - f, ch, in_from + in_step * f, in_step, out_from + out_step * f, out_step);
+}
+
+TARGET_SSE2 static void mix_s16_sse2(void *dst, const void *tail, int frames, int ch,
+  float in_from, float in_step, float out_from, float out_step)
+{
+  int16_t *d = dst;
+  const int16_t *t = tail;
+  int samples = frames * ch, i = 0;
+
+  if (4 % ch == 0){
+    __m128 ifrom = _mm_set1_ps(in_from), istep = _mm_set1_ps(in_step);
+    __m128 ofrom = _mm_set1_ps(out_from), ostep = _mm_set1_ps(out_step);
+    __m128 idx = lane_index_sse2(ch), half = _mm_set1_ps(4 / ch);
+
+    for (; i + 8 <= samples; i += 8){
+      __m128i x = _mm_loadu_si128((const __m128i*)(d + i));
+      __m128i y = _mm_loadu_si128((const __m128i*)(t + i));
+      // sign extend the 16 bit halves into 32 bit lanes
+      __m128 xlo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+      __m128 xhi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+      __m128 ylo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(y, y), 16));
+      __m128 yhi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(y, y), 16));
+
+      __m128 lo = _mm_add_ps(_mm_mul_ps(xlo, _mm_add_ps(ifrom, _mm_mul_ps(istep, idx))),
+                             _mm_mul_ps(ylo, _mm_add_ps(ofrom, _mm_mul_ps(ostep, idx))));
+      idx = _mm_add_ps(idx, half);
+      __m128 hi = _mm_add_ps(_mm_mul_ps(xhi, _mm_add_ps(ifrom, _mm_mul_ps(istep, idx))),
+                             _mm_mul_ps(yhi, _mm_add_ps(ofrom, _mm_mul_ps(ostep, idx))));
+      idx = _mm_add_ps(idx, half);
+
+      // packs saturates, so no clamp needed
+      _mm_storeu_si128((__m128i*)(d + i), _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+    }
+  }
+
+  int f = i / ch;
+  mix_s16_scalar(d + i, t + i, frames - f, ch, in_from + in_step * f, in_step, out_from + out_step * f, out_step);
+}
+
+TARGET_SSE2 static void mix_s32_sse2(void *dst, const void *tail, int frames, int ch,
+  float in_from, float in_step, float out_from, float out_step)
+{
+  int32_t *d = dst;
+  const int32_t *t = tail;
+  int samples = frames * ch, i = 0;
+
+  if (4 % ch == 0){
+    __m128 ifrom = _mm_set1_ps(in_from), istep = _mm_set1_ps(in_step);
+    __m128 ofrom = _mm_set1_ps(out_from), ostep = _mm_set1_ps(out_step);
+    __m128 idx = lane_index_sse2(ch), inc = _mm_set1_ps(4 / ch);
+    __m128 lo = _mm_set1_ps(-2147483648.0f), hi = _mm_set1_ps(2147483520.0f);
+
+    for (; i + 4 <= samples; i += 4){
+      __m128 x = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(d + i)));
+      __m128 y = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(t + i)));
+      __m128 v = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(ifrom, _mm_mul_ps(istep, idx))),
+                            _mm_mul_ps(y, _mm_add_ps(ofrom, _mm_mul_ps(ostep, idx))));
+
+      v = _mm_min_ps(_mm_max_ps(v, lo), hi);
+      _mm_storeu_si128((__m128i*)(d + i), _mm_cvtps_epi32(v));
+      idx = _mm_add_ps(idx, inc);
+    }
+  }
+
+  int f = i / ch;
+  mix_s32_scalar(d + i, t + i, frames - f, ch, in_from + in_step * f, in_step, out_from + out_step * f, out_step);
+}
+
+
+// =================================================================
+// AVX2, 8 lanes, same idea (ch = 1, 2, 4, 8)
+
+TARGET_AVX2 static inline __m256 lane_index_avx2(int ch)
+{
+  return _mm256_setr_ps(0 / ch + 1, 1 / ch + 1, 2 / ch + 1, 3 / ch + 1,
+                        4 / ch + 1, 5 / ch + 1, 6 / ch + 1, 7 / ch + 1);
+}
+
+TARGET_AVX2 static void mix_f32_avx2(void *dst, const void *tail, int frames, int ch,
+  float in_from, float in_step, float out_from, float out_step)
+{
+  float *d = dst;
+  const float *t = tail;
+  int samples = frames * ch, i = 0;
+
+  if (8 % ch == 0){
+    __m256 ifrom = _mm256_set1_ps(in_from), istep = _mm256_set1_ps(in_step);
+    __m256 ofrom = _mm256_set1_ps(out_from), ostep = _mm256_set1_ps(out_step);
+    __m256 idx = lane_index_avx2(ch), inc = _mm256_set1_ps(8 / ch);
+
+    for (; i + 8 <= samples; i += 8){
+      __m256 gi = _mm256_add_ps(ifrom, _mm256_mul_ps(istep, idx));
+      __m256 go = _mm256_add_ps(ofrom, _mm256_mul_ps(ostep, idx));
+      __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(d + i), gi), _mm256_mul_ps(_mm256_loadu_ps(t + i), go));
+      _mm256_storeu_ps(d + i, v);
+      idx = _mm256_add_ps(idx, inc);
+    }
+  }
+
+  int f = i / ch;
+  mix_f32_scalar(d + i, t + i, frames - f, ch, in_from + in_step * f, in_step, out_from + out_step * f, out_step);
+}
+
+TARGET_AVX2 static void mix_s16_avx2(void *dst, const void *tail, int frames, int ch,
+  float in_from, float in_step, float out_from, float out_step)
+{
+  int16_t *d = dst;
+  const int16_t *t = tail;
+  int samples = frames * ch, i = 0;
+
+  if (8 % ch == 0){
+    __m256 ifrom = _mm256_set1_ps(in_from), istep = _mm256_set1_ps(in_step);
+    __m256 ofrom = _mm256_set1_ps(out_from), ostep = _mm256_set1_ps(out_step);
+    __m256 idx = lane_index_avx2(ch), inc = _mm256_set1_ps(8 / ch);
+
+    for (; i + 8 <= samples; i += 8){
+      __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(d + i))));
+      __m256 y = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(t + i))));
+      __m256 v = _mm256_add_ps(_mm256_mul_ps(x, _mm256_add_ps(ifrom, _mm256_mul_ps(istep, idx))),
+                               _mm256_mul_ps(y, _mm256_add_ps(ofrom, _mm256_mul_ps(ostep, idx))));
+
+      __m256i r = _mm256_cvtps_epi32(v);
+      // packs works per 128 bit lane, so pack the two halves by hand
+      _mm_storeu_si128((__m128i*)(d + i), _mm_packs_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1)));
+      idx = _mm256_add_ps(idx, inc);
+    }
+  }
+
+  int f = i / ch;
+  mix_s16_scalar(d + i, t + i, frames - f, ch, in_from + in_step * f, in_step, out_from + out_step * f, out_step);
+}
+
+TARGET_AVX2 static void mix_s32_avx2(void *dst, const void *tail, int frames, int ch,
+  float in_from, float in_step, float out_from, float out_step)
+{
+  int32_t *d = dst;
+  const int32_t *t = tail;
+  int samples = frames * ch, i = 0;
+
+  if (8 % ch == 0){
+    __m256 ifrom = _mm256_set1_ps(in_from), istep = _mm256_set1_ps(in_step);
+    __m256 ofrom = _mm256_set1_ps(out_from), ostep = _mm256_set1_ps(out_step);
+    __m256 idx = lane_index_avx2(ch), inc = _mm256_set1_ps(8 / ch);
+    __m256 lo = _mm256_set1_ps(-2147483648.0f), hi = _mm256_set1_ps(2147483520.0f);
+
+    for (; i + 8 <= samples; i += 8){
+      __m256 x = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(d + i)));
+      __m256 y = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(t + i)));
+      __m256 v = _mm256_add_ps(_mm256_mul_ps(x, _mm256_add_ps(ifrom, _mm256_mul_ps(istep, idx))),
+                               _mm256_mul_ps(y, _mm256_add_ps(ofrom, _mm256_mul_ps(ostep, idx))));
+
+      v = _mm256_min_ps(_mm256_max_ps(v, lo), hi);
+      _mm256_storeu_si256((__m256i*)(d + i), _mm256_cvtps_epi32(v));
+      idx = _mm256_add_ps(idx, inc);
+    }
+  }
+
+  int f = i / ch;
+  mix_s32_scalar(d + i, t + i, frames - f, ch, in_from + in_step * f, in_step, out_from + out_step * f, out_step);
+}
+#endif
+
+
+// =================================================================
+// runtime dispatch, picked once
+
+static void crossfade_pick(void)
+{
+  kernels.name = "scalar";
+  kernels.f32 = mix_f32_scalar;
+  kernels.s16 = mix_s16_scalar;
+  kernels.s32 = mix_s32_scalar;
+
+  #ifdef CROSSFADE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){
+      kernels.name = "avx2";
+      kernels.f32 = mix_f32_avx2;
+      kernels.s16 = mix_s16_avx2;
+      kernels.s32 = mix_s32_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2")){
+      kernels.name = "sse2";
+      kernels.f32 = mix_f32_sse2;
+      kernels.s16 = mix_s16_sse2;
+      kernels.s32 = mix_s32_sse2;
+    }
+  #endif
+}
+
+void crossfade_init(void)
+{
+  pthread_once(&kernels_once, crossfade_pick);
+}
+
+const char *crossfade_kernel_name(void)
+{
+  crossfade_init();
+  return kernels.name;
+}
+
+void crossfade_mix(void *dst, const void *tail, int frames, ma_format fmt, int ch,
+  float in_from, float in_step, float out_from, float out_step)
+{
+  switch (fmt){
+    case ma_format_f32: kernels.f32(dst, tail, frames, ch, in_from, in_step, out_from, out_step); break;
+    case ma_format_s16: kernels.s16(dst, tail, frames, ch, in_from, in_step, out_from, out_step); break;
+    case ma_format_s32: kernels.s32(dst, tail, frames, ch, in_from, in_step, out_from, out_step); break;
+    case ma_format_u8: mix_u8_scalar(dst, tail, frames, ch, in_from, in_step, out_from, out_step); break;
+    default: break;
+  }
+}
+
+
+// =================================================================
+
+Crossfade *crossfade_create(ma_format fmt, int ch, int rate, int seconds, Crossfade_Curve curve)
+{
+  // s24 never gets here, the ring carries s32 for those devices
+  if (fmt != ma_format_f32 && fmt != ma_format_s16 && fmt != ma_format_s32 && fmt != ma_format_u8) return NULL;
+
+  crossfade_init();
+
+  Crossfade *cf = calloc(1, sizeof(Crossfade));
+  if (!cf) return NULL;
+
+  cf->fmt = fmt;
+  cf->ch = ch;
+  cf->frame_bytes = ch * ma_get_bytes_per_sample(fmt);
+  cf->seconds = seconds;
+  cf->curve = curve;
+  cf->cap = rate * seconds;
+  cf->hold_from = -1;
+
+  if (!(cf->tail = malloc((size_t)cf->cap * cf->frame_bytes))){
+    free(cf);
+    return NULL;
+  }
+  return cf;
+}
+
+void crossfade_destroy(Crossfade *cf)
+{
+  if (!cf) return;
+
+  free(cf->tail);
+  free(cf);
+}
+
+void crossfade_arm(Crossfade *cf, int64_t hold_from, float gain)
+{
+  cf->hold_from = hold_from;
+  cf->holding = 0;
+  cf->gain = gain;
+}
+
+void crossfade_position(Crossfade *cf, int64_t pos)
+{
+  if (cf->holding || cf->hold_from < 0 || pos < cf->hold_from || cf->mixed < cf->len) return;
+
+  cf->holding = 1;
+  cf->head = cf->len = cf->mixed = 0;
+  atomic_store(&cf->held, 0);
+}
+
+int crossfade_over(const Crossfade *cf, int frames)
+{
+  int over = cf->len + frames - cf->cap;
+  return over > 0 ? over : 0;
+}
+
+// only the head moves, the window is never copied around
+void crossfade_drop(Crossfade *cf, int frames)
+{
+  cf->head = (cf->head + frames) % cf->cap;
+  cf->len -= frames;
+  atomic_store(&cf->held, cf->len);
+}
+
+int crossfade_span(const Crossfade *cf, int from, int frames, uint8_t **data)
+{
+  int at = (cf->head + from) % cf->cap;
+
+  if (frames > cf->cap - at) frames = cf->cap - at;
+  *data = cf->tail + at * cf->frame_bytes;
+  return frames;
+}
+
+void crossfade_hold(Crossfade *cf, const void *pcm, int frames)
+{
+  int at = (cf->head + cf->len) % cf->cap;
+  int first = cf->cap - at < frames ? cf->cap - at : frames;
+
+  memcpy(cf->tail + at * cf->frame_bytes, pcm, first * cf->frame_bytes);
+  memcpy(cf->tail, (const uint8_t*)pcm + first * cf->frame_bytes, (frames - first) * cf->frame_bytes);
+  cf->len += frames;
+  atomic_store(&cf->held, cf->len);
+}
+
+int crossfade_handoff(Crossfade *cf)
+{
+  if (!cf->holding) return 0;
+
+  cf->holding = 0;
+  cf->hold_from = -1;
+  cf->mixed = 0;
+  cf->tail_gain = cf->gain;
+  atomic_store(&cf->held, 0);
+  return cf->len > 0;
+}
+
+// how far into the fade `t` (0..1) the track coming in and the one going out are
+static void curve(Crossfade_Curve c, float t, float *in, float *out)
+{
+  if (c == CROSSFADE_LINEAR){
+    *in = t;
+    *out = 1.0f - t;
+  }
+  else {
+    *in = sinf(t * (float)M_PI_2);
+    *out = cosf(t * (float)M_PI_2);
+  }
+}
+
+int crossfade_apply(Crossfade *cf, void *pcm, int frames, float gain)
+{
+  int n = cf->len - cf->mixed;
+  if (n > frames) n = frames;
+  if (n <= 0) return 0;
+
+  // the callback puts the new track's replaygain on all of it, so the old
+  // track's tail is brought to its own level here
+  float level = gain > 0 ? cf->tail_gain / gain : 1.0f;
+  uint8_t *d = pcm;
+
+  // the curves are straight lines between points CROSSFADE_STEP frames apart,
+  // and one more where the tail wraps
+  for (int done = 0; done < n; ){
+    int k = n - done < CROSSFADE_STEP ? n - done : CROSSFADE_STEP;
+    uint8_t *tail;
+    float in0, out0, in1, out1;
+
+    k = crossfade_span(cf, cf->mixed, k, &tail);
+    curve(cf->curve, (float)(cf->mixed) / cf->len, &in0, &out0);
+    curve(cf->curve, (float)(cf->mixed + k) / cf->len, &in1, &out1);
+
+    crossfade_mix(d + done * cf->frame_bytes, tail, k, cf->fmt, cf->ch,
+      in0, (in1 - in0) / k, out0 * level, (out1 - out0) * level / k);
+
+    done += k;
+    cf->mixed += k;
+  }
+
+  return n;
+}
+
+void crossfade_reset(Crossfade *cf)
+{
+  cf->holding = 0;
+  cf->head = cf->len = cf->mixed = 0;
+  atomic_store(&cf->held, 0);
+}
@@ -0,0 +1,87 @@
+#ifndef CROSSFADE_H
+#define CROSSFADE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "../libs/miniaudio.h"
+
+#define CROSSFADE_MAX 15         // seconds
+#define CROSSFADE_STEP 64        // frames the fade curves are straight over
+
+typedef enum {
+  CROSSFADE_EQUAL_POWER,       // sin/cos: the sum keeps its loudness for unrelated material
+  CROSSFADE_LINEAR,            // the sum keeps its level for the same material
+
+} Crossfade_Curve;
+
+void crossfade_init(void);
+const char *crossfade_kernel_name(void);
+
+// dst = dst * (in_from + in_step * (i + 1)) + tail * (out_from + out_step * (i + 1))
+// for frame i, both in `fmt`. exported for the bench
+void crossfade_mix(void *dst, const void *tail, int frames, ma_format fmt, int ch,
+  float in_from, float in_step, float out_from, float out_step);
+
+// --crossfade: the last seconds of a track that's followed by another are
+// held back here instead of going into the ring. the next track's decoder
+// (opened early by the prefetcher, so only one extra decoder ever) mixes its
+// first seconds with them on the way into the ring. the audio callback never
+// sees any of it
+typedef struct {
+  ma_format fmt;
+  int ch, frame_bytes;
+  int seconds;
+  Crossfade_Curve curve;
+
+  // the decoder of the track that ends
+  int64_t hold_from;           // input frames, where holding starts. -1 = this track doesn't fade
+  int holding;
+  atomic_int held;             // frames held back from the ring, for seeking
+
+  // the track the fade goes into. one buffer does for both sides: a track
+  // only starts holding once the fade into it is over
+  uint8_t *tail;               // what was held, a ring of `cap` frames
+  int cap, head, len;          // frames, the oldest held is at `head`
+  int mixed;                   // frames of tail already mixed in, < len while fading
+  float gain;                  // replaygain of the track that holds
+  float tail_gain;             // and of the one the tail came from
+
+} Crossfade;
+
+Crossfade *crossfade_create(ma_format fmt, int ch, int rate, int seconds, Crossfade_Curve curve);
+void crossfade_destroy(Crossfade *cf);
+
+// the track starting now fades into the next from `hold_from` (input frames),
+// -1 if it doesn't. `gain` is its replaygain
+void crossfade_arm(Crossfade *cf, int64_t hold_from, float gain);
+
+// the decoder got to input frame `pos`: start holding once it's time, and
+// the fade into this track is done
+void crossfade_position(Crossfade *cf, int64_t pos);
+
+// frames of what's held that have to go (the oldest) before `frames` more
+// fit. the caller writes them to the ring, then drops them. past `len` it's
+// the new frames' start that goes straight out
+int crossfade_over(const Crossfade *cf, int frames);
+void crossfade_drop(Crossfade *cf, int frames);
+
+// the held frames from `from` (0 = the oldest) on, as far as they're in one
+// piece and at most `frames` of them: the count, `data` gets where they are.
+// any run of the tail is one or two of these
+int crossfade_span(const Crossfade *cf, int from, int frames, uint8_t **data);
+
+// keep `frames` more, crossfade_over() made room for them
+void crossfade_hold(Crossfade *cf, const void *pcm, int frames);
+
+// the track ended: what's held waits for the next one. 0 if nothing was held
+int crossfade_handoff(Crossfade *cf);
+
+// fading in: mix what's left of the tail into `frames` frames of the new
+// track, in place, `gain` its replaygain. returns the frames mixed
+int crossfade_apply(Crossfade *cf, void *pcm, int frames, float gain);
+
+// a seek or a skip: forget the tail
+void crossfade_reset(Crossfade *cf);
+
+#endif
@@ -0,0 +1,481 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+  #define EQ_X86
+  #define TARGET_SSE2 __attribute__((target("sse2")))
+  #define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#include "eq.h"
+
+static struct {
+  const char *name;
+  int lanes;
+  eq_kernel run;
+
+} kernels;
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+
+// =================================================================
+// --eq=
+
+int eq_parse(const char *spec, Eq_Band *bands, int max, char *error, int error_size)
+{
+  int n = 0;
+
+  while (*spec) {
+    char type[8];
+    float freq, gain, q = 0;
+    int used = 0;
+
+    if (n == max) {
+      snprintf(error, error_size, "more than %d bands", max);
+      return -1;
+    }
+
+    // the q is optional, so try with it first
+    if (sscanf(spec, "%7[a-z]:%f:%f:%f%n", type, &freq, &gain, &q, &used) < 4) {
+      used = 0;
+      if (sscanf(spec, "%7[a-z]:%f:%f%n", type, &freq, &gain, &used) < 3 || !used) {
+        snprintf(error, error_size, "'%s' isn't type:freq:gain[:q]", spec);
+        return -1;
+      }
+    }
+
+    Eq_Band *b = &bands[n++];
+
+    if (!strcmp(type, "low")) b->type = EQ_LOW_SHELF;
+    else if (!strcmp(type, "high")) b->type = EQ_HIGH_SHELF;
+    else if (!strcmp(type, "peak")) b->type = EQ_PEAK;
+    else {
+      snprintf(error, error_size, "'%s' isn't low, high or peak", type);
+      return -1;
+    }
+
+    if (freq <= 0 || q < 0 || fabsf(gain) > 24) {
+      snprintf(error, error_size, "band %d: the frequency must be > 0 and the gain within +-24 dB", n);
+      return -1;
+    }
+
+    b->freq = freq;
+    b->gain = gain;
+    // a shelf's q is its slope, 1 is the steepest that doesn't overshoot
+    b->q = q > 0 ? q : 1.0f;
+
+    spec += used;
+    if (*spec == ',') spec++;
+    else if (*spec) {
+      snprintf(error, error_size, "'%s': bands are separated by ','", spec);
+      return -1;
+    }
+  }
+
+  if (!n) snprintf(error, error_size, "no bands");
+  return n ? n : -1;
+}
+
+
+// =================================================================
+// coefficients, from the audio eq cookbook (r. bristow-johnson)
+
+static void band_coef(const Eq_Band *b, float gain, int rate, float out[5])
+{
+  // past ~0.45 of the rate the bilinear warp makes a mess of the curve
+  double freq = fmin(b->freq, rate * 0.45);
+  double A = pow(10.0, gain / 40.0);
+  double w0 = 2.0 * M_PI * freq / rate;
+  double cw = cos(w0), sw = sin(w0);
+  double b0, b1, b2, a0, a1, a2;
+
+  if (b->type == EQ_PEAK) {
+    double alpha = sw / (2.0 * b->q);
+
+    b0 = 1.0 + alpha * A;
+    b1 = -2.0 * cw;
+    b2 = 1.0 - alpha * A;
+    a0 = 1.0 + alpha / A;
+    a1 = -2.0 * cw;
+    a2 = 1.0 - alpha / A;
+  }
+  else {
+    double k = (A + 1.0 / A) * (1.0 / b->q - 1.0) + 2.0;
+    double beta = 2.0 * sqrt(A) * sw / 2.0 * sqrt(k > 0 ? k : 0);
+    double s = b->type == EQ_LOW_SHELF ? 1.0 : -1.0;  // high is low with cos flipped
+
+    b0 = A * ((A + 1) - s * (A - 1) * cw + beta);
+    b1 = s * 2.0 * A * ((A - 1) - s * (A + 1) * cw);
+    b2 = A * ((A + 1) - s * (A - 1) * cw - beta);
+    a0 = (A + 1) + s * (A - 1) * cw + beta;
+    a1 = -s * 2.0 * ((A - 1) + s * (A + 1) * cw);
+    a2 = (A + 1) + s * (A - 1) * cw - beta;
+  }
+
+  out[0] = b0 / a0;
+  out[1] = b1 / a0;
+  out[2] = b2 / a0;
+  out[3] = a1 / a0;
+  out[4] = a2 / a0;
+}
+
+// every band at `mix` of its gain. lanes past the last band pass their
+// input on unchanged
+static void eq_update(Equalizer *eq)
+{
+  int lanes = eq->lanes;
+
+  for (int i = 0; i < eq->groups * lanes; i++) {
+    float c[5] = { 1, 0, 0, 0, 0 };
+    float *g = eq->coef + (i / lanes) * 5 * lanes;
+
+    if (i < eq->bands) band_coef(&eq->band[i], eq->band[i].gain * eq->mix, eq->rate, c);
+    for (int k = 0; k < 5; k++) g[k * lanes + i % lanes] = c[k];
+  }
+}
+
+
+// =================================================================
+// scalar kernel, a band at a time (lanes = 1, no latency)
+
+static void eq_run_scalar(float *x, int n, const float *coef, float *state, int groups)
+{
+  for (int g = 0; g < groups; g++, coef += 5, state += 3) {
+    float b0 = coef[0], b1 = coef[1], b2 = coef[2], a1 = coef[3], a2 = coef[4];
+    float z1 = state[0], z2 = state[1];
+
+    for (int i = 0; i < n; i++) {
+      float in = x[i];
+      float y = b0 * in + z1;
+
+      z1 = b1 * in - a1 * y + z2;
+      z2 = b2 * in - a2 * y;
+      x[i] = y;
+    }
+
+    state[0] = z1;
+    state[1] = z2;
+  }
+}
+
+
+#ifdef EQ_X86
+// =================================================================
+// SSE2, 4 bands a step. lane k takes what lane k-1 put out the step before,
+// lane 0 the next sample, and the last lane's output is the group's, 3
+// samples late
+
+TARGET_SSE2 static void eq_run_sse2(float *x, int n, const float *coef, float *state, int groups)
+{
+  for (int g = 0; g < groups; g++, coef += 20, state += 12) {
+    __m128 b0 = _mm_loadu_ps(coef), b1 = _mm_loadu_ps(coef + 4), b2 = _mm_loadu_ps(coef + 8);
+    __m128 a1 = _mm_loadu_ps(coef + 12), a2 = _mm_loadu_ps(coef + 16);
+    __m128 z1 = _mm_loadu_ps(state), z2 = _mm_loadu_ps(state + 4), y = _mm_loadu_ps(state + 8);
+
+    for (int i = 0; i < n; i++) {
+      __m128 in = _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(y), 4));
+      in = _mm_move_ss(in, _mm_set_ss(x[i]));
+
+      y = _mm_add_ps(_mm_mul_ps(b0, in), z1);
+      z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, in), _mm_mul_ps(a1, y)), z2);
+      z2 = _mm_sub_ps(_mm_mul_ps(b2, in), _mm_mul_ps(a2, y));
+      x[i] = _mm_cvtss_f32(_mm_shuffle_ps(y, y, 3));
+    }
+
+    _mm_storeu_ps(state, z1);
+    _mm_storeu_ps(state + 4, z2);
+    _mm_storeu_ps(state + 8, y);
+  }
+}
+
+
+// =================================================================
+// AVX2, 8 bands a step, 7 samples late
+
+TARGET_AVX2 static void eq_run_avx2(float *x, int n, const float *coef, float *state, int groups)
+{
+  const __m256i shift = _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6);
+
+  for (int g = 0; g < groups; g++, coef += 40, state += 24) {
+    __m256 b0 = _mm256_loadu_ps(coef), b1 = _mm256_loadu_ps(coef + 8), b2 = _mm256_loadu_ps(coef + 16);
+    __m256 a1 = _mm256_loadu_ps(coef + 24), a2 = _mm256_loadu_ps(coef + 32);
+    __m256 z1 = _mm256_loadu_ps(state), z2 = _mm256_loadu_ps(state + 8), y = _mm256_loadu_ps(state + 16);
+
+    for (int i = 0; i < n; i++) {
+      __m256 in = _mm256_blend_ps(_mm256_permutevar8x32_ps(y, shift), _mm256_set1_ps(x[i]), 1);
+
+      y = _mm256_add_ps(_mm256_mul_ps(b0, in), z1);
+      z1 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b1, in), _mm256_mul_ps(a1, y)), z2);
+      z2 = _mm256_sub_ps(_mm256_mul_ps(b2, in), _mm256_mul_ps(a2, y));
+
+      __m128 hi = _mm256_extractf128_ps(y, 1);
+      x[i] = _mm_cvtss_f32(_mm_shuffle_ps(hi, hi, 3));
+    }
+
+    _mm256_storeu_ps(state, z1);
+    _mm256_storeu_ps(state + 8, z2);
+    _mm256_storeu_ps(state + 16, y);
+  }
+}
+
+// a decaying filter tail ends up in denormals, which are slow enough on x86
+// to show up in the decoder's time. flush them to zero while we run
+TARGET_SSE2 static unsigned denormals_off(void)
+{
+  unsigned csr = _mm_getcsr();
+  _mm_setcsr(csr | 0x8040);    // FTZ | DAZ
+  return csr;
+}
+
+TARGET_SSE2 static void denormals_restore(unsigned csr)
+{
+  _mm_setcsr(csr);
+}
+#endif
+
+
+// =================================================================
+// runtime dispatch, picked once
+
+static void eq_pick(void)
+{
+  kernels.name = "scalar";
+  kernels.lanes = 1;
+  kernels.run = eq_run_scalar;
+
+  #ifdef EQ_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){
+      kernels.name = "avx2";
+      kernels.lanes = 8;
+      kernels.run = eq_run_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2")){
+      kernels.name = "sse2";
+      kernels.lanes = 4;
+      kernels.run = eq_run_sse2;
+    }
+  #endif
+}
+
+void eq_init_kernels(void)
+{
+  pthread_once(&kernels_once, eq_pick);
+}
+
+const char *eq_kernel_name(void)
+{
+  eq_init_kernels();
+  return kernels.name;
+}
+
+int eq_kernel_select(const char *name)
+{
+  eq_init_kernels();
+
+  if (!strcmp(name, "scalar")) {
+    kernels.name = "scalar";
+    kernels.lanes = 1;
+    kernels.run = eq_run_scalar;
+    return 0;
+  }
+
+  #ifdef EQ_X86
+    if (!strcmp(name, "sse2") && __builtin_cpu_supports("sse2")) {
+      kernels.name = "sse2";
+      kernels.lanes = 4;
+      kernels.run = eq_run_sse2;
+      return 0;
+    }
+    if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2")) {
+      kernels.name = "avx2";
+      kernels.lanes = 8;
+      kernels.run = eq_run_avx2;
+      return 0;
+    }
+  #endif
+
+  return -1;
+}
+
+
+// =================================================================
+// the ring's format to a float block per channel and back. one loop per
+// format so each stays a plain loop the compiler can vectorize
+
+static void load_block(const Equalizer *eq, const void *pcm, int n)
+{
+  int ch = eq->ch;
+
+  for (int c = 0; c < ch; c++) {
+    float *x = eq->x + c * EQ_BLOCK;
+
+    switch (eq->fmt) {
+      case ma_format_f32: {
+        const float *s = (const float*)pcm + c;
+        for (int i = 0; i < n; i++) x[i] = s[i * ch];
+        break;
+      }
+      case ma_format_s16: {
+        const int16_t *s = (const int16_t*)pcm + c;
+        for (int i = 0; i < n; i++) x[i] = s[i * ch] * (1.0f / 32768.0f);
+        break;
+      }
+      case ma_format_s32: {
+        const int32_t *s = (const int32_t*)pcm + c;
+        for (int i = 0; i < n; i++) x[i] = s[i * ch] * (1.0f / 2147483648.0f);
+        break;
+      }
+      case ma_format_u8: {
+        const uint8_t *s = (const uint8_t*)pcm + c;
+        for (int i = 0; i < n; i++) x[i] = (s[i * ch] - 128) * (1.0f / 128.0f);
+        break;
+      }
+      default: break;
+    }
+  }
+}
+
+static inline float clampf(float v, float lo, float hi)
+{
+  return v < lo ? lo : v > hi ? hi : v;
+}
+
+// the preamp goes on here, on the way out
+static void store_block(const Equalizer *eq, void *pcm, int n, float pre)
+{
+  int ch = eq->ch;
+
+  for (int c = 0; c < ch; c++) {
+    const float *x = eq->x + c * EQ_BLOCK;
+
+    switch (eq->fmt) {
+      case ma_format_f32: {
+        float *s = (float*)pcm + c;
+        for (int i = 0; i < n; i++) s[i * ch] = x[i] * pre;
+        break;
+      }
+      case ma_format_s16: {
+        int16_t *s = (int16_t*)pcm + c;
+        for (int i = 0; i < n; i++) s[i * ch] = lrintf(clampf(x[i] * pre * 32768.0f, -32768.0f, 32767.0f));
+        break;
+      }
+      case ma_format_s32: {
+        int32_t *s = (int32_t*)pcm + c;
+        // 2147483520 is the biggest float below 2^31
+        for (int i = 0; i < n; i++) s[i * ch] = lrintf(clampf(x[i] * pre * 2147483648.0f, -2147483648.0f, 2147483520.0f));
+        break;
+      }
+      case ma_format_u8: {
+        uint8_t *s = (uint8_t*)pcm + c;
+        for (int i = 0; i < n; i++) s[i * ch] = lrintf(clampf(x[i] * pre * 128.0f, -128.0f, 127.0f)) + 128;
+        break;
+      }
+      default: break;
+    }
+  }
+}
+
+
+// =================================================================
+
+Equalizer *eq_create(const Eq_Band *bands, int n, ma_format fmt, int ch, int rate)
+{
+  // s24 never gets here, the ring carries s32 for those devices
+  if (ch < 1 || ch > EQ_MAX_CH || n < 1 || n > EQ_MAX_BANDS) return NULL;
+  if (fmt != ma_format_f32 && fmt != ma_format_s16 && fmt != ma_format_s32 && fmt != ma_format_u8) return NULL;
+
+  eq_init_kernels();
+
+  Equalizer *eq = calloc(1, sizeof(Equalizer));
+  if (!eq) return NULL;
+
+  eq->fmt = fmt;
+  eq->ch = ch;
+  eq->rate = rate;
+  eq->bands = n;
+  eq->lanes = kernels.lanes;
+  eq->run = kernels.run;
+  eq->groups = (n + eq->lanes - 1) / eq->lanes;
+  memcpy(eq->band, bands, n * sizeof(Eq_Band));
+
+  for (int i = 0; i < n; i++)
+    if (bands[i].gain > eq->max_gain) eq->max_gain = bands[i].gain;
+
+  eq->coef = calloc(eq->groups * 5 * eq->lanes, sizeof(float));
+  eq->state = calloc(ch * eq->groups * 3 * eq->lanes, sizeof(float));
+  eq->x = calloc(ch * EQ_BLOCK, sizeof(float));
+
+  if (!eq->coef || !eq->state || !eq->x) {
+    eq_destroy(eq);
+    return NULL;
+  }
+
+  atomic_init(&eq->enabled, 1);
+  eq->mix = 1.0f;
+  eq_update(eq);
+  return eq;
+}
+
+void eq_destroy(Equalizer *eq)
+{
+  if (!eq) return;
+
+  free(eq->coef);
+  free(eq->state);
+  free(eq->x);
+  free(eq);
+}
+
+int eq_latency(const Equalizer *eq)
+{
+  return eq->groups * (eq->lanes - 1);
+}
+
+void eq_process(Equalizer *eq, void *pcm, int frames)
+{
+  int frame_bytes = eq->ch * ma_get_bytes_per_sample(eq->fmt);
+  float target = atomic_load(&eq->enabled) ? 1.0f : 0.0f;
+  float ramp = 1000.0f / (eq->rate * EQ_RAMP_MS);  // mix per frame during a fade
+  int state_len = eq->groups * 3 * eq->lanes;
+
+  #ifdef EQ_X86
+    unsigned csr = eq->lanes > 1 ? denormals_off() : 0;
+  #endif
+
+  while (frames > 0) {
+    int n = frames < EQ_BLOCK ? frames : EQ_BLOCK;
+
+    // moving towards on/off: new coefficients every EQ_RAMP_STEP frames,
+    // the filter state stays, so the curve morphs instead of jumping
+    if (eq->mix != target) {
+      if (n > EQ_RAMP_STEP) n = EQ_RAMP_STEP;
+
+      eq->mix = target > eq->mix ? fminf(eq->mix + ramp * n, 1.0f) : fmaxf(eq->mix - ramp * n, 0.0f);
+      eq_update(eq);
+    }
+
+    // switched off and done fading, the bands are flat. they still run so
+    // the delay doesn't jump when the eq comes back on
+
+    float pre = powf(10.0f, -eq->max_gain * eq->mix / 20.0f);
+
+    load_block(eq, pcm, n);
+    for (int c = 0; c < eq->ch; c++)
+      eq->run(eq->x + c * EQ_BLOCK, n, eq->coef, eq->state + c * state_len, eq->groups);
+    store_block(eq, pcm, n, pre);
+
+    pcm = (uint8_t*)pcm + n * frame_bytes;
+    frames -= n;
+  }
+
+  #ifdef EQ_X86
+    if (eq->lanes > 1) denormals_restore(csr);
+  #endif
+}
@@ -0,0 +1,78 @@
+#ifndef EQ_H
+#define EQ_H
+
+#include <stdatomic.h>
+
+#include "../libs/miniaudio.h"
+
+#define EQ_MAX_BANDS 16
+#define EQ_MAX_CH 8              // more channels than this play without the eq
+#define EQ_BLOCK 256             // frames converted to float and filtered at a time
+#define EQ_RAMP_MS 50            // switching the eq on or off fades the bands over this
+#define EQ_RAMP_STEP 32          // frames between two coefficient updates during a fade
+
+typedef enum {
+  EQ_LOW_SHELF,
+  EQ_HIGH_SHELF,
+  EQ_PEAK,
+
+} Eq_Type;
+
+// one band of --eq, as typed. q is the shelf slope for shelves
+typedef struct {
+  Eq_Type type;
+  float freq;                  // Hz
+  float gain;                  // dB
+  float q;
+
+} Eq_Band;
+
+// "type:freq:gain[:q],..." with type low, high or peak. the number of bands,
+// -1 (and why in `error`) if it doesn't parse
+int eq_parse(const char *spec, Eq_Band *bands, int max, char *error, int error_size);
+
+// runs every group of a channel's cascade over `n` samples of x, in place
+typedef void (*eq_kernel)(float *x, int n, const float *coef, float *state, int groups);
+
+void eq_init_kernels(void);
+const char *eq_kernel_name(void);
+
+// use this kernel (scalar, sse2, avx2) for equalizers made after, -1 if the
+// cpu doesn't have it. the bench compares them, playback takes the best
+int eq_kernel_select(const char *name);
+
+// the bands as a cascade of biquads in transposed direct form II. the kernels
+// run several bands at once, one per vector lane, each lane a sample behind
+// the one before it (a wavefront), so a channel comes out a few samples late
+// (eq_latency), the same few samples for as long as it runs
+typedef struct {
+  ma_format fmt;
+  int ch, rate;
+  int bands, groups;           // groups of `lanes` bands, the rest identity
+  int lanes;                   // bands one kernel call runs side by side
+  eq_kernel run;
+  Eq_Band band[EQ_MAX_BANDS];
+  float max_gain;              // the loudest boost, the preamp takes it off again
+
+  atomic_int enabled;          // the 'e' key flips it, the decoder fades to it
+  float mix;                   // where the fade is: 0 flat .. 1 the bands as given
+
+  // structure of arrays: per group, lane after lane, so a kernel loads one
+  // coefficient of every band it runs with one load
+  float *coef;                 // groups * 5 * lanes: b0 b1 b2 a1 a2
+  float *state;                // ch * groups * 3 * lanes: z1 z2 and the lane's last output
+  float *x;                    // ch * EQ_BLOCK, the block being filtered
+
+} Equalizer;
+
+// NULL if the format or the channels aren't something it can run on
+Equalizer *eq_create(const Eq_Band *bands, int n, ma_format fmt, int ch, int rate);
+void eq_destroy(Equalizer *eq);
+
+// samples a channel is delayed by
+int eq_latency(const Equalizer *eq);
+
+// filter `frames` interleaved frames in place. decoder thread only
+void eq_process(Equalizer *eq, void *pcm, int frames);
+
+#endif
@@ -0,0 +1,507 @@
+#include <math.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+  #define GAIN_X86
+  #define TARGET_SSE2 __attribute__((target("sse2")))
+  #define TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  #include <arm_neon.h>
+  #define GAIN_NEON
+#endif
+
+#include "gain.h"
+
+// every kernel gets the gain of the frame *before* the block and the per-frame
+// step, so frame i is scaled by from + step * (i + 1). samples are normalized
+// to [-1, 1] before the limiter so one curve fits every format.
+typedef void (*gain_kernel)(void *pcm, ma_uint32 frames, ma_uint32 ch, float from, float step, int limit);
+
+static struct {
+  const char *name;
+  gain_kernel f32, s16, s32;
+
+} kernels;
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+// x for |x| <= knee, above that it approaches 1.0 without ever reaching it,
+// and the slope is 1 at the knee so there's no corner to hear
+static inline float soft_limit(float x)
+{
+  const float range = 1.0f - GAIN_LIMIT_KNEE;
+  float a = fabsf(x);
+
+  if (a <= GAIN_LIMIT_KNEE) return x;
+
+  float u = (a - GAIN_LIMIT_KNEE) / range;
+  return copysignf(GAIN_LIMIT_KNEE + range * u / (1.0f + u), x);
+}
+
+static inline int32_t clamp_round(float v, float lo, float hi)
+{
+  if (v < lo) v = lo;
+  if (v > hi) v = hi;
+  return (int32_t)lrintf(v);
+}
+
+
+// =================================================================
+// scalar kernels, also used for the tails and odd channel counts
+
+static void gain_f32_scalar(void *pcm, ma_uint32 frames, ma_uint32 ch, float from, float step, int limit)
+{
+  float *s = pcm;
+
+  for (ma_uint32 i = 0; i < frames; i++){
+    float g = from + step * (i + 1);
+
+    for (ma_uint32 c = 0; c < ch; c++, s++){
+      float v = *s * g;
+      *s = limit ? soft_limit(v) : v;
+    }
+  }
+}
+
+static void gain_s16_scalar(void *pcm, ma_uint32 frames, ma_uint32 ch, float from, float step, int limit)
+{
+  int16_t *s = pcm;
+
+  for (ma_uint32 i = 0; i < frames; i++){
+    float g = from + step * (i + 1);
+
+    for (ma_uint32 c = 0; c < ch; c++, s++){
+      float v = *s * (1.0f / 32768.0f) * g;
+      if (limit) v = soft_limit(v);
+      *s = clamp_round(v * 32768.0f, -32768.0f, 32767.0f);
+    }
+  }
+}
+
+static void gain_s32_scalar(void *pcm, ma_uint32 frames, ma_uint32 ch, float from, float step, int limit)
+{
+  int32_t *s = pcm;
+
+  for (ma_uint32 i = 0; i < frames; i++){
+    float g = from + step * (i + 1);
+
+    for (ma_uint32 c = 0; c < ch; c++, s++){
+      float v = *s * (1.0f / 2147483648.0f) * g;
+      if (limit) v = soft_limit(v);
+      // 2147483520 is the biggest float below 2^31
+      *s = clamp_round(v * 2147483648.0f, -2147483648.0f, 2147483520.0f);
+    }
+  }
+}
+
+// packed 24 bit and u8 are rare enough that they stay scalar everywhere
+static void gain_s24_scalar(void *pcm, ma_uint32 frames, ma_uint32 ch, float from, float step, int limit)
+{
+  uint8_t *s = pcm;
+
+  for (ma_uint32 i = 0; i < frames; i++){
+    float g = from + step * (i + 1);
+
+    for (ma_uint32 c = 0; c < ch; c++, s += 3){
+      int32_t x = (int32_t)((uint32_t)s[0] << 8 | (uint32_t)s[1] << 16 | (uint32_t)s[2] << 24) >> 8;
+      float v = x * (1.0f / 8388608.0f) * g;
+      if (limit) v = soft_limit(v);
+
+      x = clamp_round(v * 8388608.0f, -8388608.0f, 8388607.0f);
+      s[0] = x; s[1] = x >> 8; s[2] = x >> 16;
+    }
+  }
+}
+
+static void gain_u8_scalar(void *pcm, ma_uint32 frames, ma_uint32 ch, float from, float step, int limit)
+{
+  uint8_t *s = pcm;
+
+  for (ma_uint32 i = 0; i < frames; i++){
+    float g = from + step * (i + 1);
+
+    for (ma_uint32 c = 0; c < ch; c++, s++){
+      float v = (*s - 128) * (1.0f / 128.0f) * g;
+      if (limit) v = soft_limit(v);
+      *s = clamp_round(v * 128.0f, -128.0f, 127.0f) + 128;
+    }
+  }
+}
+
+
+#ifdef GAIN_X86
+// =================================================================
+// SSE2, 4 lanes. lane j of a vector belongs to frame j / ch, so this only
+// works when ch divides the lane count (1, 2, 4), everything else is scalar
+
+TARGET_SSE2 static inline __m128 limit_sse2(__m128 v)
+{
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 knee = _mm_set1_ps(GAIN_LIMIT_KNEE);
+  const __m128 range = _mm_set1_ps(1.0f - GAIN_LIMIT_KNEE);
+
+  __m128 a = _mm_andnot_ps(sign, v);
+  __m128 u = _mm_div_ps(_mm_max_ps(_mm_sub_ps(a, knee), _mm_setzero_ps()), range);
+  __m128 y = _mm_add_ps(_mm_min_ps(a, knee), _mm_mul_ps(range, _mm_div_ps(u, _mm_add_ps(_mm_set1_ps(1.0f), u))));
+
+  return _mm_or_ps(y, _mm_and_ps(sign, v));
+}
+
+// frame index (+1) of every lane in the first vector
+TARGET_SSE2 static inline __m128 lane_index_sse2(ma_uint32 ch)
+{
+  return _mm_setr_ps(0 / ch + 1, 1 / ch + 1, 2 / ch + 1, 3 / ch + 1);
+}
+
+TARGET_SSE2 static void gain_f32_sse2(void *pcm, ma_uint32 frames, ma_uint32 ch, float from, float step, int limit)
+{
+  float *s = pcm;
+  ma_uint32 samples = frames * ch, i = 0;
+
+  if (4 % ch == 0){
+    __m128 vfrom = _mm_set1_ps(from), vstep = _mm_set1_ps(step);
+    __m128 idx = lane_index_sse2(ch), inc = _mm_set1_ps(4 / ch);
+
+    for (; i + 4 <= samples; i += 4){
+      __m128 v = _mm_mul_ps(_mm_loadu_ps(s + i), _mm_add_ps(vfrom, _mm_mul_ps(vstep, idx)));
+      if (limit) v = limit_sse2(v);
+      _mm_storeu_ps(s + i, v);
+      idx = _mm_add_ps(idx, inc);
+    }
+  }
+
+  gain_f32_scalar(s + i, frames - i / ch, ch, from + step * (i / ch), step, limit);
+}
+
+TARGET_SSE2 static void gain_s16_sse2(void *pcm, ma_uint32 frames, ma_uint32 ch, float from, float step, int limit)
+{
+  int16_t *s = pcm;
+  ma_uint32 samples = frames * ch, i = 0;
+
+  if (4 % ch == 0){
+    __m128 vfrom = _mm_set1_ps(from), vstep = _mm_set1_ps(step * (1.0f / 32768.0f));
+    __m128 idx = lane_index_sse2(ch), half = _mm_set1_ps(4 / ch);
+    __m128 norm = _mm_set1_ps(1.0f / 32768.0f), full = _mm_set1_ps(32768.0f);
+    vfrom = _mm_mul_ps(vfrom, norm);
+
+    for (; i + 8 <= samples; i += 8){
+      __m128i x = _mm_loadu_si128((const __m128i*)(s + i));
+      // sign extend the 16 bit halves into 32 bit lanes
+      __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+      __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+
+      lo = _mm_mul_ps(lo, _mm_add_ps(vfrom, _mm_mul_ps(vstep, idx)));
+      idx = _mm_add_ps(idx, half);
+      hi = _mm_mul_ps(hi, _mm_add_ps(vfrom, _mm_mul_ps(vstep, idx)));
+      idx = _mm_add_ps(idx, half);
+
+      if (limit){
+        lo = limit_sse2(lo);
+        hi = limit_sse2(hi);
+      }
+
+      // packs saturates, so no clamp needed
+      __m128i out = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(lo, full)), _mm_cvtps_epi32(_mm_mul_ps(hi, full)));
+      _mm_storeu_si128((__m128i*)(s + i), out);
+    }
+  }
+
+  gain_s16_scalar(s + i, frames - i / ch, ch, from + step * (i / ch), step, limit);
+}
+
+TARGET_SSE2 static void gain_s32_sse2(void *pcm, ma_uint32 frames, ma_uint32 ch, float from, float step, int limit)
+{
+  int32_t *s = pcm;
+  ma_uint32 samples = frames * ch, i = 0;
+
+  if (4 % ch == 0){
+    __m128 vfrom = _mm_set1_ps(from), vstep = _mm_set1_ps(step);
+    __m128 idx = lane_index_sse2(ch), inc = _mm_set1_ps(4 / ch);
+    __m128 norm = _mm_set1_ps(1.0f / 2147483648.0f), full = _mm_set1_ps(2147483648.0f);
+    __m128 lo = _mm_set1_ps(-2147483648.0f), hi = _mm_set1_ps(2147483520.0f);
+
+    for (; i + 4 <= samples; i += 4){
+      __m128 v = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(s + i)));
+      v = _mm_mul_ps(_mm_mul_ps(v, norm), _mm_add_ps(vfrom, _mm_mul_ps(vstep, idx)));
+      if (limit) v = limit_sse2(v);
+
+      v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(v, full), lo), hi);
+      _mm_storeu_si128((__m128i*)(s + i), _mm_cvtps_epi32(v));
+      idx = _mm_add_ps(idx, inc);
+    }
+  }
+
+  gain_s32_scalar(s + i, frames - i / ch, ch, from + step * (i / ch), step, limit);
+}
+
+
+// =================================================================
+// AVX2, 8 lanes, same idea (ch = 1, 2, 4, 8)
+
+TARGET_AVX2 static inline __m256 limit_avx2(__m256 v)
+{
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  const __m256 knee = _mm256_set1_ps(GAIN_LIMIT_KNEE);
+  const __m256 range = _mm256_set1_ps(1.0f - GAIN_LIMIT_KNEE);
+
+  __m256 a = _mm256_andnot_ps(sign, v);
+  __m256 u = _mm256_div_ps(_mm256_max_ps(_mm256_sub_ps(a, knee), _mm256_setzero_ps()), range);
+  __m256 y = _mm256_add_ps(_mm256_min_ps(a, knee), _mm256_mul_ps(range, _mm256_div_ps(u, _mm256_add_ps(_mm256_set1_ps(1.0f), u))));
+
+  return _mm256_or_ps(y, _mm256_and_ps(sign, v));
+}
+
+TARGET_AVX2 static inline __m256 lane_index_avx2(ma_uint32 ch)
+{
+  return _mm256_setr_ps(0 / ch + 1, 1 / ch + 1, 2 / ch + 1, 3 / ch + 1,
+                        4 / ch + 1, 5 / ch + 1, 6 / ch + 1, 7 / ch + 1);
+}
+
+TARGET_AVX2 static void gain_f32_avx2(void *pcm, ma_uint32 frames, ma_uint32 ch, float from, float step, int limit)
+{
+  float *s = pcm;
+  ma_uint32 samples = frames * ch, i = 0;
+
+  if (8 % ch == 0){
+    __m256 vfrom = _mm256_set1_ps(from), vstep = _mm256_set1_ps(step);
+    __m256 idx = lane_index_avx2(ch), inc = _mm256_set1_ps(8 / ch);
+
+    for (; i + 8 <= samples; i += 8){
+      __m256 v = _mm256_mul_ps(_mm256_loadu_ps(s + i), _mm256_add_ps(vfrom, _mm256_mul_ps(vstep, idx)));
+      if (limit) v = limit_avx2(v);
+      _mm256_storeu_ps(s + i, v);
+      idx = _mm256_add_ps(idx, inc);
+    }
+  }
+
+  gain_f32_scalar(s + i, frames - i / ch, ch, from + step * (i / ch), step, limit);
+}
+
+TARGET_AVX2 static void gain_s16_avx2(void *pcm, ma_uint32 frames, ma_uint32 ch, float from, float step, int limit)
+{
+  int16_t *s = pcm;
+  ma_uint32 samples = frames * ch, i = 0;
+
+  if (8 % ch == 0){
+    __m256 norm = _mm256_set1_ps(1.0f / 32768.0f), full = _mm256_set1_ps(32768.0f);
+    __m256 vfrom = _mm256_mul_ps(_mm256_set1_ps(from), norm), vstep = _mm256_mul_ps(_mm256_set1_ps(step), norm);
+    __m256 idx = lane_index_avx2(ch), inc = _mm256_set1_ps(8 / ch);
+
+    for (; i + 8 <= samples; i += 8){
+      __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(s + i))));
+      v = _mm256_mul_ps(v, _mm256_add_ps(vfrom, _mm256_mul_ps(vstep, idx)));
+      if (limit) v = limit_avx2(v);
+
+      __m256i x = _mm256_cvtps_epi32(_mm256_mul_ps(v, full));
+      // packs works per 128 bit lane, so pack the two halves by hand
+      __m128i out = _mm_packs_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+      _mm_storeu_si128((__m128i*)(s + i), out);
+      idx = _mm256_add_ps(idx, inc);
+    }
+  }
+
+  gain_s16_scalar(s + i, frames - i / ch, ch, from + step * (i / ch), step, limit);
+}
+
+TARGET_AVX2 static void gain_s32_avx2(void *pcm, ma_uint32 frames, ma_uint32 ch, float from, float step, int limit)
+{
+  int32_t *s = pcm;
+  ma_uint32 samples = frames * ch, i = 0;
+
+  if (8 % ch == 0){
+    __m256 vfrom = _mm256_set1_ps(from), vstep = _mm256_set1_ps(step);
+    __m256 idx = lane_index_avx2(ch), inc = _mm256_set1_ps(8 / ch);
+    __m256 norm = _mm256_set1_ps(1.0f / 2147483648.0f), full = _mm256_set1_ps(2147483648.0f);
+    __m256 lo = _mm256_set1_ps(-2147483648.0f), hi = _mm256_set1_ps(2147483520.0f);
+
+    for (; i + 8 <= samples; i += 8){
+      __m256 v = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(s + i)));
+      v = _mm256_mul_ps(_mm256_mul_ps(v, norm), _mm256_add_ps(vfrom, _mm256_mul_ps(vstep, idx)));
+      if (limit) v = limit_avx2(v);
+
+      v = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(v, full), lo), hi);
+      _mm256_storeu_si256((__m256i*)(s + i), _mm256_cvtps_epi32(v));
+      idx = _mm256_add_ps(idx, inc);
+    }
+  }
+
+  gain_s32_scalar(s + i, frames - i / ch, ch, from + step * (i / ch), step, limit);
+}
+#endif
+
+
+#ifdef GAIN_NEON
+// =================================================================
+// NEON (aarch64), 4 lanes, same layout as SSE2
+
+static inline float32x4_t limit_neon(float32x4_t v)
+{
+  const float32x4_t knee = vdupq_n_f32(GAIN_LIMIT_KNEE);
+  const float32x4_t range = vdupq_n_f32(1.0f - GAIN_LIMIT_KNEE);
+
+  float32x4_t a = vabsq_f32(v);
+  float32x4_t u = vdivq_f32(vmaxq_f32(vsubq_f32(a, knee), vdupq_n_f32(0.0f)), range);
+  float32x4_t y = vaddq_f32(vminq_f32(a, knee), vmulq_f32(range, vdivq_f32(u, vaddq_f32(vdupq_n_f32(1.0f), u))));
+
+  // put the sign of v back on y
+  return vbslq_f32(vdupq_n_u32(0x80000000), v, y);
+}
+
+static inline float32x4_t lane_index_neon(ma_uint32 ch)
+{
+  float idx[4] = { 0 / ch + 1, 1 / ch + 1, 2 / ch + 1, 3 / ch + 1 };
+  return vld1q_f32(idx);
+}
+
+static void gain_f32_neon(void *pcm, ma_uint32 frames, ma_uint32 ch, float from, float step, int limit)
+{
+  float *s = pcm;
+  ma_uint32 samples = frames * ch, i = 0;
+
+  if (4 % ch == 0){
+    float32x4_t vfrom = vdupq_n_f32(from), vstep = vdupq_n_f32(step);
+    float32x4_t idx = lane_index_neon(ch), inc = vdupq_n_f32(4 / ch);
+
+    for (; i + 4 <= samples; i += 4){
+      float32x4_t v = vmulq_f32(vld1q_f32(s + i), vmlaq_f32(vfrom, vstep, idx));
+      if (limit) v = limit_neon(v);
+      vst1q_f32(s + i, v);
+      idx = vaddq_f32(idx, inc);
+    }
+  }
+
+  gain_f32_scalar(s + i, frames - i / ch, ch, from + step * (i / ch), step, limit);
+}
+
+static void gain_s16_neon(void *pcm, ma_uint32 frames, ma_uint32 ch, float from, float step, int limit)
+{
+  int16_t *s = pcm;
+  ma_uint32 samples = frames * ch, i = 0;
+
+  if (4 % ch == 0){
+    float32x4_t vfrom = vdupq_n_f32(from * (1.0f / 32768.0f)), vstep = vdupq_n_f32(step * (1.0f / 32768.0f));
+    float32x4_t idx = lane_index_neon(ch), half = vdupq_n_f32(4 / ch);
+    float32x4_t full = vdupq_n_f32(32768.0f);
+
+    for (; i + 8 <= samples; i += 8){
+      int16x8_t x = vld1q_s16(s + i);
+      float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(x)));
+      float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(x)));
+
+      lo = vmulq_f32(lo, vmlaq_f32(vfrom, vstep, idx));
+      idx = vaddq_f32(idx, half);
+      hi = vmulq_f32(hi, vmlaq_f32(vfrom, vstep, idx));
+      idx = vaddq_f32(idx, half);
+
+      if (limit){
+        lo = limit_neon(lo);
+        hi = limit_neon(hi);
+      }
+
+      // vqmovn saturates like packs does on x86
+      int16x8_t out = vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(vmulq_f32(lo, full))),
+                                   vqmovn_s32(vcvtnq_s32_f32(vmulq_f32(hi, full))));
+      vst1q_s16(s + i, out);
+    }
+  }
+
+  gain_s16_scalar(s + i, frames - i / ch, ch, from + step * (i / ch), step, limit);
+}
+
+static void gain_s32_neon(void *pcm, ma_uint32 frames, ma_uint32 ch, float from, float step, int limit)
+{
+  int32_t *s = pcm;
+  ma_uint32 samples = frames * ch, i = 0;
+
+  if (4 % ch == 0){
+    float32x4_t vfrom = vdupq_n_f32(from), vstep = vdupq_n_f32(step);
+    float32x4_t idx = lane_index_neon(ch), inc = vdupq_n_f32(4 / ch);
+    float32x4_t norm = vdupq_n_f32(1.0f / 2147483648.0f), full = vdupq_n_f32(2147483648.0f);
+
+    for (; i + 4 <= samples; i += 4){
+      float32x4_t v = vmulq_f32(vcvtq_f32_s32(vld1q_s32(s + i)), norm);
+      v = vmulq_f32(v, vmlaq_f32(vfrom, vstep, idx));
+      if (limit) v = limit_neon(v);
+
+      // float -> int conversion saturates on arm, no clamp needed
+      vst1q_s32(s + i, vcvtnq_s32_f32(vmulq_f32(v, full)));
+      idx = vaddq_f32(idx, inc);
+    }
+  }
+
+  gain_s32_scalar(s + i, frames - i / ch, ch, from + step * (i / ch), step, limit);
+}
+#endif
+
+
+// =================================================================
+// runtime dispatch, picked once
+
+static void gain_pick(void)
+{
+  kernels.name = "scalar";
+  kernels.f32 = gain_f32_scalar;
+  kernels.s16 = gain_s16_scalar;
+  kernels.s32 = gain_s32_scalar;
+
+  #ifdef GAIN_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")){
+      kernels.name = "avx2";
+      kernels.f32 = gain_f32_avx2;
+      kernels.s16 = gain_s16_avx2;
+      kernels.s32 = gain_s32_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2")){
+      kernels.name = "sse2";
+      kernels.f32 = gain_f32_sse2;
+      kernels.s16 = gain_s16_sse2;
+      kernels.s32 = gain_s32_sse2;
+    }
+  #elif defined(GAIN_NEON)
+    kernels.name = "neon";
+    kernels.f32 = gain_f32_neon;
+    kernels.s16 = gain_s16_neon;
+    kernels.s32 = gain_s32_neon;
+  #endif
+}
+
+void gain_init(void)
+{
+  pthread_once(&kernels_once, gain_pick);
+}
+
+const char *gain_kernel_name(void)
+{
+  gain_init();
+  return kernels.name;
+}
+
+void gain_apply(void *pcm, ma_uint32 frames, ma_format fmt, ma_uint32 ch, float from, float to, int soft_limit)
+{
+  if (frames == 0 || ch == 0) return;
+
+  // flat unity block, nothing would change
+  if (from == 1.0f && to == 1.0f) return;
+
+  float step = (to - from) / frames;
+  // samples can't go over full scale unless the gain does
+  int limit = soft_limit && (from > 1.0f || to > 1.0f);
+
+  switch (fmt){
+    case ma_format_f32: kernels.f32(pcm, frames, ch, from, step, limit); break;
+    case ma_format_s16: kernels.s16(pcm, frames, ch, from, step, limit); break;
+    case ma_format_s32: kernels.s32(pcm, frames, ch, from, step, limit); break;
+    case ma_format_s24: gain_s24_scalar(pcm, frames, ch, from, step, limit); break;
+    case ma_format_u8: gain_u8_scalar(pcm, frames, ch, from, step, limit); break;
+    default: break;
+  }
+}
+
+void gain_limit(float *pcm, ma_uint32 samples)
+{
+  if (samples) kernels.f32(pcm, samples, 1, 1.0f, 0.0f, 1);
+}
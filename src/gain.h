@@ -0,0 +1,21 @@
+#ifndef GAIN_H
+#define GAIN_H
+
+#include "../libs/miniaudio.h"
+
+// where the soft limiter starts bending the curve (full scale = 1.0),
+// it only runs on blocks where the gain goes above unity
+#define GAIN_LIMIT_KNEE 0.9f
+
+void gain_init(void);
+const char *gain_kernel_name(void);
+
+// scale `frames` interleaved frames in place. the gain moves linearly from
+// `from` to `to` across the block (reaching `to` on the last frame) so volume
+// changes don't step. gain_init() must have run before this is called.
+void gain_apply(void *pcm, ma_uint32 frames, ma_format fmt, ma_uint32 ch, float from, float to, int soft_limit);
+
+// the soft limiter alone, for a sum that may have gone over full scale (--mix)
+void gain_limit(float *pcm, ma_uint32 samples);
+
+#endif
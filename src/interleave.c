@@ -0,0 +1,378 @@
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+  #define INTERLEAVE_X86
+  #define TARGET_SSE2 __attribute__((target("sse2")))
+  #define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#include "interleave.h"
+
+static struct {
+  const char *name;
+  interleave_fn stereo8, stereo16, stereo32;
+  interleave_fn multi8, multi16, multi32;   // more than two channels
+} kernels;
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+// mono is already "interleaved"
+#define MONO(bytes) \
+  static void interleave_mono##bytes(uint8_t *dst, const uint8_t *const *planes, int first, int frames, int ch) \
+  { \
+    (void)ch; \
+    memcpy(dst, planes[0] + first * bytes, frames * bytes); \
+  }
+
+MONO(1)
+MONO(2)
+MONO(4)
+
+
+// =================================================================
+// any channel count, one output frame at a time. the inner loop has a fixed
+// sample type so the compiler turns it into plain moves
+
+#define GENERIC(type, bytes) \
+  static void interleave_any##bytes(uint8_t *dst, const uint8_t *const *planes, int first, int frames, int ch) \
+  { \
+    type *out = (type*)dst; \
+    for (int i = first; i < first + frames; i++) \
+      for (int c = 0; c < ch; c++) \
+        *out++ = ((const type*)planes[c])[i]; \
+  }
+
+GENERIC(uint8_t, 1)
+GENERIC(uint16_t, 2)
+GENERIC(uint32_t, 4)
+
+
+#ifdef INTERLEAVE_X86
+// =================================================================
+// stereo, SSE2: unpack lo/hi zips L and R together
+
+TARGET_SSE2 static void interleave_stereo8_sse2(uint8_t *dst, const uint8_t *const *planes, int first, int frames, int ch)
+{
+  const uint8_t *l = planes[0] + first;
+  const uint8_t *r = planes[1] + first;
+  int i = 0;
+
+  for (; i + 16 <= frames; i += 16){
+    __m128i a = _mm_loadu_si128((const __m128i*)(l + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(r + i));
+    _mm_storeu_si128((__m128i*)(dst + 2 * i), _mm_unpacklo_epi8(a, b));
+    _mm_storeu_si128((__m128i*)(dst + 2 * i + 16), _mm_unpackhi_epi8(a, b));
+  }
+
+  interleave_any1(dst + 2 * i, planes, first + i, frames - i, ch);
+}
+
+TARGET_SSE2 static void interleave_stereo16_sse2(uint8_t *dst, const uint8_t *const *planes, int first, int frames, int ch)
+{
+  const int16_t *l = (const int16_t*)planes[0] + first;
+  const int16_t *r = (const int16_t*)planes[1] + first;
+  int16_t *out = (int16_t*)dst;
+  int i = 0;
+
+  for (; i + 8 <= frames; i += 8){
+    __m128i a = _mm_loadu_si128((const __m128i*)(l + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(r + i));
+    _mm_storeu_si128((__m128i*)(out + 2 * i), _mm_unpacklo_epi16(a, b));
+    _mm_storeu_si128((__m128i*)(out + 2 * i + 8), _mm_unpackhi_epi16(a, b));
+  }
+
+  interleave_any2(dst + 4 * i, planes, first + i, frames - i, ch);
+}
+
+TARGET_SSE2 static void interleave_stereo32_sse2(uint8_t *dst, const uint8_t *const *planes, int first, int frames, int ch)
+{
+  const int32_t *l = (const int32_t*)planes[0] + first;
+  const int32_t *r = (const int32_t*)planes[1] + first;
+  int32_t *out = (int32_t*)dst;
+  int i = 0;
+
+  for (; i + 4 <= frames; i += 4){
+    __m128i a = _mm_loadu_si128((const __m128i*)(l + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(r + i));
+    _mm_storeu_si128((__m128i*)(out + 2 * i), _mm_unpacklo_epi32(a, b));
+    _mm_storeu_si128((__m128i*)(out + 2 * i + 4), _mm_unpackhi_epi32(a, b));
+  }
+
+  interleave_any4(dst + 8 * i, planes, first + i, frames - i, ch);
+}
+
+
+// =================================================================
+// stereo, AVX2: unpack works inside each 128 bit half, a cross-lane
+// permute puts the halves back in order
+
+TARGET_AVX2 static void interleave_stereo8_avx2(uint8_t *dst, const uint8_t *const *planes, int first, int frames, int ch)
+{
+  const uint8_t *l = planes[0] + first;
+  const uint8_t *r = planes[1] + first;
+  int i = 0;
+
+  for (; i + 32 <= frames; i += 32){
+    __m256i a = _mm256_loadu_si256((const __m256i*)(l + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(r + i));
+    __m256i lo = _mm256_unpacklo_epi8(a, b);
+    __m256i hi = _mm256_unpackhi_epi8(a, b);
+    _mm256_storeu_si256((__m256i*)(dst + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i*)(dst + 2 * i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+
+  interleave_stereo8_sse2(dst + 2 * i, planes, first + i, frames - i, ch);
+}
+
+TARGET_AVX2 static void interleave_stereo16_avx2(uint8_t *dst, const uint8_t *const *planes, int first, int frames, int ch)
+{
+  const int16_t *l = (const int16_t*)planes[0] + first;
+  const int16_t *r = (const int16_t*)planes[1] + first;
+  int16_t *out = (int16_t*)dst;
+  int i = 0;
+
+  for (; i + 16 <= frames; i += 16){
+    __m256i a = _mm256_loadu_si256((const __m256i*)(l + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(r + i));
+    __m256i lo = _mm256_unpacklo_epi16(a, b);
+    __m256i hi = _mm256_unpackhi_epi16(a, b);
+    _mm256_storeu_si256((__m256i*)(out + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i*)(out + 2 * i + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+
+  interleave_stereo16_sse2(dst + 4 * i, planes, first + i, frames - i, ch);
+}
+
+TARGET_AVX2 static void interleave_stereo32_avx2(uint8_t *dst, const uint8_t *const *planes, int first, int frames, int ch)
+{
+  const int32_t *l = (const int32_t*)planes[0] + first;
+  const int32_t *r = (const int32_t*)planes[1] + first;
+  int32_t *out = (int32_t*)dst;
+  int i = 0;
+
+  for (; i + 8 <= frames; i += 8){
+    __m256i a = _mm256_loadu_si256((const __m256i*)(l + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(r + i));
+    __m256i lo = _mm256_unpacklo_epi32(a, b);
+    __m256i hi = _mm256_unpackhi_epi32(a, b);
+    _mm256_storeu_si256((__m256i*)(out + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i*)(out + 2 * i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+
+  interleave_stereo32_sse2(dst + 8 * i, planes, first + i, frames - i, ch);
+}
+
+
+// =================================================================
+// more than two channels (5.1, 7.1, ...): a transpose, four planes at a
+// time. unpacking a with b and c with d zips them into pairs, unpacking the
+// pairs at twice the width puts each frame's four samples next to each
+// other. those go where that frame's channels are in the output. two planes
+// left over stop after the first round, a last odd one is copied.
+// `w` is the sample size, a 128 bit block holds `n` = 16 / w frames
+
+// the frames in `v`, `size` bytes of each, `stride` apart in the output.
+// size is a constant wherever this is inlined, only one case is left
+TARGET_SSE2 static inline void scatter(uint8_t *o, int stride, __m128i v, int size)
+{
+  switch (size){
+    case 16:
+      _mm_storeu_si128((__m128i*)o, v);
+      break;
+
+    case 8:
+      _mm_storel_epi64((__m128i*)o, v);
+      _mm_storel_epi64((__m128i*)(o + stride), _mm_unpackhi_epi64(v, v));
+      break;
+
+    case 4:
+      for (int k = 0; k < 4; k++, v = _mm_srli_si128(v, 4)){
+        int32_t x = _mm_cvtsi128_si32(v);
+        memcpy(o + k * stride, &x, 4);
+      }
+      break;
+
+    case 2:
+      for (int k = 0; k < 8; k++, v = _mm_srli_si128(v, 2)){
+        int16_t x = _mm_cvtsi128_si32(v);
+        memcpy(o + k * stride, &x, 2);
+      }
+      break;
+  }
+}
+
+// the second round's results hold a quarter of the block's frames each
+TARGET_SSE2 static inline void scatter_quad(uint8_t *o, int stride, int n, __m128i q0, __m128i q1, __m128i q2, __m128i q3, int size)
+{
+  scatter(o, stride, q0, size);
+  scatter(o + n / 4 * stride, stride, q1, size);
+  scatter(o + n / 2 * stride, stride, q2, size);
+  scatter(o + 3 * n / 4 * stride, stride, q3, size);
+}
+
+#define MULTI_SSE2(bits, w, zip, pair) \
+  TARGET_SSE2 static void interleave_multi##bits##_sse2(uint8_t *dst, const uint8_t *const *planes, int first, int frames, int ch) \
+  { \
+    const int n = 16 / w, stride = ch * w; \
+    int i = 0; \
+    \
+    for (; i + n <= frames; i += n){ \
+      uint8_t *o = dst + i * stride; \
+      int c = 0; \
+      \
+      for (; c + 4 <= ch; c += 4){ \
+        __m128i a = _mm_loadu_si128((const __m128i*)(planes[c] + (first + i) * w)); \
+        __m128i b = _mm_loadu_si128((const __m128i*)(planes[c + 1] + (first + i) * w)); \
+        __m128i x = _mm_loadu_si128((const __m128i*)(planes[c + 2] + (first + i) * w)); \
+        __m128i y = _mm_loadu_si128((const __m128i*)(planes[c + 3] + (first + i) * w)); \
+        __m128i ab0 = _mm_unpacklo_##zip(a, b), ab1 = _mm_unpackhi_##zip(a, b); \
+        __m128i xy0 = _mm_unpacklo_##zip(x, y), xy1 = _mm_unpackhi_##zip(x, y); \
+        \
+        scatter_quad(o + c * w, stride, n, _mm_unpacklo_##pair(ab0, xy0), _mm_unpackhi_##pair(ab0, xy0), \
+          _mm_unpacklo_##pair(ab1, xy1), _mm_unpackhi_##pair(ab1, xy1), 4 * w); \
+      } \
+      \
+      if (c + 2 <= ch){ \
+        __m128i a = _mm_loadu_si128((const __m128i*)(planes[c] + (first + i) * w)); \
+        __m128i b = _mm_loadu_si128((const __m128i*)(planes[c + 1] + (first + i) * w)); \
+        scatter(o + c * w, stride, _mm_unpacklo_##zip(a, b), 2 * w); \
+        scatter(o + n / 2 * stride + c * w, stride, _mm_unpackhi_##zip(a, b), 2 * w); \
+        c += 2; \
+      } \
+      \
+      for (; c < ch; c++) \
+        for (int k = 0; k < n; k++) memcpy(o + k * stride + c * w, planes[c] + (first + i + k) * w, w); \
+    } \
+    \
+    interleave_any##w(dst + i * stride, planes, first + i, frames - i, ch); \
+  }
+
+// the same on 256 bits. unpack stays inside each 128 bit half, so every
+// result is two blocks: the low half's frames, then n frames on the high's
+#define MULTI_AVX2(bits, w, zip, pair) \
+  TARGET_AVX2 static void interleave_multi##bits##_avx2(uint8_t *dst, const uint8_t *const *planes, int first, int frames, int ch) \
+  { \
+    const int n = 16 / w, stride = ch * w; \
+    int i = 0; \
+    \
+    for (; i + 2 * n <= frames; i += 2 * n){ \
+      uint8_t *o = dst + i * stride; \
+      int c = 0; \
+      \
+      for (; c + 4 <= ch; c += 4){ \
+        __m256i a = _mm256_loadu_si256((const __m256i*)(planes[c] + (first + i) * w)); \
+        __m256i b = _mm256_loadu_si256((const __m256i*)(planes[c + 1] + (first + i) * w)); \
+        __m256i x = _mm256_loadu_si256((const __m256i*)(planes[c + 2] + (first + i) * w)); \
+        __m256i y = _mm256_loadu_si256((const __m256i*)(planes[c + 3] + (first + i) * w)); \
+        __m256i ab0 = _mm256_unpacklo_##zip(a, b), ab1 = _mm256_unpackhi_##zip(a, b); \
+        __m256i xy0 = _mm256_unpacklo_##zip(x, y), xy1 = _mm256_unpackhi_##zip(x, y); \
+        __m256i q0 = _mm256_unpacklo_##pair(ab0, xy0), q1 = _mm256_unpackhi_##pair(ab0, xy0); \
+        __m256i q2 = _mm256_unpacklo_##pair(ab1, xy1), q3 = _mm256_unpackhi_##pair(ab1, xy1); \
+        \
+        scatter_quad(o + c * w, stride, n, _mm256_castsi256_si128(q0), _mm256_castsi256_si128(q1), \
+          _mm256_castsi256_si128(q2), _mm256_castsi256_si128(q3), 4 * w); \
+        scatter_quad(o + n * stride + c * w, stride, n, _mm256_extracti128_si256(q0, 1), _mm256_extracti128_si256(q1, 1), \
+          _mm256_extracti128_si256(q2, 1), _mm256_extracti128_si256(q3, 1), 4 * w); \
+      } \
+      \
+      if (c + 2 <= ch){ \
+        __m256i a = _mm256_loadu_si256((const __m256i*)(planes[c] + (first + i) * w)); \
+        __m256i b = _mm256_loadu_si256((const __m256i*)(planes[c + 1] + (first + i) * w)); \
+        __m256i ab0 = _mm256_unpacklo_##zip(a, b), ab1 = _mm256_unpackhi_##zip(a, b); \
+        \
+        scatter(o + c * w, stride, _mm256_castsi256_si128(ab0), 2 * w); \
+        scatter(o + n / 2 * stride + c * w, stride, _mm256_castsi256_si128(ab1), 2 * w); \
+        scatter(o + n * stride + c * w, stride, _mm256_extracti128_si256(ab0, 1), 2 * w); \
+        scatter(o + 3 * n / 2 * stride + c * w, stride, _mm256_extracti128_si256(ab1, 1), 2 * w); \
+        c += 2; \
+      } \
+      \
+      for (; c < ch; c++) \
+        for (int k = 0; k < 2 * n; k++) memcpy(o + k * stride + c * w, planes[c] + (first + i + k) * w, w); \
+    } \
+    \
+    interleave_multi##bits##_sse2(dst + i * stride, planes, first + i, frames - i, ch); \
+  }
+
+MULTI_SSE2(8, 1, epi8, epi16)
+MULTI_SSE2(16, 2, epi16, epi32)
+MULTI_SSE2(32, 4, epi32, epi64)
+
+// no 16 bit one: its frames are 8 byte stores either way, the lane extracts
+// only added to that and it came out slower than sse2 (bench/interleave.c)
+MULTI_AVX2(8, 1, epi8, epi16)
+MULTI_AVX2(32, 4, epi32, epi64)
+#endif
+
+
+// =================================================================
+// runtime dispatch, picked once
+
+static void interleave_pick(void)
+{
+  kernels.name = "scalar";
+  kernels.stereo8 = kernels.multi8 = interleave_any1;
+  kernels.stereo16 = kernels.multi16 = interleave_any2;
+  kernels.stereo32 = kernels.multi32 = interleave_any4;
+
+  #ifdef INTERLEAVE_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")){
+      kernels.name = "avx2";
+      kernels.stereo8 = interleave_stereo8_avx2;
+      kernels.stereo16 = interleave_stereo16_avx2;
+      kernels.stereo32 = interleave_stereo32_avx2;
+      kernels.multi8 = interleave_multi8_avx2;
+      kernels.multi16 = interleave_multi16_sse2;
+      kernels.multi32 = interleave_multi32_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2")){
+      kernels.name = "sse2";
+      kernels.stereo8 = interleave_stereo8_sse2;
+      kernels.stereo16 = interleave_stereo16_sse2;
+      kernels.stereo32 = interleave_stereo32_sse2;
+      kernels.multi8 = interleave_multi8_sse2;
+      kernels.multi16 = interleave_multi16_sse2;
+      kernels.multi32 = interleave_multi32_sse2;
+    }
+  #endif
+}
+
+const char *interleave_kernel_name(void)
+{
+  pthread_once(&kernels_once, interleave_pick);
+  return kernels.name;
+}
+
+interleave_fn interleave_get(int sample_bytes, int ch)
+{
+  pthread_once(&kernels_once, interleave_pick);
+
+  if (ch == 1){
+    switch (sample_bytes){
+      case 1: return interleave_mono1;
+      case 2: return interleave_mono2;
+      case 4: return interleave_mono4;
+    }
+  }
+
+  if (ch == 2){
+    switch (sample_bytes){
+      case 1: return kernels.stereo8;
+      case 2: return kernels.stereo16;
+      case 4: return kernels.stereo32;
+    }
+  }
+
+  switch (sample_bytes){
+    case 1: return kernels.multi8;
+    case 2: return kernels.multi16;
+    case 4: return kernels.multi32;
+  }
+
+  return NULL;
+}
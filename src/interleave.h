@@ -0,0 +1,15 @@
+#ifndef INTERLEAVE_H
+#define INTERLEAVE_H
+
+#include <stdint.h>
+
+// copy `frames` frames, starting at frame `first` of every plane, into
+// interleaved dst. the kernel only cares about the sample size, so f32 and
+// s32 share one.
+typedef void (*interleave_fn)(uint8_t *dst, const uint8_t *const *planes, int first, int frames, int ch);
+
+// NULL if there's no kernel for that sample size
+interleave_fn interleave_get(int sample_bytes, int ch);
+const char *interleave_kernel_name(void);
+
+#endif
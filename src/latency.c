@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "control.h"
+#include "latency.h"
+
+#define PROBE_ROUNDS 20
+
+uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void slot_record(Latency_Slot *slot, uint64_t stamp)
+{
+  uint64_t took = now_ns() - stamp;
+
+  atomic_fetch_add_explicit(&slot->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&slot->total_ns, took, memory_order_relaxed);
+
+  if (took > atomic_load_explicit(&slot->max_ns, memory_order_relaxed))
+    atomic_store_explicit(&slot->max_ns, took, memory_order_relaxed);
+}
+
+// called from the audio callback once the block carrying the command's effect
+// has been handed to the device (the "loopback" point)
+void latency_record(Latency_Stats *ls, Command_Type type, uint64_t stamp)
+{
+  slot_record(&ls->slots[type], stamp);
+}
+
+// the decoder's half of a skip: from the key to the new track having audio
+// ready. the rest is waiting for the callback to drop the old track's data
+// and come back for more, a period or so
+void latency_record_skip(Latency_Stats *ls, uint64_t stamp)
+{
+  slot_record(&ls->skip_ready, stamp);
+}
+
+static void slot_report(Latency_Slot *slot, const char *name)
+{
+  unsigned count = atomic_load(&slot->count);
+  if (!count) return;
+
+  printf("  %-12s n=%-4u avg %.2fms  max %.2fms\n", name, count,
+    atomic_load(&slot->total_ns) / (double)count / 1e6,
+    atomic_load(&slot->max_ns) / 1e6
+  );
+}
+
+void latency_report(Latency_Stats *ls)
+{
+  static const char *names[CMD_COUNT] = {
+    [CMD_TOGGLE] = "toggle",
+    [CMD_PAUSE] = "pause",
+    [CMD_RESUME] = "resume",
+    [CMD_VOLUME_UP] = "volume up",
+    [CMD_VOLUME_DOWN] = "volume down",
+    [CMD_SEEK] = "seek",
+    [CMD_NEXT] = "next track",
+    [CMD_PREV] = "prev track",
+  };
+
+  printf("command -> output latency (device period %u frames, %.2fms)\n",
+    ls->period_frames, ls->sample_rate ? ls->period_frames * 1000.0 / ls->sample_rate : 0.0
+  );
+
+  for (int i = 0; i < CMD_COUNT; i++)
+    slot_report(&ls->slots[i], names[i]);
+
+  slot_report(&ls->skip_ready, "skip, ready");
+}
+
+// stands in for the keyboard thread when running with --latency: fires every
+// kind of command with a random gap so they don't line up with the periods
+void *run_latency_probe(void *arg)
+{
+  PlayBackState *state = (PlayBackState*)arg;
+
+  void (*script[])(PlayBackState*) = {
+    playback_pause, playback_resume,
+    volume_decrease, volume_increase,
+    seek_forward, seek_backward,
+    track_next, track_prev,
+  };
+  int script_len = sizeof(script) / sizeof(script[0]);
+
+  // skipping only goes somewhere with more than one file
+  if (!state->queue || !queue_get(state->queue, 1)) script_len -= 2;
+
+  srand(time(NULL));
+  usleep(300000); // let the buffer fill up first
+
+  for (int round = 0; round < PROBE_ROUNDS; round++){
+    for (int i = 0; i < script_len; i++){
+      if (!atomic_load(&state->running)) return NULL;
+
+      script[i](state);
+      usleep(100000 + rand() % 100000);
+    }
+  }
+
+  playback_stop(state);
+  return NULL;
+}
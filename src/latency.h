@@ -0,0 +1,34 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "command.h"
+
+// command -> output latency, per command type. written by the audio callback
+// only, read once playback is over.
+typedef struct {
+  atomic_uint count;
+  atomic_ullong total_ns;
+  atomic_ullong max_ns;
+
+} Latency_Slot;
+
+typedef struct {
+  Latency_Slot slots[CMD_COUNT];
+  Latency_Slot skip_ready;     // next/prev -> first frame of the new track converted
+  unsigned period_frames;      // what the device actually asked for
+  unsigned sample_rate;
+
+} Latency_Stats;
+
+uint64_t now_ns(void);
+
+void latency_record(Latency_Stats *ls, Command_Type type, uint64_t stamp);
+void latency_record_skip(Latency_Stats *ls, uint64_t stamp);
+void latency_report(Latency_Stats *ls);
+
+void *run_latency_probe(void *arg);
+
+#endif
@@ -0,0 +1,469 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <libavutil/dict.h>
+
+#include "loudness.h"
+#include "utils.h"
+
+// =================================================================
+// meter
+
+static double energy_to_lufs(double e)
+{
+  return e > 0 ? -0.691 + 10.0 * log10(e) : -HUGE_VAL;
+}
+
+// the two K-weighting stages for any rate, the BS.1770 analog prototypes
+// through the bilinear transform (same numbers libebur128 uses)
+static void k_weighting(Loudness_Meter *m)
+{
+  double f0 = 1681.974450955533, G = 3.999843853973347, Q = 0.7071752369554196;
+  double K = tan(M_PI * f0 / m->rate);
+  double Vh = pow(10.0, G / 20.0);
+  double Vb = pow(Vh, 0.4996667741545416);
+  double a0 = 1.0 + K / Q + K * K;
+
+  m->shelf_b[0] = (Vh + Vb * K / Q + K * K) / a0;
+  m->shelf_b[1] = 2.0 * (K * K - Vh) / a0;
+  m->shelf_b[2] = (Vh - Vb * K / Q + K * K) / a0;
+  m->shelf_a[1] = 2.0 * (K * K - 1.0) / a0;
+  m->shelf_a[2] = (1.0 - K / Q + K * K) / a0;
+
+  f0 = 38.13547087602444;
+  Q = 0.5003270373238773;
+  K = tan(M_PI * f0 / m->rate);
+  a0 = 1.0 + K / Q + K * K;
+
+  m->hp_b[0] = 1.0;
+  m->hp_b[1] = -2.0;
+  m->hp_b[2] = 1.0;
+  m->hp_a[1] = 2.0 * (K * K - 1.0) / a0;
+  m->hp_a[2] = (1.0 - K / Q + K * K) / a0;
+}
+
+// hann windowed sinc, each phase scaled to unity gain at DC
+static int true_peak_taps(Loudness_Meter *m)
+{
+  m->over = m->rate < 96000 ? 4 : m->rate < 192000 ? 2 : 1;
+  int n = m->over * LOUD_TP_TAPS;
+
+  if (!(m->taps = malloc(n * sizeof(float)))) return -1;
+
+  double *h = malloc(n * sizeof(double));
+  if (!h) return -1;
+
+  for (int i = 0; i < n; i++) {
+    double x = (i - (n - 1) / 2.0) / m->over;
+    double sinc = x == 0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+    h[i] = sinc * (0.5 - 0.5 * cos(2.0 * M_PI * (i + 0.5) / n));
+  }
+
+  for (int p = 0; p < m->over; p++) {
+    double sum = 0;
+    for (int k = 0; k < LOUD_TP_TAPS; k++) sum += h[p + k * m->over];
+
+    // reversed, so the newest sample meets the first tap
+    for (int k = 0; k < LOUD_TP_TAPS; k++)
+      m->taps[p * LOUD_TP_TAPS + k] = h[p + (LOUD_TP_TAPS - 1 - k) * m->over] / sum;
+  }
+
+  free(h);
+  return 0;
+}
+
+int loudness_init(Loudness_Meter *m, int rate, int ch)
+{
+  *m = (Loudness_Meter){0};
+  if (ch <= 0 || ch > LOUD_MAX_CH || rate < 8000) return -1;
+
+  m->rate = rate;
+  m->ch = ch;
+  m->sub_len = rate / 10;
+
+  // the usual order (FL FR FC LFE BL BR...): the LFE doesn't count and the
+  // surrounds weigh 1.41. stereo and mono are all 1.0
+  for (int c = 0; c < ch; c++)
+    m->weight[c] = ch < 6 || c < 3 ? 1.0 : c == 3 ? 0.0 : 1.41;
+
+  k_weighting(m);
+
+  m->count = calloc(LOUD_BINS, sizeof(uint32_t));
+  m->energy = calloc(LOUD_BINS, sizeof(double));
+  if (!m->count || !m->energy || true_peak_taps(m) < 0) {
+    loudness_free(m);
+    return -1;
+  }
+  return 0;
+}
+
+void loudness_free(Loudness_Meter *m)
+{
+  free(m->count);
+  free(m->energy);
+  free(m->taps);
+  m->count = NULL;
+  m->energy = NULL;
+  m->taps = NULL;
+}
+
+static void add_block(Loudness_Meter *m, double e)
+{
+  double lufs = energy_to_lufs(e);
+  if (lufs < -70.0) return; // absolute gate
+
+  int bin = (lufs + 70.0) / LOUD_BIN_LU;
+  if (bin >= LOUD_BINS) bin = LOUD_BINS - 1;
+
+  m->count[bin]++;
+  m->energy[bin] += e;
+}
+
+static inline double biquad(double x, const double *b, const double *a, double *z)
+{
+  double y = b[0] * x + z[0];
+  z[0] = b[1] * x - a[1] * y + z[1];
+  z[1] = b[2] * x - a[2] * y;
+  return y;
+}
+
+void loudness_add(Loudness_Meter *m, const float *pcm, int frames)
+{
+  int ch = m->ch;
+  int over = m->over;
+  float peak = m->peak;
+
+  for (int i = 0; i < frames; i++) {
+    const float *frame = pcm + i * ch;
+    int pos = m->hist_pos;
+
+    for (int c = 0; c < ch; c++) {
+      float x = frame[c];
+      double y = biquad(x, m->shelf_b, m->shelf_a, m->z[c]);
+      y = biquad(y, m->hp_b, m->hp_a, m->z[c] + 2);
+      m->sub_sum += m->weight[c] * y * y;
+
+      // sample peak, then the in-between samples the DAC will make
+      float a = fabsf(x);
+      if (a > peak) peak = a;
+
+      if (over > 1) {
+        float *h = m->hist[c];
+        h[pos] = h[pos + LOUD_TP_TAPS] = x;
+
+        for (int p = 0; p < over; p++) {
+          const float *t = m->taps + p * LOUD_TP_TAPS;
+          const float *s = h + pos + 1;
+          float acc = 0;
+          for (int k = 0; k < LOUD_TP_TAPS; k++) acc += t[k] * s[k];
+          if (fabsf(acc) > peak) peak = fabsf(acc);
+        }
+      }
+    }
+
+    m->hist_pos = pos + 1 == LOUD_TP_TAPS ? 0 : pos + 1;
+
+    // a 100ms sub-block is done, a 400ms block is the last four of them
+    if (++m->sub_n == m->sub_len) {
+      m->subs[m->subs_seen++ & 3] = m->sub_sum / m->sub_len;
+      m->sub_sum = 0;
+      m->sub_n = 0;
+
+      if (m->subs_seen >= 4)
+        add_block(m, (m->subs[0] + m->subs[1] + m->subs[2] + m->subs[3]) / 4.0);
+    }
+  }
+
+  m->peak = peak;
+}
+
+void loudness_merge(Loudness_Meter *album, const Loudness_Meter *track)
+{
+  for (int i = 0; i < LOUD_BINS; i++) {
+    album->count[i] += track->count[i];
+    album->energy[i] += track->energy[i];
+  }
+  if (track->peak > album->peak) album->peak = track->peak;
+}
+
+double loudness_integrated(const Loudness_Meter *m)
+{
+  double sum = 0;
+  uint64_t n = 0;
+
+  for (int i = 0; i < LOUD_BINS; i++) {
+    sum += m->energy[i];
+    n += m->count[i];
+  }
+  if (!n) return -HUGE_VAL;
+
+  // relative gate: 10 LU under what the absolute gate let through. the bin
+  // the gate falls in counts whole, it's 0.1 LU wide
+  double gate = energy_to_lufs(sum / n) - 10.0;
+  int from = (gate + 70.0) / LOUD_BIN_LU;
+  if (from < 0) from = 0;
+
+  sum = 0;
+  n = 0;
+  for (int i = from; i < LOUD_BINS; i++) {
+    sum += m->energy[i];
+    n += m->count[i];
+  }
+
+  return n ? energy_to_lufs(sum / n) : -HUGE_VAL;
+}
+
+// =================================================================
+// cache
+
+// fnv-1a
+static uint64_t path_hash(const char *s)
+{
+  uint64_t h = 0xcbf29ce484222325ull;
+  while (*s) h = (h ^ (unsigned char)*s++) * 0x100000001b3ull;
+  return h;
+}
+
+static Loudness_Entry *cache_slot(Loudness_Cache *c, const char *path)
+{
+  if (!c->cap) return NULL;
+
+  for (uint64_t i = path_hash(path);; i++) {
+    Loudness_Entry *e = &c->slots[i & (c->cap - 1)];
+    if (!e->path || !strcmp(e->path, path)) return e;
+  }
+}
+
+static int cache_grow(Loudness_Cache *c)
+{
+  Loudness_Cache grown = { .cap = c->cap ? c->cap * 2 : 256 };
+
+  if (!(grown.slots = calloc(grown.cap, sizeof(Loudness_Entry)))) return -1;
+
+  for (int i = 0; i < c->cap; i++) {
+    if (!c->slots[i].path) continue;
+    *cache_slot(&grown, c->slots[i].path) = c->slots[i];
+    grown.count++;
+  }
+
+  free(c->slots);
+  *c = grown;
+  return 0;
+}
+
+int loudness_cache_put(Loudness_Cache *c, const Loudness_Entry *e)
+{
+  // kept at most half full
+  if ((c->count + 1) * 2 > c->cap && cache_grow(c) < 0) return -1;
+
+  Loudness_Entry *slot = cache_slot(c, e->path);
+
+  if (slot->path) {
+    char *path = slot->path;
+    *slot = *e;
+    slot->path = path;
+    slot->changed = 1;
+    c->dirty = 1;
+    return 0;
+  }
+
+  *slot = *e;
+  if (!(slot->path = strdup(e->path))) return -1;
+  slot->changed = 1;
+  c->count++;
+  c->dirty = 1;
+  return 0;
+}
+
+int loudness_cache_load(Loudness_Cache *c)
+{
+  *c = (Loudness_Cache){0};
+
+  char file[PATH_MAX];
+  if (cache_path(file, sizeof(file), "loudness", 0) < 0) return -1;
+
+  FILE *f = fopen(file, "r");
+  if (!f) return errno == ENOENT ? 0 : -1; // nothing analyzed yet
+
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t read;
+
+  while ((read = getline(&line, &line_cap, f)) > 0) {
+    Loudness_Entry e = {0};
+    long long from, to, mtime, size;
+    int path_at = 0;
+
+    if (line[0] == '#') continue;
+    if (line[read - 1] == '\n') line[read - 1] = '\0';
+
+    // lines from before --trim have no from/to, and a path can't pass for a number
+    int got = sscanf(line, "%f %f %f %f %lld %lld %lld %lld %n", &e.track_lufs, &e.track_peak, &e.album_lufs,
+      &e.album_peak, &from, &to, &mtime, &size, &path_at);
+
+    if (got == 8) {
+      e.audio_from = from;
+      e.audio_to = to;
+    }
+    else if (sscanf(line, "%f %f %f %f %lld %lld %n", &e.track_lufs, &e.track_peak, &e.album_lufs, &e.album_peak,
+      &mtime, &size, &path_at) < 6)
+      continue;
+
+    if (!path_at || !line[path_at]) continue;
+
+    e.mtime = mtime;
+    e.size = size;
+    e.path = line + path_at;
+    loudness_cache_put(c, &e);
+  }
+
+  free(line);
+  fclose(f);
+  for (int i = 0; i < c->cap; i++) c->slots[i].changed = 0;
+  c->dirty = 0;
+  return 0;
+}
+
+// the whole table, into a temp file renamed over the old one
+static int cache_write(const Loudness_Cache *c, const char *file)
+{
+  char tmp[PATH_MAX + 8];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+
+  FILE *f = fopen(tmp, "w");
+  if (!f) return -1;
+
+  fprintf(f, "# tomu loudness: track LUFS, track peak, album LUFS, album peak, sound from, sound to, mtime, size, path\n");
+
+  for (int i = 0; i < c->cap; i++) {
+    Loudness_Entry *e = &c->slots[i];
+    if (!e->path) continue;
+
+    fprintf(f, "%.2f %.6f %.2f %.6f %lld %lld %lld %lld %s\n", e->track_lufs, e->track_peak, e->album_lufs,
+      e->album_peak, (long long)e->audio_from, (long long)e->audio_to, (long long)e->mtime, (long long)e->size, e->path);
+  }
+
+  if (fclose(f) != 0 || rename(tmp, file) < 0) {
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+// the file as it is now with ours put over it. the lock keeps two tomus from
+// both reading the old file and the second rename losing the first one's
+// entries (the tmp file is shared too)
+int loudness_cache_save(Loudness_Cache *c)
+{
+  char file[PATH_MAX], lock_file[PATH_MAX + 8];
+  Loudness_Cache disk;
+  int ret = -1;
+
+  if (cache_path(file, sizeof(file), "loudness", 1) < 0) return -1;
+  snprintf(lock_file, sizeof(lock_file), "%s.lock", file);
+
+  int lock = open(lock_file, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (lock < 0) return -1;
+  while (flock(lock, LOCK_EX) < 0)
+    if (errno != EINTR) goto out;
+
+  // one that can't be read any more is written over, as it would be at the next load
+  if (loudness_cache_load(&disk) < 0) disk = (Loudness_Cache){0};
+
+  for (int i = 0; i < c->cap; i++) {
+    Loudness_Entry *e = &c->slots[i];
+    if (e->path && e->changed && loudness_cache_put(&disk, e) < 0) goto merged;
+  }
+
+  if (cache_write(&disk, file) < 0) goto merged;
+
+  for (int i = 0; i < c->cap; i++) c->slots[i].changed = 0;
+  c->dirty = 0;
+  ret = 0;
+
+merged:
+  loudness_cache_free(&disk);
+out:
+  close(lock);
+  return ret;
+}
+
+void loudness_cache_free(Loudness_Cache *c)
+{
+  for (int i = 0; i < c->cap; i++) free(c->slots[i].path);
+  free(c->slots);
+  *c = (Loudness_Cache){0};
+}
+
+const Loudness_Entry *loudness_cache_get(Loudness_Cache *c, const char *path)
+{
+  char real[PATH_MAX];
+  struct stat st;
+
+  if (!c || !c->count || !realpath(path, real) || stat(real, &st) < 0) return NULL;
+
+  Loudness_Entry *e = cache_slot(c, real);
+  if (!e->path || e->mtime != st.st_mtime || e->size != st.st_size) return NULL;
+  return e;
+}
+
+// =================================================================
+// replaygain
+
+static int tag_db(AVDictionary *tags, AVDictionary *stream_tags, const char *key, double *out)
+{
+  AVDictionaryEntry *t = av_dict_get(tags, key, NULL, 0);
+  if (!t) t = av_dict_get(stream_tags, key, NULL, 0);
+  if (!t) return 0;
+
+  char *end;
+  *out = strtod(t->value, &end);
+  return end != t->value;
+}
+
+float replaygain_gain(Loudness_Cache *c, const char *path, AVDictionary *tags, AVDictionary *stream_tags,
+  ReplayGain_Mode mode, const char **from)
+{
+  const Loudness_Entry *e = loudness_cache_get(c, path);
+  int album = mode == REPLAYGAIN_ALBUM;
+  double db, peak = 0, r128;
+
+  *from = NULL;
+  if (mode == REPLAYGAIN_OFF) return 1.0f;
+
+  if (e && (album ? e->album_lufs : e->track_lufs) > -70) {
+    db = REPLAYGAIN_REF - (album ? e->album_lufs : e->track_lufs);
+    peak = album ? e->album_peak : e->track_peak;
+    *from = album ? "album, measured" : "track, measured";
+  }
+  else if (album && tag_db(tags, stream_tags, "REPLAYGAIN_ALBUM_GAIN", &db)) {
+    tag_db(tags, stream_tags, "REPLAYGAIN_ALBUM_PEAK", &peak);
+    *from = "album, tags";
+  }
+  else if (tag_db(tags, stream_tags, "REPLAYGAIN_TRACK_GAIN", &db)) {
+    tag_db(tags, stream_tags, "REPLAYGAIN_TRACK_PEAK", &peak);
+    *from = "track, tags";
+  }
+  // opus: Q7.8 dB against -23 LUFS, five under our reference
+  else if ((album && tag_db(tags, stream_tags, "R128_ALBUM_GAIN", &r128)) || tag_db(tags, stream_tags, "R128_TRACK_GAIN", &r128)) {
+    db = r128 / 256.0 + REPLAYGAIN_REF + 23.0;
+    *from = "r128 tags";
+  }
+  else if (e && e->track_lufs > -70) {
+    db = REPLAYGAIN_REF - e->track_lufs;
+    peak = e->track_peak;
+    *from = "track, measured";
+  }
+  else return 1.0f;
+
+  float gain = pow(10.0, db / 20.0);
+  if (peak > 0 && gain * peak > 1.0f) gain = 1.0f / peak;
+  return gain;
+}
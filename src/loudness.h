@@ -0,0 +1,104 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <stdint.h>
+#include <libavutil/dict.h>
+
+#define LOUD_MAX_CH 8            // more channels than this aren't measured
+#define LOUD_BINS 750            // block loudness histogram, -70 to +5 LUFS
+#define LOUD_BIN_LU 0.1          // in 0.1 LU steps
+#define LOUD_TP_TAPS 12          // true peak interpolator taps per phase
+#define REPLAYGAIN_REF -18.0     // LUFS that plays at 0 dB (ReplayGain 2.0)
+
+typedef enum {
+  REPLAYGAIN_TRACK,            // the default
+  REPLAYGAIN_ALBUM,
+  REPLAYGAIN_OFF,
+
+} ReplayGain_Mode;
+
+// EBU R128 / BS.1770-4: integrated loudness and true peak of one track (or
+// of an album, merged). blocks are 400ms every 100ms; their loudness goes in
+// a histogram with the energy summed per bin, so gating needs no list of
+// blocks and an album is the sum of its tracks' histograms
+typedef struct {
+  int rate, ch;
+  double weight[LOUD_MAX_CH];  // 1.0, surrounds 1.41, LFE 0
+
+  // K-weighting: shelf then high pass, two biquads per channel
+  double shelf_b[3], shelf_a[3], hp_b[3], hp_a[3];
+  double z[LOUD_MAX_CH][4];
+
+  // 100ms sub-blocks, a block is the last four
+  int sub_len, sub_n;
+  double sub_sum;              // channel weighted sum of squares so far
+  double subs[4];
+  int subs_seen;
+
+  uint32_t *count;             // LOUD_BINS each
+  double *energy;
+
+  // true peak: `over`x oversampling by a windowed sinc, polyphase. each
+  // channel's history is kept twice over so the taps read it in one run
+  int over;
+  float *taps;                 // over * LOUD_TP_TAPS, phase major
+  float hist[LOUD_MAX_CH][2 * LOUD_TP_TAPS];
+  int hist_pos;
+  float peak;                  // linear, the higher of sample and true peak
+
+} Loudness_Meter;
+
+int loudness_init(Loudness_Meter *m, int rate, int ch);
+void loudness_free(Loudness_Meter *m);
+
+// interleaved float frames
+void loudness_add(Loudness_Meter *m, const float *pcm, int frames);
+
+// the track's blocks into the album's meter (only the histogram and peak)
+void loudness_merge(Loudness_Meter *album, const Loudness_Meter *track);
+
+// LUFS, -HUGE_VAL for silence or under 400ms
+double loudness_integrated(const Loudness_Meter *m);
+
+// results per file, measured by --analyze (and where --trim found the sound
+// to be). a line per file in the cache, stale once the file's mtime or size
+// changed
+typedef struct {
+  char *path;                  // realpath, NULL for an empty slot
+  int64_t mtime, size;
+  float track_lufs, track_peak;
+  float album_lufs, album_peak; // album = the files of one directory
+  int64_t audio_from, audio_to;  // --trim: where the sound starts and ends (input frames), to = 0 unknown
+  int changed;                 // put since the load, what a save writes over the file
+
+} Loudness_Entry;
+
+// open addressing on the path, sized a power of two
+typedef struct {
+  Loudness_Entry *slots;
+  int cap;
+  int count;
+  int dirty;                   // put since the last load or save
+
+} Loudness_Cache;
+
+// $XDG_CACHE_HOME/tomu/loudness or ~/.cache/tomu/loudness. a save reads the
+// file again and puts only the changed entries over it, so what another tomu
+// saved in the meantime (an --analyze next to a session) stays
+int loudness_cache_load(Loudness_Cache *c);
+int loudness_cache_save(Loudness_Cache *c);
+void loudness_cache_free(Loudness_Cache *c);
+
+// NULL if there's none or the file changed since. `path` as given, it's
+// resolved here
+const Loudness_Entry *loudness_cache_get(Loudness_Cache *c, const char *path);
+int loudness_cache_put(Loudness_Cache *c, const Loudness_Entry *e);
+
+// the linear gain for a track: measured values from the cache first, then
+// REPLAYGAIN_* / R128_* tags from `tags` (format, then stream). kept under
+// 1/peak so it can't push a peak into the limiter. 1.0 when there's
+// nothing to go by. `from` says which it was, for the status line
+float replaygain_gain(Loudness_Cache *c, const char *path, AVDictionary *tags, AVDictionary *stream_tags,
+  ReplayGain_Mode mode, const char **from);
+
+#endif
@@ -1,7 +1,10 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "control.h"
+#include "pipe_input.h"
+#include "prefetch.h"
 #include "utils.h"
 
 #define PROG_NAME "tomu"
@@ -10,26 +13,151 @@
 int main(int argc, char *argv[])
 {
   if (argc < 2){
-    printf("Usage: %s [File.mp3]\n", PROG_NAME);
+    printf("Usage: %s [File.mp3 | DIR]...\n", PROG_NAME);
     return 0;
   }
 
-  const char *arg = argv[1];
-  const char *filename = argv[argc - 1];
+  PlayBackOptions opt = {
+    .prefetch_lead = PREFETCH_LEAD,
+    .pipe_buffer = PIPE_BUFFER,
+    .pipe_probe = PIPE_PROBE,
+    .jitter = NET_JITTER,
+  };
+  int i = 1;
+
+  // flags first, the paths are whatever comes after them
+  for (; i < argc && argv[i][0] == '-' && argv[i][1] == '-'; i++) {
+    const char *arg = argv[i];
 
-  if (argv[1][0] == '-' && argv[1][1] == '-') {
     if (strcmp("--loop", arg) == 0)
-      path_handle(filename, true);
+      opt.loop = true;
+
+    else if (strcmp("--latency", arg) == 0)
+      opt.latency_probe = true;
+
+    else if (strcmp("--no-limiter", arg) == 0)
+      opt.no_limiter = true;
+
+    else if (strcmp("--pipeline", arg) == 0)
+      opt.pipeline = true;
+
+    else if (strncmp("--prefetch=", arg, 11) == 0)
+      opt.prefetch_lead = atoi(arg + 11);
+
+    else if (strncmp("--resample=", arg, 11) == 0) {
+      const char *q = arg + 11;
+
+      if (strcmp("fast", q) == 0) opt.resample = RESAMPLE_FAST;
+      else if (strcmp("default", q) == 0) opt.resample = RESAMPLE_DEFAULT;
+      else if (strcmp("high", q) == 0) opt.resample = RESAMPLE_HIGH;
+      else {
+        printf("[T] Unknown resample quality '%s' (fast, default, high)\n", q);
+        return 0;
+      }
+    }
+
+    else if (strncmp("--layout=", arg, 9) == 0)
+      opt.layout = arg + 9;
+
+    else if (strncmp("--stream=", arg, 9) == 0)
+      opt.stream = atoi(arg + 9);
+
+    else if (strncmp("--pipe-buffer=", arg, 14) == 0)
+      opt.pipe_buffer = atoi(arg + 14) > 0 ? atoi(arg + 14) : PIPE_BUFFER;
+
+    else if (strncmp("--pipe-probe=", arg, 13) == 0)
+      opt.pipe_probe = atoi(arg + 13) > 0 ? atoi(arg + 13) : PIPE_PROBE;
+
+    else if (strcmp("--spill", arg) == 0)
+      opt.spill = true;
+
+    else if (strncmp("--jitter=", arg, 9) == 0)
+      opt.jitter = atof(arg + 9) > 0 ? atof(arg + 9) : NET_JITTER;
+
+    else if (strcmp("--analyze", arg) == 0)
+      opt.analyze = true;
+
+    else if (strcmp("--verify", arg) == 0)
+      opt.verify = true;
+
+    else if (strncmp("--jobs=", arg, 7) == 0)
+      opt.jobs = atoi(arg + 7);
+
+    else if (strncmp("--replaygain=", arg, 13) == 0) {
+      if (strcmp(arg + 13, "track") == 0) opt.replaygain = REPLAYGAIN_TRACK;
+      else if (strcmp(arg + 13, "album") == 0) opt.replaygain = REPLAYGAIN_ALBUM;
+      else if (strcmp(arg + 13, "off") == 0) opt.replaygain = REPLAYGAIN_OFF;
+      else die("replaygain: '%s' isn't track, album or off", arg + 13);
+    }
 
-    else if (strcmp("--help", arg) == 0)
+    else if (strcmp("--trim", arg) == 0)
+      opt.trim = true;
+
+    else if (strncmp("--eq=", arg, 5) == 0) {
+      char error[128];
+
+      opt.eq_bands = eq_parse(arg + 5, opt.eq, EQ_MAX_BANDS, error, sizeof(error));
+      if (opt.eq_bands < 0) die("eq: %s", error);
+    }
+
+    else if (strncmp("--speed=", arg, 8) == 0) {
+      opt.speed = atof(arg + 8);
+      if (opt.speed < STRETCH_MIN || opt.speed > STRETCH_MAX)
+        die("speed: '%s' isn't between %.1f and %.1f", arg + 8, STRETCH_MIN, STRETCH_MAX);
+    }
+
+    else if (strncmp("--crossfade=", arg, 12) == 0) {
+      char *end;
+
+      opt.crossfade = strtol(arg + 12, &end, 10);
+      if (end == arg + 12 || opt.crossfade < 1 || opt.crossfade > CROSSFADE_MAX)
+        die("crossfade: '%s' isn't 1 to %d seconds", arg + 12, CROSSFADE_MAX);
+
+      if (strcmp(end, ":linear") == 0) opt.crossfade_curve = CROSSFADE_LINEAR;
+      else if (!*end || strcmp(end, ":equal") == 0) opt.crossfade_curve = CROSSFADE_EQUAL_POWER;
+      else die("crossfade: the curve '%s' isn't linear or equal", end + 1);
+    }
+
+    else if (strcmp("--spectrum", arg) == 0 || strcmp("--spectrum=bars", arg) == 0)
+      opt.spectrum = SPECTRUM_BARS_VIEW;
+
+    else if (strcmp("--spectrum=vu", arg) == 0)
+      opt.spectrum = SPECTRUM_VU;
+
+    else if (strcmp("--shm-tap", arg) == 0)
+      opt.shm_tap = true;
+
+    else if (strncmp("--tee=", arg, 6) == 0) {
+      if (!arg[6]) die("tee: no file or |command");
+      if (opt.tee_count == TEE_MAX_SINKS) die("tee: at most %d of them", TEE_MAX_SINKS);
+      opt.tee[opt.tee_count++] = arg + 6;
+    }
+
+    else if (strcmp("--mix", arg) == 0)
+      opt.mix = true;
+
+    else if (strcmp("--help", arg) == 0) {
       help();
+      return 0;
+    }
 
-    else if (strcmp("--version", arg) == 0)
+    else if (strcmp("--version", arg) == 0) {
       printf("%s\n", PROG_VER);
+      return 0;
+    }
 
-    else 
+    else {
       printf("[T] Unknown Arg '%s'\n", arg);
-  } else path_handle(filename, false);
+      return 0;
+    }
+  }
+
+  if (i >= argc){
+    printf("Usage: %s [File.mp3 | DIR]...\n", PROG_NAME);
+    return 0;
+  }
+
+  path_handle(argv + i, argc - i, &opt);
 
   return 0;
 }
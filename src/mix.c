@@ -0,0 +1,441 @@
+#include <libavformat/avformat.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+  #define MIX_X86
+  #define TARGET_SSE2 __attribute__((target("sse2")))
+  #define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#include "mix.h"
+#include "backend_utils.h"
+#include "control.h"
+#include "gain.h"
+#include "network.h"
+#include "socket.h"
+#include "utils.h"
+
+typedef void (*add_kernel)(float *dst, const float *src, int frames, int ch, float from, float step);
+
+static struct {
+  const char *name;
+  add_kernel add;
+
+} kernels;
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+// what the callback owns, and the layers
+typedef struct {
+  Mix_Layer layer[MIX_MAX_LAYERS];
+  int count;
+  int ch;
+  int fade_frames;             // pause/resume ramps, as for a single track
+  int soft_limit;
+  PlayBackState *session;      // quit, and which layer the keys go to
+  float *scratch;              // MIX_CHUNK frames, one layer's read at a time
+
+} Mixer;
+
+
+// =================================================================
+// bus kernels. scalar also does the tails and odd channel counts
+
+static void add_scalar(float *dst, const float *src, int frames, int ch, float from, float step)
+{
+  for (int i = 0; i < frames; i++){
+    float g = from + step * (i + 1);
+    for (int c = 0; c < ch; c++, dst++, src++) *dst += *src * g;
+  }
+}
+
+#ifdef MIX_X86
+// lane j of a vector belongs to frame j / ch, so only when ch divides the
+// lane count
+TARGET_SSE2 static void add_sse2(float *dst, const float *src, int frames, int ch, float from, float step)
+{
+  int samples = frames * ch, i = 0;
+
+  if (4 % ch == 0){
+    __m128 vfrom = _mm_set1_ps(from), vstep = _mm_set1_ps(step);
+    __m128 idx = _mm_setr_ps(0 / ch + 1, 1 / ch + 1, 2 / ch + 1, 3 / ch + 1), inc = _mm_set1_ps(4 / ch);
+
+    for (; i + 4 <= samples; i += 4){
+      __m128 g = _mm_add_ps(vfrom, _mm_mul_ps(vstep, idx));
+      _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+      idx = _mm_add_ps(idx, inc);
+    }
+  }
+
+  add_scalar(dst + i, src + i, frames - i / ch, ch, from + step * (i / ch), step);
+}
+
+TARGET_AVX2 static void add_avx2(float *dst, const float *src, int frames, int ch, float from, float step)
+{
+  int samples = frames * ch, i = 0;
+
+  if (8 % ch == 0){
+    __m256 vfrom = _mm256_set1_ps(from), vstep = _mm256_set1_ps(step);
+    __m256 idx = _mm256_setr_ps(0 / ch + 1, 1 / ch + 1, 2 / ch + 1, 3 / ch + 1,
+                                4 / ch + 1, 5 / ch + 1, 6 / ch + 1, 7 / ch + 1);
+    __m256 inc = _mm256_set1_ps(8 / ch);
+
+    for (; i + 8 <= samples; i += 8){
+      __m256 g = _mm256_add_ps(vfrom, _mm256_mul_ps(vstep, idx));
+      _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(_mm256_loadu_ps(src + i), g)));
+      idx = _mm256_add_ps(idx, inc);
+    }
+  }
+
+  add_scalar(dst + i, src + i, frames - i / ch, ch, from + step * (i / ch), step);
+}
+#endif
+
+static void mix_pick(void)
+{
+  kernels.name = "scalar";
+  kernels.add = add_scalar;
+
+  #ifdef MIX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){
+      kernels.name = "avx2";
+      kernels.add = add_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2")){
+      kernels.name = "sse2";
+      kernels.add = add_sse2;
+    }
+  #endif
+}
+
+void mix_init(void)
+{
+  pthread_once(&kernels_once, mix_pick);
+}
+
+const char *mix_kernel_name(void)
+{
+  mix_init();
+  return kernels.name;
+}
+
+void mix_add(float *dst, const float *src, int frames, int ch, float from, float step)
+{
+  if (frames > 0) kernels.add(dst, src, frames, ch, from, step);
+}
+
+
+// =================================================================
+// the callback
+
+static inline int layer_seeking(PlayBackState *state)
+{
+  return atomic_load(&state->flush_req) != atomic_load(&state->flush_ack);
+}
+
+// one layer's next `frames` onto the bus. paused, it stops reading after the
+// fade out so it picks up from there
+static void mix_layer(Mixer *mx, Mix_Layer *l, float *out, int frames)
+{
+  PlayBackState *state = &l->state;
+  int frame_bytes = mx->ch * sizeof(float);
+
+  // seeking: drop what's buffered, the new position glides in
+  if (layer_seeking(state)) {
+    audio_buffer_skip(l->ctx.buf);
+    l->gain = 0.0f;
+    return;
+  }
+
+  int paused = atomic_load(&state->paused);
+  if (paused && l->gain == 0.0f) return;
+
+  int want = paused && mx->fade_frames < frames ? mx->fade_frames : frames;
+  int got = audio_buffer_read(l->ctx.buf, (uint8_t*)mx->scratch, want * frame_bytes) / frame_bytes;
+
+  // volume changes and resumes ramp over the fade length, then it's flat
+  float target = paused ? 0.0f : atomic_load(&state->volume);
+  int ramp = mx->fade_frames < got ? mx->fade_frames : got;
+
+  if (ramp > 0) mix_add(out, mx->scratch, ramp, mx->ch, l->gain, (target - l->gain) / ramp);
+  mix_add(out + ramp * mx->ch, mx->scratch + ramp * mx->ch, got - ramp, mx->ch, target, 0.0f);
+
+  if (got > 0 || paused) l->gain = target;
+}
+
+static void mix_callback(ma_device *device, void *output, const void *input, ma_uint32 frameCount)
+{
+  Mixer *mx = device->pUserData;
+  float *out = output;
+  uint64_t applied[CMD_COUNT];
+
+  memset(out, 0, frameCount * mx->ch * sizeof(float));
+  if (!atomic_load(&mx->session->running)) return;
+
+  // every layer's controls land at the start of the period
+  for (int i = 0; i < mx->count; i++)
+    playback_apply(&mx->layer[i].state, applied);
+
+  for (ma_uint32 done = 0; done < frameCount; done += MIX_CHUNK){
+    int frames = frameCount - done < MIX_CHUNK ? frameCount - done : MIX_CHUNK;
+
+    for (int i = 0; i < mx->count; i++)
+      mix_layer(mx, &mx->layer[i], out + done * mx->ch, frames);
+  }
+
+  if (mx->soft_limit) gain_limit(out, frameCount * mx->ch);
+
+  // --spectrum, --shm-tap and --tee get the bus, what the device plays
+  PlayBackState *session = mx->session;
+  if (session->spectrum) spectrum_tap(session->spectrum, out, frameCount, ma_format_f32, mx->ch);
+  if (session->tap) shm_tap_write(session->tap, out, frameCount);
+  if (session->tee) tee_write(session->tee, out, frameCount);
+}
+
+
+// =================================================================
+
+static void *run_layer(void *arg)
+{
+  Mix_Layer *l = arg;
+
+  run_decoder(&l->ctx);
+  atomic_store(&l->done, 1);
+  return NULL;
+}
+
+// one line for every layer: the picked one inverted, then where it is and
+// what it's set to
+static void mix_status(Mixer *mx)
+{
+  int picked = atomic_load(&mx->session->layer);
+
+  printf("\033[2K\r");
+  for (int i = 0; i < mx->count; i++){
+    Mix_Layer *l = &mx->layer[i];
+    int pos = atomic_load(&l->state.position);
+    const char *name = strrchr(l->track.filename, '/');
+
+    name = name ? name + 1 : l->track.filename;
+    printf("%s%s%d %.12s %d:%02d v:%.0f%%%s%s\033[0m", i ? " | " : "", i == picked ? "\033[7m" : "",
+      i + 1, name, get_min(pos), get_sec(pos), atomic_load(&l->state.volume) * 100.0f,
+      atomic_load(&l->done) ? " end" : atomic_load(&l->state.paused) ? " ||" : "",
+      atomic_load(&l->state.looping) ? " loop" : "");
+  }
+
+  // --spectrum: of the whole bus, after the layers
+  if (mx->session->spectrum ){
+    char view[160];
+    spectrum_draw(mx->session->spectrum, view, sizeof(view));
+    printf(" | %s", view);
+  }
+  fflush(stdout);
+}
+
+int mix_run(Play_Queue *queue, const PlayBackOptions *opt)
+{
+  PlayBackState session = {0};
+  PlayBackState *layers[MIX_MAX_LAYERS];
+  const char *path;
+
+  av_log_set_level(AV_LOG_QUIET);
+  init_playbackstatus(&session, 0);
+
+  Mixer *mx = calloc(1, sizeof(Mixer));
+  if (!mx) die("mix: out of memory");
+
+  mx->session = &session;
+  mx->soft_limit = !opt->no_limiter;
+
+  // a url wants the pipeline's network buffer, a layer runs the plain decoder
+  for (int i = 0; (path = queue_get(queue, i)); i++){
+    if (mx->count == MIX_MAX_LAYERS ){
+      warn("mix: %d layers at most, the rest are left out", MIX_MAX_LAYERS);
+      break;
+    }
+
+    Mix_Layer *l = &mx->layer[mx->count];
+    memset(l, 0, sizeof(Mix_Layer));
+    l->track.filename = path;
+
+    if (net_is_url(path) ){
+      warn("%s: a url can't be a layer", path);
+      continue;
+    }
+
+    if (open_track(&l->track, opt) < 0 ){
+      warn("%s: %s", path, l->track.error);
+      continue;
+    }
+    mx->count++;
+  }
+
+  if (!mx->count ){
+    free(mx);
+    return 0;
+  }
+
+  // f32 whatever the device prefers: the layers add up past full scale before
+  // the limiter brings them back
+  ma_device_config config = ma_device_config_init(ma_device_type_playback);
+  config.playback.format = ma_format_f32;
+  config.playback.channels = 0;
+  config.sampleRate = 0;
+  config.dataCallback = mix_callback;
+  config.pUserData = mx;
+  config.noPreSilencedOutputBuffer = MA_TRUE;
+  config.noClip = mx->soft_limit ? MA_TRUE : MA_FALSE;
+
+  if (opt->layout ){
+    int ch = layout_channels(opt->layout);
+    if (ch <= 0 || ch > MA_MAX_CHANNELS) die("layout: unknown channel layout '%s'", opt->layout);
+    config.playback.channels = ch;
+  }
+
+  // --latency: the null backend, no scripted controls here
+  ma_context context;
+  ma_context *pContext = NULL;
+
+  if (opt->latency_probe ){
+    ma_backend backends[] = { ma_backend_null };
+    if (ma_context_init(backends, 1, NULL, &context) != MA_SUCCESS) return -1;
+    pContext = &context;
+  }
+
+  ma_device device;
+  if (ma_device_init(pContext, &config, &device) != MA_SUCCESS ){
+    if (pContext) ma_context_uninit(pContext);
+    for (int i = 0; i < mx->count; i++) close_track(&mx->layer[i].track);
+    free(mx);
+    return -1;
+  }
+
+  mx->ch = device.playback.channels;
+  mx->fade_frames = device.sampleRate / 200;
+  if (!(mx->scratch = malloc(MIX_CHUNK * mx->ch * sizeof(float)))) die("mix: out of memory");
+
+  gain_init();
+  mix_init();
+
+  // --spectrum, --shm-tap and --tee as for a single track, on the bus
+  if (opt->spectrum ){
+    if (!(session.spectrum = spectrum_create(device.sampleRate, opt->spectrum))) die("spectrum: out of memory");
+    spectrum_start(session.spectrum);
+  }
+
+  if (opt->shm_tap ){
+    if ((session.tap = shm_tap_create(ma_format_f32, mx->ch, device.sampleRate)))
+      printf("shm tap: %s, f32 %dch %dHz\n", SHM_TAP_NAME, mx->ch, device.sampleRate);
+    else if (errno == EBUSY)
+      warn("shm tap: %s belongs to another tomu that's playing, going on without it", SHM_TAP_NAME);
+    else
+      warn("shm tap: %s:", SHM_TAP_NAME);
+  }
+
+  if (opt->tee_count && !(session.tee = tee_create(opt->tee, opt->tee_count, ma_format_f32, mx->ch, device.sampleRate)))
+    die("tee: out of memory");
+
+  // each layer is a track of its own as far as run_decoder can tell, with a
+  // 500ms ring like the single track one
+  printf("Mixing %d layers (bus: %s)\n", mx->count, mix_kernel_name());
+
+  for (int i = 0; i < mx->count; i++){
+    Mix_Layer *l = &mx->layer[i];
+    AVIOContext *pb = l->track.fmtCTX->pb;
+
+    set_output_format(&l->inf, &device, opt->layout);
+    set_input_format(&l->inf, &l->track.inf);
+    l->inf.resample = opt->resample;
+
+    init_playbackstatus(&l->state, opt->loop);
+    l->state.quiet = 1;
+    atomic_store(&l->state.seekable, !pb || (pb->seekable & AVIO_SEEKABLE_NORMAL));
+
+    l->ctx.inf = &l->inf;
+    l->ctx.buf = audio_buffer_init((l->inf.sample_rate / 2) * l->inf.ch * l->inf.sample_fmt_bytes);
+    l->ctx.fmtCTX = l->track.fmtCTX;
+    l->ctx.codecCTX = l->track.codecCTX;
+    l->ctx.state = &l->state;
+    l->state.buf = l->ctx.buf;
+    layers[i] = &l->state;
+
+    printf("%d: %s\n", i + 1, l->track.filename);
+    print_pipeline(&l->inf);
+  }
+
+  session.layers = layers;
+  session.layer_count = mx->count;
+
+  // keys and the socket both act on the picked layer, as for a single track
+  pthread_t control_thread, sock_thread;
+  pthread_create(&control_thread, NULL, handle_input, &session);
+  if (!opt->latency_probe) pthread_create(&sock_thread, NULL, run_socket, &session);
+
+  ma_device_start(&device);
+
+  for (int i = 0; i < mx->count; i++)
+    pthread_create(&mx->layer[i].decoder, NULL, run_layer, &mx->layer[i]);
+
+  // until every layer has played out, or the user quits
+  for (;;) {
+    int playing = 0;
+
+    if (!atomic_load(&session.running) ){
+      for (int i = 0; i < mx->count; i++){
+        atomic_store(&mx->layer[i].state.running, 0);
+        audio_buffer_close(mx->layer[i].ctx.buf);
+      }
+    }
+
+    for (int i = 0; i < mx->count; i++) playing += !atomic_load(&mx->layer[i].done);
+    if (!playing) break;
+
+    mix_status(mx);
+    usleep(100000);
+  }
+
+  printf("\n");
+  atomic_store(&session.running, 0);
+  pthread_join(control_thread, NULL);
+  if (!opt->latency_probe) pthread_join(sock_thread, NULL);
+
+  // the layers kept quiet while the line was up
+  for (int i = 0; i < mx->count; i++){
+    pthread_join(mx->layer[i].decoder, NULL);
+
+    int errors = atomic_load(&mx->layer[i].state.decode_errors);
+    if (errors) warn("%d: %s: %d packets failed to decode", i + 1, mx->layer[i].track.filename, errors);
+  }
+
+  // clean up
+  ma_device_stop(&device);
+  ma_device_uninit(&device);
+  if (pContext) ma_context_uninit(pContext);
+  spectrum_destroy(session.spectrum);
+  shm_tap_destroy(session.tap);
+  tee_destroy(session.tee);
+
+  for (int i = 0; i < mx->count; i++){
+    Mix_Layer *l = &mx->layer[i];
+
+    audio_buffer_destroy(l->ctx.buf);
+    close_track(&l->track);
+    #ifndef LEGACY_LIBSWRSAMPLE
+      av_channel_layout_uninit(&l->inf.in_layout);
+      av_channel_layout_uninit(&l->inf.ch_layout);
+    #endif
+  }
+
+  int quit = atomic_load(&session.quit);
+  free(mx->scratch);
+  free(mx);
+  return quit;
+}
@@ -0,0 +1,38 @@
+#ifndef MIX_H
+#define MIX_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "backend.h"
+
+#define MIX_MAX_LAYERS 9         // the keys 1-9 pick one
+#define MIX_CHUNK 1024           // frames the callback mixes at a time
+
+void mix_init(void);
+const char *mix_kernel_name(void);
+
+// dst += src * (from + step * (i + 1)) for frame i, f32 interleaved. the
+// bus's one kernel, exported for the bench
+void mix_add(float *dst, const float *src, int frames, int ch, float from, float step);
+
+// one file of --mix: opened, decoded by run_decoder into a ring of its own,
+// with its own volume, pause, seek and loop
+typedef struct {
+  Track track;
+  Audio_Info inf;
+  PlayBackState state;
+  StreamContext ctx;
+  pthread_t decoder;
+  atomic_int done;             // its decoder returned
+  float gain;                  // callback only: where the last block ended
+
+} Mix_Layer;
+
+// --mix: every file plays at the same time. one device (f32, so the sum has
+// room above full scale until the limiter), one callback summing the rings,
+// one set of libraries instead of a process per file. returns 1 if the user
+// quit, -1 if there's no device
+int mix_run(Play_Queue *queue, const PlayBackOptions *opt);
+
+#endif
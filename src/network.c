@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "network.h"
+
+int net_is_url(const char *path)
+{
+  return strstr(path, "://") && strncmp(path, "file://", 7);
+}
+
+// ffmpeg's http reconnects on its own, resuming with a Range request where
+// the server allows it (reconnect_streamed covers live streams that don't).
+// a read that stalls errors out after NET_TIMEOUT instead of hanging the demux
+// thread, and that's where our own reopen (NET_RETRIES) takes over. options a
+// protocol or an older ffmpeg doesn't know are left in the dict and ignored
+void net_options(AVDictionary **opts)
+{
+  av_dict_set(opts, "reconnect", "1", 0);
+  av_dict_set(opts, "reconnect_streamed", "1", 0);
+  av_dict_set(opts, "reconnect_on_network_error", "1", 0);
+  av_dict_set(opts, "reconnect_delay_max", "4", 0);
+  av_dict_set_int(opts, "rw_timeout", NET_TIMEOUT, 0);
+}
+
+void net_buffer_init(Net_Buffer *nb, double jitter)
+{
+  *nb = (Net_Buffer){0};
+  nb->jitter_us = jitter * 1000000;
+  nb->ahead_us = nb->jitter_us * NET_AHEAD;
+  nb->fill_min_us = INT64_MAX;
+  atomic_init(&nb->buffering, 1); // nothing plays before the first jitter_us
+}
+
+// demuxer: a packet of `us` went into the queue
+void net_buffer_add(Net_Buffer *nb, int64_t us)
+{
+  atomic_fetch_add(&nb->buffered_us, us);
+}
+
+// decoder: a packet of `us` came out
+void net_buffer_take(Net_Buffer *nb, int64_t us)
+{
+  int64_t fill = atomic_fetch_sub(&nb->buffered_us, us) - us;
+
+  if (fill < nb->fill_min_us) nb->fill_min_us = fill;
+  nb->fill_sum_us += fill;
+  nb->fill_samples++;
+}
+
+void net_buffer_report(Net_Buffer *nb)
+{
+  if (!nb->fill_samples) return;
+
+  printf("network: buffer avg %.2fs min %.2fs (jitter %.2fs), %d rebuffers, %d reconnects\n",
+    nb->fill_sum_us / (double)nb->fill_samples / 1e6, nb->fill_min_us / 1e6, nb->jitter_us / 1e6,
+    atomic_load(&nb->rebuffers), atomic_load(&nb->reconnects)
+  );
+}
@@ -0,0 +1,44 @@
+#ifndef NETWORK_H
+#define NETWORK_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <libavformat/avformat.h>
+
+#define NET_JITTER 2.0           // default --jitter, seconds buffered before playing
+#define NET_AHEAD 4              // read at most this many jitter buffers ahead
+#define NET_PACKETS_PER_SEC 64   // sizes the packet queue, mp3/aac/opus all stay under
+#define NET_RETRIES 5            // reopen attempts after ffmpeg's own reconnect gave up
+#define NET_TIMEOUT 10000000     // us a read may stall before it counts as a drop
+
+// the compressed packets between the network thread (demux) and the decoder,
+// counted in seconds of audio rather than slots. the demuxer adds, the
+// decoder takes, everything else is read by whoever wants to show it
+typedef struct {
+  int64_t jitter_us;             // prebuffer at the start and after running dry
+  int64_t ahead_us;              // the demuxer stops reading past this
+  atomic_llong buffered_us;
+  atomic_int eof;                // the demuxer queued its last packet
+  atomic_int buffering;          // decoder waiting for jitter_us to come in
+
+  // metrics: rebuffers/fill by the decoder, reconnects by the demuxer
+  atomic_int rebuffers;
+  atomic_int reconnects;
+  int64_t fill_min_us;
+  int64_t fill_sum_us;
+  uint64_t fill_samples;
+
+} Net_Buffer;
+
+// http(s)://, icecast and anything else ffmpeg has a protocol for, not file://
+int net_is_url(const char *path);
+
+// options every network open gets (see network.c)
+void net_options(AVDictionary **opts);
+
+void net_buffer_init(Net_Buffer *nb, double jitter);
+void net_buffer_add(Net_Buffer *nb, int64_t us);
+void net_buffer_take(Net_Buffer *nb, int64_t us);
+void net_buffer_report(Net_Buffer *nb);
+
+#endif
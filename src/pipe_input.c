@@ -0,0 +1,137 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pipe_input.h"
+
+typedef struct {
+  int fd;
+  FILE *spill;                 // every byte read so far, NULL = no going back
+  int64_t pos;                 // where the demuxer is reading
+  int64_t spilled;             // bytes taken from fd (all of them are in spill)
+  int eof;
+
+} Pipe_Input;
+
+int pipe_is_input(const char *path)
+{
+  struct stat st;
+  return !strcmp(path, "-") || (stat(path, &st) == 0 && S_ISFIFO(st.st_mode));
+}
+
+static int pipe_read_fd(Pipe_Input *p, uint8_t *buf, int size)
+{
+  ssize_t n;
+
+  do n = read(p->fd, buf, size);
+  while (n < 0 && errno == EINTR);
+
+  if (n == 0) p->eof = 1;
+  if (n <= 0) return n;
+
+  if (p->spill ){
+    ssize_t w = pwrite(fileno(p->spill), buf, n, p->spilled);
+    if (w != n) {
+      if (w >= 0) errno = ENOSPC; // short write, the temp dir is full
+      return -1;
+    }
+    p->spilled += n;
+  }
+  return n;
+}
+
+static int pipe_read(void *opaque, uint8_t *buf, int size)
+{
+  Pipe_Input *p = (Pipe_Input*)opaque;
+  int n;
+
+  // seeked back: replay from the spill until we catch up with the pipe
+  if (p->spill && p->pos < p->spilled ){
+    int64_t left = p->spilled - p->pos;
+    n = pread(fileno(p->spill), buf, size < left ? size : left, p->pos);
+  }
+  else n = pipe_read_fd(p, buf, size);
+
+  if (n == 0) return AVERROR_EOF;
+  if (n < 0) return AVERROR(errno);
+
+  p->pos += n;
+  return n;
+}
+
+// only with a spill: anywhere we've been is a pread away, ahead of that we
+// read the pipe through into the spill. the size is known once it ended
+static int64_t pipe_seek(void *opaque, int64_t offset, int whence)
+{
+  Pipe_Input *p = (Pipe_Input*)opaque;
+  uint8_t chunk[1 << 16];
+  int64_t target;
+
+  whence &= ~AVSEEK_FORCE;
+
+  switch (whence ){
+    case AVSEEK_SIZE: return p->eof ? p->spilled : -1;
+    case SEEK_SET: target = offset; break;
+    case SEEK_CUR: target = p->pos + offset; break;
+    case SEEK_END:
+      if (!p->eof) return -1;
+      target = p->spilled + offset;
+      break;
+    default: return -1;
+  }
+
+  if (target < 0) return -1;
+
+  while (target > p->spilled && !p->eof)
+    if (pipe_read_fd(p, chunk, sizeof(chunk)) < 0) return AVERROR(errno);
+
+  // past the end: sit on it, the next read says EOF
+  p->pos = target < p->spilled ? target : p->spilled;
+  return p->pos;
+}
+
+AVIOContext *pipe_input_open(const char *path, int buffer_size, int spill)
+{
+  Pipe_Input *p = calloc(1, sizeof(Pipe_Input));
+  uint8_t *buffer = av_malloc(buffer_size);
+  AVIOContext *pb = NULL;
+
+  if (!p || !buffer) goto fail;
+
+  // a fifo's open blocks until someone opens the other end, that's fine:
+  // there's nothing to play before that anyway
+  p->fd = strcmp(path, "-") ? open(path, O_RDONLY) : STDIN_FILENO;
+  if (p->fd < 0) goto fail;
+
+  if (spill && !(p->spill = tmpfile())) goto fail;
+
+  pb = avio_alloc_context(buffer, buffer_size, 0, p, pipe_read, NULL, spill ? pipe_seek : NULL);
+  if (!pb) goto fail;
+
+  return pb;
+
+fail:
+  if (p && p->spill) fclose(p->spill);
+  if (p && p->fd > 0) close(p->fd);
+  av_free(buffer);
+  free(p);
+  return NULL;
+}
+
+void pipe_input_close(AVIOContext **pb)
+{
+  if (!*pb) return;
+
+  Pipe_Input *p = (Pipe_Input*)(*pb)->opaque;
+  if (p->fd != STDIN_FILENO) close(p->fd);
+  if (p->spill) fclose(p->spill);
+  free(p);
+
+  // ffmpeg may have swapped the buffer for a bigger one, free what it holds now
+  av_freep(&(*pb)->buffer);
+  avio_context_free(pb);
+}
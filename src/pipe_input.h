@@ -0,0 +1,17 @@
+#ifndef PIPE_INPUT_H
+#define PIPE_INPUT_H
+
+#include <libavformat/avformat.h>
+
+#define PIPE_BUFFER 64           // default --pipe-buffer, KiB per read
+#define PIPE_PROBE 64            // default --pipe-probe, KiB the format probe may read
+#define PIPE_ANALYZE 500000      // us of audio find_stream_info may look at
+
+// "-" (stdin) or a named pipe. ffmpeg's own file protocol would do for a fifo
+// too, but it probes and seeks like it's a file; ours reads straight from the
+// fd and can't seek unless `spill` keeps what went by in a temp file
+int pipe_is_input(const char *path);
+AVIOContext *pipe_input_open(const char *path, int buffer_size, int spill);
+void pipe_input_close(AVIOContext **pb);
+
+#endif
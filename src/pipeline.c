@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "pipeline.h"
+
+int stage_queue_init(Stage_Queue *q, unsigned size)
+{
+  *q = (Stage_Queue){0};
+
+  // indices wrap with a mask
+  if (size == 0 || (size & (size - 1))) return -1;
+
+  q->items = calloc(size, sizeof(Stage_Item));
+  if (!q->items) return -1;
+
+  q->size = size;
+  sem_init(&q->space, 0, size);
+  sem_init(&q->filled, 0, 0);
+  return 0;
+}
+
+// the slot objects belong to whoever put them there, free those first
+void stage_queue_destroy(Stage_Queue *q)
+{
+  sem_destroy(&q->space);
+  sem_destroy(&q->filled);
+  free(q->items);
+  q->items = NULL;
+}
+
+// sem_wait that counts the times it had to sleep, -1 once the queue got closed
+static int stage_wait(Stage_Queue *q, sem_t *sem, unsigned *waits)
+{
+  if (sem_trywait(sem) < 0) {
+    (*waits)++;
+    while (sem_wait(sem) < 0 && errno == EINTR);
+  }
+
+  // close() posts to wake us, that isn't a real slot
+  return atomic_load(&q->closed) ? -1 : 0;
+}
+
+Stage_Item *stage_queue_back(Stage_Queue *q)
+{
+  if (atomic_load(&q->closed)) return NULL;
+
+  if (!q->reserved) {
+    if (stage_wait(q, &q->space, &q->full_waits) < 0) return NULL;
+    q->reserved = 1;
+  }
+
+  return &q->items[atomic_load(&q->tail) & (q->size - 1)];
+}
+
+void stage_queue_push(Stage_Queue *q)
+{
+  unsigned tail = atomic_load(&q->tail) + 1;
+  unsigned fill = tail - atomic_load(&q->head);
+
+  q->fill_sum += fill;
+  q->pushes++;
+  if (fill > q->fill_max) q->fill_max = fill;
+
+  // publish the slot only after it's filled
+  atomic_store(&q->tail, tail);
+  q->reserved = 0;
+  sem_post(&q->filled);
+}
+
+Stage_Item *stage_queue_front(Stage_Queue *q)
+{
+  if (atomic_load(&q->closed)) return NULL;
+
+  if (!q->held) {
+    if (stage_wait(q, &q->filled, &q->empty_waits) < 0) return NULL;
+    q->held = 1;
+  }
+
+  return &q->items[atomic_load(&q->head) & (q->size - 1)];
+}
+
+void stage_queue_pop(Stage_Queue *q)
+{
+  atomic_store(&q->head, atomic_load(&q->head) + 1);
+  q->held = 0;
+  sem_post(&q->space);
+}
+
+// wake both sides and make every call from now on give up
+void stage_queue_close(Stage_Queue *q)
+{
+  if (atomic_exchange(&q->closed, 1)) return;
+  sem_post(&q->space);
+  sem_post(&q->filled);
+}
+
+void stage_queue_report(Stage_Queue *q, const char *name)
+{
+  printf("  %-8s avg %5.1f / %-4u max %-4u producer waited %u, consumer waited %u\n", name,
+    q->pushes ? q->fill_sum / (double)q->pushes : 0.0, q->size, q->fill_max,
+    q->full_waits, q->empty_waits
+  );
+}
@@ -0,0 +1,64 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+
+// --pipeline: demux, decode and convert each get a thread, connected by these
+#define PIPELINE_PACKETS 128     // a few seconds of compressed audio, soaks up slow reads
+#define PIPELINE_FRAMES 8        // decoded frames waiting for conversion
+
+typedef enum {
+  ITEM_DATA,                     // obj holds a packet / frame
+  ITEM_FLUSH,                    // seek done, everything before this is stale
+  ITEM_RESTART,                  // looped back to the start
+  ITEM_EOF,
+
+} Item_Kind;
+
+typedef struct {
+  Item_Kind kind;
+  unsigned req;                  // ITEM_FLUSH: the flush_req it answers
+  int64_t pos;                   // ITEM_FLUSH: input samples at the new position,
+                                 // ITEM_DATA of a network stream: us of audio in it
+  void *obj;                     // AVPacket / AVFrame owned by the slot, reused
+
+} Stage_Item;
+
+// bounded single producer / single consumer queue of reusable slots. both
+// sides sleep on a semaphore when there's nothing to do, neither ever locks
+typedef struct {
+  Stage_Item *items;
+  unsigned size;                 // power of two
+  atomic_uint head;              // next slot to read (consumer only)
+  atomic_uint tail;              // next slot to fill (producer only)
+  sem_t space;
+  sem_t filled;
+  atomic_int closed;             // someone is stopping, both sides give up
+  int reserved, held;            // producer / consumer already own a slot
+
+  // metrics, each written by one side only and read after both stopped
+  uint64_t fill_sum;             // occupancy seen on every push
+  uint64_t pushes;
+  unsigned fill_max;
+  unsigned full_waits;           // producer had to wait for space
+  unsigned empty_waits;          // consumer had to wait for data
+
+} Stage_Queue;
+
+int stage_queue_init(Stage_Queue *q, unsigned size);
+void stage_queue_destroy(Stage_Queue *q);
+
+// producer: the slot to fill next (same one until pushed), NULL once closed
+Stage_Item *stage_queue_back(Stage_Queue *q);
+void stage_queue_push(Stage_Queue *q);
+
+// consumer: the oldest item (same one until popped), NULL once closed
+Stage_Item *stage_queue_front(Stage_Queue *q);
+void stage_queue_pop(Stage_Queue *q);
+
+void stage_queue_close(Stage_Queue *q);
+void stage_queue_report(Stage_Queue *q, const char *name);
+
+#endif
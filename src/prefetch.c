@@ -0,0 +1,69 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "pipe_input.h"
+#include "prefetch.h"
+
+// ask the kernel to start reading the header and the first seconds now, the
+// probe and the first decodes then come out of the page cache
+static void warm_cache(const char *filename)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return;
+
+  posix_fadvise(fd, 0, PREFETCH_BYTES, POSIX_FADV_WILLNEED);
+  close(fd);
+}
+
+static void *run_prefetch(void *arg)
+{
+  Prefetch *pf = (Prefetch*)arg;
+  PlayBackState *state = pf->state;
+
+  // wait until we're close to the end, or the track stopped early (skipped,
+  // seeked past the end, short file). unknown length means right away. the
+  // end of the track posts `wake`, so after a skip nothing waits out a nap.
+  // until then a second at a time (the position is in seconds), that's how
+  // soon a seek towards the end is noticed
+  while (!atomic_load(&pf->now) && atomic_load(&state->position) < pf->duration - pf->lead) {
+    struct timespec until;
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += 1;
+    while (sem_timedwait(&pf->wake, &until) < 0 && errno == EINTR);
+  }
+
+  if (atomic_load(&state->quit)) return NULL;
+
+  // pipes open when it's their turn: opening a fifo waits for whoever writes
+  // it, and nothing could get us out of that if the user quits meanwhile.
+  // same for urls, and a live stream would run on ahead while we wait
+  if (pipe_is_input(pf->track->filename) || net_is_url(pf->track->filename)) return NULL;
+
+  warm_cache(pf->track->filename);
+
+  // a failure leaves the track closed, play_track tries again and reports it
+  open_track(pf->track, pf->opt);
+  return NULL;
+}
+
+void prefetch_start(Prefetch *pf)
+{
+  sem_init(&pf->wake, 0, 0);
+  pthread_create(&pf->thread, NULL, run_prefetch, pf);
+}
+
+void prefetch_now(Prefetch *pf)
+{
+  atomic_store(&pf->now, 1);
+  sem_post(&pf->wake);
+}
+
+void prefetch_finish(Prefetch *pf)
+{
+  pthread_join(pf->thread, NULL);
+  sem_destroy(&pf->wake);
+}
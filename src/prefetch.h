@@ -0,0 +1,37 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+#include "backend.h"
+
+#define PREFETCH_LEAD 15                 // default --prefetch, seconds before the end
+#define PREFETCH_BYTES (4 << 20)         // header + first seconds, read ahead by the kernel
+
+// opens the next track on its own thread once the current one gets close to
+// its end (or gets skipped), so starting it doesn't wait on a spun-down disk
+// or a slow probe
+typedef struct {
+  pthread_t thread;
+  Track *track;                // filename set, opened in the background
+  PlayBackState *state;
+  int duration;                // length of the track playing now in seconds (0 = unknown)
+  int lead;
+  const PlayBackOptions *opt;
+  atomic_int now;              // the track playing now is over, stop waiting
+  sem_t wake;                  // posted with `now`
+
+} Prefetch;
+
+void prefetch_start(Prefetch *pf);
+
+// the track playing now is over (played out or skipped): open the next one
+// without waiting any longer
+void prefetch_now(Prefetch *pf);
+
+// waits for the thread, pf->track is opened if it got that far
+void prefetch_finish(Prefetch *pf);
+
+#endif
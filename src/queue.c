@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "queue.h"
+
+void queue_init(Play_Queue *q)
+{
+  *q = (Play_Queue){0};
+  q->current = -1;
+  pthread_mutex_init(&q->lock, NULL);
+}
+
+void queue_free(Play_Queue *q)
+{
+  while (q->chunks ){
+    Arena_Chunk *next = q->chunks->next;
+    free(q->chunks);
+    q->chunks = next;
+  }
+
+  free(q->entries);
+  pthread_mutex_destroy(&q->lock);
+}
+
+// room for n bytes that never move, a new chunk when the current one is full
+static char *arena_alloc(Play_Queue *q, size_t n)
+{
+  Arena_Chunk *c = q->chunks;
+
+  if (!c || c->size - c->used < n ){
+    size_t size = n > ARENA_CHUNK ? n : ARENA_CHUNK;
+
+    if (!(c = malloc(sizeof(Arena_Chunk) + size))) return NULL;
+    c->next = q->chunks;
+    c->used = 0;
+    c->size = size;
+    q->chunks = c;
+  }
+
+  char *p = c->data + c->used;
+  c->used += n;
+  q->bytes += n;
+  return p;
+}
+
+// append prefix + name as one entry (prefix may be empty)
+static int queue_append(Play_Queue *q, const char *prefix, size_t prefix_len, const char *name, size_t name_len)
+{
+  int ret = -1;
+  pthread_mutex_lock(&q->lock);
+
+  if (q->count == q->cap ){
+    int cap = q->cap ? q->cap * 2 : 64;
+    char **grown = realloc(q->entries, cap * sizeof(char*));
+    if (!grown) goto out;
+
+    q->entries = grown;
+    q->cap = cap;
+  }
+
+  char *s = arena_alloc(q, prefix_len + name_len + 1);
+  if (!s) goto out;
+
+  memcpy(s, prefix, prefix_len);
+  memcpy(s + prefix_len, name, name_len);
+  s[prefix_len + name_len] = '\0';
+
+  q->entries[q->count++] = s;
+  ret = 0;
+
+out:
+  pthread_mutex_unlock(&q->lock);
+  return ret;
+}
+
+int queue_push(Play_Queue *q, const char *path)
+{
+  return queue_append(q, "", 0, path, strlen(path));
+}
+
+// fisher-yates over [from, count)
+static void queue_shuffle(Play_Queue *q, int from)
+{
+  pthread_mutex_lock(&q->lock);
+
+  for (int i = q->count - 1; i > from; i--){
+    int j = from + rand() % (i - from + 1);
+    char *tmp = q->entries[i];
+    q->entries[i] = q->entries[j];
+    q->entries[j] = tmp;
+  }
+
+  pthread_mutex_unlock(&q->lock);
+}
+
+int queue_add_dir(Play_Queue *q, const char *dir)
+{
+  DIR *d = opendir(dir);
+  if (!d) return -1;
+
+  int from = q->count;
+  struct dirent *entry;
+  char filename[4096];
+  struct stat st;
+
+  while ((entry = readdir(d)) != NULL ){
+    if (entry->d_name[0] == '.') continue; // ".", ".." and hidden files
+
+    snprintf(filename, sizeof(filename), "%s/%s", dir, entry->d_name);
+    if (stat(filename, &st) < 0 || !S_ISREG(st.st_mode)) continue;
+
+    queue_push(q, filename);
+  }
+
+  closedir(d);
+  queue_shuffle(q, from);
+  return 0;
+}
+
+int queue_is_playlist(const char *path)
+{
+  const char *ext = strrchr(path, '.');
+  if (!ext) return 0;
+
+  return !strcasecmp(ext, ".m3u") || !strcasecmp(ext, ".m3u8") || !strcasecmp(ext, ".pls");
+}
+
+static int hex(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// %XX escapes of a file:// uri, in place. returns the new length
+static size_t uri_decode(char *s, size_t len)
+{
+  size_t out = 0;
+
+  for (size_t i = 0; i < len; i++){
+    if (s[i] == '%' && i + 2 < len && hex(s[i + 1]) >= 0 && hex(s[i + 2]) >= 0 ){
+      s[out++] = hex(s[i + 1]) << 4 | hex(s[i + 2]);
+      i += 2;
+    }
+    else s[out++] = s[i];
+  }
+  return out;
+}
+
+int queue_add_playlist(Play_Queue *q, const char *playlist)
+{
+  FILE *f = fopen(playlist, "r");
+  if (!f) return -1;
+
+  // relative entries hang off the playlist's directory (slash included)
+  const char *slash = strrchr(playlist, '/');
+  size_t dir_len = slash ? (size_t)(slash - playlist) + 1 : 0;
+
+  const char *ext = strrchr(playlist, '.');
+  int pls = ext && !strcasecmp(ext, ".pls");
+
+  // one line buffer for the whole file, getline grows it for the longest line
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t read;
+  int first = 1;
+
+  while ((read = getline(&line, &line_cap, f)) > 0 ){
+    char *s = line;
+    size_t len = read;
+
+    // m3u8 written on windows starts with a BOM
+    if (first && len >= 3 && !memcmp(s, "\xEF\xBB\xBF", 3)) { s += 3; len -= 3; }
+    first = 0;
+
+    while (len && (s[len - 1] == '\n' || s[len - 1] == '\r' || s[len - 1] == ' ' || s[len - 1] == '\t')) len--;
+    while (len && (*s == ' ' || *s == '\t')) { s++; len--; }
+    if (!len) continue;
+    s[len] = '\0';
+
+    if (pls ){
+      // FileN=path, Title/Length/NumberOfEntries/[playlist] don't matter to us
+      if (len < 5 || strncasecmp(s, "File", 4)) continue;
+
+      char *eq = memchr(s, '=', len);
+      if (!eq) continue;
+
+      len -= eq + 1 - s;
+      s = eq + 1;
+    }
+    else if (*s == '#') continue; // #EXTM3U, #EXTINF and friends
+
+    if (len > 7 && !strncmp(s, "file://", 7) ){
+      s += 7;
+      len = uri_decode(s, len - 7);
+      s[len] = '\0';
+    }
+
+    // absolute paths and urls as they are, everything else is relative
+    if (*s == '/' || strstr(s, "://"))
+      queue_append(q, "", 0, s, len);
+    else
+      queue_append(q, playlist, dir_len, s, len);
+  }
+
+  free(line);
+  fclose(f);
+  return 0;
+}
+
+const char *queue_get(Play_Queue *q, int index)
+{
+  pthread_mutex_lock(&q->lock);
+  const char *path = index >= 0 && index < q->count ? q->entries[index] : NULL;
+  pthread_mutex_unlock(&q->lock);
+  return path;
+}
+
+const char *queue_jump(Play_Queue *q, int index)
+{
+  const char *path = NULL;
+  pthread_mutex_lock(&q->lock);
+
+  if (index >= 0 && index < q->count ){
+    q->current = index;
+    path = q->entries[index];
+  }
+
+  pthread_mutex_unlock(&q->lock);
+  return path;
+}
+
+const char *queue_next(Play_Queue *q)
+{
+  return queue_jump(q, queue_position(q) + 1);
+}
+
+const char *queue_prev(Play_Queue *q)
+{
+  return queue_jump(q, queue_position(q) - 1);
+}
+
+int queue_position(Play_Queue *q)
+{
+  pthread_mutex_lock(&q->lock);
+  int current = q->current;
+  pthread_mutex_unlock(&q->lock);
+  return current;
+}
@@ -0,0 +1,54 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define ARENA_CHUNK (256 << 10)  // paths are packed into chunks this big
+
+typedef struct Arena_Chunk {
+  struct Arena_Chunk *next;
+  size_t used;
+  size_t size;
+  char data[];
+
+} Arena_Chunk;
+
+// the files to play, in order. path strings live in a chunked arena (they
+// never move once added), the index is one array of pointers into it, so a
+// huge playlist costs two allocations per chunk/doubling, not one per entry
+typedef struct {
+  char **entries;
+  int count;
+  int cap;
+  int current;                 // index of what's playing (-1 before the start)
+
+  Arena_Chunk *chunks;         // newest first
+  size_t bytes;                // arena bytes in use
+
+  pthread_mutex_t lock;        // the socket thread enqueues while we play
+
+} Play_Queue;
+
+void queue_init(Play_Queue *q);
+void queue_free(Play_Queue *q);
+int queue_push(Play_Queue *q, const char *path);
+
+// every file in a directory, shuffled. -1 if it can't be read
+int queue_add_dir(Play_Queue *q, const char *dir);
+
+// .m3u / .m3u8 / .pls, relative entries resolve against the playlist's
+// directory. read line by line, memory doesn't grow with the file beyond the
+// paths themselves. -1 if it can't be opened
+int queue_is_playlist(const char *path);
+int queue_add_playlist(Play_Queue *q, const char *playlist);
+
+// all O(1). they return the path now current, NULL past either end (and
+// leave current where it was)
+const char *queue_get(Play_Queue *q, int index);
+const char *queue_jump(Play_Queue *q, int index);
+const char *queue_next(Play_Queue *q);
+const char *queue_prev(Play_Queue *q);
+int queue_position(Play_Queue *q);
+
+#endif
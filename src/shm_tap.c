@@ -0,0 +1,235 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shm_tap.h"
+
+// data starts on its own cache line
+#define HEADER_BYTES 128
+
+_Static_assert(sizeof(Shm_Tap_Header) <= HEADER_BYTES, "shm tap header outgrew its space");
+
+static const char *format_name(ma_format fmt)
+{
+  switch (fmt){
+    case ma_format_u8: return "u8";
+    case ma_format_s16: return "s16";
+    case ma_format_s24: return "s24";
+    case ma_format_s32: return "s32";
+    case ma_format_f32: return "f32";
+    default: return "unknown";
+  }
+}
+
+// the tap that's there now: is whoever made it still running
+static int writer_alive(void)
+{
+  Shm_Tap *tap = shm_tap_open();
+  if (!tap) return 0;
+
+  pid_t pid = atomic_load(&tap->head->writer_pid);
+  int alive = pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+
+  shm_tap_close(tap);
+  return alive;
+}
+
+Shm_Tap *shm_tap_create(ma_format fmt, int ch, int rate)
+{
+  Shm_Tap *tap = calloc(1, sizeof(Shm_Tap));
+  if (!tap) return NULL;
+
+  tap->frame_bytes = ch * ma_get_bytes_per_sample(fmt);
+  uint32_t capacity = (uint32_t)rate * SHM_TAP_SECONDS * tap->frame_bytes;
+  tap->size = HEADER_BYTES + capacity;
+
+  // a leftover from a run that died is replaced, readers of it see the new
+  // one the next time they map the name. another tomu's that's still
+  // playing is left alone
+  int fd = shm_open(SHM_TAP_NAME, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0 && errno == EEXIST ){
+    if (writer_alive()) {
+      errno = EBUSY;
+      goto fail;
+    }
+    shm_unlink(SHM_TAP_NAME);
+    fd = shm_open(SHM_TAP_NAME, O_RDWR | O_CREAT | O_EXCL, 0644);
+  }
+  if (fd < 0) goto fail;
+
+  if (ftruncate(fd, tap->size) < 0) goto fail_fd;
+
+  void *map = mmap(NULL, tap->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) goto fail_fd;
+  close(fd);
+
+  tap->head = map;
+  tap->data = (uint8_t*)map + HEADER_BYTES;
+
+  // the callback must not fault pages in the first time round
+  memset(tap->data, 0, capacity);
+
+  Shm_Tap_Header *h = tap->head;
+  h->header_bytes = HEADER_BYTES;
+  h->capacity = capacity;
+  h->format = fmt;
+  h->channels = ch;
+  h->sample_rate = rate;
+  h->frame_bytes = tap->frame_bytes;
+  snprintf(h->format_name, sizeof(h->format_name), "%s", format_name(fmt));
+  atomic_store(&h->written, 0);
+  atomic_store(&h->claimed, 0);
+  atomic_store(&h->periods, 0);
+  atomic_store(&h->writer_pid, getpid());
+  h->version = SHM_TAP_VERSION;
+
+  // a reader that checks the magic sees a filled in header
+  atomic_thread_fence(memory_order_release);
+  h->magic = SHM_TAP_MAGIC;
+  return tap;
+
+fail_fd:
+  {
+    int err = errno;
+    close(fd);
+    shm_unlink(SHM_TAP_NAME);
+    errno = err;
+  }
+fail:
+  free(tap);
+  return NULL;
+}
+
+void shm_tap_destroy(Shm_Tap *tap)
+{
+  if (!tap) return;
+
+  atomic_store(&tap->head->writer_pid, 0);
+  munmap(tap->head, tap->size);
+  shm_unlink(SHM_TAP_NAME);
+  free(tap);
+}
+
+void shm_tap_write(Shm_Tap *tap, const void *pcm, int frames)
+{
+  Shm_Tap_Header *h = tap->head;
+  uint32_t bytes = frames * tap->frame_bytes;
+  if (!bytes) return;
+
+  // a block longer than the ring only leaves its end
+  if (bytes > h->capacity ){
+    pcm = (const uint8_t*)pcm + (bytes - h->capacity);
+    bytes = h->capacity;
+  }
+
+  // only the callback writes these, relaxed loads of our own stores
+  uint64_t at = atomic_load_explicit(&h->written, memory_order_relaxed);
+  uint32_t off = at % h->capacity;
+  uint32_t first = h->capacity - off < bytes ? h->capacity - off : bytes;
+
+  // claim first so a reader knows what's being overwritten
+  atomic_store_explicit(&h->claimed, at + bytes, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  memcpy(tap->data + off, pcm, first);
+  memcpy(tap->data, (const uint8_t*)pcm + first, bytes - first);
+
+  atomic_store_explicit(&h->written, at + bytes, memory_order_release);
+  atomic_store_explicit(&h->periods, atomic_load_explicit(&h->periods, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+
+// =================================================================
+// the reader side
+
+Shm_Tap *shm_tap_open(void)
+{
+  int fd = shm_open(SHM_TAP_NAME, O_RDONLY, 0);
+  if (fd < 0) return NULL;
+
+  struct stat st;
+  Shm_Tap *tap = NULL;
+
+  if (fstat(fd, &st) < 0 || st.st_size < HEADER_BYTES) goto out;
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) goto out;
+
+  Shm_Tap_Header *h = map;
+  if (h->magic != SHM_TAP_MAGIC || h->version != SHM_TAP_VERSION || h->header_bytes + (size_t)h->capacity > (size_t)st.st_size ){
+    munmap(map, st.st_size);
+    errno = EPROTO;
+    goto out;
+  }
+  atomic_thread_fence(memory_order_acquire);
+
+  if (!(tap = calloc(1, sizeof(Shm_Tap)))) {
+    munmap(map, st.st_size);
+    goto out;
+  }
+
+  tap->head = h;
+  tap->data = (uint8_t*)map + h->header_bytes;
+  tap->frame_bytes = h->frame_bytes;
+  tap->size = st.st_size;
+
+out:
+  close(fd);
+  return tap;
+}
+
+void shm_tap_close(Shm_Tap *tap)
+{
+  if (!tap) return;
+
+  munmap(tap->head, tap->size);
+  free(tap);
+}
+
+int shm_tap_read(Shm_Tap *tap, uint64_t *pos, void *out, int max, uint64_t *lost)
+{
+  Shm_Tap_Header *h = tap->head;
+  uint64_t cap = h->capacity;
+  uint64_t end = atomic_load_explicit(&h->written, memory_order_acquire);
+
+  *lost = 0;
+
+  // fell more than the whole ring behind, or started before the writer
+  // did: skip to the oldest that's still there
+  if (end - *pos > cap || *pos > end ){
+    uint64_t oldest = end > cap ? end - cap : 0;
+    if (*pos < oldest) *lost = oldest - *pos;
+    *pos = oldest;
+  }
+
+  max -= max % tap->frame_bytes;
+  int n = end - *pos < (uint64_t)max ? (int)(end - *pos) : max;
+  if (n <= 0) return 0;
+
+  uint32_t off = *pos % cap;
+  uint32_t first = cap - off < (uint64_t)n ? cap - off : (uint64_t)n;
+  memcpy(out, tap->data + off, first);
+  memcpy((uint8_t*)out + first, tap->data, n - first);
+
+  // anything the writer claimed over while we copied is garbage now
+  atomic_thread_fence(memory_order_acquire);
+  uint64_t claimed = atomic_load_explicit(&h->claimed, memory_order_relaxed);
+  uint64_t valid = claimed > cap ? claimed - cap : 0;
+
+  if (valid > *pos ){
+    uint64_t bad = valid - *pos < (uint64_t)n ? valid - *pos : (uint64_t)n;
+    memmove(out, (uint8_t*)out + bad, n - bad);
+    n -= bad;
+    *pos += bad;
+    *lost += bad;
+  }
+
+  *pos += n;
+  return n;
+}
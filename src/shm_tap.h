@@ -0,0 +1,69 @@
+#ifndef SHM_TAP_H
+#define SHM_TAP_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "../libs/miniaudio.h"
+
+#define SHM_TAP_NAME "/tomu-pcm"    // shm_open name, /dev/shm/tomu-pcm on linux
+#define SHM_TAP_MAGIC 0x554d4f54    // "TOMU"
+#define SHM_TAP_VERSION 1
+#define SHM_TAP_SECONDS 2           // how far behind a reader may fall before it loses data
+
+// --shm-tap: what the device is handed, mirrored into shared memory for
+// visualizers and recorders. the callback copies each block in and then
+// bumps `written`, nothing else, and never waits for a reader. a reader maps
+// the name read-only and keeps its own position:
+//
+//   end = written (acquire); copy [pos, end) out of data[] (offsets mod
+//   capacity); acquire fence, then look at claimed: whatever is more than
+//   `capacity` behind it may have been overwritten during the copy, drop it
+//
+// shm_tap_read() below does exactly that. the layout is fixed, every field
+// is at the same offset for a given version
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t header_bytes;            // data starts this far in
+  uint32_t capacity;                // bytes of data, whole frames
+
+  // the format descriptor: interleaved, what the device plays
+  uint32_t format;                  // ma_format: 1 u8, 2 s16, 4 s32, 5 f32
+  uint32_t channels;
+  uint32_t sample_rate;
+  uint32_t frame_bytes;
+  char format_name[8];              // "s16", "f32", ...
+
+  atomic_ullong written;            // the sequence counter: bytes ever written
+  atomic_ullong claimed;            // bytes the writer has started on, >= written
+  atomic_ullong periods;            // blocks ever written
+  atomic_uint writer_pid;           // 0 once the writer is gone
+
+} Shm_Tap_Header;
+
+typedef struct {
+  Shm_Tap_Header *head;
+  uint8_t *data;
+  int frame_bytes;
+  size_t size;                      // of the mapping
+
+} Shm_Tap;
+
+// the writer. NULL with errno set if shm can't be had, EBUSY if another
+// tomu that's still running has the name
+Shm_Tap *shm_tap_create(ma_format fmt, int ch, int rate);
+void shm_tap_destroy(Shm_Tap *tap);
+
+// the callback: one block, one copy
+void shm_tap_write(Shm_Tap *tap, const void *pcm, int frames);
+
+// a reader: map what the writer made, read-only
+Shm_Tap *shm_tap_open(void);
+void shm_tap_close(Shm_Tap *tap);
+
+// up to `max` bytes (whole frames) from *pos on, *pos moved past them.
+// `lost` gets the bytes the writer overwrote before we got to them
+int shm_tap_read(Shm_Tap *tap, uint64_t *pos, void *out, int max, uint64_t *lost);
+
+#endif
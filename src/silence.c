@@ -0,0 +1,558 @@
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+  #define SILENCE_X86
+  #define TARGET_SSE2 __attribute__((target("sse2")))
+  #define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#include "silence.h"
+
+// every kernel scans `n` samples of one type and returns the index of the
+// first (or last) one louder than `level`, -1 if there's none. `level` is
+// already in the sample type's scale. the first one that's louder is all
+// we're after, so most blocks of music end on the first vector
+typedef int (*scan_fn)(const void *s, int n, float level);
+
+static struct {
+  const char *name;
+  scan_fn s16_first, s16_last, s32_first, s32_last, f32_first, f32_last;
+
+} kernels;
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+
+// =================================================================
+// scalar kernels, also used for the tails and u8/double/s64
+
+#define SCALAR(name, type, loud) \
+  static int name##_first_scalar(const void *p, int n, float level) \
+  { \
+    const type *s = p; \
+    for (int i = 0; i < n; i++) \
+      if (loud) return i; \
+    return -1; \
+  } \
+  static int name##_last_scalar(const void *p, int n, float level) \
+  { \
+    const type *s = p; \
+    for (int i = n - 1; i >= 0; i--) \
+      if (loud) return i; \
+    return -1; \
+  }
+
+SCALAR(u8, uint8_t, fabsf(s[i] - 128.0f) > level)
+SCALAR(s16, int16_t, fabsf((float)s[i]) > level)
+SCALAR(s32, int32_t, fabsf((float)s[i]) > level)
+SCALAR(s64, int64_t, fabsf((float)s[i]) > level)
+SCALAR(f32, float, fabsf(s[i]) > level)
+SCALAR(f64, double, fabs(s[i]) > level)
+
+
+#ifdef SILENCE_X86
+// =================================================================
+// SSE2: compare a vector against +-level, movemask says which lanes are loud.
+// the scalar kernel finishes the block past the last whole vector
+
+TARGET_SSE2 static int s16_first_sse2(const void *p, int n, float level)
+{
+  const int16_t *s = p;
+  int16_t t = level < 32767.0f ? (int16_t)level : 32767;
+  __m128i hi = _mm_set1_epi16(t), lo = _mm_set1_epi16(-t);
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8){
+    __m128i x = _mm_loadu_si128((const __m128i*)(s + i));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi16(x, hi), _mm_cmplt_epi16(x, lo)));
+    if (mask) return i + __builtin_ctz(mask) / 2;
+  }
+
+  int r = s16_first_scalar(s + i, n - i, level);
+  return r < 0 ? -1 : i + r;
+}
+
+TARGET_SSE2 static int s16_last_sse2(const void *p, int n, float level)
+{
+  const int16_t *s = p;
+  int16_t t = level < 32767.0f ? (int16_t)level : 32767;
+  __m128i hi = _mm_set1_epi16(t), lo = _mm_set1_epi16(-t);
+  int i = n;
+
+  for (; i - 8 >= 0; i -= 8){
+    __m128i x = _mm_loadu_si128((const __m128i*)(s + i - 8));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi16(x, hi), _mm_cmplt_epi16(x, lo)));
+    if (mask) return i - 8 + (31 - __builtin_clz(mask)) / 2;
+  }
+
+  return s16_last_scalar(s, i, level);
+}
+
+TARGET_SSE2 static int s32_first_sse2(const void *p, int n, float level)
+{
+  const int32_t *s = p;
+  int32_t t = level < 2147483520.0f ? (int32_t)level : INT32_MAX;
+  __m128i hi = _mm_set1_epi32(t), lo = _mm_set1_epi32(-t);
+  int i = 0;
+
+  for (; i + 4 <= n; i += 4){
+    __m128i x = _mm_loadu_si128((const __m128i*)(s + i));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(_mm_cmpgt_epi32(x, hi), _mm_cmplt_epi32(x, lo))));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+
+  int r = s32_first_scalar(s + i, n - i, level);
+  return r < 0 ? -1 : i + r;
+}
+
+TARGET_SSE2 static int s32_last_sse2(const void *p, int n, float level)
+{
+  const int32_t *s = p;
+  int32_t t = level < 2147483520.0f ? (int32_t)level : INT32_MAX;
+  __m128i hi = _mm_set1_epi32(t), lo = _mm_set1_epi32(-t);
+  int i = n;
+
+  for (; i - 4 >= 0; i -= 4){
+    __m128i x = _mm_loadu_si128((const __m128i*)(s + i - 4));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(_mm_cmpgt_epi32(x, hi), _mm_cmplt_epi32(x, lo))));
+    if (mask) return i - 4 + 31 - __builtin_clz(mask);
+  }
+
+  return s32_last_scalar(s, i, level);
+}
+
+TARGET_SSE2 static int f32_first_sse2(const void *p, int n, float level)
+{
+  const float *s = p;
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 t = _mm_set1_ps(level);
+  int i = 0;
+
+  for (; i + 4 <= n; i += 4){
+    int mask = _mm_movemask_ps(_mm_cmpgt_ps(_mm_andnot_ps(sign, _mm_loadu_ps(s + i)), t));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+
+  int r = f32_first_scalar(s + i, n - i, level);
+  return r < 0 ? -1 : i + r;
+}
+
+TARGET_SSE2 static int f32_last_sse2(const void *p, int n, float level)
+{
+  const float *s = p;
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 t = _mm_set1_ps(level);
+  int i = n;
+
+  for (; i - 4 >= 0; i -= 4){
+    int mask = _mm_movemask_ps(_mm_cmpgt_ps(_mm_andnot_ps(sign, _mm_loadu_ps(s + i - 4)), t));
+    if (mask) return i - 4 + 31 - __builtin_clz(mask);
+  }
+
+  return f32_last_scalar(s, i, level);
+}
+
+
+// =================================================================
+// AVX2: the same, twice as wide
+
+TARGET_AVX2 static int s16_first_avx2(const void *p, int n, float level)
+{
+  const int16_t *s = p;
+  int16_t t = level < 32767.0f ? (int16_t)level : 32767;
+  __m256i hi = _mm256_set1_epi16(t), lo = _mm256_set1_epi16(-t);
+  int i = 0;
+
+  for (; i + 16 <= n; i += 16){
+    __m256i x = _mm256_loadu_si256((const __m256i*)(s + i));
+    unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpgt_epi16(x, hi), _mm256_cmpgt_epi16(lo, x)));
+    if (mask) return i + __builtin_ctz(mask) / 2;
+  }
+
+  int r = s16_first_sse2(s + i, n - i, level);
+  return r < 0 ? -1 : i + r;
+}
+
+TARGET_AVX2 static int s16_last_avx2(const void *p, int n, float level)
+{
+  const int16_t *s = p;
+  int16_t t = level < 32767.0f ? (int16_t)level : 32767;
+  __m256i hi = _mm256_set1_epi16(t), lo = _mm256_set1_epi16(-t);
+  int i = n;
+
+  for (; i - 16 >= 0; i -= 16){
+    __m256i x = _mm256_loadu_si256((const __m256i*)(s + i - 16));
+    unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpgt_epi16(x, hi), _mm256_cmpgt_epi16(lo, x)));
+    if (mask) return i - 16 + (31 - __builtin_clz(mask)) / 2;
+  }
+
+  return s16_last_sse2(s, i, level);
+}
+
+TARGET_AVX2 static int s32_first_avx2(const void *p, int n, float level)
+{
+  const int32_t *s = p;
+  int32_t t = level < 2147483520.0f ? (int32_t)level : INT32_MAX;
+  __m256i hi = _mm256_set1_epi32(t), lo = _mm256_set1_epi32(-t);
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8){
+    __m256i x = _mm256_loadu_si256((const __m256i*)(s + i));
+    int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_or_si256(_mm256_cmpgt_epi32(x, hi), _mm256_cmpgt_epi32(lo, x))));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+
+  int r = s32_first_sse2(s + i, n - i, level);
+  return r < 0 ? -1 : i + r;
+}
+
+TARGET_AVX2 static int s32_last_avx2(const void *p, int n, float level)
+{
+  const int32_t *s = p;
+  int32_t t = level < 2147483520.0f ? (int32_t)level : INT32_MAX;
+  __m256i hi = _mm256_set1_epi32(t), lo = _mm256_set1_epi32(-t);
+  int i = n;
+
+  for (; i - 8 >= 0; i -= 8){
+    __m256i x = _mm256_loadu_si256((const __m256i*)(s + i - 8));
+    int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_or_si256(_mm256_cmpgt_epi32(x, hi), _mm256_cmpgt_epi32(lo, x))));
+    if (mask) return i - 8 + 31 - __builtin_clz(mask);
+  }
+
+  return s32_last_sse2(s, i, level);
+}
+
+TARGET_AVX2 static int f32_first_avx2(const void *p, int n, float level)
+{
+  const float *s = p;
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  __m256 t = _mm256_set1_ps(level);
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8){
+    int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_andnot_ps(sign, _mm256_loadu_ps(s + i)), t, _CMP_GT_OQ));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+
+  int r = f32_first_sse2(s + i, n - i, level);
+  return r < 0 ? -1 : i + r;
+}
+
+TARGET_AVX2 static int f32_last_avx2(const void *p, int n, float level)
+{
+  const float *s = p;
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  __m256 t = _mm256_set1_ps(level);
+  int i = n;
+
+  for (; i - 8 >= 0; i -= 8){
+    int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_andnot_ps(sign, _mm256_loadu_ps(s + i - 8)), t, _CMP_GT_OQ));
+    if (mask) return i - 8 + 31 - __builtin_clz(mask);
+  }
+
+  return f32_last_sse2(s, i, level);
+}
+#endif
+
+
+// =================================================================
+// runtime dispatch, picked once
+
+static void silence_pick(void)
+{
+  kernels.name = "scalar";
+  kernels.s16_first = s16_first_scalar;
+  kernels.s16_last = s16_last_scalar;
+  kernels.s32_first = s32_first_scalar;
+  kernels.s32_last = s32_last_scalar;
+  kernels.f32_first = f32_first_scalar;
+  kernels.f32_last = f32_last_scalar;
+
+  #ifdef SILENCE_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")){
+      kernels.name = "avx2";
+      kernels.s16_first = s16_first_avx2;
+      kernels.s16_last = s16_last_avx2;
+      kernels.s32_first = s32_first_avx2;
+      kernels.s32_last = s32_last_avx2;
+      kernels.f32_first = f32_first_avx2;
+      kernels.f32_last = f32_last_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2")){
+      kernels.name = "sse2";
+      kernels.s16_first = s16_first_sse2;
+      kernels.s16_last = s16_last_sse2;
+      kernels.s32_first = s32_first_sse2;
+      kernels.s32_last = s32_last_sse2;
+      kernels.f32_first = f32_first_sse2;
+      kernels.f32_last = f32_last_sse2;
+    }
+  #endif
+}
+
+void silence_init(void)
+{
+  pthread_once(&kernels_once, silence_pick);
+}
+
+const char *silence_kernel_name(void)
+{
+  silence_init();
+  return kernels.name;
+}
+
+// the kernel for a sample type and `level` in its scale
+static scan_fn scan_get(enum AVSampleFormat fmt, int last, float *level)
+{
+  silence_init();
+
+  switch (av_get_packed_sample_fmt(fmt)){
+    case AV_SAMPLE_FMT_U8:  *level *= 128.0f;        return last ? u8_last_scalar : u8_first_scalar;
+    case AV_SAMPLE_FMT_S16: *level *= 32768.0f;      return last ? kernels.s16_last : kernels.s16_first;
+    case AV_SAMPLE_FMT_S32: *level *= 2147483648.0f; return last ? kernels.s32_last : kernels.s32_first;
+    case AV_SAMPLE_FMT_S64: *level *= 9223372036854775808.0f; return last ? s64_last_scalar : s64_first_scalar;
+    case AV_SAMPLE_FMT_FLT:                          return last ? kernels.f32_last : kernels.f32_first;
+    case AV_SAMPLE_FMT_DBL:                          return last ? f64_last_scalar : f64_first_scalar;
+    default: return NULL;
+  }
+}
+
+// packed: one run of frames * ch samples. planar: every plane, the earliest
+// (latest) of them wins and the later planes only need to look before it
+static int scan_frames(const uint8_t *const *data, enum AVSampleFormat fmt, int ch, int frames, float level, int last)
+{
+  scan_fn scan = scan_get(fmt, last, &level);
+  int found = -1;
+
+  if (!scan || frames <= 0) return -1;
+
+  if (!av_sample_fmt_is_planar(fmt)){
+    int i = scan(data[0], frames * ch, level);
+    return i < 0 ? -1 : i / ch;
+  }
+
+  int bytes = av_get_bytes_per_sample(fmt);
+  for (int c = 0; c < ch; c++){
+    if (!last){
+      int i = scan(data[c], found < 0 ? frames : found, level);
+      if (i >= 0) found = i;
+    }
+    else {
+      int from = found + 1;
+      int i = scan(data[c] + from * bytes, frames - from, level);
+      if (i >= 0) found = from + i;
+    }
+  }
+  return found;
+}
+
+int silence_first(const uint8_t *const *data, enum AVSampleFormat fmt, int ch, int frames, float level)
+{
+  return scan_frames(data, fmt, ch, frames, level, 0);
+}
+
+int silence_last(const uint8_t *const *data, enum AVSampleFormat fmt, int ch, int frames, float level)
+{
+  return scan_frames(data, fmt, ch, frames, level, 1);
+}
+
+
+// =================================================================
+// trim
+
+// keep `keep` frames from `skip` on. the buffers stay where they are, the
+// frame just points into them further on
+static void frame_cut(AVFrame *frame, enum AVSampleFormat fmt, int ch, int skip, int keep)
+{
+  int planar = av_sample_fmt_is_planar(fmt);
+  int offset = skip * av_get_bytes_per_sample(fmt) * (planar ? 1 : ch);
+  int planes = planar ? ch : 1;
+
+  for (int c = 0; c < planes; c++){
+    if (frame->extended_data != frame->data) frame->extended_data[c] += offset;
+    if (c < AV_NUM_DATA_POINTERS) frame->data[c] += offset;
+  }
+  frame->nb_samples = keep;
+}
+
+static void held_drop(Silence_Trim *t)
+{
+  for (int i = 0; i < t->held_n; i++) av_frame_free(&t->held[t->held_first + i]);
+  t->held_first = t->held_n = 0;
+  t->held_frames = 0;
+  t->release_all = 0;
+}
+
+static int held_push(Silence_Trim *t, AVFrame *frame)
+{
+  if (t->held_first + t->held_n == t->held_cap){
+    if (t->held_first > 0){
+      memmove(t->held, t->held + t->held_first, t->held_n * sizeof(AVFrame*));
+      t->held_first = 0;
+    }
+    else {
+      int cap = t->held_cap ? t->held_cap * 2 : 64;
+      AVFrame **grown = realloc(t->held, cap * sizeof(AVFrame*));
+      if (!grown) return -1;
+      t->held = grown;
+      t->held_cap = cap;
+    }
+  }
+
+  AVFrame *ref = av_frame_clone(frame);
+  if (!ref) return -1;
+
+  t->held[t->held_first + t->held_n++] = ref;
+  t->held_frames += frame->nb_samples;
+  return 0;
+}
+
+void silence_trim_init(Silence_Trim *t, int rate, int hold, const Loudness_Entry *entry)
+{
+  *t = (Silence_Trim){0};
+  t->level = pow(10.0, SILENCE_DB / 20.0);
+  t->hold = hold;
+  t->hold_max = (int64_t)rate * SILENCE_HOLD_S;
+  t->leading = 1;
+  t->whole = 1;
+  t->from = -1;
+
+  if (entry && entry->audio_to > 0){
+    t->lead = entry->audio_from;
+    t->end = entry->audio_to;
+  }
+  silence_init();
+}
+
+void silence_trim_free(Silence_Trim *t)
+{
+  held_drop(t);
+  free(t->held);
+  t->held = NULL;
+  t->held_cap = 0;
+}
+
+Silence_Action silence_trim_frame(Silence_Trim *t, AVFrame *frame, enum AVSampleFormat fmt, int ch)
+{
+  int64_t at = t->pos;
+  int n = frame->nb_samples;
+  const uint8_t *const *data;
+
+  t->pos += n;
+
+  // the cache knows where the sound is, nothing to scan
+  if (t->end){
+    int64_t from = t->leading ? t->lead : 0;
+    int64_t to = t->end;
+
+    if (at + n <= from || at >= to) return SILENCE_DROP;
+
+    int skip = from > at ? from - at : 0;
+    int keep = (to < at + n ? to - at : n) - skip;
+    if (skip || keep < n) frame_cut(frame, fmt, ch, skip, keep);
+    if (at + n > from) t->leading = 0;
+    return SILENCE_PASS;
+  }
+
+  data = (const uint8_t *const *)frame->extended_data;
+
+  if (t->leading){
+    int first = silence_first(data, fmt, ch, n, t->level);
+    if (first < 0) return SILENCE_DROP;
+
+    t->leading = 0;
+    if (t->whole) t->from = at + first;
+    if (first) frame_cut(frame, fmt, ch, first, n - first);
+    at += first;
+    n -= first;
+    data = (const uint8_t *const *)frame->extended_data;
+  }
+
+  // looking from the end: a block of music stops at its last sample
+  int last = silence_last(data, fmt, ch, n, t->level);
+  if (last >= 0 || !t->hold){
+    if (last >= 0) t->to = at + last + 1;
+    t->release_all = 1;
+    return SILENCE_PASS;
+  }
+
+  // out of memory: play it rather than lose it
+  if (held_push(t, frame) < 0){
+    t->release_all = 1;
+    return SILENCE_PASS;
+  }
+  return SILENCE_HOLD;
+}
+
+AVFrame *silence_trim_release(Silence_Trim *t)
+{
+  if (!t->held_n){
+    t->release_all = 0;
+    return NULL;
+  }
+
+  // more than SILENCE_HOLD_S of it: the oldest goes out, the track may well
+  // go on after it (a hidden track, a long pause)
+  if (!t->release_all && t->held_frames <= t->hold_max) return NULL;
+
+  AVFrame *frame = t->held[t->held_first++];
+  t->held_n--;
+  t->held_frames -= frame->nb_samples;
+  return frame;
+}
+
+void silence_trim_seek(Silence_Trim *t, int64_t pos)
+{
+  held_drop(t);
+  t->pos = pos;
+  t->leading = 0;
+  t->whole = 0;
+}
+
+void silence_trim_eof(Silence_Trim *t)
+{
+  held_drop(t);
+
+  if (t->whole && !t->end && t->from >= 0 && t->to > t->from){
+    t->found = 1;
+    t->lead = t->from;
+    t->end = t->to;
+  }
+}
+
+void silence_trim_rewind(Silence_Trim *t)
+{
+  silence_trim_eof(t);
+  t->pos = 0;
+  t->leading = 1;
+}
+
+int silence_trim_save(Loudness_Cache *c, const char *path, const Silence_Trim *t)
+{
+  const Loudness_Entry *old = loudness_cache_get(c, path);
+  Loudness_Entry e = { .track_lufs = -HUGE_VAL, .album_lufs = -HUGE_VAL };
+  char real[PATH_MAX];
+  struct stat st;
+
+  // not measured yet: loudness stays unknown until --analyze gets to it
+  if (old) e = *old;
+  else {
+    if (!realpath(path, real) || stat(real, &st) < 0) return -1;
+    e.path = real;
+    e.mtime = st.st_mtime;
+    e.size = st.st_size;
+  }
+
+  e.audio_from = t->from;
+  e.audio_to = t->to;
+  return loudness_cache_put(c, &e);
+}
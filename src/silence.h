@@ -0,0 +1,78 @@
+#ifndef SILENCE_H
+#define SILENCE_H
+
+#include <stdint.h>
+#include <libavutil/frame.h>
+#include <libavutil/samplefmt.h>
+
+#include "loudness.h"
+
+#define SILENCE_DB -70.0         // --trim: anything quieter counts as silence (dBFS)
+#define SILENCE_HOLD_S 10        // seconds of silence held back to see if the track ends in it
+
+void silence_init(void);
+const char *silence_kernel_name(void);
+
+// first / last frame of a decoded block with any sample above `level` (linear,
+// full scale 1.0), -1 if it's all silence. `data` is the frame's extended_data,
+// planar or packed as `fmt` says
+int silence_first(const uint8_t *const *data, enum AVSampleFormat fmt, int ch, int frames, float level);
+int silence_last(const uint8_t *const *data, enum AVSampleFormat fmt, int ch, int frames, float level);
+
+typedef enum {
+  SILENCE_PASS,                // write it (after what silence_trim_release() hands back)
+  SILENCE_HOLD,                // silence, kept until we know more
+  SILENCE_DROP,                // cut
+
+} Silence_Action;
+
+// --trim, per track: drops the silence before the first sound and, once the
+// decoder gets to the end, the silence after the last. silence in the middle
+// is held back (as frame references) until sound follows it, up to
+// SILENCE_HOLD_S, so a track only ends early when there's nothing after it.
+// positions are in input frames from the start of the file
+typedef struct {
+  float level;
+  int hold;                    // 0 for pipes and streams: holding back stalls playback
+  int64_t lead, end;           // known from the cache, end = 0 if not
+
+  // the decoder's side
+  int leading;                 // still before the first sound
+  int64_t pos;                 // input frames seen
+  int whole;                   // seen from the start without a seek
+  int64_t from, to;            // where the sound started and ended, from < 0 = not yet
+  int found;                   // got to the end with `whole`: from/to are worth caching
+
+  AVFrame **held;
+  int held_cap, held_first, held_n;
+  int64_t held_frames, hold_max;
+  int release_all;             // sound came after what's held, it all goes out
+
+} Silence_Trim;
+
+// `entry` is the file's cache entry or NULL
+void silence_trim_init(Silence_Trim *t, int rate, int hold, const Loudness_Entry *entry);
+void silence_trim_free(Silence_Trim *t);
+
+// may cut the frame's start or end in place (data pointers and nb_samples)
+Silence_Action silence_trim_frame(Silence_Trim *t, AVFrame *frame, enum AVSampleFormat fmt, int ch);
+
+// a held frame that's due now, oldest first, NULL once there's none. the
+// caller writes it out and frees it
+AVFrame *silence_trim_release(Silence_Trim *t);
+
+// the decoder jumped to `pos`: what's held is from before, and the start
+// isn't there to trim anymore
+void silence_trim_seek(Silence_Trim *t, int64_t pos);
+
+// the decoder got to the end: what's held is the trailing silence
+void silence_trim_eof(Silence_Trim *t);
+
+// --loop got to the end and starts the file over, cut it like the first
+// time round
+void silence_trim_rewind(Silence_Trim *t);
+
+// keep what a full pass found next to the file's loudness values
+int silence_trim_save(Loudness_Cache *c, const char *path, const Silence_Trim *t);
+
+#endif
@@ -1,5 +1,6 @@
 #include <errno.h>
 #include <signal.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
@@ -53,7 +54,7 @@ void *run_socket(void *arg)
 	while (1) {
         int ret = poll(&pfd, 1, 80);
         
-        if (!state->running) break;
+        if (!atomic_load(&state->running)) break;
 
         if (ret > 0 && (pfd.revents & POLLIN)) {
           int client = accept(sock, NULL, NULL);
@@ -62,9 +63,58 @@ void *run_socket(void *arg)
           int n;
           while ((n = recv(client, buf, sizeof(buf)-1, 0)) > 0) {
             buf[n] = '\0';
-            if (!strncmp(buf, "q", 1)) die("");
+
+            // --mix: as on the keyboard, a digit picks the layer and the
+            // rest goes to that one (quitting quits them all)
+            if (state->layers && buf[0] >= '1' && buf[0] < '1' + state->layer_count)
+                atomic_store(&state->layer, buf[0] - '1');
+
+            PlayBackState *target = state->layers ? state->layers[atomic_load(&state->layer)] : state;
+
+            if (!strncmp(buf, "q", 1)){
+                playback_stop(state);
+            }
             if (!strncmp(buf, " ", 1)){
-                playback_toggle(state);
+                playback_toggle(target);
+            }
+            // "+" / "-": what up and down do on the keyboard
+            if (!strncmp(buf, "+", 1)){
+                volume_increase(target);
+            }
+            if (!strncmp(buf, "-", 1)){
+                volume_decrease(target);
+            }
+            if (!strncmp(buf, "n", 1)){
+                track_next(target);
+            }
+            if (!strncmp(buf, "p", 1)){
+                track_prev(target);
+            }
+            if (!strncmp(buf, "e", 1)){
+                eq_toggle(target);
+            }
+            if (!strncmp(buf, "]", 1)){
+                speed_up(target);
+            }
+            if (!strncmp(buf, "[", 1)){
+                speed_down(target);
+            }
+            // "t": where the --shm-tap is and what's in it
+            if (!strncmp(buf, "t", 1)){
+                char reply[128];
+                Shm_Tap *tap = state->tap;
+
+                if (tap)
+                    snprintf(reply, sizeof(reply), "tap %s %s %u %u\n", SHM_TAP_NAME, tap->head->format_name,
+                        tap->head->channels, tap->head->sample_rate);
+                else
+                    snprintf(reply, sizeof(reply), "tap off\n");
+                send(client, reply, strlen(reply), MSG_NOSIGNAL);
+            }
+            // "a PATH": add a file to the end of the queue
+            if (!strncmp(buf, "a ", 2) && state->queue){
+                buf[strcspn(buf, "\r\n")] = '\0';
+                queue_push(state->queue, buf + 2);
             }
           }
           close(client);
@@ -0,0 +1,241 @@
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "spectrum.h"
+
+#define TAP_MASK (SPECTRUM_TAP - 1)
+#define BAR_LOW_HZ 40.0f         // where the first bar starts
+#define FALL_DB 1.5f             // how far a bar may drop per frame
+#define VU_WIDTH 24
+
+static const char *blocks[9] = { " ", "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█" };
+
+Spectrum *spectrum_create(int rate, Spectrum_Mode mode)
+{
+  Spectrum *sp = calloc(1, sizeof(Spectrum));
+  if (!sp) return NULL;
+
+  sp->mode = mode;
+  sp->decimate = rate / SPECTRUM_TAP_RATE > 1 ? rate / SPECTRUM_TAP_RATE : 1;
+  sp->rate = rate / sp->decimate;
+
+  int bits = 0;
+  while ((1 << bits) < SPECTRUM_FFT) bits++;
+
+  for (int i = 0; i < SPECTRUM_FFT; i++){
+    int r = 0;
+    for (int b = 0; b < bits; b++) r |= ((i >> b) & 1) << (bits - 1 - b);
+    sp->bitrev[i] = r;
+    sp->window[i] = 0.5f - 0.5f * cosf(2.0f * M_PI * i / SPECTRUM_FFT);
+  }
+
+  for (int i = 0; i < SPECTRUM_FFT / 2; i++){
+    sp->cos_tab[i] = cosf(2.0f * M_PI * i / SPECTRUM_FFT);
+    sp->sin_tab[i] = -sinf(2.0f * M_PI * i / SPECTRUM_FFT);
+  }
+
+  // log spaced from BAR_LOW_HZ to nyquist, at least a bin each
+  float hz_per_bin = (float)sp->rate / SPECTRUM_FFT;
+  float ratio = (sp->rate / 2.0f) / BAR_LOW_HZ;
+
+  for (int b = 0; b <= SPECTRUM_BARS; b++){
+    int bin = BAR_LOW_HZ * powf(ratio, (float)b / SPECTRUM_BARS) / hz_per_bin;
+    if (b > 0 && bin <= sp->edge[b - 1]) bin = sp->edge[b - 1] + 1;
+    if (bin > SPECTRUM_FFT / 2) bin = SPECTRUM_FFT / 2;
+    sp->edge[b] = bin;
+  }
+
+  for (int b = 0; b < SPECTRUM_BARS; b++) sp->smooth[b] = SPECTRUM_FLOOR_DB;
+  atomic_init(&sp->rms, SPECTRUM_FLOOR_DB * 10);
+  atomic_init(&sp->peak, SPECTRUM_FLOOR_DB * 10);
+  return sp;
+}
+
+void spectrum_destroy(Spectrum *sp)
+{
+  if (!sp) return;
+
+  spectrum_stop(sp);
+  free(sp);
+}
+
+
+// =================================================================
+// the tap, on the callback
+
+static inline float sample_at(const void *pcm, ma_format fmt, int i)
+{
+  switch (fmt){
+    case ma_format_f32: return ((const float*)pcm)[i];
+    case ma_format_s16: return ((const int16_t*)pcm)[i] * (1.0f / 32768.0f);
+    case ma_format_s32: return ((const int32_t*)pcm)[i] * (1.0f / 2147483648.0f);
+    case ma_format_u8: return (((const uint8_t*)pcm)[i] - 128) * (1.0f / 128.0f);
+    default: return 0.0f;
+  }
+}
+
+void spectrum_tap(Spectrum *sp, const void *pcm, int frames, ma_format fmt, int ch)
+{
+  uint64_t written = atomic_load_explicit(&sp->written, memory_order_relaxed);
+  float scale = 1.0f / (ch * sp->decimate);
+
+  // the channels mixed down and every `decimate` frames averaged, a crude
+  // low pass but the bars don't need more
+  for (int f = 0, i = 0; f < frames; f++){
+    for (int c = 0; c < ch; c++, i++) sp->acc += sample_at(pcm, fmt, i);
+
+    if (++sp->phase == sp->decimate ){
+      sp->tap[written++ & TAP_MASK] = sp->acc * scale;
+      sp->acc = 0.0f;
+      sp->phase = 0;
+    }
+  }
+
+  atomic_store_explicit(&sp->written, written, memory_order_release);
+}
+
+
+// =================================================================
+// the analyzer
+
+// in place, radix 2, the input already in bit reversed order
+static void fft(Spectrum *sp)
+{
+  float *re = sp->re, *im = sp->im;
+
+  for (int len = 2; len <= SPECTRUM_FFT; len <<= 1){
+    int half = len >> 1, step = SPECTRUM_FFT / len;
+
+    for (int i = 0; i < SPECTRUM_FFT; i += len){
+      for (int k = 0; k < half; k++){
+        float wr = sp->cos_tab[k * step], wi = sp->sin_tab[k * step];
+        int a = i + k, b = a + half;
+        float tr = re[b] * wr - im[b] * wi;
+        float ti = re[b] * wi + im[b] * wr;
+
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+      }
+    }
+  }
+}
+
+static inline float to_db(float v)
+{
+  return v > 0.0f ? 20.0f * log10f(v) : SPECTRUM_FLOOR_DB;
+}
+
+int spectrum_analyze(Spectrum *sp)
+{
+  uint64_t end = atomic_load_explicit(&sp->written, memory_order_acquire);
+  if (end < SPECTRUM_FFT) return 0;
+
+  uint64_t from = end - SPECTRUM_FFT;
+  float sum = 0.0f, peak = 0.0f;
+
+  for (int i = 0; i < SPECTRUM_FFT; i++){
+    float v = sp->tap[(from + i) & TAP_MASK];
+
+    sum += v * v;
+    if (fabsf(v) > peak) peak = fabsf(v);
+    sp->re[sp->bitrev[i]] = v * sp->window[i];
+    sp->im[sp->bitrev[i]] = 0.0f;
+  }
+
+  // the callback went all the way round while we copied: torn, skip it
+  if (atomic_load_explicit(&sp->written, memory_order_acquire) - from > SPECTRUM_TAP) return 0;
+
+  atomic_store(&sp->rms, to_db(sqrtf(sum / SPECTRUM_FFT)) * 10);
+  atomic_store(&sp->peak, to_db(peak) * 10);
+  if (sp->mode != SPECTRUM_BARS_VIEW) return 1;
+
+  fft(sp);
+
+  // a full scale sine through the hann window peaks at FFT / 4
+  for (int b = 0; b < SPECTRUM_BARS; b++){
+    float top = 0.0f;
+
+    for (int k = sp->edge[b]; k < sp->edge[b + 1]; k++){
+      float mag = sp->re[k] * sp->re[k] + sp->im[k] * sp->im[k];
+      if (mag > top) top = mag;
+    }
+
+    float db = to_db(sqrtf(top) / (SPECTRUM_FFT / 4));
+    sp->smooth[b] = db > sp->smooth[b] - FALL_DB ? db : sp->smooth[b] - FALL_DB;
+
+    int level = (sp->smooth[b] - SPECTRUM_FLOOR_DB) / -SPECTRUM_FLOOR_DB * 8;
+    atomic_store(&sp->level[b], level < 0 ? 0 : level > 8 ? 8 : level);
+  }
+
+  return 1;
+}
+
+// idle priority, like the waveform scan, and a steady tick: it sleeps to the
+// next frame instead of for a frame so slow analyses don't drift
+static void *run_spectrum(void *arg)
+{
+  Spectrum *sp = arg;
+  struct timespec next;
+
+  #ifdef SCHED_IDLE
+    struct sched_param param = {0};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+  #endif
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
+  while (!atomic_load(&sp->stop)) {
+    spectrum_analyze(sp);
+
+    next.tv_nsec += 1000000000L / SPECTRUM_FPS;
+    if (next.tv_nsec >= 1000000000L ){
+      next.tv_nsec -= 1000000000L;
+      next.tv_sec++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+
+  return NULL;
+}
+
+void spectrum_start(Spectrum *sp)
+{
+  atomic_store(&sp->stop, 0);
+  sp->running = pthread_create(&sp->thread, NULL, run_spectrum, sp) == 0;
+}
+
+void spectrum_stop(Spectrum *sp)
+{
+  if (!sp->running) return;
+
+  atomic_store(&sp->stop, 1);
+  pthread_join(sp->thread, NULL);
+  sp->running = 0;
+}
+
+void spectrum_draw(Spectrum *sp, char *out, int size)
+{
+  int n = 0;
+
+  if (sp->mode == SPECTRUM_BARS_VIEW ){
+    for (int b = 0; b < SPECTRUM_BARS && n < size; b++)
+      n += snprintf(out + n, size - n, "%s", blocks[atomic_load(&sp->level[b])]);
+    return;
+  }
+
+  // vu: rms as the bar, the peak as a tick past it
+  float rms = atomic_load(&sp->rms) / 10.0f, peak = atomic_load(&sp->peak) / 10.0f;
+  int fill = (rms - SPECTRUM_FLOOR_DB) / -SPECTRUM_FLOOR_DB * VU_WIDTH;
+  int tick = (peak - SPECTRUM_FLOOR_DB) / -SPECTRUM_FLOOR_DB * VU_WIDTH;
+
+  for (int i = 0; i < VU_WIDTH && n < size; i++)
+    n += snprintf(out + n, size - n, "%s", i < fill ? "█" : i == tick ? "|" : "·");
+  if (n < size) snprintf(out + n, size - n, " %5.1f dB", rms);
+}
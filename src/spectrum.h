@@ -0,0 +1,74 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "../libs/miniaudio.h"
+
+#define SPECTRUM_FFT 1024        // points, at the tap's rate (~43ms, ~20Hz a bin)
+#define SPECTRUM_FPS 30          // analyses a second
+#define SPECTRUM_BARS 24
+#define SPECTRUM_TAP 4096        // tap ring, samples (a power of two)
+#define SPECTRUM_TAP_RATE 20000  // the tap decimates down to about this
+#define SPECTRUM_FLOOR_DB -60.0f // this quiet or less draws as nothing
+
+typedef enum {
+  SPECTRUM_OFF,
+  SPECTRUM_BARS_VIEW,          // --spectrum: bars on a log frequency scale
+  SPECTRUM_VU,                 // --spectrum=vu: rms and peak level
+
+} Spectrum_Mode;
+
+// --spectrum: the callback drops a mono, decimated copy of every block it
+// plays into the tap, a ring it never waits on: one counter, stored after the
+// samples. a thread at idle priority takes the newest SPECTRUM_FFT of them
+// SPECTRUM_FPS times a second (and gives up on a copy the callback lapped
+// while it was reading), runs the fft and leaves the levels for the progress
+// line to draw
+typedef struct {
+  Spectrum_Mode mode;
+  int rate;                    // of the tap
+
+  // callback only, but the samples and the counter
+  float tap[SPECTRUM_TAP];
+  atomic_ullong written;       // samples ever put in the tap
+  int decimate, phase;
+  float acc;
+
+  // analyzer only. the plan (window, twiddles, bit reversal) is made up front
+  float window[SPECTRUM_FFT];
+  float cos_tab[SPECTRUM_FFT / 2], sin_tab[SPECTRUM_FFT / 2];
+  uint16_t bitrev[SPECTRUM_FFT];
+  float re[SPECTRUM_FFT], im[SPECTRUM_FFT];
+  int edge[SPECTRUM_BARS + 1]; // first bin of every bar
+  float smooth[SPECTRUM_BARS]; // dB, falls slower than it rises
+
+  // what gets drawn: 0..8 eighths per bar, vu in tenths of a dB
+  atomic_int level[SPECTRUM_BARS];
+  atomic_int rms, peak;
+
+  pthread_t thread;
+  atomic_int stop;
+  int running;
+
+} Spectrum;
+
+Spectrum *spectrum_create(int rate, Spectrum_Mode mode);
+void spectrum_destroy(Spectrum *sp);
+
+void spectrum_start(Spectrum *sp);
+void spectrum_stop(Spectrum *sp);
+
+// the callback: one block as it goes to the device. never waits
+void spectrum_tap(Spectrum *sp, const void *pcm, int frames, ma_format fmt, int ch);
+
+// one analysis of the newest tap samples, what the thread runs every frame.
+// 0 if there wasn't enough yet or the callback overran the copy
+int spectrum_analyze(Spectrum *sp);
+
+// the display (utf-8) into `out`
+void spectrum_draw(Spectrum *sp, char *out, int size);
+
+#endif
@@ -0,0 +1,376 @@
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+  #define STRETCH_X86
+  #define TARGET_SSE2 __attribute__((target("sse2")))
+  #define TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  #include <arm_neon.h>
+  #define STRETCH_NEON
+#endif
+
+#include "stretch.h"
+
+typedef float (*dot_kernel)(const float *a, const float *b, int n);
+
+static struct {
+  const char *name;
+  dot_kernel dot;
+
+} kernels;
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+
+// =================================================================
+// dot products, scalar also does the tails
+
+static float dot_scalar(const float *a, const float *b, int n)
+{
+  float sum = 0;
+  for (int i = 0; i < n; i++) sum += a[i] * b[i];
+  return sum;
+}
+
+#ifdef STRETCH_X86
+// two accumulators so the adds don't wait on each other
+
+TARGET_SSE2 static float dot_sse2(const float *a, const float *b, int n)
+{
+  __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8){
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+  }
+
+  s0 = _mm_add_ps(s0, s1);
+  s0 = _mm_add_ps(s0, _mm_movehl_ps(s0, s0));
+  s0 = _mm_add_ss(s0, _mm_shuffle_ps(s0, s0, 1));
+  return _mm_cvtss_f32(s0) + dot_scalar(a + i, b + i, n - i);
+}
+
+TARGET_AVX2 static float dot_avx2(const float *a, const float *b, int n)
+{
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+  int i = 0;
+
+  for (; i + 16 <= n; i += 16){
+    s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    s1 = _mm256_add_ps(s1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+  }
+
+  s0 = _mm256_add_ps(s0, s1);
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s) + dot_scalar(a + i, b + i, n - i);
+}
+#endif
+
+#ifdef STRETCH_NEON
+static float dot_neon(const float *a, const float *b, int n)
+{
+  float32x4_t s0 = vdupq_n_f32(0), s1 = vdupq_n_f32(0);
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8){
+    s0 = vmlaq_f32(s0, vld1q_f32(a + i), vld1q_f32(b + i));
+    s1 = vmlaq_f32(s1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+  }
+
+  return vaddvq_f32(vaddq_f32(s0, s1)) + dot_scalar(a + i, b + i, n - i);
+}
+#endif
+
+static void stretch_pick(void)
+{
+  kernels.name = "scalar";
+  kernels.dot = dot_scalar;
+
+  #ifdef STRETCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){
+      kernels.name = "avx2";
+      kernels.dot = dot_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2")){
+      kernels.name = "sse2";
+      kernels.dot = dot_sse2;
+    }
+  #elif defined(STRETCH_NEON)
+    kernels.name = "neon";
+    kernels.dot = dot_neon;
+  #endif
+}
+
+void stretch_init(void)
+{
+  pthread_once(&kernels_once, stretch_pick);
+}
+
+const char *stretch_kernel_name(void)
+{
+  stretch_init();
+  return kernels.name;
+}
+
+float stretch_dot(const float *a, const float *b, int n)
+{
+  stretch_init();
+  return kernels.dot(a, b, n);
+}
+
+
+// =================================================================
+// the ring's format to floats and back, interleaved
+
+static void load(Stretch *st, const void *pcm, int frames)
+{
+  float *x = st->in + st->in_len * st->ch;
+  int samples = frames * st->ch;
+
+  switch (st->fmt){
+    case ma_format_f32: memcpy(x, pcm, samples * sizeof(float)); break;
+    case ma_format_s16: for (int i = 0; i < samples; i++) x[i] = ((const int16_t*)pcm)[i] * (1.0f / 32768.0f); break;
+    case ma_format_s32: for (int i = 0; i < samples; i++) x[i] = ((const int32_t*)pcm)[i] * (1.0f / 2147483648.0f); break;
+    case ma_format_u8: for (int i = 0; i < samples; i++) x[i] = (((const uint8_t*)pcm)[i] - 128) * (1.0f / 128.0f); break;
+    default: break;
+  }
+
+  // the search only needs to see the shape, one channel of it is enough
+  float *m = st->mono + st->in_len;
+  for (int i = 0; i < frames; i++){
+    float sum = 0;
+    for (int c = 0; c < st->ch; c++) sum += x[i * st->ch + c];
+    m[i] = sum / st->ch;
+  }
+}
+
+static inline float clampf(float v, float lo, float hi)
+{
+  return v < lo ? lo : v > hi ? hi : v;
+}
+
+static void store(Stretch *st, const float *x, int frames)
+{
+  int samples = frames * st->ch;
+
+  switch (st->fmt){
+    case ma_format_f32: memcpy(st->out, x, samples * sizeof(float)); break;
+    case ma_format_s16:
+      for (int i = 0; i < samples; i++) ((int16_t*)st->out)[i] = lrintf(clampf(x[i] * 32768.0f, -32768.0f, 32767.0f));
+      break;
+    case ma_format_s32:
+      // 2147483520 is the biggest float below 2^31
+      for (int i = 0; i < samples; i++) ((int32_t*)st->out)[i] = lrintf(clampf(x[i] * 2147483648.0f, -2147483648.0f, 2147483520.0f));
+      break;
+    case ma_format_u8:
+      for (int i = 0; i < samples; i++) ((uint8_t*)st->out)[i] = lrintf(clampf(x[i] * 128.0f, -128.0f, 127.0f)) + 128;
+      break;
+    default: break;
+  }
+}
+
+
+// =================================================================
+
+Stretch *stretch_create(ma_format fmt, int ch, int rate, float speed)
+{
+  if (fmt != ma_format_f32 && fmt != ma_format_s16 && fmt != ma_format_s32 && fmt != ma_format_u8 ){
+    errno = EINVAL;
+    return NULL;
+  }
+
+  stretch_init();
+
+  Stretch *st = calloc(1, sizeof(Stretch));
+  if (!st) return NULL;
+
+  st->fmt = fmt;
+  st->ch = ch;
+  st->rate = rate;
+  st->hop = rate * STRETCH_WINDOW_MS / 2000;
+  st->window = st->hop * 2;
+  st->seek = rate * STRETCH_SEEK_MS / 1000;
+  atomic_init(&st->speed, speed);
+
+  // the most a segment can need: it starts up to a hop (at 2x) and the seek
+  // range behind the last one's continuation, and looks a window and the
+  // seek range ahead. twice that leaves room to feed in big chunks
+  st->in_cap = 2 * (st->window + 2 * st->hop + 2 * st->seek);
+
+  st->win = malloc(st->window * sizeof(float));
+  st->in = malloc(st->in_cap * ch * sizeof(float));
+  st->mono = malloc(st->in_cap * sizeof(float));
+  st->acc = malloc(st->window * ch * sizeof(float));
+  st->out = malloc(st->hop * ch * ma_get_bytes_per_sample(fmt));
+
+  if (!st->win || !st->in || !st->mono || !st->acc || !st->out){
+    stretch_destroy(st);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  for (int i = 0; i < st->window; i++)
+    st->win[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / st->window);
+
+  stretch_reset(st);
+  return st;
+}
+
+void stretch_destroy(Stretch *st)
+{
+  if (!st) return;
+
+  free(st->win);
+  free(st->in);
+  free(st->mono);
+  free(st->acc);
+  free(st->out);
+  free(st);
+}
+
+void stretch_reset(Stretch *st)
+{
+  st->in_len = 0;
+  st->nominal = 0;
+  st->natural = 0;
+  st->started = 0;
+  st->draining = 0;
+  memset(st->acc, 0, st->window * st->ch * sizeof(float));
+  atomic_store(&st->pending, 0);
+}
+
+// input a segment needs before it can go
+static int needed(const Stretch *st)
+{
+  int ahead = (int)st->nominal + st->seek;
+  if (ahead < st->natural) ahead = st->natural;
+  return ahead + st->window;
+}
+
+// the start in [lo, hi] whose first hop looks most like what follows the last
+// segment (normalized cross-correlation, compared squared to skip the sqrt)
+static int best_start(const Stretch *st, int lo, int hi)
+{
+  const float *target = st->mono + st->natural;
+  const float *m = st->mono;
+  int n = st->hop, best = lo;
+  double energy = 0, best_score = -INFINITY;
+
+  for (int i = 0; i < n; i++) energy += m[lo + i] * m[lo + i];
+
+  for (int c = lo; c <= hi; c++){
+    double d = kernels.dot(m + c, target, n);
+    double score = d * fabs(d) / (energy + 1e-9);
+
+    if (score > best_score){
+      best_score = score;
+      best = c;
+    }
+
+    energy += m[c + n] * m[c + n] - m[c] * m[c];
+    if (energy < 0) energy = 0;
+  }
+
+  return best;
+}
+
+// one segment in, one hop out
+static int step(Stretch *st, uint8_t **out)
+{
+  float speed = clampf(atomic_load(&st->speed), STRETCH_MIN, STRETCH_MAX);
+  int ch = st->ch, p;
+
+  if (!st->started) p = 0;
+  // at 1x the continuation is where the segment would go anyway, and the
+  // overlap-add gives the input back as it was
+  else if (speed == 1.0f){
+    p = st->natural;
+    st->nominal = p;
+  }
+  else {
+    int lo = (int)st->nominal - st->seek;
+    if (lo < 0) lo = 0;
+    p = best_start(st, lo, (int)st->nominal + st->seek);
+  }
+
+  // the first segment starts at full volume instead of fading in
+  const float *x = st->in + p * ch;
+  for (int i = 0; i < st->window; i++){
+    float w = !st->started && i < st->hop ? 1.0f : st->win[i];
+    for (int c = 0; c < ch; c++) st->acc[i * ch + c] += w * x[i * ch + c];
+  }
+
+  store(st, st->acc, st->hop);
+  memmove(st->acc, st->acc + st->hop * ch, (st->window - st->hop) * ch * sizeof(float));
+  memset(st->acc + (st->window - st->hop) * ch, 0, st->hop * ch * sizeof(float));
+
+  st->natural = p + st->hop;
+  st->nominal += st->hop * speed;
+  st->started = 1;
+
+  // drop what no segment can reach anymore
+  int drop = (int)st->nominal - st->seek;
+  if (drop > st->natural) drop = st->natural;
+
+  if (drop > 0){
+    st->in_len -= drop;
+    memmove(st->in, st->in + drop * ch, st->in_len * ch * sizeof(float));
+    memmove(st->mono, st->mono + drop, st->in_len * sizeof(float));
+    st->nominal -= drop;
+    st->natural -= drop;
+    st->end -= drop;
+  }
+
+  atomic_store(&st->pending, st->in_len - st->natural);
+  *out = st->out;
+  return st->hop;
+}
+
+int stretch_feed(Stretch *st, const void *pcm, int frames)
+{
+  int n = st->in_cap - st->in_len;
+  if (n > frames) n = frames;
+
+  load(st, pcm, n);
+  st->in_len += n;
+  atomic_store(&st->pending, st->in_len - st->natural);
+  return n;
+}
+
+int stretch_take(Stretch *st, uint8_t **out)
+{
+  if (st->in_len < needed(st)) return 0;
+  return step(st, out);
+}
+
+int stretch_drain(Stretch *st, uint8_t **out)
+{
+  if (!st->draining){
+    st->draining = 1;
+    st->end = st->in_len;
+  }
+
+  // everything real is out
+  if (!st->in_len || (st->started && st->natural >= st->end)){
+    stretch_reset(st);
+    return 0;
+  }
+
+  int need = needed(st);
+  if (st->in_len < need){
+    memset(st->in + st->in_len * st->ch, 0, (need - st->in_len) * st->ch * sizeof(float));
+    memset(st->mono + st->in_len, 0, (need - st->in_len) * sizeof(float));
+    st->in_len = need;
+  }
+  return step(st, out);
+}
@@ -0,0 +1,70 @@
+#ifndef STRETCH_H
+#define STRETCH_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "../libs/miniaudio.h"
+
+#define STRETCH_MIN 0.5f
+#define STRETCH_MAX 2.0f
+#define STRETCH_STEP 0.1f        // what '[' and ']' change it by
+#define STRETCH_WINDOW_MS 30     // the segments overlapped, half a window apart in the output
+#define STRETCH_SEEK_MS 10       // how far a segment may move (each way) to line up with the last one
+
+void stretch_init(void);
+const char *stretch_kernel_name(void);
+
+// the sum of a[i] * b[i], the correlation search's inner loop. exported for
+// the bench
+float stretch_dot(const float *a, const float *b, int n);
+
+// --speed: wsola. the output is cut into segments half a window apart, each
+// taken from the input at `speed` times that distance, and moved by up to
+// STRETCH_SEEK_MS to where it best continues the one before, so the pitch
+// stays and the waveforms line up where they overlap. works on the ring's
+// format, everything is allocated up front
+typedef struct {
+  ma_format fmt;
+  int ch, rate;
+  _Atomic float speed;         // the keys change it, the decoder reads it every segment
+  atomic_int pending;          // input frames taken in but not out yet, for seeking
+
+  int window, hop, seek;       // frames
+  float *win;                  // hann, `window` long. two half a window apart sum to 1
+
+  // input, as floats: interleaved and mixed down to one channel for the search.
+  // positions below are frames from in[0], what's before it is gone
+  float *in, *mono;
+  int in_len, in_cap;
+  double nominal;              // where the next segment would start with no search
+  int natural;                 // where the last segment continues, the search aims for this
+  int started;
+  int draining;
+  int end;                     // draining: the real input ends here, silence after
+
+  float *acc;                  // overlap-add, `window` frames. the first `hop` are done after a segment
+  uint8_t *out;                // those, in the ring's format
+
+} Stretch;
+
+// NULL with errno set: EINVAL if the format isn't one it can take, ENOMEM
+Stretch *stretch_create(ma_format fmt, int ch, int rate, float speed);
+void stretch_destroy(Stretch *st);
+
+// takes what fits of `frames` and says how much that was. call stretch_take()
+// until it's 0 before feeding more
+int stretch_feed(Stretch *st, const void *pcm, int frames);
+
+// the next block of output (in st->out, valid until the next call), its
+// length in frames, 0 if it needs more input
+int stretch_take(Stretch *st, uint8_t **out);
+
+// the track ended: what's held comes out with silence after it, then the
+// stretch is empty. call until it's 0
+int stretch_drain(Stretch *st, uint8_t **out);
+
+// a seek or a skip: forget everything held
+void stretch_reset(Stretch *st);
+
+#endif
@@ -0,0 +1,255 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "tee.h"
+#include "utils.h"
+
+#define WAV_HEADER 44
+#define WAV_UNKNOWN 0xffffffffu      // what a stream puts where the sizes go
+
+static void put16(uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+  put16(p, v);
+  put16(p + 2, v >> 16);
+}
+
+// the canonical 44 bytes. s32 is what an s24 device gets from the ring, so
+// it's 32 bit pcm here too
+static void wav_header(const Tee *tee, uint8_t *h, uint64_t data_bytes)
+{
+  int bits = ma_get_bytes_per_sample(tee->fmt) * 8;
+  uint32_t size = data_bytes > WAV_UNKNOWN - 36 ? WAV_UNKNOWN : (uint32_t)data_bytes;
+
+  memcpy(h, "RIFF", 4);
+  put32(h + 4, size == WAV_UNKNOWN ? WAV_UNKNOWN : size + 36);
+  memcpy(h + 8, "WAVEfmt ", 8);
+  put32(h + 16, 16);
+  put16(h + 20, tee->fmt == ma_format_f32 ? 3 : 1);  // ieee float or pcm
+  put16(h + 22, tee->ch);
+  put32(h + 24, tee->rate);
+  put32(h + 28, tee->rate * tee->frame_bytes);
+  put16(h + 32, tee->frame_bytes);
+  put16(h + 34, bits);
+  memcpy(h + 36, "data", 4);
+  put32(h + 40, size);
+}
+
+static int write_all(int fd, const uint8_t *p, size_t n)
+{
+  while (n ){
+    ssize_t w = write(fd, p, n);
+    if (w < 0 ){
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += w;
+    n -= w;
+  }
+  return 0;
+}
+
+static int sink_open(Tee *tee, Tee_Sink *s)
+{
+  uint8_t h[WAV_HEADER];
+
+  if (s->kind == TEE_WAV_PIPE ){
+    if (!(s->pipe = popen(s->target + 1, "w"))) return -1;
+    s->fd = fileno(s->pipe);
+  } else {
+    // a fifo waits here for its reader, the ring fills (and then drops)
+    // meanwhile. polled, so a reader that never comes doesn't hold up the exit
+    while ((s->fd = open(s->target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NONBLOCK, 0644)) < 0 ){
+      if (errno != ENXIO || atomic_load(&tee->stop)) return -1;
+      usleep(50000);
+    }
+    fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) & ~O_NONBLOCK);
+  }
+
+  if (s->kind == TEE_RAW) return 0;
+
+  wav_header(tee, h, s->kind == TEE_WAV ? 0 : WAV_UNKNOWN);
+  return write_all(s->fd, h, sizeof(h));
+}
+
+static void sink_close(Tee *tee, Tee_Sink *s)
+{
+  uint8_t h[WAV_HEADER];
+
+  // the sizes, now that they're known. a fifo named .wav can't seek back,
+  // its reader gets the stream as it went
+  if (s->kind == TEE_WAV && s->fd >= 0 ){
+    wav_header(tee, h, atomic_load(&s->taken));
+    if (pwrite(s->fd, h, sizeof(h), 0) < 0 && errno != ESPIPE && !atomic_load(&s->failed))
+      atomic_store(&s->failed, errno);
+  }
+
+  if (s->pipe) pclose(s->pipe);
+  else if (s->fd >= 0) close(s->fd);
+  s->pipe = NULL;
+  s->fd = -1;
+}
+
+static void *run_sink(void *arg)
+{
+  Tee_Sink *s = arg;
+  Tee *tee = s->tee;
+
+  // the header write may be what failed, with the file or the command
+  // already there: it's closed (and the command reaped) either way
+  if (sink_open(tee, s) < 0 ){
+    atomic_store(&s->failed, errno ? errno : EIO);
+    warn("tee: %s:", s->target);
+    sink_close(tee, s);
+    return NULL;
+  }
+
+  for (;;) {
+    int stop = atomic_load(&tee->stop);
+    uint64_t end = atomic_load_explicit(&s->written, memory_order_acquire);
+    uint64_t pos = atomic_load_explicit(&s->taken, memory_order_relaxed);
+
+    // the callback is done by the time stop is set, nothing comes after it
+    if (end == pos && stop) break;
+
+    // announce we're going to sleep, then check again so a block that went
+    // in between can't be missed
+    if (end - pos < s->batch && !stop ){
+      atomic_store(&s->waiting, 1);
+      if (atomic_load(&s->written) - pos < s->batch && !atomic_load(&tee->stop)) sem_wait(&s->ready);
+      atomic_store(&s->waiting, 0);
+      continue;
+    }
+
+    // up to the end of the ring, the rest next time round
+    uint32_t off = pos % s->capacity;
+    uint32_t n = s->capacity - off < end - pos ? s->capacity - off : (uint32_t)(end - pos);
+
+    if (write_all(s->fd, s->data + off, n) < 0 ){
+      atomic_store(&s->failed, errno);
+      warn("tee: %s:", s->target);
+      break;
+    }
+    atomic_store_explicit(&s->taken, pos + n, memory_order_release);
+  }
+
+  sink_close(tee, s);
+  return NULL;
+}
+
+Tee *tee_create(const char *const *targets, int count, ma_format fmt, int ch, int rate)
+{
+  Tee *tee = calloc(1, sizeof(Tee));
+  if (!tee) return NULL;
+
+  tee->fmt = fmt;
+  tee->ch = ch;
+  tee->rate = rate;
+  tee->frame_bytes = ch * ma_get_bytes_per_sample(fmt);
+
+  // a reader going away is a failed write for that sink, not the end of us
+  signal(SIGPIPE, SIG_IGN);
+
+  for (int i = 0; i < count && i < TEE_MAX_SINKS; i++){
+    Tee_Sink *s = &tee->sink[i];
+    size_t len = strlen(targets[i]);
+
+    s->tee = tee;
+    s->target = targets[i];
+    s->fd = -1;
+    if (targets[i][0] == '|') s->kind = TEE_WAV_PIPE;
+    else if (len > 4 && strcasecmp(targets[i] + len - 4, ".wav") == 0) s->kind = TEE_WAV;
+    else s->kind = TEE_RAW;
+
+    s->capacity = (uint32_t)rate * TEE_SECONDS * tee->frame_bytes;
+    s->batch = (uint32_t)(rate / TEE_WAKE) * tee->frame_bytes;
+    if (!(s->data = malloc(s->capacity))) goto fail;
+
+    // the callback must not fault pages in the first time round
+    memset(s->data, 0, s->capacity);
+    sem_init(&s->ready, 0, 0);
+    tee->count++;
+  }
+
+  for (int i = 0; i < tee->count; i++)
+    pthread_create(&tee->sink[i].thread, NULL, run_sink, &tee->sink[i]);
+
+  return tee;
+
+fail:
+  for (int i = 0; i < tee->count; i++){
+    sem_destroy(&tee->sink[i].ready);
+    free(tee->sink[i].data);
+  }
+  free(tee);
+  return NULL;
+}
+
+void tee_destroy(Tee *tee)
+{
+  if (!tee) return;
+
+  atomic_store(&tee->stop, 1);
+  for (int i = 0; i < tee->count; i++){
+    Tee_Sink *s = &tee->sink[i];
+
+    sem_post(&s->ready);
+    pthread_join(s->thread, NULL);
+
+    unsigned long long blocks = atomic_load(&s->blocks), dropped = atomic_load(&s->dropped);
+    double seconds = (double)atomic_load(&s->taken) / tee->frame_bytes / tee->rate;
+    int err = atomic_load(&s->failed);
+
+    printf("tee %s: %.1fs written, %llu blocks, %llu dropped%s%s\n", s->target, seconds, blocks, dropped,
+      err ? ", stopped: " : "", err ? strerror(err) : "");
+
+    sem_destroy(&s->ready);
+    free(s->data);
+  }
+
+  free(tee);
+}
+
+void tee_write(Tee *tee, const void *pcm, int frames)
+{
+  uint32_t bytes = frames * tee->frame_bytes;
+  if (!bytes) return;
+
+  for (int i = 0; i < tee->count; i++){
+    Tee_Sink *s = &tee->sink[i];
+
+    // a sink that failed takes nothing more, the rest go on
+    if (atomic_load_explicit(&s->failed, memory_order_relaxed)) continue;
+
+    uint64_t at = atomic_load_explicit(&s->written, memory_order_relaxed);
+    uint64_t used = at - atomic_load_explicit(&s->taken, memory_order_acquire);
+
+    // a whole block or none of it, so what a sink gets is always frames
+    // played back to back, with the gaps counted
+    if (bytes > s->capacity - used ){
+      atomic_store_explicit(&s->dropped, atomic_load_explicit(&s->dropped, memory_order_relaxed) + 1, memory_order_relaxed);
+      continue;
+    }
+
+    uint32_t off = at % s->capacity;
+    uint32_t first = s->capacity - off < bytes ? s->capacity - off : bytes;
+    memcpy(s->data + off, pcm, first);
+    memcpy(s->data, (const uint8_t*)pcm + first, bytes - first);
+
+    atomic_store(&s->written, at + bytes);
+    atomic_store_explicit(&s->blocks, atomic_load_explicit(&s->blocks, memory_order_relaxed) + 1, memory_order_relaxed);
+
+    // sem_post doesn't lock, fine to call from here
+    if (used + bytes >= s->batch && atomic_load(&s->waiting)) sem_post(&s->ready);
+  }
+}
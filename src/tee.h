@@ -0,0 +1,70 @@
+#ifndef TEE_H
+#define TEE_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../libs/miniaudio.h"
+
+#define TEE_MAX_SINKS 4
+#define TEE_SECONDS 2            // what a sink may fall behind before blocks get dropped
+#define TEE_WAKE 8               // the writer is woken for every 1/8s, not every period
+
+typedef enum {
+  TEE_RAW,                     // a file or a fifo: the samples as they are
+  TEE_WAV,                     // PATH.wav: a header, fixed up with the sizes at the end
+  TEE_WAV_PIPE,                // |command: a streaming wav header (no sizes) into its stdin
+
+} Tee_Kind;
+
+// one --tee target. the callback puts every block it plays into `data` if
+// it fits and counts it dropped if it doesn't, it never waits. the sink's
+// own thread does the writing, however long that takes
+typedef struct {
+  struct Tee *tee;
+  const char *target;
+  Tee_Kind kind;
+  int fd;
+  FILE *pipe;                  // TEE_WAV_PIPE, fd is its fileno
+
+  uint8_t *data;
+  uint32_t capacity;           // bytes, whole frames
+  atomic_ullong written;       // bytes ever put in (callback)
+  atomic_ullong taken;         // bytes ever written out (sink thread)
+  uint32_t batch;              // bytes a wake up waits for
+  atomic_int waiting;          // the sink thread is asleep on `ready`
+  sem_t ready;
+
+  atomic_ullong blocks;        // periods that went in
+  atomic_ullong dropped;       // periods that didn't fit
+  atomic_int failed;           // errno of the write that failed, the sink is off
+  pthread_t thread;
+
+} Tee_Sink;
+
+// --tee: the fan out after the ring. the device is one output, these are
+// the others, fed the exact same blocks
+typedef struct Tee {
+  Tee_Sink sink[TEE_MAX_SINKS];
+  int count;
+  ma_format fmt;
+  int ch, rate, frame_bytes;
+  atomic_int stop;
+
+} Tee;
+
+// starts a thread per sink, the sinks open there (a fifo may wait for its
+// reader). NULL if there's no memory
+Tee *tee_create(const char *const *targets, int count, ma_format fmt, int ch, int rate);
+
+// what's queued goes out, wav headers get their sizes, and every sink's
+// counts are printed
+void tee_destroy(Tee *tee);
+
+// the callback: one block, every sink
+void tee_write(Tee *tee, const void *pcm, int frames);
+
+#endif
@@ -1,32 +1,85 @@
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavcodec/codec.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/stat.h>
+#include <time.h>
 
+#include "analyze.h"
 #include "backend.h"
 #include "control.h"
+#include "mix.h"
+#include "pipe_input.h"
+#include "queue.h"
 #include "utils.h"
+#include "verify.h"
 
 void cleanUP(AVFormatContext *fmtCTX, AVCodecContext *codecCTX){
   if (fmtCTX ) avformat_close_input(&fmtCTX);
   if (codecCTX ) avcodec_free_context(&codecCTX);
 }
 
-void path_handle(const char *path, uint loop)
+// every file named on the command line, directories expand to their files
+// shuffled and playlists to their entries, then play them in order
+void path_handle(char **paths, int count, const PlayBackOptions *opt)
 {
+  Play_Queue queue;
   struct stat st;
+  int i;
 
-  if (stat(path, &st) < 0 ) goto bad_path;
+  queue_init(&queue);
+  srand(time(NULL));
 
-    if (S_ISDIR(st.st_mode)) shuffle(path, loop);
-    else if (S_ISREG(st.st_mode)) playback_run(path, loop);
-    else goto bad_path;
+  for (i = 0; i < count; i++){
+    // stdin, named pipes and urls play as they stream in
+    if (pipe_is_input(paths[i]) || net_is_url(paths[i]) ){
+      queue_push(&queue, paths[i]);
+      continue;
+    }
 
+    if (stat(paths[i], &st) < 0 ) goto bad_path;
+
+      if (S_ISDIR(st.st_mode)){
+        if (queue_add_dir(&queue, paths[i]) < 0) goto bad_path;
+      }
+      else if (S_ISREG(st.st_mode) && queue_is_playlist(paths[i])){
+        if (queue_add_playlist(&queue, paths[i]) < 0) goto bad_path;
+      }
+      else if (S_ISREG(st.st_mode)) queue_push(&queue, paths[i]);
+      else goto bad_path;
+  }
+
+  if (opt->analyze) analyze_run(&queue, opt);
+  else if (opt->verify) verify_run(&queue, opt);
+  else if (opt->mix) mix_run(&queue, opt);
+  else playback_run(&queue, opt);
+  queue_free(&queue);
   return;
 
 bad_path:
-  die("File:");
+  die("%s:", paths[i]);
+}
+
+// $XDG_CACHE_HOME/tomu/name or ~/.cache/tomu/name, `create` makes the
+// directories on the way
+int cache_path(char *out, size_t size, const char *name, int create)
+{
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  char dir[PATH_MAX - 64]; // room for what goes after it
+
+  if (xdg && *xdg) snprintf(dir, sizeof(dir), "%s", xdg);
+  else if (home) snprintf(dir, sizeof(dir), "%s/.cache", home);
+  else return -1;
+
+  if (create) mkdir(dir, 0755);
+  snprintf(out, size, "%s/tomu", dir);
+  if (create) mkdir(out, 0755);
+
+  snprintf(out, size, "%s/tomu/%s", dir, name);
+  return 0;
 }
 
 void verr(const char *fmt, va_list ap)
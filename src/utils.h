@@ -3,11 +3,15 @@
 
 #include <libavformat/avformat.h>
 
+#include "backend.h"
+#include "queue.h"
+
 #define false 0
 #define true 1
 
 void cleanUP(AVFormatContext *fmtCTX, AVCodecContext *codecCTX);
-void path_handle(const char *path, uint loop);
+void path_handle(char **paths, int count, const PlayBackOptions *opt);
+int cache_path(char *out, size_t size, const char *name, int create);
 
 void verr(const char *fmt, va_list ap);
 void warn(const char *fmt, ...);
@@ -0,0 +1,238 @@
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "verify.h"
+#include "pipe_input.h"
+#include "utils.h"
+#include "work_pool.h"
+
+// how far the decoded length may be off the header before it's a mismatch:
+// encoder delay and padding are a few ms, a header estimated from the
+// bitrate (mp3 without a xing frame) can be off by a lot more
+#define VERIFY_SLACK 0.5         // seconds
+#define VERIFY_SLACK_RATIO 0.01  // of the declared length, if that's more
+
+typedef struct {
+  const char *path;
+  const char *codec;           // static, from ffmpeg
+  char error[128];             // why it didn't open or where the demuxer gave up
+  int opened;
+
+  double declared;             // seconds the container says, < 0 unknown
+  double decoded;              // seconds that came out of the decoder
+  int64_t packets;
+  int decode_errors;           // packets refused, frames that failed or came out damaged
+  int corrupt_packets;         // flagged by the demuxer
+  int read_error;              // the demuxer stopped with an error before the end
+  int truncated, mismatch;
+
+} Verify_File;
+
+typedef struct {
+  const PlayBackOptions *opt;
+  Verify_File *files;
+  int count;
+  int bad;                     // under the pool's lock, like stderr
+  double audio;                // seconds decoded, all files
+
+} Verify_Job;
+
+static double declared_length(AVFormatContext *fmtCTX, int audioStream)
+{
+  AVStream *st = fmtCTX->streams[audioStream];
+
+  // the stream's own length is exact where the container has one
+  if (st->duration > 0 && st->duration != AV_NOPTS_VALUE)
+    return st->duration * av_q2d(st->time_base);
+  if (fmtCTX->duration > 0 && fmtCTX->duration != AV_NOPTS_VALUE)
+    return (double)fmtCTX->duration / AV_TIME_BASE;
+  return -1;
+}
+
+// run_decoder's loop with nothing where the ring would be, and every error
+// it would skip over counted instead
+static void verify_file(Verify_File *f, const PlayBackOptions *opt)
+{
+  Track track = { .filename = f->path };
+  Audio_Info *inf = &track.inf;
+  AVPacket *packet = NULL;
+  AVFrame *frame = NULL;
+  int64_t samples = 0;
+  int ret;
+
+  f->declared = -1;
+
+  if (open_track(&track, opt) < 0) {
+    snprintf(f->error, sizeof(f->error), "%s", track.error);
+    return;
+  }
+  f->opened = 1;
+  f->codec = avcodec_get_name(track.codecCTX->codec_id);
+  f->declared = declared_length(track.fmtCTX, inf->audioStream);
+
+  // have the decoders check what they can (crc, bitstream) rather than
+  // quietly making do
+  track.codecCTX->err_recognition |= AV_EF_CRCCHECK | AV_EF_BITSTREAM;
+
+  if (!(packet = av_packet_alloc()) || !(frame = av_frame_alloc())) die("verify: out of memory");
+
+  for (;;) {
+    int eof = (ret = av_read_frame(track.fmtCTX, packet)) < 0;
+
+    if (eof && ret != AVERROR_EOF) {
+      f->read_error = 1;
+      av_strerror(ret, f->error, sizeof(f->error));
+    }
+
+    if (eof) avcodec_send_packet(track.codecCTX, NULL);
+    else if (packet->stream_index == inf->audioStream) {
+      f->packets++;
+      if (packet->flags & AV_PKT_FLAG_CORRUPT) f->corrupt_packets++;
+      if (avcodec_send_packet(track.codecCTX, packet) < 0) f->decode_errors++;
+    }
+    av_packet_unref(packet);
+
+    while ((ret = avcodec_receive_frame(track.codecCTX, frame)) >= 0) {
+      if (frame->decode_error_flags) f->decode_errors++;
+      samples += frame->nb_samples;
+      av_frame_unref(frame);
+    }
+    if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) f->decode_errors++;
+
+    if (eof) break;
+  }
+
+  f->decoded = (double)samples / inf->in_rate;
+
+  if (f->declared > 0) {
+    double slack = fmax(VERIFY_SLACK, f->declared * VERIFY_SLACK_RATIO);
+    f->mismatch = fabs(f->decoded - f->declared) > slack;
+    f->truncated = f->decoded < f->declared - slack;
+  }
+  if (f->read_error) f->truncated = 1;
+
+  av_packet_free(&packet);
+  av_frame_free(&frame);
+  close_track(&track);
+}
+
+static int verify_bad(const Verify_File *f)
+{
+  return !f->opened || f->decode_errors || f->corrupt_packets || f->truncated || f->mismatch;
+}
+
+static void verify_work(void *arg, int i)
+{
+  Verify_Job *job = (Verify_Job*)arg;
+  verify_file(&job->files[i], job->opt);
+}
+
+static void verify_done(void *arg, int i, int done)
+{
+  Verify_Job *job = (Verify_Job*)arg;
+  Verify_File *f = &job->files[i];
+
+  job->audio += f->decoded;
+
+  if (!f->opened) {
+    job->bad++;
+    fprintf(stderr, "[%4d/%d] FAILED  %s: %s\n", done, job->count, f->path, f->error);
+  }
+  else if (verify_bad(f)) {
+    job->bad++;
+    fprintf(stderr, "[%4d/%d] BAD     %s: %d decode errors, %d corrupt packets%s, %.1fs of %.1fs\n",
+      done, job->count, f->path, f->decode_errors, f->corrupt_packets,
+      f->truncated ? ", truncated" : "", f->decoded, f->declared);
+  }
+  else fprintf(stderr, "[%4d/%d] ok      %s\n", done, job->count, f->path);
+}
+
+// paths are whatever the filesystem has, so quote them properly
+static void json_string(FILE *out, const char *s)
+{
+  fputc('"', out);
+  for (; *s; s++) {
+    unsigned char c = *s;
+
+    if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+    else if (c < 0x20) fprintf(out, "\\u%04x", c);
+    else fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+static void report(FILE *out, const Verify_Job *job, int jobs, double seconds)
+{
+  fprintf(out, "{\n  \"files\": %d,\n  \"bad\": %d,\n  \"threads\": %d,\n", job->count, job->bad, jobs);
+  fprintf(out, "  \"seconds\": %.3f,\n  \"audio_hours\": %.4f,\n", seconds, job->audio / 3600);
+  fprintf(out, "  \"files_per_sec\": %.2f,\n  \"audio_hours_per_sec\": %.4f,\n",
+    seconds > 0 ? job->count / seconds : 0.0, seconds > 0 ? job->audio / 3600 / seconds : 0.0);
+  fprintf(out, "  \"results\": [");
+
+  for (int i = 0; i < job->count; i++) {
+    const Verify_File *f = &job->files[i];
+
+    fprintf(out, "%s\n    {\"path\": ", i ? "," : "");
+    json_string(out, f->path);
+    fprintf(out, ", \"status\": \"%s\"", !f->opened ? "failed" : verify_bad(f) ? "bad" : "ok");
+
+    if (f->opened) {
+      fprintf(out, ", \"codec\": ");
+      json_string(out, f->codec ? f->codec : "unknown");
+      if (f->declared > 0) fprintf(out, ", \"declared\": %.3f", f->declared);
+      else fprintf(out, ", \"declared\": null");
+      fprintf(out, ", \"decoded\": %.3f, \"packets\": %lld, \"decode_errors\": %d, \"corrupt_packets\": %d"
+        ", \"truncated\": %s, \"mismatch\": %s", f->decoded, (long long)f->packets, f->decode_errors,
+        f->corrupt_packets, f->truncated ? "true" : "false", f->mismatch ? "true" : "false");
+    }
+
+    if (f->error[0]) {
+      fprintf(out, ", \"error\": ");
+      json_string(out, f->error);
+    }
+    fputc('}', out);
+  }
+
+  fprintf(out, "\n  ]\n}\n");
+}
+
+int verify_run(Play_Queue *queue, const PlayBackOptions *opt)
+{
+  Verify_Job job = { .opt = opt };
+  int n = queue->count;
+
+  av_log_set_level(AV_LOG_QUIET);
+
+  job.files = calloc(n, sizeof(Verify_File));
+  if (n && !job.files) die("verify: out of memory");
+
+  // a pipe or a stream has no end to check against, and reading one would
+  // take as long as playing it
+  for (int i = 0; i < n; i++) {
+    const char *path = queue_get(queue, i);
+
+    if (pipe_is_input(path) || net_is_url(path)) {
+      warn("%s: not a file, skipped", path);
+      continue;
+    }
+    job.files[job.count++].path = path;
+  }
+
+  double seconds;
+  int jobs = work_pool_run(job.count, opt->jobs, verify_work, verify_done, &job, &seconds);
+
+  report(stdout, &job, jobs, seconds);
+
+  fprintf(stderr, "%d files verified in %.1fs (%.1f files/s, %.3f audio hours/s on %d threads), %d bad\n",
+    job.count, seconds, seconds > 0 ? job.count / seconds : 0.0,
+    seconds > 0 ? job.audio / 3600 / seconds : 0.0, jobs, job.bad);
+
+  free(job.files);
+
+  return job.bad;
+}
@@ -0,0 +1,14 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "backend.h"
+#include "queue.h"
+
+// --verify: decode every file in the queue end to end and throw the audio
+// away, one file per thread at a time on --jobs threads. counts packets that
+// don't decode, streams that stop before their end and lengths that don't
+// match the header. the report goes to stdout as json, progress to stderr.
+// returns the files with a problem
+int verify_run(Play_Queue *queue, const PlayBackOptions *opt);
+
+#endif
@@ -0,0 +1,276 @@
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswresample/swresample.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "waveform.h"
+#include "backend_utils.h"
+#include "pipe_input.h"
+#include "utils.h"
+
+#define WAVE_SLICE_NS 10000000   // thread CPU between two looks at the budget
+
+static const char *blocks[] = { "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█" };
+
+// a cache file: this header, the path, then min[] and max[]. a file per
+// track so a finished scan is one small write, never a rewrite of the lot
+typedef struct {
+  char magic[4];               // "TWV1"
+  uint16_t buckets, path_len;
+  int64_t mtime, size;
+
+} Wave_Header;
+
+// fnv-1a of the realpath names the file
+static int wave_file(char *out, size_t size, const char *real, int create)
+{
+  uint64_t h = 0xcbf29ce484222325ull;
+  char name[64];
+
+  for (const char *p = real; *p; p++) h = (h ^ (unsigned char)*p) * 0x100000001b3ull;
+
+  if (create) {
+    if (cache_path(out, size, "waveform", 1) < 0) return -1;
+    mkdir(out, 0755);
+  }
+
+  snprintf(name, sizeof(name), "waveform/%016llx", (unsigned long long)h);
+  return cache_path(out, size, name, 0);
+}
+
+static int wave_load(Waveform *w, const char *real, const struct stat *st)
+{
+  char file[PATH_MAX];
+  char path[PATH_MAX];
+  Wave_Header head;
+  int ok = 0;
+
+  if (wave_file(file, sizeof(file), real, 0) < 0) return -1;
+
+  FILE *f = fopen(file, "rb");
+  if (!f) return -1;
+
+  // another file with the same hash, or this one changed since
+  if (fread(&head, sizeof(head), 1, f) == 1 && !memcmp(head.magic, "TWV1", 4) && head.buckets == WAVE_BUCKETS
+    && head.path_len < sizeof(path) && head.mtime == st->st_mtime && head.size == st->st_size
+    && fread(path, 1, head.path_len, f) == head.path_len) {
+    path[head.path_len] = '\0';
+
+    ok = !strcmp(path, real) && fread(w->min, 1, WAVE_BUCKETS, f) == WAVE_BUCKETS
+      && fread(w->max, 1, WAVE_BUCKETS, f) == WAVE_BUCKETS;
+  }
+
+  fclose(f);
+  return ok ? 0 : -1;
+}
+
+// into a temp file renamed over the old one
+static int wave_save(Waveform *w, const char *real, const struct stat *st)
+{
+  char file[PATH_MAX], tmp[PATH_MAX + 8];
+  Wave_Header head = { .magic = "TWV1", .buckets = WAVE_BUCKETS, .path_len = strlen(real),
+    .mtime = st->st_mtime, .size = st->st_size };
+
+  if (wave_file(file, sizeof(file), real, 1) < 0) return -1;
+  snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+
+  FILE *f = fopen(tmp, "wb");
+  if (!f) return -1;
+
+  fwrite(&head, sizeof(head), 1, f);
+  fwrite(real, 1, head.path_len, f);
+  fwrite(w->min, 1, WAVE_BUCKETS, f);
+  fwrite(w->max, 1, WAVE_BUCKETS, f);
+
+  if (fclose(f) != 0 || rename(tmp, file) < 0) {
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+static uint64_t thread_cpu_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline int8_t to_peak(float v)
+{
+  v = v * 127.0f;
+  return v > 127.0f ? 127 : v < -127.0f ? -127 : (int8_t)lrintf(v);
+}
+
+// decodes the whole file like analyze does, only keeping the lowest and
+// highest sample of each bucket. every WAVE_SLICE_NS of CPU it sleeps long
+// enough to stay inside WAVE_BUDGET
+static void *run_scan(void *arg)
+{
+  Wave_Scan *s = (Wave_Scan*)arg;
+  Waveform *w = &s->wave;
+  Track track = { .filename = s->path };
+  Audio_Info *inf = &track.inf;
+  SwrContext *swrCTX = NULL;
+  AVPacket *packet = NULL;
+  AVFrame *frame = NULL;
+  float *pcm = NULL;
+  int pcm_cap = 0;
+  int done = 0;
+
+  // idle: only runs on a core nothing else wants. the budget below keeps it
+  // small even where that's not there
+  #ifdef SCHED_IDLE
+    struct sched_param param = {0};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+  #endif
+
+  if (open_track(&track, s->opt) < 0) return NULL;
+
+  int64_t total = track.fmtCTX->duration > 0 ? track.fmtCTX->duration * inf->in_rate / AV_TIME_BASE : 0;
+  if (total < WAVE_BUCKETS) goto out;
+
+  if (inf->in_fmt != AV_SAMPLE_FMT_FLT && !(swrCTX = init_float(inf))) goto out;
+  if (!(packet = av_packet_alloc()) || !(frame = av_frame_alloc())) goto out;
+
+  int bucket = 0;
+  int64_t pos = 0, next = total / WAVE_BUCKETS;
+  float lo = 0, hi = 0;
+  uint64_t slice = thread_cpu_ns();
+
+  while (!atomic_load(&s->stop)) {
+    int eof = av_read_frame(track.fmtCTX, packet) < 0;
+
+    if (eof) avcodec_send_packet(track.codecCTX, NULL);
+    else if (packet->stream_index == inf->audioStream) avcodec_send_packet(track.codecCTX, packet);
+    av_packet_unref(packet);
+
+    while (avcodec_receive_frame(track.codecCTX, frame) >= 0) {
+      const float *samples = (const float*)frame->data[0];
+      int frames = frame->nb_samples;
+
+      if (swrCTX) {
+        if (frames * inf->in_ch > pcm_cap) {
+          float *grown = realloc(pcm, frames * inf->in_ch * sizeof(float));
+          if (!grown) goto out;
+          pcm = grown;
+          pcm_cap = frames * inf->in_ch;
+        }
+
+        uint8_t *data[1] = {(uint8_t*)pcm};
+        frames = swr_convert(swrCTX, data, frames, (const uint8_t**)frame->extended_data, frame->nb_samples);
+        samples = pcm;
+      }
+
+      // a file longer than its header says piles the rest into the last bucket
+      for (int i = 0; i < frames; i++, pos++) {
+        if (pos >= next && bucket < WAVE_BUCKETS - 1) {
+          w->min[bucket] = to_peak(lo);
+          w->max[bucket] = to_peak(hi);
+          atomic_store(&w->filled, ++bucket);
+          next = (bucket + 1) * total / WAVE_BUCKETS;
+          lo = hi = 0;
+        }
+
+        for (int c = 0; c < inf->in_ch; c++) {
+          float v = samples[i * inf->in_ch + c];
+          if (v < lo) lo = v;
+          if (v > hi) hi = v;
+        }
+      }
+      av_frame_unref(frame);
+    }
+
+    if (eof) {
+      done = 1;
+      break;
+    }
+
+    uint64_t used = thread_cpu_ns() - slice;
+    if (used >= WAVE_SLICE_NS) {
+      usleep(used / 1000 * (1.0 / WAVE_BUDGET - 1.0));
+      slice = thread_cpu_ns();
+    }
+  }
+
+  if (done) {
+    char real[PATH_MAX];
+    struct stat st;
+
+    w->min[bucket] = to_peak(lo);
+    w->max[bucket] = to_peak(hi);
+    atomic_store(&w->filled, WAVE_BUCKETS);
+
+    if (realpath(s->path, real) && stat(real, &st) == 0 && wave_save(w, real, &st) < 0)
+      warn("waveform cache: can't write it:");
+  }
+
+out:
+  if (swrCTX) swr_free(&swrCTX);
+  av_packet_free(&packet);
+  av_frame_free(&frame);
+  free(pcm);
+  close_track(&track);
+  return NULL;
+}
+
+void wave_scan_start(Wave_Scan *s, const char *path, const PlayBackOptions *opt)
+{
+  char real[PATH_MAX];
+  struct stat st;
+
+  memset(s, 0, sizeof(*s));
+  s->path = path;
+  s->opt = opt;
+
+  // a pipe can't be read twice, a stream would be fetched twice
+  if (pipe_is_input(path) || net_is_url(path)) return;
+  if (!realpath(path, real) || stat(real, &st) < 0) return;
+
+  if (wave_load(&s->wave, real, &st) == 0) {
+    atomic_store(&s->wave.filled, WAVE_BUCKETS);
+    return;
+  }
+
+  s->running = pthread_create(&s->thread, NULL, run_scan, s) == 0;
+}
+
+void wave_scan_stop(Wave_Scan *s)
+{
+  if (!s->running) return;
+
+  atomic_store(&s->stop, 1);
+  pthread_join(s->thread, NULL);
+  s->running = 0;
+}
+
+const char *wave_block(Waveform *w, int col, int cols)
+{
+  int from = col * WAVE_BUCKETS / cols;
+  int to = (col + 1) * WAVE_BUCKETS / cols;
+  int peak = 0;
+
+  if (to <= from) to = from + 1;
+  if (atomic_load(&w->filled) < to) return NULL;
+
+  for (int i = from; i < to; i++) {
+    if (-w->min[i] > peak) peak = -w->min[i];
+    if (w->max[i] > peak) peak = w->max[i];
+  }
+
+  // loudness is heard in dB, a linear bar would sit at the top for most music
+  double db = peak ? 20.0 * log10(peak / 127.0) : WAVE_FLOOR_DB;
+  int level = (db - WAVE_FLOOR_DB) / -WAVE_FLOOR_DB * 8;
+  if (level < 0) level = 0;
+  if (level > 7) level = 7;
+  return blocks[level];
+}
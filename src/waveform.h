@@ -0,0 +1,36 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "backend.h"
+
+#define WAVE_BUDGET 0.2          // the scan's share of one core at most
+#define WAVE_FLOOR_DB -48.0      // peaks this quiet or less draw as the lowest block
+
+// the background scan of the track that plays: its own decoder on a thread
+// at idle priority, held to WAVE_BUDGET of a core, so it never competes with
+// the one feeding the ring. a finished scan goes in the cache
+// (~/.cache/tomu/waveform/, a small binary file per track) and the next play
+// of the file just loads it
+typedef struct {
+  Waveform wave;
+  const char *path;
+  const PlayBackOptions *opt;
+  pthread_t thread;
+  int running;
+  atomic_int stop;
+
+} Wave_Scan;
+
+// loads the cached envelope or starts the scan. pipes and urls get neither,
+// `filled` stays 0 and the bar stays plain
+void wave_scan_start(Wave_Scan *s, const char *path, const PlayBackOptions *opt);
+void wave_scan_stop(Wave_Scan *s);
+
+// the block character (utf-8) for column `col` of a `cols` wide bar, NULL
+// while the scan hasn't got that far
+const char *wave_block(Waveform *w, int col, int cols);
+
+#endif
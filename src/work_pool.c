@@ -0,0 +1,58 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "work_pool.h"
+#include "latency.h"
+#include "utils.h"
+
+typedef struct {
+  int count;
+  work_fn work;
+  done_fn done;
+  void *arg;
+  atomic_int next;             // threads take the next item from here
+
+  pthread_mutex_t lock;        // around `done`
+  int finished;
+
+} Work_Pool;
+
+static void *run_worker(void *arg)
+{
+  Work_Pool *pool = (Work_Pool*)arg;
+  int i;
+
+  while ((i = atomic_fetch_add(&pool->next, 1)) < pool->count) {
+    pool->work(pool->arg, i);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->done(pool->arg, i, ++pool->finished);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+
+int work_pool_run(int count, int jobs, work_fn work, done_fn done, void *arg, double *seconds)
+{
+  Work_Pool pool = { .count = count, .work = work, .done = done, .arg = arg };
+
+  if (jobs <= 0) jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  if (jobs > count) jobs = count;
+  if (jobs < 1) jobs = 1;
+
+  pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+  if (!threads) die("out of memory");
+  pthread_mutex_init(&pool.lock, NULL);
+
+  uint64_t start = now_ns();
+  for (int i = 0; i < jobs; i++) pthread_create(&threads[i], NULL, run_worker, &pool);
+  for (int i = 0; i < jobs; i++) pthread_join(threads[i], NULL);
+  *seconds = (now_ns() - start) / 1e9;
+
+  pthread_mutex_destroy(&pool.lock);
+  free(threads);
+  return jobs;
+}
@@ -0,0 +1,16 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+// --analyze and --verify: a file per thread at a time until the queue is
+// empty. `work` runs on a worker with nothing held, `done` right after it
+// under the pool's one lock, in the order files finish, with how many are
+// done counting this one: the counters and the progress line go there
+typedef void (*work_fn)(void *arg, int i);
+typedef void (*done_fn)(void *arg, int i, int done);
+
+// every item 0..count-1 on `jobs` threads (0 = every core, never more than
+// there are items). returns the threads it ran on, `seconds` gets how long
+// it took. dies if it can't get the memory
+int work_pool_run(int count, int jobs, work_fn work, done_fn done, void *arg, double *seconds);
+
+#endif